@@ -39,6 +39,27 @@ So, you need comment/uncomment to have one block of interest active.
 // Saving to the db is convenient, but not necessary - all forecasts are always saved to as csv files in automatically created subdirectory (sorry sometimes two directories, so you have to copy :-)) of OUTPUT_DIR
 //If saving to database you need to modify run varaible, for each new run, otherwise you will get the table key error.
 
+//#define BENCHMARK_MODE
+//define BENCHMARK_MODE to run a reproducible throughput benchmark of the active PARAMS block:
+//first MAX_NUM_OF_SERIES series of the file, fixed seeds (unless --dynet-seed is given), NUM_OF_EPOCHS_TO_RUN epochs, one ibig.
+//Time per epoch split into phases (graph build, forward, backward, update, validation/TEST walk, output), series/sec, peak RSS and high-water mark of Dynet graph memory pools
+//are written as JSON lines to <OUTPUT_DIR>/<VARIABLE>_<seed>_<chunk>_bench.jsonl, see metrics.h. Build it, for comparison, with the same flags as the normal runs.
+
+//#define HOGWILD
+//define HOGWILD to train one model on all series (NUM_OF_CHUNKS=1, so invoke with chunkNo 1) with NUM_OF_WORKERS processes:
+//each epoch they take series from a shared, shuffled queue, and update the shared weights without locks. Per-series parameters are updated only by the worker doing the series.
+//Linux/Mac only, not with USE_ODBC. Metrics add up the phase times of all workers, TRACE and the PRINT_DIAGN history cover only the series done by the first worker. See workers.h
+
+//#define DATA_PARALLEL
+//define DATA_PARALLEL, instead of HOGWILD, for synchronous data-parallel training with NUM_OF_WORKERS processes (NUM_OF_CHUNKS=1, invoke with chunkNo 1):
+//in every round each worker does one series, the gradients of the shared weights are summed by a tree all-reduce and averaged, and the trainer makes one step.
+//Per-series parameters are updated by their worker. The order of the series in the epochs follows from seedForChunks and ibig, so for a given NUM_OF_WORKERS the results are reproducible (with single-threaded BLAS and a fixed --dynet-seed, e.g. BENCHMARK_MODE). Same limitations as HOGWILD, see allreduce.h
+
+//#define OVERLAP_TEST
+//define OVERLAP_TEST to take the TEST walk (forecast and its averaging) off the training path: a second process, forked every epoch, gets the parameters used for
+//each series through a queue of snapshots, replays the forward pass of the series and makes the forecast, while the trainer goes on with the next series.
+//The forecasts are the same as without it. Uses one more core per executable. Linux/Mac only, not with USE_ODBC, HOGWILD or DATA_PARALLEL. See snapshots.h
+
 #include "dynet/dynet.h"
 #include "dynet/training.h"
 #include "dynet/expr.h"
@@ -48,6 +69,34 @@ So, you need comment/uncomment to have one block of interest active.
 #include "dynet/expr.h"
 #include "dynet/lstm.h"
 #include "slstm.h" //my implementation of dilated LSTMs
+#include "accuracy.h"
+#include "metrics.h"
+#include "health.h"
+#include "placement.h"
+#include "prefetch.h"
+#if defined HOGWILD && defined DATA_PARALLEL
+  #error "define either HOGWILD or DATA_PARALLEL"
+#endif
+#if defined HOGWILD || defined DATA_PARALLEL
+  #define FORKED_WORKERS
+#endif
+#if defined FORKED_WORKERS || defined OVERLAP_TEST
+  #include "workers.h"
+#endif
+#if defined OVERLAP_TEST
+  #if defined FORKED_WORKERS || defined USE_ODBC
+    #error "OVERLAP_TEST works neither with HOGWILD/DATA_PARALLEL, nor with USE_ODBC"
+  #endif
+  #include "snapshots.h"
+#endif
+#if defined FORKED_WORKERS
+  #include "allreduce.h"
+#endif
+#if !defined _WINDOWS
+  #include "series_ingest.h"
+#endif
+#include "dynet/globals.h"
+#include "dynet/devices.h"
 
 #if defined USE_ODBC        
   #if defined _WINDOWS
@@ -183,28 +232,53 @@ Expression expand(const Expression& x) {
 
 string INPUT_PATH = DATA_DIR + VARIABLE + "-train.csv";
 string INFO_INPUT_PATH = DATA_DIR + "M4-info.csv";
+string STORE_PATH = ""; //binary series store read instead of INPUT_PATH, without parsing, e.g. DATA_DIR + VARIABLE + "-train.store", written and appended to by esrnn_ingest, see series_ingest.h. Linux/Mac only
 
-#if defined _DEBUG
+#if defined BENCHMARK_MODE
+  const int MAX_NUM_OF_SERIES = 1000; //deterministic subset: the first series of the file
+#elif defined _DEBUG
   const int MAX_NUM_OF_SERIES = 40;
 #else
   const int MAX_NUM_OF_SERIES = -1; //use all series
 #endif // _DEBUG
 
 const unsigned int NUM_OF_CATEGORIES = 6;//in data provided
-const int BIG_LOOP = 3;
-const int NUM_OF_CHUNKS = 2;
+#if defined FORKED_WORKERS
+  const int NUM_OF_CHUNKS = 1;
+  const int NUM_OF_WORKERS = 4;
+#else
+  const int NUM_OF_CHUNKS = 2;
+#endif
+#if defined OVERLAP_TEST
+  const int SNAPSHOT_QUEUE_SIZE = 8; //how far the trainer can get ahead of the forecasts
+#endif
 const float EPS=1e-6;
 const int AVERAGING_LEVEL=5;
+#if defined BENCHMARK_MODE
+  const int BIG_LOOP = 1;
+  const int NUM_OF_EPOCHS_TO_RUN = AVERAGING_LEVEL + 1; //the smallest number for which the forecasts get averaged and saved
+  const unsigned BENCH_SEED = 17;
+#else
+  const int BIG_LOOP = 3;
+  const int NUM_OF_EPOCHS_TO_RUN = NUM_OF_TRAIN_EPOCHS;
+#endif
 const bool USE_MEDIAN = false;
 const int MIDDLE_POS_FOR_AVG = 2; //if using medians
 
 const float NOISE_STD=0.001; 
 const int FREQ_OF_TEST=1;
 const float GRADIENT_CLIPPING=20;
+const float HEALTH_MAX_STATE_ABS = 1000; //a training step with a larger, or non-finite, c-state, or with a non-finite gradient, is skipped. See health.h
+const int HEALTH_STRIKES_TO_QUARANTINE = 3; //a series skipped that many times is not trained anymore in the ibig run
 const float C_STATE_PENALTY = 0;
 
 const float BIG_FLOAT=1e38;//numeric_limits<float>::max();
 const bool PRINT_DIAGN=true;
+const string METRICS_FORMAT = "jsonl"; //"jsonl": <OUTPUT_DIR>/<VARIABLE>_<seed>_<chunk>_metrics.jsonl gets a line per epoch and per ibig, "prometheus": <...>_metrics.prom is rewritten after every epoch, "": no metrics file. See metrics.h
+const bool TRACE = false; //Chrome trace-event timeline of build/forward/backward/update/validation spans, per series, written to <OUTPUT_DIR>/<VARIABLE>_<seed>_<chunk>_trace.json, for Perfetto or chrome://tracing. See trace.h
+const int BLAS_THREADS = 1; //threads of the BLAS library (MKL, OpenBLAS) in this process. More than 1 only oversubscribes the cores when many workers run. See placement.h
+const bool PIN_TO_CORES = false; //pin to the core of the slot given by ESRNN_SLOT (or the MPI local rank), and prefer the memory of its NUMA node. Off by default; without a slot nothing is pinned anyway
+const bool PREFETCH_SERIES = true; //prepare the data windows of the next series on a helper thread, during the backward pass and update of the current one. See prefetch.h
 const float TAU = PERCENTILE / 100.;
 const float TRAINING_TAU = TRAINING_PERCENTILE / 100.;
 const unsigned ATTENTION_HSIZE=STATE_HSIZE;
@@ -258,7 +332,7 @@ struct M4TS {//storing series data
   vector<float> testVals;//empty, unless LBACK>0
   int n;
   
-  M4TS(string category, stringstream  &line_stream) {
+  void setCategories(const string& category) {
     array<float, NUM_OF_CATEGORIES> categories = { 0,0,0,0,0,0 };
     if (category == "Demographic")
       categories[0] = 1;
@@ -278,7 +352,10 @@ struct M4TS {//storing series data
     }
     for (int i = 0; i < NUM_OF_CATEGORIES; i++)
       categories_vect.push_back(categories[i]);
+  }
 
+  M4TS(string category, stringstream  &line_stream) {
+    setCategories(category);
     string tmp_str;
     while(getline(line_stream, tmp_str, ',' )) {
       string val_str;
@@ -309,9 +386,48 @@ struct M4TS {//storing series data
       n = vals.size();
     }
   }
+  //from all the values of a series, e.g. mapped from the series store (series_ingest.h): the LBACK split and the chop are ranges of them, each copied once
+  M4TS(string category, const float* values, int length) {
+    setCategories(category);
+    int historyEnd = length;
+    if (LBACK > 0) {
+      if (length > LBACK*OUTPUT_SIZE_I) {
+        historyEnd = length - LBACK*OUTPUT_SIZE_I;
+        testVals.assign(values + historyEnd, values + historyEnd + OUTPUT_SIZE_I);
+      } else
+        historyEnd = 0; //n = 0
+    }
+    vals.assign(values + max(0, historyEnd - MAX_SERIES_LENGTH), values + historyEnd);
+    n = vals.size();
+  }
   M4TS(){};
 };
 
+struct PreparedSeries {//Dynet-independent part of the work on a series, done ahead by the prefetch thread
+  M4TS m4Obj;
+  vector<vector<float>> trainInputs; //input windows of the training steps i=INPUT_SIZE_I-1..n-OUTPUT_SIZE_I-1
+  vector<vector<float>> trainLabels;
+  vector<vector<float>> testInputs; //input windows of the TEST steps i=n-OUTPUT_SIZE_I..n-1
+};
+
+//the buffers keep their capacity from the previous use
+void prepareSeries(const M4TS& m4Obj, PreparedSeries& prepared) {
+  prepared.m4Obj = m4Obj;
+  int numOfTrainSteps = max(m4Obj.n - OUTPUT_SIZE_I - (INPUT_SIZE_I - 1), 0);
+  prepared.trainInputs.resize(numOfTrainSteps);
+  prepared.trainLabels.resize(numOfTrainSteps);
+  for (int i = INPUT_SIZE_I - 1; i < m4Obj.n - OUTPUT_SIZE_I; i++) {
+    auto first = m4Obj.vals.begin() + i + 1;
+    prepared.trainInputs[i + 1 - INPUT_SIZE_I].assign(first - INPUT_SIZE_I, first); //[i+1-INPUT_SIZE_I, i+1)
+    prepared.trainLabels[i + 1 - INPUT_SIZE_I].assign(first, first + OUTPUT_SIZE_I); //[i+1, i+1+OUTPUT_SIZE_I)
+  }
+  prepared.testInputs.resize(OUTPUT_SIZE_I);
+  for (int i = m4Obj.n - OUTPUT_SIZE_I; i < m4Obj.n; i++) {
+    auto first = m4Obj.vals.begin() + i + 1;
+    prepared.testInputs[i - (m4Obj.n - OUTPUT_SIZE_I)].assign(first - INPUT_SIZE_I, first);
+  }
+}
+
 
 struct AdditionalParams {//Per series, important
   Parameter levSm;
@@ -344,28 +460,12 @@ Expression pinBallLoss(const Expression& out_ex, const Expression& actuals_ex) {
 
 //weighted quantile Loss, used just for diagnostics, if if LBACK>0 and PERCENTILE!=50
 float wQuantLoss(vector<float>& out_vect, vector<float>& actuals_vect) {
-  float sumf = 0; float suma=0;
-  for (unsigned int indx = 0; indx<OUTPUT_SIZE; indx++) {
-    auto forec = out_vect[indx];
-    auto actual = actuals_vect[indx];
-    suma+= abs(actual);
-    if (actual > forec)
-      sumf = sumf + (actual - forec)*TAU;
-    else
-      sumf = sumf + (actual - forec)*(TAU - 1);
-  }
-  return sumf / suma * 200;
+  return wQuantLoss(out_vect.data(), actuals_vect.data(), OUTPUT_SIZE_I, TAU);
 }
 
 //used just for diagnostics, if LBACK>0 and PERCENTILE==50
 float sMAPE(vector<float>& out_vect, vector<float>& actuals_vect) {
-  float sumf = 0;
-  for (unsigned int indx = 0; indx<OUTPUT_SIZE; indx++) {
-    auto forec = out_vect[indx];
-    auto actual = actuals_vect[indx];
-    sumf+=abs(forec-actual)/(abs(forec)+abs(actual));
-  }
-  return sumf / OUTPUT_SIZE * 200;
+  return sMAPE(out_vect.data(), actuals_vect.data(), OUTPUT_SIZE_I);
 }
 
 float errorFunc(vector<float>& out_vect, vector<float>& actuals_vect) {
@@ -375,8 +475,59 @@ float errorFunc(vector<float>& out_vect, vector<float>& actuals_vect) {
     return wQuantLoss(out_vect, actuals_vect);
 }
 
+//bytes currently used by the Dynet memory pools of the computation graph (forward and backward)
+size_t graphPoolsUsed() {
+  return default_device->pools[(int)DeviceMempool::FXS]->used() + default_device->pools[(int)DeviceMempool::DEDFS]->used();
+}
+
+#if defined FORKED_WORKERS || defined OVERLAP_TEST
+//testResults_map entry <-> a slot of shared memory, so that the forecasts made by the workers reach the parent process
+const int TEST_RESULTS_SLOT_SIZE = (AVERAGING_LEVEL + 1)*(1 + OUTPUT_SIZE_I); //per level: size, values
+
+void saveTestResults(const array<vector<float>, AVERAGING_LEVEL + 1>& results, float* slot) {
+  for (int ilev = 0; ilev <= AVERAGING_LEVEL; ilev++, slot += 1 + OUTPUT_SIZE_I) {
+    slot[0] = (float)results[ilev].size();
+    copy(results[ilev].begin(), results[ilev].end(), slot + 1);
+  }
+}
+
+void loadTestResults(const float* slot, array<vector<float>, AVERAGING_LEVEL + 1>& results) {
+  for (int ilev = 0; ilev <= AVERAGING_LEVEL; ilev++, slot += 1 + OUTPUT_SIZE_I)
+    results[ilev].assign(slot + 1, slot + 1 + (int)slot[0]);
+}
+#endif
+
+#if defined OVERLAP_TEST
+//parameters of the TEST walk of a series: the shared ones and the series' own
+vector<ParameterStorage*> snapshotStorages(const ParameterCollection& pc, const AdditionalParams& additionalParams) {
+  vector<ParameterStorage*> storages;
+  for (auto& storage : pc.parameters_list())
+    storages.push_back(storage.get());
+  storages.push_back(additionalParams.levSm.p.get());
+  storages.push_back(additionalParams.sSm.p.get());
+  for (auto& par : additionalParams.initSeasonality)
+    storages.push_back(par.p.get());
+  return storages;
+}
+#endif
+
 int main(int argc, char** argv) {
+  placeProcess(BLAS_THREADS, PIN_TO_CORES); //before Dynet allocates its memory
+#if defined BENCHMARK_MODE
+  DynetParams dynetParams = extract_dynet_params(argc, argv);
+  if (dynetParams.random_seed == 0)
+    dynetParams.random_seed = BENCH_SEED;
+  #if defined FORKED_WORKERS
+    dynetParams.shared_parameters = true;
+  #endif
+  dynet::initialize(dynetParams);
+#elif defined FORKED_WORKERS
+  DynetParams dynetParams = extract_dynet_params(argc, argv);
+  dynetParams.shared_parameters = true; //parameter memory visible to all the worker processes
+  dynet::initialize(dynetParams);
+#else
   dynet::initialize(argc, argv);
+#endif
 
   int seedForChunks = 10; //Yes it runs, without any params, but it will work only on 1/NUM_OF_CHUNKS of all cases. The system is expected to run in NUM_OF_CHUNKS multiples.
   int chunkNo = 1;
@@ -409,6 +560,12 @@ int main(int argc, char** argv) {
     cerr<<"Can't use auto learning rate when LBACK==0";
     exit(-1);
    }
+#if defined _WINDOWS
+  if (!STORE_PATH.empty()) {
+    cerr << "STORE_PATH is not available on Windows" << endl;
+    exit(-1);
+  }
+#endif
 
  
   time_t rawtime;
@@ -542,7 +699,11 @@ int main(int argc, char** argv) {
 #endif
     
   random_device rd;     // only used once to initialise (seed) engine
+#if defined BENCHMARK_MODE
+  mt19937 rng(BENCH_SEED);
+#else
   mt19937 rng(rd());    // random-number engine used (Mersenne-Twister)
+#endif
   mt19937 rngForChunks(seedForChunks);
   
   vector<string> series_vect;
@@ -562,26 +723,48 @@ int main(int argc, char** argv) {
     seriesCategories_map[series] = category;
   }
 
-  ifstream file (INPUT_PATH);
-  getline(file, line); //header
-  while ( getline ( file, line) ) {
-    stringstream  line_stream(line);
-    string series0;  string series;
-    getline(line_stream, series0, ',' );
-    for (const auto c : series0) {
-      if (!ispunct(c)) {
-        series.push_back(c);
-      }
-    }
-
-    string category = seriesCategories_map[series];
-    M4TS m4Obj(category, line_stream);
+  auto addSeries = [&](const string& series, M4TS& m4Obj) {//false when there are enough
     if (m4Obj.n >= MIN_SERIES_LENGTH) {
       series_vect.push_back(series);
       allSeries_map[series] = m4Obj;
     }
-    if (MAX_NUM_OF_SERIES>0 && series_vect.size()>=MAX_NUM_OF_SERIES)
-      break;
+    return !(MAX_NUM_OF_SERIES>0 && series_vect.size()>=MAX_NUM_OF_SERIES);
+  };
+
+  if (!STORE_PATH.empty()) {//no parsing: the snapshot is mapped, with the points appended since applied from its log
+#if !defined _WINDOWS
+    IngestedSeries ingested;
+    string storeError;
+    if (!ingested.open(STORE_PATH, false, storeError)) {
+      cerr << storeError << endl;
+      exit(-1);
+    }
+    for (int i = 0; i < ingested.numOfSeries(); i++) {
+      string series = ingested.name(i);
+      M4TS m4Obj(seriesCategories_map[series], ingested.values(i), ingested.length(i));
+      if (!addSeries(series, m4Obj))
+        break;
+    }
+    cout << "read " << STORE_PATH << ", generation " << ingested.generation << ", " << ingested.logRecords << " records of its log" << endl;
+#endif
+  } else {
+    ifstream file (INPUT_PATH);
+    getline(file, line); //header
+    while ( getline ( file, line) ) {
+      stringstream  line_stream(line);
+      string series0;  string series;
+      getline(line_stream, series0, ',' );
+      for (const auto c : series0) {
+        if (!ispunct(c)) {
+          series.push_back(c);
+        }
+      }
+
+      string category = seriesCategories_map[series];
+      M4TS m4Obj(category, line_stream);
+      if (!addSeries(series, m4Obj))
+        break;
+    }
   }
 
   int series_len=(int)series_vect.size();
@@ -591,10 +774,27 @@ int main(int argc, char** argv) {
   
   unordered_map<string, array<vector<float>, AVERAGING_LEVEL+1>> testResults_map((int)chunkSize*1.5);
   set<string> diagSeries;
+
+#if defined BENCHMARK_MODE
+  #if defined USE_RESIDUAL_LSTM
+    const string lstmType = "ResidualDilatedLSTM";
+  #elif defined USE_ATTENTIVE_LSTM
+    const string lstmType = "AttentiveDilatedLSTM";
+  #else
+    const string lstmType = "DilatedLSTM";
+  #endif
+  BenchmarkReport benchReport;
+  benchReport.open(OUTPUT_DIR + '/' + VARIABLE + "_" + to_string(seedForChunks) + "_" + to_string(chunkNo) + "_bench.jsonl", "ES_RNN", VARIABLE, run, lstmType, series_len);
+#endif
+  MetricsExporter metricsExporter;
+  metricsExporter.open(METRICS_FORMAT, OUTPUT_DIR + '/' + VARIABLE + "_" + to_string(seedForChunks) + "_" + to_string(chunkNo) + "_metrics", "ES_RNN", VARIABLE);
+  if (TRACE)
+    traceStart(OUTPUT_DIR + '/' + VARIABLE + "_" + to_string(seedForChunks) + "_" + to_string(chunkNo) + "_trace.json");
   
   for (int ibig=0; ibig<BIG_LOOP; ibig++) { //the loop :-)
 	  int ibigDb= ibigOffset+ibig;
     string outputPath = OUTPUT_DIR + '/'+ VARIABLE + "_" + to_string(seedForChunks) + "_"+ to_string(chunkNo)+"_"+ to_string(ibigDb)+"_LB"+ to_string(LBACK)+ ".csv";
+    HealthMonitor healthMonitor(HEALTH_MAX_STATE_ABS, HEALTH_STRIKES_TO_QUARANTINE);
     vector<float> perfValid_vect; 
     int epochOfLastChangeOfLRate = -1;
 
@@ -665,8 +865,44 @@ int main(int argc, char** argv) {
 
       historyOfAdditionalParams_map[series] = new array<AdditionalParamsF, NUM_OF_TRAIN_EPOCHS>();
     }
+
+#if defined FORKED_WORKERS
+    #if defined HOGWILD
+    PrivateGradients privateGradients({ &pc, &perSeriesPC }); //only the values and the moments are shared. DATA_PARALLEL places the gradients in GradientAllReduce
+    #endif
+    //the trainers allocate their moments lazily, at the first update. Do it now, before the first fork, so it happens in the shared memory, once.
+    //It is not a step: the gradients are zero, and the step count, used by the bias correction of Adam, is restored.
+    pc.reset_gradient();
+    perSeriesPC.reset_gradient();
+    trainer.update();
+    perSeriesTrainer.update();
+    trainer.updates = 0;
+    perSeriesTrainer.updates = 0;
+
+    const int NUM_OF_LOSS_LISTS = 6;
+    ForkedWorkers workers(NUM_OF_WORKERS, NUM_OF_LOSS_LISTS, oneChunk_vect.size());
+    SharedArray<float> sharedTestResults(oneChunk_vect.size()*TEST_RESULTS_SLOT_SIZE);
+    SharedArray<char> sharedSkipped(oneChunk_vect.size()); //update skipped by the health check in this epoch
+    vector<int> seriesOrder(oneChunk_vect.size());
+    iota(seriesOrder.begin(), seriesOrder.end(), 0);
+    seed_seq orderSeed{ seedForChunks, ibigDb };
+    mt19937 rngForOrder(orderSeed); //the order of the series in every epoch, reproducible from the seed and ibig
+#endif
+#if defined OVERLAP_TEST
+    const int NUM_OF_LOSS_LISTS = 6;
+    ForkedWorkers workers(2, NUM_OF_LOSS_LISTS, oneChunk_vect.size()); //the trainer and the forecaster
+    SharedArray<float> sharedTestResults(oneChunk_vect.size()*TEST_RESULTS_SLOT_SIZE);
+    ParameterSnapshotQueue snapshots(SNAPSHOT_QUEUE_SIZE, snapshotFloats(snapshotStorages(pc, additionalParams_map[oneChunk_vect[0]])));
+#endif
+#if defined DATA_PARALLEL
+    GradientAllReduce gradientAllReduce(NUM_OF_WORKERS, pc, perSeriesPC);
+    const int NUM_OF_ROUNDS = ((int)oneChunk_vect.size() + NUM_OF_WORKERS - 1) / NUM_OF_WORKERS;
+#endif
     
-    for (int iEpoch=0; iEpoch<NUM_OF_TRAIN_EPOCHS; iEpoch++) {
+    for (int iEpoch=0; iEpoch<NUM_OF_EPOCHS_TO_RUN; iEpoch++) {
+      Metrics epochMetrics;
+      TraceSpan epochSpan("epoch");
+      size_t epochPoolHighWaterMark = 0;
       if (!USE_AUTO_LEARNING_RATE && LEARNING_RATES.find(iEpoch) != LEARNING_RATES.end()) {
         trainer.learning_rate = LEARNING_RATES.at(iEpoch);
         perSeriesTrainer.learning_rate = LEARNING_RATES.at(iEpoch)*PER_SERIES_LR_MULTIP;
@@ -683,9 +919,48 @@ int main(int argc, char** argv) {
         SQLBindParameter(hInsertStmt, 5, SQL_PARAM_INPUT, SQL_C_SLONG, SQL_INTEGER, 0, 0, (SQLPOINTER)&iEpoch, 0, NULL));
       #endif
       
-      for (auto iter = oneChunk_vect.begin() ; iter != oneChunk_vect.end(); ++iter) {
-        string series=*iter;
-        auto m4Obj = allSeries_map[series];
+      bool forecaster = false; //OVERLAP_TEST: this process does not train, it only makes the forecasts
+      bool makeForecasts = true;
+#if defined OVERLAP_TEST
+      snapshots.reset();
+      forecaster = workers.start() == 1;
+      makeForecasts = forecaster;
+      if (PIN_TO_CORES && slotFromEnvironment() >= 0)
+        pinWorker(slotFromEnvironment(), forecaster ? 1 : 0, 2);
+#endif
+      Prefetcher<PreparedSeries> prefetcher(PREFETCH_SERIES, [&](int iseries, PreparedSeries& prepared) {
+        prepareSeries(allSeries_map.at(oneChunk_vect[iseries]), prepared);
+      });
+#if defined HOGWILD
+      shuffle(seriesOrder.begin(), seriesOrder.end(), rngForOrder);
+      sharedSkipped.fill(0);
+      int worker = workers.start();
+      if (PIN_TO_CORES && slotFromEnvironment() >= 0)
+        pinWorker(slotFromEnvironment(), worker, NUM_OF_WORKERS);
+      for (int iorder = workers.next(); iorder < (int)seriesOrder.size(); iorder = workers.next()) {
+        int iseries = seriesOrder[iorder];
+        int nextIseries = -1; //comes from the shared queue, unknown in advance
+#elif defined DATA_PARALLEL
+      shuffle(seriesOrder.begin(), seriesOrder.end(), rngForOrder);
+      sharedSkipped.fill(0);
+      int worker = workers.start();
+      if (PIN_TO_CORES && slotFromEnvironment() >= 0)
+        pinWorker(slotFromEnvironment(), worker, NUM_OF_WORKERS);
+      gradientAllReduce.attach(worker, pc);
+      for (int iorder = worker; iorder < NUM_OF_ROUNDS*NUM_OF_WORKERS; iorder += NUM_OF_WORKERS) { //round iorder/NUM_OF_WORKERS
+        if (iorder >= (int)seriesOrder.size()) { //no series for this worker in the last round
+          gradientAllReduce.reduceAndUpdate(worker, pc, trainer, false, epochMetrics);
+          continue;
+        }
+        int iseries = seriesOrder[iorder];
+        int nextIseries = iorder + NUM_OF_WORKERS < (int)seriesOrder.size() ? seriesOrder[iorder + NUM_OF_WORKERS] : -1;
+#else
+      for (int iseries = 0; iseries < (int)oneChunk_vect.size(); iseries++) {
+        int nextIseries = iseries + 1 < (int)oneChunk_vect.size() ? iseries + 1 : -1;
+#endif
+        string series=oneChunk_vect[iseries];
+        PreparedSeries& prepared = prefetcher.get(iseries, nextIseries); //and starts preparing the next one
+        M4TS& m4Obj = prepared.m4Obj;
 
         #if defined USE_ODBC
         TRYODBC(hInsertStmt,
@@ -697,6 +972,7 @@ int main(int argc, char** argv) {
           SQLBindParameter(hInsertStmt, OFFSET_TO_FIRST_ACTUAL + 2 * OUTPUT_SIZE_I + 3, SQL_PARAM_INPUT, SQL_C_SLONG, SQL_INTEGER, 0, 0, (SQLPOINTER)&m4Obj.n, 0, NULL));
         #endif
       
+        double phaseStart = nowSecs();
         ComputationGraph cg;
          for (int il=0; il<dilations.size(); il++) {
            rNNStack[il].new_graph(cg);
@@ -712,6 +988,12 @@ int main(int argc, char** argv) {
         Expression adapterB_ex=parameter(cg, adapterB_par);
 
         auto additionalParams= additionalParams_map[series];
+        #if defined OVERLAP_TEST
+        if (forecaster)
+          snapshots.pop(iseries, snapshotStorages(pc, additionalParams)); //the values the trainer uses for this series
+        else
+          snapshots.push(iseries, snapshotStorages(pc, additionalParams), workers.children[0]);
+        #endif
         Expression levSm_ex = logistic(parameter(cg, additionalParams.levSm));  //level smoothing
 		    Expression sSm_ex = logistic(parameter(cg, additionalParams.sSm)); //seasonality smoothing
 
@@ -760,10 +1042,7 @@ int main(int argc, char** argv) {
 			    vector<Expression> inputSeasonality_exVect(firstE, pastLastE);  //[first,pastLast)
 			    Expression inputSeasonality_ex=concatenate(inputSeasonality_exVect);
 
-          vector<float>::const_iterator first = m4Obj.vals.begin() +i+1-INPUT_SIZE_I;
-          vector<float>::const_iterator pastLast = m4Obj.vals.begin() +i+1; //not including the last one
-          vector<float> input_vect(first, pastLast); //[first,pastLast)
-          Expression input0_ex=input(cg,{INPUT_SIZE},input_vect);
+          Expression input0_ex=input(cg,{INPUT_SIZE},prepared.trainInputs[i+1-INPUT_SIZE_I]); //[i+1-INPUT_SIZE_I, i+1)
 			    Expression input1_ex=cdiv(input0_ex,inputSeasonality_ex); //deseasonalization
           vector<Expression> joinedInput_ex;
           input1_ex= cdiv(input1_ex, levels_exVect[i]);
@@ -794,10 +1073,7 @@ int main(int argc, char** argv) {
 			    vector<Expression> outputSeasonality_exVect(firstE, pastLastE);  //[first,pastLast)
 			    Expression outputSeasonality_ex=concatenate(outputSeasonality_exVect);
 
-          first = m4Obj.vals.begin() +i+1;
-          pastLast = m4Obj.vals.begin() +i+1+OUTPUT_SIZE_I;
-          vector<float> labels_vect(first, pastLast);  //[first,pastLast)
-          Expression labels0_ex=input(cg,{OUTPUT_SIZE},labels_vect);
+          Expression labels0_ex=input(cg,{OUTPUT_SIZE},prepared.trainLabels[i+1-INPUT_SIZE_I]); //[i+1, i+1+OUTPUT_SIZE_I)
 			    Expression labels1_ex=cdiv(labels0_ex,outputSeasonality_ex); //deseasonalization
           labels1_ex= cdiv(labels1_ex, levels_exVect[i]);//normalization
 			    Expression labels_ex=squash(labels1_ex);
@@ -833,66 +1109,54 @@ int main(int argc, char** argv) {
           loss_exp = loss_exp + cStateLossP_ex;
         }
           
+        epochMetrics.count(COUNTER_SERIES);
+        epochMetrics.count(COUNTER_GRAPH_NODES, (double)cg.nodes.size());
+        phaseStart = epochMetrics.times.add(PHASE_BUILD, phaseStart, series, m4Obj.n); //includes forward of the few nodes evaluated while building, e.g. in pinBallLoss
         float loss = as_scalar(cg.forward(loss_exp));
+        phaseStart = epochMetrics.times.add(PHASE_FORWARD, phaseStart, series, m4Obj.n);
         trainingLosses.push_back(loss);//losses of all series in one epoch
 
         float forecastLoss = loss - levVarLoss - cStateLoss;
         forecLosses.push_back(forecastLoss);
 
-        cg.backward(loss_exp);
-        try {
-          trainer.update();//update shared weights
-          perSeriesTrainer.update();  //apdate params of this series only
-        } catch (exception& e) {  //long diagnostics for this unlikely event :-)
-          cerr<<"cought exception while doing "<<series<<endl;
-          cerr << e.what() << endl;
-
-            float minSeason = BIG_FLOAT;
-            cout << "season:";
-            for (int isea = 0; isea < season_exVect.size(); isea++) {
-              float val = as_scalar(season_exVect[isea].value());
-              //cout << " " << val;
-              if (val<minSeason)
-                minSeason = val;
-            }
-
-            float minLevel = BIG_FLOAT;
-            cout << "levels:";
-            for (int isea = 0; isea < levels_exVect.size(); isea++) {
-              float val = as_scalar(levels_exVect[isea].value());
-              //cout << " " << val;
-              if (val<minLevel)
-                minLevel = val;
+        bool updated = false;
+        if (!forecaster && !healthMonitor.isQuarantined(series)) { //a quarantined series still gets its forecast, but does not train anymore
+          cg.backward(loss_exp);
+          phaseStart = epochMetrics.times.add(PHASE_BACKWARD, phaseStart, series, m4Obj.n);
+          healthMonitor.begin();
+          healthMonitor.addGradients(pc);
+          healthMonitor.addGradient(additionalParams.levSm);
+          healthMonitor.addGradient(additionalParams.sSm);
+          healthMonitor.addGradients(additionalParams.initSeasonality);
+          healthMonitor.addStates(rNNStack);
+          if (healthMonitor.healthy()) {
+            try {
+              #if !defined DATA_PARALLEL
+              trainer.update();//update shared weights
+              #endif
+              perSeriesTrainer.update();  //update params of this series only
+              updated = true;
+            } catch (exception& e) {  //rare, the health check catches most of the numerical problems before
+              epochMetrics.count(COUNTER_UPDATE_EXCEPTIONS);
+              cerr<<"cought exception while doing "<<series<<endl;
+              cerr << e.what() << endl;
             }
-
-            float maxAbs = 0; int timeOfMax = 0; int layerOfMax = 0; int chunkOfMax = 0;
-            for (int irnn = 0; irnn < rNNStack.size(); irnn++) {
-              auto state_vEx = rNNStack[irnn].c;//(time,layers)
-              for (int it = 0; it < state_vEx.size(); it++) {  //through time
-                for (int il = 0; il < state_vEx[it].size(); il++) {//through layers. Each layer has two states: c and h
-                  auto state = as_vector(state_vEx[it][il].value());
-                  for (int iv = 0; iv < state.size(); iv++) {
-                    if (abs(state[iv]) > maxAbs) {
-                      maxAbs = abs(state[iv]);
-                      timeOfMax = it;
-                      layerOfMax = il;
-                      chunkOfMax = irnn;
-                    }
-                  }
-                } //through layers/states
-              } //through time
-            }  //through chunks
-
-            cout << "levSm:" << as_scalar(levSm_ex.value()) << endl;
-            cout << "sSm:" << as_scalar(sSm_ex.value()) << endl;
-            cout << " min season=" << minSeason << endl;
-            cout << " min level=" << minLevel << endl;
-            cout << " max abs:" << maxAbs << " at time:" << timeOfMax << " at layer:" << layerOfMax << " and chunk:" << chunkOfMax << endl;
-
-            //diagSeries.insert(series);
-          pc.reset_gradient();
-          perSeriesPC.reset_gradient();
+          }
+          if (!updated) {
+            #if defined FORKED_WORKERS
+            healthMonitor.reportSkipped(series, epochMetrics);
+            sharedSkipped[iseries] = 1; //struck once, by the parent after the join, as the monitors of the children are lost
+            #else
+            healthMonitor.strike(series, epochMetrics);
+            #endif
+            pc.reset_gradient();
+            perSeriesPC.reset_gradient();
+          }
         }
+        #if defined DATA_PARALLEL
+        gradientAllReduce.reduceAndUpdate(worker, pc, trainer, updated, epochMetrics); //one step of the shared weights per round, averaged over the series updated in it
+        #endif
+        phaseStart = epochMetrics.times.add(PHASE_UPDATE, phaseStart, series, m4Obj.n);
 
         //saving per-series values for diagnostics purposes
         AdditionalParamsF &histAdditionalParams= historyOfAdditionalParams_map[series]->at(iEpoch);
@@ -907,16 +1171,13 @@ int main(int argc, char** argv) {
           }
           
         //TEST. We walk (without learning) till end of the series. At the last point, the output is taken as the forecast
-        for (int i=(m4Obj.n - OUTPUT_SIZE_I); i<m4Obj.n; i++) {
+        for (int i=(m4Obj.n - OUTPUT_SIZE_I); i<m4Obj.n && makeForecasts; i++) {
           vector<Expression>::const_iterator firstE = season_exVect.begin() + i + 1 - INPUT_SIZE_I;
           vector<Expression>::const_iterator pastLastE = season_exVect.begin() + i + 1; //not including the last one
           vector<Expression> inputSeasonality_exVect(firstE, pastLastE);  //[first,pastLast)
           Expression inputSeasonality_ex = concatenate(inputSeasonality_exVect);
 
-          vector<float>::const_iterator first = m4Obj.vals.begin() + i + 1 - INPUT_SIZE_I;
-          vector<float>::const_iterator pastLast = m4Obj.vals.begin() + i + 1; //not including the last one
-          vector<float> input_vect(first, pastLast); //[first,pastLast)
-          Expression input0_ex = input(cg, { INPUT_SIZE }, input_vect);
+          Expression input0_ex = input(cg, { INPUT_SIZE }, prepared.testInputs[i - (m4Obj.n - OUTPUT_SIZE_I)]);
           Expression input1_ex = cdiv(input0_ex, inputSeasonality_ex); //deseasonalization
           vector<Expression> joinedInput_ex;
           input1_ex= cdiv(input1_ex, levels_exVect[i]);//normalization
@@ -1000,16 +1261,52 @@ int main(int argc, char** argv) {
                     SQL_HANDLE_STMT,
                     SQLBindParameter(hInsertStmt, ipos+1, SQL_PARAM_INPUT, SQL_C_FLOAT, SQL_FLOAT, 0, 0, (SQLPOINTER)&testResults_map[series][AVERAGING_LEVEL][io], 0, NULL));
                 }
-                if (MAX_NUM_OF_SERIES<0)
+                if (MAX_NUM_OF_SERIES<0) {
+                  phaseStart = epochMetrics.times.add(PHASE_VALIDATION, phaseStart);
                   TRYODBC(hInsertStmt,
                     SQL_HANDLE_STMT,
                     SQLExecute(hInsertStmt));
+                  phaseStart = epochMetrics.times.add(PHASE_ODBC, phaseStart);
+                }
                 #endif    
               }
             } //time to average
           }//last anchor point of the series
         }//through TEST loop        
+        size_t poolUsed = graphPoolsUsed();
+        if (poolUsed > epochPoolHighWaterMark)
+          epochPoolHighWaterMark = poolUsed;
+        epochMetrics.times.add(PHASE_VALIDATION, phaseStart, series, m4Obj.n);
+        if (makeForecasts) {
+          epochMetrics.count(COUNTER_VALIDATION_SERIES);
+          #if defined FORKED_WORKERS || defined OVERLAP_TEST
+          saveTestResults(testResults_map[series], &sharedTestResults[iseries*TEST_RESULTS_SLOT_SIZE]);
+          #endif
+        }
       }//through series
+#if defined OVERLAP_TEST
+      if (forecaster) { //only the forecasts and their losses go back. All its work counts as validation.
+        trainingLosses.clear(); forecLosses.clear(); levVarLosses.clear(); stateLosses.clear();
+        Metrics forecasterMetrics;
+        forecasterMetrics.times.secs[PHASE_VALIDATION] = epochMetrics.times.total();
+        forecasterMetrics.count(COUNTER_VALIDATION_SERIES, epochMetrics.counters[COUNTER_VALIDATION_SERIES]);
+        epochMetrics = forecasterMetrics;
+      }
+      workers.join({ &testLosses, &testAvgLosses, &trainingLosses, &forecLosses, &levVarLosses, &stateLosses }, epochMetrics); //the forecaster exits here
+      for (int iseries = 0; iseries < (int)oneChunk_vect.size(); iseries++)
+        loadTestResults(&sharedTestResults[iseries*TEST_RESULTS_SLOT_SIZE], testResults_map[oneChunk_vect[iseries]]);
+#endif
+#if defined FORKED_WORKERS
+      workers.join({ &testLosses, &testAvgLosses, &trainingLosses, &forecLosses, &levVarLosses, &stateLosses }, epochMetrics); //the other workers exit here
+      for (int iseries = 0; iseries < (int)oneChunk_vect.size(); iseries++) {
+        loadTestResults(&sharedTestResults[iseries*TEST_RESULTS_SLOT_SIZE], testResults_map[oneChunk_vect[iseries]]);
+        if (sharedSkipped[iseries])
+          healthMonitor.addStrike(oneChunk_vect[iseries], epochMetrics);
+      }
+#endif
+#if defined BENCHMARK_MODE
+      benchReport.writeEpoch(ibig, iEpoch, (double)oneChunk_vect.size(), epochMetrics.times, epochPoolHighWaterMark);
+#endif
 
   
       if (iEpoch % FREQ_OF_TEST == 0) {
@@ -1060,13 +1357,17 @@ int main(int argc, char** argv) {
         }
       }
       #if defined USE_ODBC 
-      TRYODBC(hDbc,
-        SQL_HANDLE_DBC,
-        SQLEndTran(
+      {
+        ScopedTimer odbcTimer(epochMetrics.times, PHASE_ODBC);
+        TRYODBC(hDbc,
           SQL_HANDLE_DBC,
-          hDbc,
-          SQL_COMMIT));
+          SQLEndTran(
+            SQL_HANDLE_DBC,
+            hDbc,
+            SQL_COMMIT));
+      }
       #endif    
+      metricsExporter.writeEpoch(ibig, iEpoch, epochMetrics);
     }//through epochs
 
     if (PRINT_DIAGN) {//some diagnostic info
@@ -1109,6 +1410,8 @@ int main(int argc, char** argv) {
     }
 
     //save the forecast to outputFile
+    Metrics outputMetrics;
+    double outputStart = nowSecs();
     ofstream outputFile;
     outputFile.open(outputPath);
     for (auto iter = oneChunk_vect.begin(); iter != oneChunk_vect.end(); ++iter) {
@@ -1119,6 +1422,11 @@ int main(int argc, char** argv) {
       outputFile<<endl;
     }
     outputFile.close();
+    outputMetrics.times.add(PHASE_OUTPUT, outputStart);
+#if defined BENCHMARK_MODE
+    benchReport.addTimes(outputMetrics.times);
+#endif
+    metricsExporter.writeIbig(ibig, outputMetrics);
 
 
     //delete
@@ -1128,6 +1436,10 @@ int main(int argc, char** argv) {
       delete addHistArr_ptr;
     }
   }//ibig
+#if defined BENCHMARK_MODE
+  benchReport.writeSummary();
+#endif
+  traceFinish();
 }//main
 
 #if defined USE_ODBC
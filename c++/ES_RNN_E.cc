@@ -30,6 +30,43 @@ These blocks are as they were during the final forecasting run. You need comment
 // Saving to the db is convenient, but not necessary - all forecasts are always saved to as csv files in automatically created subdirectory (sorry sometimes two directories, so you have to copy :-)) of OUTPUT_DIR
 //If saving to database you need to modify run varaible, for each new run, otherwise you will get the table key error.
 
+//#define BENCHMARK_MODE
+//define BENCHMARK_MODE to run a reproducible throughput benchmark of the active PARAMS block:
+//first MAX_NUM_OF_SERIES series of the file, fixed seeds (unless --dynet-seed is given), NUM_OF_EPOCHS_TO_RUN epochs, one ibig.
+//Time per epoch split into phases (graph build, forward, backward, update, validation, output), series/sec, peak RSS and high-water mark of Dynet graph memory pools
+//are written as JSON lines to <OUTPUT_DIR>/<VARIABLE>_<ibigOffset>_bench.jsonl, see metrics.h. Build it, for comparison, with the same flags as the normal runs.
+
+//#define USE_MPI
+//define USE_MPI to spread the NUM_OF_NETS nets over MPI ranks (also over many nodes). Build with mpicxx and run e.g.
+//mpirun -np 4 <this_executable> 0
+//Validation losses and forecasts are exchanged every epoch, rank 0 evaluates the ensemble and writes the forecasts. Metrics, trace and benchmark files get a _rank<r> suffix.
+//The health check quarantines a series only in the nets of the rank that saw it fail. Not with USE_ODBC. See mpi_ensemble.h
+
+//With EXPORT_MODEL (off by default) every ibig run also saves its model (global weights, per series ES parameters, configuration, net rankings) next to its forecasts, see model_artifact.h.
+//<this_executable> 0 --forecast-only --model-dir <the output directory of the training run, e.g. .../Hourly2018-06-01_09_30Final/>
+//loads the model of every ibig run instead of training, and makes the forecasts with a single forward pass per series through its top nets.
+//--model-dir is needed by all the modes below: they read (and --update, the cache, write back) the model files there, the forecasts go as usual to a new output directory.
+//The ibig offset has to be that of the training run, e.g. a run started with 10 exported <VARIABLE>_10_LB0.*, ... and is forecast with <this_executable> 10 --forecast-only --model-dir ...
+//The executable has to be built with the same PARAMS block (and the same number of MPI ranks), otherwise the model is refused. Series not in the model are skipped, with a warning.
+//The forecasts are those of the final weights, not averaged over the last AVERAGING_LEVEL epochs as in the training run.
+//With FORECAST_CACHE_ENTRIES>0 the forecasts are kept in <model>.cache, and a series whose history (and model) has not changed since the last --forecast-only
+//is not forecast again, see forecast_cache.h. Linux/Mac only, not with USE_MPI, --update, --cold-start or --serve.
+//esrnn_infer makes the same forecasts from the exported model without Dynet, see inference.h.
+//With ONLINE_STATE (off by default) the model also gets the online state of the top nets of every series, after its last point, see online_state.h.
+//<this_executable> 0 --update <new points file> --model-dir <dir>
+//advances that state over the new points (a file in the format of the training file, only the new points of each series) and writes the forecasts after them,
+//in a pass over the new points only. The state is saved back, so the next --update continues from there.
+//<this_executable> 0 --cold-start <new series file> --model-dir <dir>
+//forecasts like --forecast-only, also for the series of the file (format of the training file) that are not in the model: their ES parameters are fitted
+//against the frozen nets, COLD_START_STEPS steps in each net, in COLD_START_WORKERS processes, and the nets are ranked by the fitted losses. See fitColdStart().
+//<this_executable> 0 --serve <socket path> --model-dir <dir> [--dynet-autobatch 1]
+//is a long-lived server of the model of ibig 0 (+offset) and its online state: forecast and update requests over a Unix domain socket, see serving.h.
+//Requests arriving within SERVE_BATCH_WINDOW_MS are coalesced (up to SERVE_MAX_BATCH) into one graph per net, which Dynet's autobatching runs as batches.
+//Load it with esrnn_loadgen (p50/p99 latency, QPS). Linux/Mac only, not with USE_MPI.
+//With STREAM_SHARD_SIZE>0 the training streams the series from memory-mapped shards of that many series, written to OUTPUT_DIR at the start, instead of keeping them all in memory.
+//Their per series parameters and Adam moments live in the shards too, Dynet holds the parameters of one shard only. Every pass of a net goes through the shards in random order,
+//the next shard read ahead and the previous one written back in the background, see series_shards.h. Linux/Mac only, not with --forecast-only, --update, --cold-start or --serve.
+
 #include "dynet/dynet.h"
 #include "dynet/training.h"
 #include "dynet/expr.h"
@@ -39,6 +76,27 @@ These blocks are as they were during the final forecasting run. You need comment
 #include "dynet/expr.h"
 #include "dynet/lstm.h"
 #include "slstm.h" //my implementation of dilated LSTMs
+#include "accuracy.h"
+#include "metrics.h"
+#include "health.h"
+#include "placement.h"
+#include "mpi_ensemble.h"
+#include "model_artifact.h"
+#include "online_state.h"
+#include "series_store.h"
+#if !defined _WINDOWS
+  #include "workers.h"
+  #include "serving.h"
+  #include "forecast_cache.h"
+  #include "series_shards.h"
+  #include "prefetch.h"
+  #include "series_ingest.h"
+#endif
+#if defined USE_MPI && defined USE_ODBC
+  #error "USE_MPI does not support USE_ODBC"
+#endif
+#include "dynet/globals.h"
+#include "dynet/devices.h"
 
 
 #if defined USE_ODBC        
@@ -217,12 +275,13 @@ const int TOPN = 4;
 
 //end of VARIABLE-specific params
 
-const int BIG_LOOP = 3;
 const int NUM_OF_NETS = 5;
 const unsigned int ATTENTION_HSIZE = STATE_HSIZE;
 
 
-#if defined _DEBUG
+#if defined BENCHMARK_MODE
+  const int MAX_NUM_OF_SERIES = 1000; //deterministic subset: the first series of the file
+#elif defined _DEBUG
   const int MAX_NUM_OF_SERIES = 20;
 #else
   const int MAX_NUM_OF_SERIES = -1;
@@ -230,18 +289,47 @@ const unsigned int ATTENTION_HSIZE = STATE_HSIZE;
 
 const unsigned int NUM_OF_CATEGORIES = 6;
 const int AVERAGING_LEVEL = 5;
+#if defined BENCHMARK_MODE
+  const int BIG_LOOP = 1;
+  const int NUM_OF_EPOCHS_TO_RUN = AVERAGING_LEVEL + 1; //the smallest number for which the forecasts get averaged and saved
+  const unsigned BENCH_SEED = 17;
+#else
+  const int BIG_LOOP = 3;
+  const int NUM_OF_EPOCHS_TO_RUN = NUM_OF_TRAIN_EPOCHS;
+#endif
 const float EPS=1e-6;
 
 const float NOISE_STD=0.001; 
 const int FREQ_OF_TEST=1;
 const float GRADIENT_CLIPPING=50;
+const float HEALTH_MAX_STATE_ABS = 1000; //a training step with a larger, or non-finite, c-state, or with a non-finite gradient, is skipped. See health.h
+const int HEALTH_STRIKES_TO_QUARANTINE = 3; //a series skipped that many times is not trained anymore in the ibig run
 const float BIG_FLOAT=1e38;//numeric_limits<float>::max();
 const bool PRINT_DIAGN = false;
+const string METRICS_FORMAT = "jsonl"; //"jsonl": <OUTPUT_DIR>/<VARIABLE>_<ibigOffset>_metrics.jsonl gets a line per epoch and per ibig, "prometheus": <...>_metrics.prom is rewritten after every epoch, "": no metrics file. See metrics.h
+const bool TRACE = false; //Chrome trace-event timeline of build/forward/backward/update/validation spans, per series, written to <OUTPUT_DIR>/<VARIABLE>_<ibigOffset>_trace.json, for Perfetto or chrome://tracing. See trace.h
+const int BLAS_THREADS = 1; //threads of the BLAS library (MKL, OpenBLAS) in this process. More than 1 only oversubscribes the cores when many workers run. See placement.h
+const bool PIN_TO_CORES = false; //pin to the core of the slot given by ESRNN_SLOT (or the MPI local rank), and prefer the memory of its NUMA node. Off by default; without a slot nothing is pinned anyway
+const int TBPTT_WINDOW = 0; //truncated BPTT: series longer than that many RNN steps (forecast windows) are trained in segments of it, each a separate graph and update, see the training loop. 0: whole series. If used, at least the largest dilation, e.g. 1000 for Hourly
+const int CHECKPOINT_EVERY = 0; //gradient checkpointing: the graph of a series is built in segments of that many RNN steps, keeping only the states at their starts; the backward pass recomputes them, last first. Exact gradients, one update per series, graph memory ~ the segment. ~sqrt(steps) and at least the largest dilation, e.g. 200 for Hourly. 0: off
+static_assert(TBPTT_WINDOW == 0 || CHECKPOINT_EVERY == 0, "TBPTT_WINDOW and CHECKPOINT_EVERY are exclusive");
+static_assert(TBPTT_WINDOW != 1 && TBPTT_WINDOW >= 0 && CHECKPOINT_EVERY != 1 && CHECKPOINT_EVERY >= 0, "a segment of TBPTT_WINDOW or CHECKPOINT_EVERY needs at least 2 steps, its end state refers to the level before the last");
+const bool EXPORT_MODEL = false; //save the model of every ibig run, for --forecast-only, --update, --cold-start and --serve, see model_artifact.h. Off by default: set it in the training run whose model is to be reused
+const bool ONLINE_STATE = false; //with EXPORT_MODEL, also save the online state of the top nets of every series, for --update and --serve, see online_state.h. Off by default: an extra pass over every series
+const int COLD_START_STEPS = 40; //--cold-start: Adam steps fitting the ES parameters of a new series in a net
+const float COLD_START_LEARNING_RATE = 0.03f; //much larger than in training: only a few parameters, and a few steps
+const int COLD_START_WORKERS = 4; //--cold-start: processes fitting the (series, net) pairs in parallel, Linux/Mac only
+const int SERVE_MAX_BATCH = 64; //--serve: requests run in one graph per net
+const double SERVE_BATCH_WINDOW_MS = 2; //--serve: the longest wait for more requests after the first one of a batch, the latency paid for batching
+const int STREAM_SHARD_SIZE = 0; //streaming training of more series than fit in RAM: series per memory-mapped shard, e.g. 10000. Memory holds two shards of series and per series parameters. 0: all in memory. See series_shards.h
+const bool COMPRESS_SERIES = false; //keep the values of the series compressed in memory, decoded into a scratch series before its graph is built. Lossless, for catalogs larger than RAM holds as vector<float>s. See series_store.h
+const int FORECAST_CACHE_ENTRIES = 0; //--forecast-only: entries of the persistent forecast cache <model>.cache, e.g. 1<<20, see forecast_cache.h. 0: no cache
 const float TAU = PERCENTILE / 100.;
 const float TRAINING_TAU = TRAINING_PERCENTILE / 100.; 
 
 string INPUT_PATH = DATA_DIR + VARIABLE + "-train.csv";
 string INFO_INPUT_PATH = DATA_DIR + "M4-info.csv";
+string STORE_PATH = ""; //binary series store read instead of INPUT_PATH, without parsing, e.g. DATA_DIR + VARIABLE + "-train.store", written and appended to by esrnn_ingest, see series_ingest.h. Linux/Mac only
 
 
 Expression squash(const Expression& x) {
@@ -298,8 +386,9 @@ struct M4TS {//storing series data
   vector<float> vals;
   vector<float> testVals;//empty, unless LBACK>0
   int n;
+  int stored = -1; //COMPRESS_SERIES: index in the series store, vals and testVals are empty, see seriesOf
   
-  M4TS(string category, stringstream  &line_stream) {
+  void setCategories(const string& category) {
     array<float, NUM_OF_CATEGORIES> categories = { 0,0,0,0,0,0 };
     if (category == "Demographic")
       categories[0] = 1;
@@ -319,7 +408,10 @@ struct M4TS {//storing series data
     }
     for (int i = 0; i < NUM_OF_CATEGORIES; i++)
       categories_vect.push_back(categories[i]);
+  }
 
+  M4TS(string category, stringstream  &line_stream) {
+    setCategories(category);
     string tmp_str;
     while(getline(line_stream, tmp_str, ',' )) {
       string val_str;
@@ -350,9 +442,32 @@ struct M4TS {//storing series data
       n = vals.size();
     }
   }
+  //from all the values of a series, e.g. mapped from the series store (series_ingest.h): the LBACK split and the chop are ranges of them, each copied once
+  M4TS(string category, const float* values, int length) {
+    setCategories(category);
+    int historyEnd = length;
+    if (LBACK > 0) {
+      if (length > LBACK*(int)OUTPUT_SIZE) {
+        historyEnd = length - LBACK*OUTPUT_SIZE;
+        testVals.assign(values + historyEnd, values + historyEnd + OUTPUT_SIZE);
+      } else
+        historyEnd = 0; //n = 0
+    }
+    vals.assign(values + max(0, historyEnd - MAX_SERIES_LENGTH), values + historyEnd);
+    n = vals.size();
+  }
   M4TS(){};
 };
 
+#if defined USE_RESIDUAL_LSTM
+  const string LSTM_TYPE = "ResidualDilatedLSTM";
+#elif defined USE_ATTENTIVE_LSTM
+  const string LSTM_TYPE = "AttentiveDilatedLSTM";
+#else
+  const string LSTM_TYPE = "DilatedLSTM";
+#endif
+
+
 #if defined USE_ODBC        
 void HandleDiagnosticRecord(SQLHANDLE      hHandle,
   SQLSMALLINT    hType,
@@ -378,6 +493,281 @@ struct AdditionalParamsF {//Used for storing diagnostics
     vector<float> seasons;
     vector<float> seasons2;
 };
+//raw (unconstrained) values of the per series parameters, in the order levSm, [sSm, initSeasonality], [sSm2, initSeasonality2]. Used by the model artifact
+vector<float> esParameterValues(const AdditionalParams& params) {
+  vector<float> values;
+  values.push_back(as_scalar(params.levSm.get_storage().values));
+  if (SEASONALITY_NUM > 0) {
+    values.push_back(as_scalar(params.sSm.get_storage().values));
+    for (int isea = 0; isea<SEASONALITY; isea++)
+      values.push_back(as_scalar(params.initSeasonality[isea].get_storage().values));
+  }
+  if (SEASONALITY_NUM > 1) {
+    values.push_back(as_scalar(params.sSm2.get_storage().values));
+    for (int isea = 0; isea<SEASONALITY2; isea++)
+      values.push_back(as_scalar(params.initSeasonality2[isea].get_storage().values));
+  }
+  return values;
+}
+
+const int ES_PARAMS_PER_SERIES = 1 + (SEASONALITY_NUM > 0 ? 1 + SEASONALITY : 0) + (SEASONALITY_NUM > 1 ? 1 + SEASONALITY2 : 0);
+
+//false if values do not fit
+bool setEsParameterValues(AdditionalParams& params, const vector<float>& values) {
+  if (values.size() != (size_t)ES_PARAMS_PER_SERIES)
+    return false;
+  auto value = values.begin();
+  params.levSm.set_value({ *value++ });
+  if (SEASONALITY_NUM > 0) {
+    params.sSm.set_value({ *value++ });
+    for (int isea = 0; isea<SEASONALITY; isea++)
+      params.initSeasonality[isea].set_value({ *value++ });
+  }
+  if (SEASONALITY_NUM > 1) {
+    params.sSm2.set_value({ *value++ });
+    for (int isea = 0; isea<SEASONALITY2; isea++)
+      params.initSeasonality2[isea].set_value({ *value++ });
+  }
+  return true;
+}
+
+//storages of the per series parameters, in the order of esParameterValues()
+vector<ParameterStorage*> esParameterStorages(AdditionalParams& params) {
+  vector<ParameterStorage*> storages;
+  storages.push_back(&params.levSm.get_storage());
+  if (SEASONALITY_NUM > 0) {
+    storages.push_back(&params.sSm.get_storage());
+    for (int isea = 0; isea<SEASONALITY; isea++)
+      storages.push_back(&params.initSeasonality[isea].get_storage());
+  }
+  if (SEASONALITY_NUM > 1) {
+    storages.push_back(&params.sSm2.get_storage());
+    for (int isea = 0; isea<SEASONALITY2; isea++)
+      storages.push_back(&params.initSeasonality2[isea].get_storage());
+  }
+  return storages;
+}
+
+//STREAM_SHARD_SIZE: update of the per series parameters of one series, with its Adam moments m and v kept in its shard, instead of perSeriesTrainer->update().
+//As Dynet's AdamTrainer does it: the gradient clipped to GRADIENT_CLIPPING by its norm, the bias correction by the count of updates of the net, then the gradient cleared.
+void streamedAdamUpdate(AdditionalParams& params, float* m, float* v, float learningRate, long updates) {
+  vector<ParameterStorage*> storages = esParameterStorages(params);
+  float norm2 = 0;
+  for (auto storage : storages)
+    norm2 += storage->g.v[0] * storage->g.v[0];
+  float gscale = norm2 > GRADIENT_CLIPPING*GRADIENT_CLIPPING ? GRADIENT_CLIPPING / sqrt(norm2) : 1;
+  float lr_t = learningRate * sqrt(1 - pow(0.999, (double)updates)) / (1 - pow(0.9, (double)updates));
+  for (size_t i = 0; i < storages.size(); i++) {
+    float g = storages[i]->g.v[0] * gscale;
+    m[i] = 0.9f*m[i] + 0.1f*g;
+    v[i] = 0.999f*v[i] + 0.001f*g*g;
+    storages[i]->values.v[0] -= lr_t*m[i] / (sqrt(v[i]) + EPS);
+    storages[i]->clear();
+  }
+}
+
+//everything that shapes the model, see model_artifact.h
+ModelConfig modelConfig() {
+  string dilationsText;
+  for (auto& layers : dilations) {
+    if (!dilationsText.empty())
+      dilationsText += "|";
+    for (size_t i = 0; i < layers.size(); i++)
+      dilationsText += (i > 0 ? "," : "") + to_string(layers[i]);
+  }
+  ModelConfig config;
+  config.push_back(make_pair("program", string("ES_RNN_E")));
+  config.push_back(make_pair("variable", VARIABLE));
+  config.push_back(make_pair("lstm_type", LSTM_TYPE));
+  config.push_back(make_pair("dilations", dilationsText));
+  config.push_back(make_pair("add_nl_layer", to_string(ADD_NL_LAYER)));
+  config.push_back(make_pair("seasonality_num", to_string(SEASONALITY_NUM)));
+  config.push_back(make_pair("seasonality", to_string(SEASONALITY)));
+  config.push_back(make_pair("seasonality2", to_string(SEASONALITY2)));
+  config.push_back(make_pair("input_size", to_string(INPUT_SIZE)));
+  config.push_back(make_pair("output_size", to_string(OUTPUT_SIZE)));
+  config.push_back(make_pair("max_series_length", to_string(MAX_SERIES_LENGTH))); //longer series are cut, so it shapes the forecasts
+  config.push_back(make_pair("state_hsize", to_string(STATE_HSIZE)));
+#if defined USE_ATTENTIVE_LSTM
+  config.push_back(make_pair("attention_hsize", to_string(ATTENTION_HSIZE)));
+#endif
+  config.push_back(make_pair("num_of_categories", to_string(NUM_OF_CATEGORIES)));
+  config.push_back(make_pair("num_of_nets", to_string(NUM_OF_NETS)));
+  config.push_back(make_pair("topn", to_string(TOPN)));
+  config.push_back(make_pair("mpi_ranks", to_string(MpiWorld::instance().size)));
+  return config;
+}
+
+//state before the first point of a series, see online_state.h
+OnlineSeriesState startOnlineState(const AdditionalParams& params, const vector<float>& categories) {
+  vector<float> esValues = esParameterValues(params);
+  auto logistic = [](float x) { return 1 / (1 + exp(-x)); };
+  OnlineSeriesState state;
+  state.categories = categories;
+  state.levSm = logistic(esValues[0]);
+  if (SEASONALITY_NUM > 0) {
+    state.seasonality = SEASONALITY;
+    state.sSm = logistic(esValues[1]);
+    for (int isea = 0; isea<SEASONALITY; isea++)
+      state.seasons.push_back(exp(esValues[2 + isea]));
+  }
+  if (SEASONALITY_NUM > 1) {
+    state.seasonality2 = SEASONALITY2;
+    state.sSm2 = logistic(esValues[2 + SEASONALITY]);
+    for (int isea = 0; isea<SEASONALITY2; isea++)
+      state.seasons2.push_back(exp(esValues[3 + SEASONALITY + isea]));
+  }
+  return state;
+}
+
+//Advances the online states of series in one net over their newValues: the ES in floats, the LSTMs in a graph of the new steps only, continuing from the saved h and c.
+//All series share one graph, as independent sequences, so with --dynet-autobatch 1 Dynet runs their steps as batches (--serve coalesces requests for that).
+//Sets the forecasts after the last points (no input noise, unlike the validation pass); a series still shorter than INPUT_SIZE keeps its (empty) forecast.
+template <class RnnStack>
+void updateOnlineStates(const vector<OnlineSeriesState*>& states, const vector<const vector<float>*>& newValues, RnnStack& rNNStack,
+    Parameter& MLPW_par, Parameter& MLPB_par, Parameter& adapterW_par, Parameter& adapterB_par) {
+  ComputationGraph cg;
+  for (int il=0; il<dilations.size(); il++)
+    rNNStack[il].new_graph(cg);
+  Expression MLPW_ex, MLPB_ex;
+  if (ADD_NL_LAYER) {
+    MLPW_ex = parameter(cg, MLPW_par);
+    MLPB_ex = parameter(cg, MLPB_par);
+  }
+  Expression adapterW_ex = parameter(cg, adapterW_par);
+  Expression adapterB_ex = parameter(cg, adapterB_par);
+
+  vector<Expression> out_exVect(states.size());
+  vector<vector<vector<vector<Expression>>>> h_exVect(states.size()), c_exVect(states.size()); //[series][rnn][time][layer], the steps to keep
+  Expression last_ex;
+  bool anyStepped = false;
+  for (size_t is = 0; is < states.size(); is++) {
+    OnlineSeriesState& state = *states[is];
+    state.h.resize(dilations.size());
+    state.c.resize(dilations.size());
+    for (int il=0; il<dilations.size(); il++) {
+      rNNStack[il].start_new_sequence();
+      if (!state.h[il].empty()) {
+        vector<vector<Expression>> h_hist, c_hist;
+        for (int it = 0; it < state.h[il].size(); it++) {
+          h_hist.push_back(vector<Expression>());
+          c_hist.push_back(vector<Expression>());
+          for (int layer = 0; layer < state.h[il][it].size(); layer++) {
+            h_hist.back().push_back(input(cg, { STATE_HSIZE }, state.h[il][it][layer]));
+            c_hist.back().push_back(input(cg, { STATE_HSIZE }, state.c[il][it][layer]));
+          }
+        }
+        rNNStack[il].continue_sequence(h_hist, c_hist);
+      }
+    }
+
+    Expression rnn_ex;
+    bool stepped = false;
+    for (float value : *newValues[is]) {
+      state.advance(value, INPUT_SIZE);
+      if (state.numOfPoints < INPUT_SIZE)
+        continue;
+      vector<Expression> joinedInput_ex;
+      joinedInput_ex.emplace_back(input(cg, { INPUT_SIZE }, state.normalizedInput(INPUT_SIZE)));
+      joinedInput_ex.emplace_back(input(cg, { NUM_OF_CATEGORIES }, state.categories));
+      rnn_ex = rNNStack[0].add_input(concatenate(joinedInput_ex));
+      for (int il=1; il<dilations.size(); il++)
+        rnn_ex=rnn_ex+rNNStack[il].add_input(rnn_ex);
+      stepped = true;
+    }
+    if (!stepped)
+      continue;
+
+    if (ADD_NL_LAYER) {
+      out_exVect[is]=MLPW_ex*rnn_ex+MLPB_ex;
+      out_exVect[is] = adapterW_ex*tanh(out_exVect[is])+adapterB_ex;
+    } else 
+      out_exVect[is]=adapterW_ex*rnn_ex+adapterB_ex;
+    last_ex = out_exVect[is];
+    anyStepped = true;
+
+    h_exVect[is].resize(dilations.size());
+    c_exVect[is].resize(dilations.size());
+    for (int il=0; il<dilations.size(); il++) {//the last max(dilation) steps, the reach of the dilated connections
+      auto& rnn = rNNStack[il];
+      int numOfSteps = min((int)rnn.h.size(), (int)*max_element(dilations[il].begin(), dilations[il].end()));
+      h_exVect[is][il].assign(rnn.h.end() - numOfSteps, rnn.h.end());
+      c_exVect[is][il].assign(rnn.c.end() - numOfSteps, rnn.c.end());
+    }
+  }
+  if (!anyStepped)
+    return;
+  cg.forward(last_ex); //evaluates every node before it, so the outputs and states of all series
+
+  for (size_t is = 0; is < states.size(); is++) {
+    if (h_exVect[is].empty())
+      continue;
+    OnlineSeriesState& state = *states[is];
+    state.forecast = state.denormalize(as_vector(out_exVect[is].value()));
+    for (int il=0; il<dilations.size(); il++) {
+      state.h[il].clear();
+      state.c[il].clear();
+      for (int it = 0; it < h_exVect[is][il].size(); it++) {
+        state.h[il].push_back(vector<vector<float>>());
+        state.c[il].push_back(vector<vector<float>>());
+        for (int layer = 0; layer < h_exVect[is][il][it].size(); layer++) {
+          state.h[il].back().push_back(as_vector(h_exVect[is][il][it][layer].value()));
+          state.c[il].back().push_back(as_vector(c_exVect[is][il][it][layer].value()));
+        }
+      }
+    }
+  }
+}
+
+//single series version, returns the forecast
+template <class RnnStack>
+vector<float> updateOnlineState(OnlineSeriesState& state, const vector<float>& newValues, RnnStack& rNNStack,
+    Parameter& MLPW_par, Parameter& MLPB_par, Parameter& adapterW_par, Parameter& adapterB_par) {
+  updateOnlineStates({ &state }, { &newValues }, rNNStack, MLPW_par, MLPB_par, adapterW_par, adapterB_par);
+  return state.forecast;
+}
+
+//new points per series, in the format of the training file: header, then "<series>",<value>,<value>,...
+unordered_map<string, vector<float>> readNewPoints(const string& path) {
+  unordered_map<string, vector<float>> newPoints;
+  ifstream file(path);
+  if (!file) {
+    cerr << "could not open " << path << endl;
+    exit(-1);
+  }
+  string line;
+  getline(file, line); //header
+  while (getline(file, line)) {
+    stringstream line_stream(line);
+    string series0; string series;
+    getline(line_stream, series0, ',');
+    for (const auto c : series0) {
+      if (!ispunct(c))
+        series.push_back(c);
+    }
+    vector<float>& vals = newPoints[series];
+    string tmp_str;
+    while (getline(line_stream, tmp_str, ',')) {
+      string val_str;
+      for (const auto c : tmp_str) {
+        if (c != '\"' && c != '\r')
+          val_str.push_back(c);
+      }
+      if (val_str.size() == 0)
+        break;
+      vals.push_back(atof(val_str.c_str()));
+    }
+  }
+  return newPoints;
+}
+
+struct CarriedState {//the state at the start of a segment of a series (TBPTT_WINDOW, CHECKPOINT_EVERY). Flattened in the order the segment's graph takes it in:
+    //RNN h and c of the last max(dilation) steps of the previous segment ([rnn][time][layer]), SEASONALITY and SEASONALITY2 factors from the first point of the ES recursion,
+    //level of the point before it, log difference of the levels
+    vector<int> rnnSteps; //per rnn
+    vector<float> values;
+    vector<float> gradient; //checkpointing: of the loss of the later segments, with respect to values
+};
   
 
 array<int, NUM_OF_NETS> perfToRanking (array<float, NUM_OF_NETS> perf_arr) {
@@ -412,30 +802,166 @@ Expression pinBallLoss(const Expression& out_ex, const Expression& actuals_ex) {
 }
 
 
+//The parameters and the trainer of fitColdStart(), one set per process and reused for all the fits: Dynet does not give back the memory of a ParameterCollection.
+struct ColdStartFit {
+  ParameterCollection pc;
+  AdditionalParams params;
+  AdamTrainer trainer;
+
+  ColdStartFit() : params(addParams(pc)), trainer(pc, COLD_START_LEARNING_RATE, 0.9, 0.999, EPS) {
+    trainer.clip_threshold = GRADIENT_CLIPPING;
+  }
+
+  static AdditionalParams addParams(ParameterCollection& pc) {
+    AdditionalParams params;
+    params.levSm = pc.add_parameters({ 1 }, ParameterInitConst(0));
+    if (SEASONALITY_NUM > 0) {
+      params.sSm = pc.add_parameters({ 1 }, ParameterInitConst(0));
+      for (int isea = 0; isea<SEASONALITY; isea++)
+        params.initSeasonality[isea] = pc.add_parameters({ 1 }, ParameterInitConst(0));
+    }
+    if (SEASONALITY_NUM > 1) {
+      params.sSm2 = pc.add_parameters({ 1 }, ParameterInitConst(0));
+      for (int isea = 0; isea<SEASONALITY2; isea++)
+        params.initSeasonality2[isea] = pc.add_parameters({ 1 }, ParameterInitConst(0));
+    }
+    return params;
+  }
+
+  //the start of a fit: no smoothing preference, flat seasonality, no Adam moments
+  void reset() {
+    setEsParameterValues(params, vector<float>(ES_PARAMS_PER_SERIES, 0));
+    pc.reset_gradient();
+    trainer.restart();
+    trainer.updates = 0;
+  }
+};
+
+//Fits, for --cold-start, the ES parameters of a series that is not in the model against the frozen weights of one net:
+//the LSTMs and the adapter enter the graph as constants (new_graph(cg, false), const_parameter), and COLD_START_STEPS Adam steps of the trainer of fit
+//minimize the training loss of the series (pinball over the training area, level variability penalty), without the input noise.
+//Returns the loss after the fit (BIG_FLOAT if the series is too short) and the fitted values, in the order of esParameterValues().
+template <class RnnStack>
+float fitColdStart(const M4TS& m4Obj, ColdStartFit& fit, vector<float>& esValues, RnnStack& rNNStack,
+    Parameter& MLPW_par, Parameter& MLPB_par, Parameter& adapterW_par, Parameter& adapterB_par) {
+  fit.reset();
+  AdditionalParams& params = fit.params;
+  AdamTrainer& trainer = fit.trainer;
+
+  float loss = BIG_FLOAT;
+  for (int istep = 0; istep <= COLD_START_STEPS; istep++) {//the last one only evaluates
+    ComputationGraph cg;
+    for (int il=0; il<dilations.size(); il++) {
+      rNNStack[il].new_graph(cg, false);
+      rNNStack[il].start_new_sequence();
+    }
+    Expression MLPW_ex, MLPB_ex;
+    if (ADD_NL_LAYER) {
+      MLPW_ex = const_parameter(cg, MLPW_par);
+      MLPB_ex = const_parameter(cg, MLPB_par);
+    }
+    Expression adapterW_ex = const_parameter(cg, adapterW_par);
+    Expression adapterB_ex = const_parameter(cg, adapterB_par);
+
+    Expression levSm_ex = logistic(parameter(cg, params.levSm));
+    Expression sSm_ex, sSm2_ex;
+    vector<Expression> season_exVect, season2_exVect;
+    if (SEASONALITY_NUM > 0) {
+      sSm_ex = logistic(parameter(cg, params.sSm));
+      for (int isea = 0; isea<SEASONALITY; isea++)
+        season_exVect.push_back(exp(parameter(cg, params.initSeasonality[isea])));
+      season_exVect.push_back(season_exVect[0]);
+    }
+    if (SEASONALITY_NUM > 1) {
+      sSm2_ex = logistic(parameter(cg, params.sSm2));
+      for (int isea = 0; isea<SEASONALITY2; isea++)
+        season2_exVect.push_back(exp(parameter(cg, params.initSeasonality2[isea])));
+      season2_exVect.push_back(season2_exVect[0]);
+    }
+
+    //the ES recurrence of the training graph; only the training area is needed, so no seasonality factors beyond the series
+    vector<Expression> levels_exVect;
+    vector<Expression> logDiffOfLevels_vect;
+    Expression lev = input(cg, m4Obj.vals[0]);
+    if (SEASONALITY_NUM == 1)
+      lev = cdiv(lev, season_exVect[0]);
+    else if (SEASONALITY_NUM == 2)
+      lev = cdiv(lev, season_exVect[0] * season2_exVect[0]);
+    levels_exVect.push_back(lev);
+    for (int i = 1; i<m4Obj.vals.size(); i++) {
+      if (SEASONALITY_NUM == 0) {
+        levels_exVect.push_back(levSm_ex*m4Obj.vals[i] + (1 - levSm_ex)*levels_exVect[i - 1]);
+        continue;
+      }
+      Expression seasons_ex = SEASONALITY_NUM == 1 ? season_exVect[i] : season_exVect[i] * season2_exVect[i];
+      Expression newLevel_ex = m4Obj.vals[i] * cdiv(levSm_ex, seasons_ex) + (1 - levSm_ex)*levels_exVect[i - 1];
+      levels_exVect.push_back(newLevel_ex);
+      logDiffOfLevels_vect.push_back(log(cdiv(newLevel_ex, levels_exVect[i - 1])));
+      Expression newSeason_ex = m4Obj.vals[i] * cdiv(sSm_ex, SEASONALITY_NUM == 1 ? newLevel_ex : newLevel_ex*season2_exVect[i]) + (1 - sSm_ex)*season_exVect[i];
+      if (SEASONALITY_NUM == 2)
+        season2_exVect.push_back(m4Obj.vals[i] * cdiv(sSm2_ex, newLevel_ex*season_exVect[i]) + (1 - sSm2_ex)*season2_exVect[i]);
+      season_exVect.push_back(newSeason_ex);
+    }
+
+    vector<Expression> losses;
+    for (int i=INPUT_SIZE-1; i<(m4Obj.n- OUTPUT_SIZE); i++) {
+      vector<float> input_vect(m4Obj.vals.begin() + i + 1 - INPUT_SIZE, m4Obj.vals.begin() + i + 1);
+      vector<float> labels_vect(m4Obj.vals.begin() + i + 1, m4Obj.vals.begin() + i + 1 + OUTPUT_SIZE);
+      Expression input1_ex = input(cg, { INPUT_SIZE }, input_vect);
+      Expression labels1_ex = input(cg, { OUTPUT_SIZE }, labels_vect);
+      if (SEASONALITY_NUM > 0) {
+        input1_ex = cdiv(input1_ex, concatenate(vector<Expression>(season_exVect.begin() + i + 1 - INPUT_SIZE, season_exVect.begin() + i + 1)));
+        labels1_ex = cdiv(labels1_ex, concatenate(vector<Expression>(season_exVect.begin() + i + 1, season_exVect.begin() + i + 1 + OUTPUT_SIZE)));
+      }
+      if (SEASONALITY_NUM > 1) {
+        input1_ex = cdiv(input1_ex, concatenate(vector<Expression>(season2_exVect.begin() + i + 1 - INPUT_SIZE, season2_exVect.begin() + i + 1)));
+        labels1_ex = cdiv(labels1_ex, concatenate(vector<Expression>(season2_exVect.begin() + i + 1, season2_exVect.begin() + i + 1 + OUTPUT_SIZE)));
+      }
+      vector<Expression> joinedInput_ex;
+      joinedInput_ex.emplace_back(squash(cdiv(input1_ex, levels_exVect[i])));
+      joinedInput_ex.emplace_back(input(cg, { NUM_OF_CATEGORIES }, m4Obj.categories_vect));
+      Expression rnn_ex = rNNStack[0].add_input(concatenate(joinedInput_ex));
+      for (int il=1; il<dilations.size(); il++)
+        rnn_ex=rnn_ex+rNNStack[il].add_input(rnn_ex);
+      Expression out_ex;
+      if (ADD_NL_LAYER) {
+        out_ex=MLPW_ex*rnn_ex+MLPB_ex;
+        out_ex = adapterW_ex*tanh(out_ex)+adapterB_ex;
+      } else 
+        out_ex=adapterW_ex*rnn_ex+adapterB_ex;
+      if (i>=INPUT_SIZE+MIN_INP_SEQ_LEN)
+        losses.push_back(pinBallLoss(out_ex, squash(cdiv(labels1_ex, levels_exVect[i]))));
+    }
+    if (losses.size() == 0)
+      return BIG_FLOAT;
+    Expression loss_ex = average(losses);
+    if (LEVEL_VARIABILITY_PENALTY > 0 && logDiffOfLevels_vect.size() > 1) {
+      vector<Expression> levelVarLoss_v;
+      for (int i = 1; i<logDiffOfLevels_vect.size(); i++) {
+        Expression diff_ex = logDiffOfLevels_vect[i] - logDiffOfLevels_vect[i - 1];
+        levelVarLoss_v.push_back(diff_ex*diff_ex);
+      }
+      loss_ex = loss_ex + average(levelVarLoss_v)*LEVEL_VARIABILITY_PENALTY;
+    }
+    loss = as_scalar(cg.forward(loss_ex));
+    if (istep == COLD_START_STEPS || !isfinite(loss))
+      break;
+    cg.backward(loss_ex);
+    trainer.update();
+  }
+  esValues = esParameterValues(params);
+  return isfinite(loss) ? loss : BIG_FLOAT;
+}
+
+
 // weighted quantile Loss, used just for diagnostics, if if LBACK>0 and PERCENTILE!=50
 float wQuantLoss(vector<float>& out_vect, vector<float>& actuals_vect) {
-  float sumf = 0; float suma=0;
-  for (unsigned int indx = 0; indx<OUTPUT_SIZE; indx++) {
-    auto forec = out_vect[indx];
-    auto actual = actuals_vect[indx];
-    suma+= abs(actual);
-    if (actual > forec)
-      sumf = sumf + (actual - forec)*TAU;
-    else
-      sumf = sumf + (actual - forec)*(TAU - 1);
-  }
-  return sumf / suma * 200;
+  return wQuantLoss(out_vect.data(), actuals_vect.data(), OUTPUT_SIZE, TAU);
 }
 
 //used just for diagnostics, if LBACK>0 and PERCENTILE==50
 float sMAPE(vector<float>& out_vect, vector<float>& actuals_vect) {
-  float sumf = 0;
-  for (unsigned int indx = 0; indx<OUTPUT_SIZE; indx++) {
-    auto forec = out_vect[indx];
-    auto actual = actuals_vect[indx];
-    sumf+=abs(forec-actual)/(abs(forec)+abs(actual));
-  }
-  return sumf / OUTPUT_SIZE * 200;
+  return sMAPE(out_vect.data(), actuals_vect.data(), OUTPUT_SIZE);
 }
 
 float errorFunc(vector<float>& out_vect, vector<float>& actuals_vect) {
@@ -445,13 +971,61 @@ float errorFunc(vector<float>& out_vect, vector<float>& actuals_vect) {
     return wQuantLoss(out_vect, actuals_vect);
 }
 
+//bytes currently used by the Dynet memory pools of the computation graph (forward and backward)
+size_t graphPoolsUsed() {
+  return default_device->pools[(int)DeviceMempool::FXS]->used() + default_device->pools[(int)DeviceMempool::DEDFS]->used();
+}
+
 int main(int argc, char** argv) {
+  mpiInit(argc, argv);
+  placeProcess(BLAS_THREADS, PIN_TO_CORES); //before Dynet allocates its memory
+#if defined BENCHMARK_MODE
+  DynetParams dynetParams = extract_dynet_params(argc, argv);
+  if (dynetParams.random_seed == 0)
+    dynetParams.random_seed = BENCH_SEED;
+  dynet::initialize(dynetParams);
+#else
   dynet::initialize(argc, argv);
+#endif
 
   int ibigOffset = 0;
-  if (argc == 2)
-    ibigOffset = atoi(argv[1]);
+  bool forecastOnly = false; //see model_artifact.h
+  string updatePath; //--update, see online_state.h
+  string coldStartPath; //--cold-start, see fitColdStart()
+  string servePath; //--serve, see serving.h
+  string modelDir; //--model-dir: the output directory of the training run that exported the model
+  for (int iarg = 1; iarg < argc; iarg++) {
+    if (string(argv[iarg]) == "--forecast-only")
+      forecastOnly = true;
+    else if (string(argv[iarg]) == "--update" && iarg + 1 < argc) {
+      forecastOnly = true;
+      updatePath = argv[++iarg];
+    } else if (string(argv[iarg]) == "--cold-start" && iarg + 1 < argc) {
+      forecastOnly = true;
+      coldStartPath = argv[++iarg];
+    } else if (string(argv[iarg]) == "--serve" && iarg + 1 < argc) {
+      forecastOnly = true;
+      servePath = argv[++iarg];
+    } else if (string(argv[iarg]) == "--model-dir" && iarg + 1 < argc)
+      modelDir = argv[++iarg];
+    else
+      ibigOffset = atoi(argv[iarg]);
+  }
     
+  if (forecastOnly && modelDir.empty()) {//every run writes into a new, time stamped, directory, so the model of the training run has to be pointed to
+    cerr << "--forecast-only, --update, --cold-start and --serve need --model-dir <output directory of the training run that exported the model>" << endl;
+    exit(-1);
+  }
+  if (STREAM_SHARD_SIZE > 0 && forecastOnly) {
+    cerr << "STREAM_SHARD_SIZE is for training; --forecast-only, --update, --cold-start and --serve need the whole model in memory" << endl;
+    exit(-1);
+  }
+#if defined _WINDOWS
+  if (STREAM_SHARD_SIZE > 0 || !STORE_PATH.empty()) {
+    cerr << "STREAM_SHARD_SIZE and STORE_PATH are not available on Windows" << endl;
+    exit(-1);
+  }
+#endif
   cout << VARIABLE<<" "<<run << " Lback=" << LBACK << endl;
   cout << "ibigOffset:"<< ibigOffset<<endl;
 
@@ -591,10 +1165,35 @@ int main(int argc, char** argv) {
 #endif
    
   random_device rd;     // only used once to initialise (seed) engine
-  mt19937 rng(rd());    // random-number engine used (Mersenne-Twister in this case)
+#if defined BENCHMARK_MODE
+  mt19937 rng(BENCH_SEED);
+  srand(BENCH_SEED); //random_shuffle
+#else
+  mt19937 rng(commonSeed(rd()));    // random-number engine used (Mersenne-Twister in this case). The same on all MPI ranks, they must agree on the series assignments
+#endif
   
   vector<string> series_vect;
   unordered_map<string, M4TS> allSeries_map(30000);//max series in one chunk would be 24k for yearly series
+  SeriesStore seriesStore; //COMPRESS_SERIES: the values of the series of allSeries_map
+  auto keepSeries = [&](const string& series, M4TS& m4Obj) {
+    if (COMPRESS_SERIES) {
+      m4Obj.stored = seriesStore.add(m4Obj.vals, m4Obj.testVals);
+      vector<float>().swap(m4Obj.vals);
+      vector<float>().swap(m4Obj.testVals);
+    }
+    allSeries_map[series] = m4Obj;
+  };
+  //the series with its values: a compressed one is decoded into the scratch series of the thread, valid until its next call
+  auto seriesOf = [&](const string& series) -> const M4TS& {
+    const M4TS& m4Obj = allSeries_map[series];
+    if (m4Obj.stored < 0)
+      return m4Obj;
+    static thread_local M4TS scratch;
+    scratch.categories_vect = m4Obj.categories_vect;
+    scratch.n = m4Obj.n;
+    seriesStore.decode(m4Obj.stored, scratch.vals, scratch.testVals);
+    return scratch;
+  };
   unordered_map<string, string> seriesCategories_map(120000);//100k series
 
   ifstream infoFile(INFO_INPUT_PATH);
@@ -611,29 +1210,111 @@ int main(int argc, char** argv) {
   }
 
 
-  ifstream file (INPUT_PATH);
-  getline(file, line); //header
-  while ( getline ( file, line) ) {
-    stringstream  line_stream(line);
-    string series0;  string series;
-    getline(line_stream, series0, ',' );
-    for (const auto c : series0) {
-      if (!ispunct(c)) {
-        series.push_back(c);
-      }
-    }
+#if !defined _WINDOWS
+  string streamPrefix = OUTPUT_DIR + '/' + VARIABLE + "_" + to_string(ibigOffset) + mpiRankSuffix() + "_stream"; //STREAM_SHARD_SIZE: the shards
+  ShardWriter shardWriter(streamPrefix, max(STREAM_SHARD_SIZE, 1), NUM_OF_NETS, ES_PARAMS_PER_SERIES);
+#endif
+  auto streamOut = [&](const string& series, const M4TS& m4Obj) {//STREAM_SHARD_SIZE: to the shards, instead of allSeries_map
+#if !defined _WINDOWS
+    int category = (int)(max_element(m4Obj.categories_vect.begin(), m4Obj.categories_vect.end()) - m4Obj.categories_vect.begin());
+    shardWriter.add(series, category, m4Obj.vals, m4Obj.testVals);
+#endif
+  };
 
-    string category = seriesCategories_map[series];
-    
-    M4TS m4Obj(category, line_stream);
+  auto addSeries = [&](const string& series, M4TS& m4Obj) {//false when there are enough
     if (m4Obj.n >= MIN_SERIES_LENGTH) {
       series_vect.push_back(series);
-      allSeries_map[series] = m4Obj;
+      if (STREAM_SHARD_SIZE > 0)
+        streamOut(series, m4Obj);
+      else
+        keepSeries(series, m4Obj);
+    }
+    return !(MAX_NUM_OF_SERIES>0 && series_vect.size()>=MAX_NUM_OF_SERIES);
+  };
+
+  if (!STORE_PATH.empty()) {//no parsing: the snapshot is mapped, with the points appended since applied from its log
+#if !defined _WINDOWS
+    IngestedSeries ingested;
+    string storeError;
+    if (!ingested.open(STORE_PATH, false, storeError)) {
+      cerr << storeError << endl;
+      exit(-1);
+    }
+    for (int i = 0; i < ingested.numOfSeries(); i++) {
+      string series = ingested.name(i);
+      M4TS m4Obj(seriesCategories_map[series], ingested.values(i), ingested.length(i));
+      if (!addSeries(series, m4Obj))
+        break;
+    }
+    cout << "read " << STORE_PATH << ", generation " << ingested.generation << ", " << ingested.logRecords << " records of its log" << endl;
+#endif
+  } else {
+    ifstream file (INPUT_PATH);
+    getline(file, line); //header
+    while ( getline ( file, line) ) {
+      stringstream  line_stream(line);
+      string series0;  string series;
+      getline(line_stream, series0, ',' );
+      for (const auto c : series0) {
+        if (!ispunct(c)) {
+          series.push_back(c);
+        }
+      }
+
+      string category = seriesCategories_map[series];
+      
+      M4TS m4Obj(category, line_stream);
+      if (!addSeries(series, m4Obj))
+        break;
+    }
+  }
+  if (!coldStartPath.empty()) {//new series, added to the ones of the training file; those not in the model get fitted
+    ifstream coldStartFile(coldStartPath);
+    if (!coldStartFile) {
+      cerr << "could not open " << coldStartPath << endl;
+      exit(-1);
+    }
+    getline(coldStartFile, line); //header
+    while (getline(coldStartFile, line)) {
+      stringstream  line_stream(line);
+      string series0;  string series;
+      getline(line_stream, series0, ',' );
+      for (const auto c : series0) {
+        if (!ispunct(c)) {
+          series.push_back(c);
+        }
+      }
+      if (allSeries_map.find(series) != allSeries_map.end())
+        continue;
+      auto category = seriesCategories_map.find(series);
+      M4TS m4Obj(category == seriesCategories_map.end() ? "Other" : category->second, line_stream);
+      if (m4Obj.n >= MIN_SERIES_LENGTH) {
+        series_vect.push_back(series);
+        keepSeries(series, m4Obj);
+      }
     }
-    if (MAX_NUM_OF_SERIES>0 && series_vect.size()>=MAX_NUM_OF_SERIES)
-      break;
   }
   cout << "num of series:" << series_vect.size() << endl;
+  if (COMPRESS_SERIES && STREAM_SHARD_SIZE == 0) {
+    seriesStore.shrink();
+    double decodeBegin = nowSecs();
+    for (auto& series : series_vect)
+      seriesOf(series);
+    SeriesStoreStats storeStats = seriesStore.stats();
+    cout << "series store: " << storeStats.numOfValues << " values in " << storeStats.storedBytes / 1e6 << "MB, " << storeStats.rawBytes / 1e6 << "MB as vectors, ratio " << storeStats.ratio()
+      << ", blocks decimal:" << storeStats.decimalBlocks << " XOR:" << storeStats.xorBlocks << ", decode " << storeStats.numOfValues / max(nowSecs() - decodeBegin, 1e-9) / 1e6 << "M values/s" << endl;
+  }
+  int numOfShards = 0;
+  unordered_map<string, int> seriesIndex_map; //STREAM_SHARD_SIZE: series -> index in series_vect; shard k holds the indices [k*STREAM_SHARD_SIZE, (k+1)*STREAM_SHARD_SIZE)
+  auto shardOf = [&](int iseries) { return iseries / max(STREAM_SHARD_SIZE, 1); };
+#if !defined _WINDOWS
+  if (STREAM_SHARD_SIZE > 0) {
+    numOfShards = shardWriter.finish();
+    for (int iseries = 0; iseries < (int)series_vect.size(); iseries++)
+      seriesIndex_map[series_vect[iseries]] = iseries;
+    cout << "streaming from " << numOfShards << " shards " << streamPrefix << "_shard<k>.bin" << endl;
+  }
+#endif
 
   unsigned int series_len=(unsigned int)series_vect.size();
   uniform_int_distribution<int> uniOnSeries(0,series_len-1);  // closed interval [a, b]
@@ -644,9 +1325,21 @@ int main(int argc, char** argv) {
   set<string> diagSeries;
   
   unordered_map<string, array<int, NUM_OF_NETS>> netRanking_map;
+
+#if defined BENCHMARK_MODE
+  BenchmarkReport benchReport;
+  benchReport.open(OUTPUT_DIR + '/' + VARIABLE + "_" + to_string(ibigOffset) + mpiRankSuffix() + "_bench.jsonl", "ES_RNN_E", VARIABLE, run, LSTM_TYPE, series_len);
+#endif
+  MetricsExporter metricsExporter;
+  metricsExporter.open(METRICS_FORMAT, OUTPUT_DIR + '/' + VARIABLE + "_" + to_string(ibigOffset) + mpiRankSuffix() + "_metrics", "ES_RNN_E", VARIABLE);
+  if (TRACE)
+    traceStart(OUTPUT_DIR + '/' + VARIABLE + "_" + to_string(ibigOffset) + mpiRankSuffix() + "_trace.json");
+
   for (int ibig=0; ibig<BIG_LOOP; ibig++) {
   	int ibigDb= ibigOffset+ibig;
     string outputPath = OUTPUT_DIR + '/'+ VARIABLE + "_" + to_string(ibigDb)+"_LB"+ to_string(LBACK)+ ".csv";
+    string modelPath = (forecastOnly ? modelDir : OUTPUT_DIR) + '/'+ VARIABLE + "_" + to_string(ibigDb)+"_LB"+ to_string(LBACK)+ mpiRankSuffix(); //.model, .weights, .state
+    HealthMonitor healthMonitor(HEALTH_MAX_STATE_ABS, HEALTH_STRIKES_TO_QUARANTINE);
     vector<float> perfValid_vect; 
     int epochOfLastChangeOfLRate = -1;
     
@@ -678,10 +1371,16 @@ int main(int argc, char** argv) {
     
     //this is not a history, this is the real stuff
     unordered_map<string, array<AdditionalParams, NUM_OF_NETS>* > additionalParams_mapOfArr((int)series_len*1.5); //per series, per net
-    for (auto iter = series_vect.begin() ; iter != series_vect.end(); ++iter) {
-      string series=*iter;
-      additionalParams_mapOfArr[series]=new array<AdditionalParams, NUM_OF_NETS>();
-    }
+    vector<array<AdditionalParams, NUM_OF_NETS>*> perSeriesParams_vect; //in the order of series_vect; STREAM_SHARD_SIZE: the slots of the series of the current shard, see streamShard
+    if (STREAM_SHARD_SIZE > 0)
+      for (int islot = 0; islot < min(STREAM_SHARD_SIZE, (int)series_len); islot++)
+        perSeriesParams_vect.push_back(new array<AdditionalParams, NUM_OF_NETS>());
+    else
+      for (auto iter = series_vect.begin() ; iter != series_vect.end(); ++iter) {
+        string series=*iter;
+        additionalParams_mapOfArr[series]=new array<AdditionalParams, NUM_OF_NETS>();
+        perSeriesParams_vect.push_back(additionalParams_mapOfArr[series]);
+      }
     
     for (int inet=0; inet<NUM_OF_NETS; inet++) {
       ParameterCollection& pc=paramsCollection_arr[inet];
@@ -714,9 +1413,7 @@ int main(int argc, char** argv) {
   	  adapterW_parArr[inet]=pc.add_parameters({OUTPUT_SIZE, STATE_HSIZE});
   	  adapterB_parArr[inet]=pc.add_parameters({OUTPUT_SIZE});
       
-      for (auto iter = series_vect.begin() ; iter != series_vect.end(); ++iter) {
-        string series=*iter;
-        array<AdditionalParams, NUM_OF_NETS>*  additionalParams_arr=additionalParams_mapOfArr[series];
+      for (auto additionalParams_arr : perSeriesParams_vect) {
         additionalParams_arr->at(inet).levSm=perSeriesPC.add_parameters({1}, 0.5);//per series, per net
         if (SEASONALITY_NUM > 0) {
           additionalParams_arr->at(inet).sSm = perSeriesPC.add_parameters({ 1 }, 0.5);
@@ -733,10 +1430,83 @@ int main(int argc, char** argv) {
     
     //history of params. Series->[NUM_OF_NETS,NUM_OF_TRAIN_EPOCHS]
     unordered_map<string, array<array<AdditionalParamsF, NUM_OF_TRAIN_EPOCHS>, NUM_OF_NETS>*> historyOfAdditionalParams_map((int)series_len*1.5);
+    set<string> streamDiagSeries; //STREAM_SHARD_SIZE: the history is kept only for the series of the diagnostics, picked here
+    if (STREAM_SHARD_SIZE > 0)
+      streamDiagSeries.insert(series_vect[uniOnSeries(rng)]);
     for (auto iter = series_vect.begin() ; iter != series_vect.end(); ++iter) {
       string series=*iter;
-      historyOfAdditionalParams_map[series]=new array<array<AdditionalParamsF, NUM_OF_TRAIN_EPOCHS>, NUM_OF_NETS>();
+      if (STREAM_SHARD_SIZE == 0 || streamDiagSeries.count(series) > 0)
+        historyOfAdditionalParams_map[series]=new array<array<AdditionalParamsF, NUM_OF_TRAIN_EPOCHS>, NUM_OF_NETS>();
     }
+
+#if !defined _WINDOWS
+    Prefetcher<MappedShard> shardPrefetcher(true, [&](int ishard, MappedShard& shard) {//writes back the shard it had, reads in the next one
+      shard.open(shardPath(streamPrefix, ishard), ishard);
+    });
+#endif
+    int streamedNet = -2; //whose parameters are in the slots, -1: of all nets
+    bool streamedTrained = false; //the parameters in the slots have to be written back to the shard
+    array<long, NUM_OF_NETS> perSeriesUpdates; //streaming: updates of the per series parameters of a net, for the bias correction of Adam
+    perSeriesUpdates.fill(0);
+    //STREAM_SHARD_SIZE: makes shard ishard the current one: its series in allSeries_map and additionalParams_mapOfArr, with the parameters of net inet (-1: of all nets, -2: none)
+    //in the slots, after the parameters trained in the previous one have been written back. nextShard (-1: none) is read ahead. Trained: the slots will be written back.
+    auto streamShard = [&](int ishard, int nextShard, int inet, bool trained) {
+#if !defined _WINDOWS
+      MappedShard& current = shardPrefetcher.current;
+      if (streamedTrained && current.index >= 0)
+        for (int i = 0; i < current.numOfSeries(); i++) {
+          vector<float> values = esParameterValues(perSeriesParams_vect[i]->at(streamedNet));
+          copy(values.begin(), values.end(), current.params(streamedNet, i));
+        }
+      MappedShard& shard = current.index == ishard ? current : shardPrefetcher.get(ishard, nextShard);
+      for (int jnet = 0; jnet < NUM_OF_NETS; jnet++)//first use in this ibig run: initialized as by add_parameters({1}, 0.5), uniform in [-0.5,0.5], zero moments
+        if ((jnet == inet || (inet == -1 && ownsNet(jnet))) && shard.header().paramsRun[jnet] != ibigDb) {
+          mt19937 initRng((unsigned)((ibigDb*numOfShards + ishard)*NUM_OF_NETS + jnet));
+          uniform_real_distribution<float> uniOnInit(-0.5f, 0.5f);
+          for (int i = 0; i < shard.numOfSeries(); i++) {
+            float* params = shard.params(jnet, i);
+            for (int ip = 0; ip < ES_PARAMS_PER_SERIES; ip++)
+              params[ip] = uniOnInit(initRng);
+            fill(params + ES_PARAMS_PER_SERIES, params + 3 * ES_PARAMS_PER_SERIES, 0.f);
+          }
+          shard.header().paramsRun[jnet] = ibigDb;
+        }
+      allSeries_map.clear();
+      additionalParams_mapOfArr.clear();
+      for (int i = 0; i < shard.numOfSeries(); i++) {
+        string series = shard.name(i);
+        const ShardSeriesEntry& entry = shard.entry(i);
+        M4TS& m4Obj = allSeries_map[series];
+        m4Obj.categories_vect.assign(NUM_OF_CATEGORIES, 0.f);
+        m4Obj.categories_vect[entry.category] = 1;
+        m4Obj.vals.assign(shard.vals(i), shard.vals(i) + entry.n);
+        m4Obj.testVals.assign(shard.testVals(i), shard.testVals(i) + entry.numOfTestVals);
+        m4Obj.n = (int)entry.n;
+        additionalParams_mapOfArr[series] = perSeriesParams_vect[i];
+        for (int jnet = 0; jnet < NUM_OF_NETS; jnet++)
+          if (jnet == inet || (inet == -1 && ownsNet(jnet)))
+            setEsParameterValues(perSeriesParams_vect[i]->at(jnet), vector<float>(shard.params(jnet, i), shard.params(jnet, i) + ES_PARAMS_PER_SERIES));
+      }
+      streamedNet = inet;
+      streamedTrained = trained;
+#endif
+    };
+    //STREAM_SHARD_SIZE, in a pass over series_vect: at the first series of a shard, makes it current and reads ahead the next one
+    auto streamInOrder = [&](int iseries, int inet) {
+      if (STREAM_SHARD_SIZE > 0 && iseries % max(STREAM_SHARD_SIZE, 1) == 0) {
+        int ishard = shardOf(iseries);
+        streamShard(ishard, ishard + 1 < numOfShards ? ishard + 1 : -1, inet, false);
+      }
+    };
+    //STREAM_SHARD_SIZE: Adam moments of a series of the current shard in net inet, m then v
+    auto streamedMoments = [&](const string& series, int inet) -> float* {
+#if !defined _WINDOWS
+      MappedShard& current = shardPrefetcher.current;
+      return current.params(inet, seriesIndex_map.at(series) - current.index*max(STREAM_SHARD_SIZE, 1)) + ES_PARAMS_PER_SERIES;
+#else
+      return NULL;
+#endif
+    };
     
     //first assignment. Yes, we are using vector , so the very first time the duplicates are possible. But a set can't be sorted
     array<vector<string>, NUM_OF_NETS> seriesAssignment;//every net has an array
@@ -746,17 +1516,262 @@ int main(int argc, char** argv) {
         seriesAssignment[inet].push_back(series_vect[i]);
       }
     
+#if !defined _WINDOWS
+    ForecastCache forecastCache; //--forecast-only with FORECAST_CACHE_ENTRIES
+    uint64_t cacheModelKey = 0;
+    unordered_map<string, uint64_t> cacheKeys; //series forecast in this run -> its key
+#endif
+    unordered_map<string, vector<float>> cachedForecasts; //series -> forecast from the cache
+    if (forecastOnly) {//the trained model instead of training
+      ModelArtifact artifact;
+      string error;
+      if (!artifact.load(modelPath + ".model", modelConfig(), error)) {
+        cerr << error << endl;
+        exit(-1);
+      }
+      TextFileLoader weightsLoader(modelPath + ".weights");
+      for (int inet=0; inet<NUM_OF_NETS; inet++)
+        if (ownsNet(inet))
+          weightsLoader.populate(paramsCollection_arr[inet], "/net" + to_string(inet));
+      netRanking_map.clear();
+      finalResults_map.clear();
+      int numOfMissing = 0;
+      vector<string> coldSeries;
+      for (auto iter = series_vect.begin() ; iter != series_vect.end(); ++iter) {
+        string series=*iter;
+        auto esParams = artifact.esParams.find(series);
+        auto ranking = artifact.rankings.find(series);
+        bool fits = esParams != artifact.esParams.end() && ranking != artifact.rankings.end() && ranking->second.size() == NUM_OF_NETS;
+        for (int inet=0; fits && inet<NUM_OF_NETS; inet++)
+          if (ownsNet(inet))
+            fits = esParams->second.count(inet) > 0 && setEsParameterValues(additionalParams_mapOfArr[series]->at(inet), esParams->second.at(inet));
+        if (!fits && !coldStartPath.empty()) {//ranked after the fit, below
+          coldSeries.push_back(series);
+          continue;
+        } else if (!fits) {
+          if (numOfMissing++ < 10)
+            cerr << "series " << series << " is not in the model, skipped" << endl;
+          continue;
+        }
+        copy(ranking->second.begin(), ranking->second.end(), netRanking_map[series].begin());
+      }
+      if (numOfMissing > 0)
+        cerr << numOfMissing << " series not in the model " << modelPath << ".model" << endl;
+
+      if (coldSeries.size() > 0) {//ES parameters of the series not in the model, fitted in every net, which are then ranked by the fitted losses
+        double coldStartBegin = nowSecs();
+        vector<pair<int, int>> pairs; //series index, net
+        for (int iseries = 0; iseries < coldSeries.size(); iseries++)
+          for (int inet=0; inet<NUM_OF_NETS; inet++)
+            if (ownsNet(inet))
+              pairs.push_back(make_pair(iseries, inet));
+        const int recordSize = 1 + ES_PARAMS_PER_SERIES;
+        ColdStartFit coldStartFit; //before the fork, so every worker gets a copy
+#if defined _WINDOWS
+        vector<float> records(pairs.size()*recordSize); //[pair]: loss, fitted values
+#else
+        SharedArray<float> records(pairs.size()*recordSize); //[pair]: loss, fitted values, written by the worker of the pair
+#endif
+        auto fitPair = [&](int ipair) {
+          int inet = pairs[ipair].second;
+          vector<float> esValues;
+          float* record = &records[(size_t)ipair*recordSize];
+          record[0] = fitColdStart(seriesOf(coldSeries[pairs[ipair].first]), coldStartFit, esValues, rnnStack_arr[inet],
+            MLPW_parArr[inet], MLPB_parArr[inet], adapterW_parArr[inet], adapterB_parArr[inet]);
+          copy(esValues.begin(), esValues.end(), record + 1);
+        };
+#if defined _WINDOWS
+        for (int ipair = 0; ipair < pairs.size(); ipair++)
+          fitPair(ipair);
+#else
+        ForkedWorkers coldStartWorkers(COLD_START_WORKERS, 0, 0);
+        Metrics coldStartMetrics;
+        coldStartWorkers.start();
+        for (int ipair = coldStartWorkers.next(); ipair < (int)pairs.size(); ipair = coldStartWorkers.next())
+          fitPair(ipair);
+        coldStartWorkers.join({}, coldStartMetrics); //the workers exit here
+#endif
+        unordered_map<string, array<float, NUM_OF_NETS>> coldPerf_map;
+        for (auto& series : coldSeries)
+          coldPerf_map[series].fill(BIG_FLOAT);
+        for (size_t ipair = 0; ipair < pairs.size(); ipair++) {
+          const float* record = &records[ipair*recordSize];
+          string& series = coldSeries[pairs[ipair].first];
+          coldPerf_map[series][pairs[ipair].second] = record[0];
+          setEsParameterValues(additionalParams_mapOfArr[series]->at(pairs[ipair].second), vector<float>(record + 1, record + recordSize));
+        }
+        allMinNetPerf(coldSeries, coldPerf_map, BIG_FLOAT); //USE_MPI: every rank ranks all nets
+        for (auto& series : coldSeries)
+          netRanking_map[series] = perfToRanking(coldPerf_map[series]);
+        cout << "cold start: " << coldSeries.size() << " series fitted in " << nowSecs() - coldStartBegin << "s" << endl;
+      }
+
+#if !defined _WINDOWS
+      if (FORECAST_CACHE_ENTRIES > 0 && updatePath.empty() && coldStartPath.empty() && servePath.empty() && MpiWorld::instance().size == 1) {
+        //the series found in the cache leave netRanking_map, so the validation loop skips them
+        cacheModelKey = hashBytes("ES_RNN_E", 8);
+        uint64_t modelHash = fileHash(modelPath + ".model"), weightsHash = fileHash(modelPath + ".weights");
+        cacheModelKey = hashBytes(&modelHash, sizeof(modelHash), cacheModelKey);
+        cacheModelKey = hashBytes(&weightsHash, sizeof(weightsHash), cacheModelKey);
+        if (!forecastCache.open(modelPath + ".cache", FORECAST_CACHE_ENTRIES, OUTPUT_SIZE, error))
+          cerr << error << ", forecasting without it" << endl;
+        else
+          for (auto iter = netRanking_map.begin(); iter != netRanking_map.end(); ) {
+            const M4TS& m4Obj = seriesOf(iter->first);
+            uint64_t key = seriesKey(iter->first, m4Obj.categories_vect.data(), NUM_OF_CATEGORIES, m4Obj.vals.data(), (int)m4Obj.vals.size());
+            vector<float> forec(OUTPUT_SIZE);
+            if (forecastCache.find(cacheModelKey, key, forec.data())) {
+              cachedForecasts[iter->first] = forec;
+              iter = netRanking_map.erase(iter);
+            } else {
+              cacheKeys[iter->first] = key;
+              ++iter;
+            }
+          }
+      }
+#endif
+
+      if (!updatePath.empty()) {//the new points, through the online state; the forecasts go where the validation would put them
+        OnlineStates onlineStates;
+        if (!loadOnlineStates(modelPath + ".state", onlineStates, error)) {
+          cerr << error << " (the training run needs EXPORT_MODEL and ONLINE_STATE)" << endl;
+          exit(-1);
+        }
+        auto newPoints = readNewPoints(updatePath);
+        for (auto& seriesStates : onlineStates) {
+          auto points = newPoints.find(seriesStates.first);
+          for (auto& netState : seriesStates.second) {
+            int inet = netState.first;
+            if (!ownsNet(inet))
+              continue;
+            testResults_map[seriesStates.first][inet][0] = updateOnlineState(netState.second, points == newPoints.end() ? vector<float>() : points->second,
+              rnnStack_arr[inet], MLPW_parArr[inet], MLPB_parArr[inet], adapterW_parArr[inet], adapterB_parArr[inet]);
+          }
+        }
+        if (!saveOnlineStates(modelPath + ".state", onlineStates))
+          cerr << "could not save the online state to " << modelPath << ".state" << endl;
+      }
+
+      if (!servePath.empty()) {//serves until a shutdown request, then saves the state and exits
+#if defined _WINDOWS
+        cerr << "--serve is not available on Windows" << endl;
+        exit(-1);
+#else
+        if (MpiWorld::instance().size > 1) {
+          cerr << "--serve needs all nets in one process, run it without mpirun" << endl;
+          exit(-1);
+        }
+        OnlineStates onlineStates;
+        if (!loadOnlineStates(modelPath + ".state", onlineStates, error)) {
+          cerr << error << " (the training run needs EXPORT_MODEL and ONLINE_STATE)" << endl;
+          exit(-1);
+        }
+        RequestQueue requestQueue;
+        UnixSocketServer server;
+        server.start(servePath, requestQueue);
+        cout << "serving " << onlineStates.size() << " series on " << servePath << endl;
+        long numOfRequests = 0, numOfBatches = 0;
+        bool shuttingDown = false;
+        vector<ServeRequest> batch;
+        while (!shuttingDown) {
+          if (batch.empty())
+            batch = requestQueue.nextBatch(SERVE_MAX_BATCH, SERVE_BATCH_WINDOW_MS / 1000);
+          numOfBatches++;
+          //The updates of a round are applied before its replies, so an update of a series that already has a request in this round waits for the next round,
+          //and so do all the later requests of that series: every request sees the points sent before it, and only those. A shutdown waits for the deferred requests.
+          vector<ServeRequest> current, deferred;
+          set<string> currentSeries, deferredSeries;
+          for (auto& request : batch) {
+            bool perSeries = request.kind == ServeRequest::FORECAST || request.kind == ServeRequest::UPDATE;
+            bool defer = perSeries ? deferredSeries.count(request.series) > 0 || (request.kind == ServeRequest::UPDATE && currentSeries.count(request.series) > 0)
+              : request.kind == ServeRequest::SHUTDOWN && !deferred.empty();
+            if (defer) {
+              if (perSeries)
+                deferredSeries.insert(request.series);
+              deferred.push_back(move(request));
+            } else {
+              if (perSeries)
+                currentSeries.insert(request.series);
+              current.push_back(move(request));
+            }
+          }
+          batch = move(deferred);
+
+          array<vector<OnlineSeriesState*>, NUM_OF_NETS> netStates;
+          array<vector<const vector<float>*>, NUM_OF_NETS> netValues;
+          for (auto& request : current) {
+            auto states = onlineStates.find(request.series);
+            if (request.kind != ServeRequest::UPDATE || states == onlineStates.end())
+              continue;
+            for (auto& netState : states->second) {
+              netStates[netState.first].push_back(&netState.second);
+              netValues[netState.first].push_back(&request.values);
+            }
+          }
+          for (int inet=0; inet<NUM_OF_NETS; inet++)
+            if (netStates[inet].size() > 0)
+              updateOnlineStates(netStates[inet], netValues[inet], rnnStack_arr[inet], MLPW_parArr[inet], MLPB_parArr[inet], adapterW_parArr[inet], adapterB_parArr[inet]);
+
+          for (auto& request : current) {//the average of the top nets, as in the output file
+            numOfRequests++;
+            if (request.kind == ServeRequest::SHUTDOWN) {
+              shuttingDown = true;
+              sendLine(*request.connection, "ok");
+              continue;
+            }
+            auto states = onlineStates.find(request.series);
+            auto ranking = netRanking_map.find(request.series);
+            if (request.kind == ServeRequest::INVALID || states == onlineStates.end() || ranking == netRanking_map.end()) {
+              sendLine(*request.connection, request.kind == ServeRequest::INVALID ? "error bad request" : "error unknown series " + request.series);
+              continue;
+            }
+            vector<float> forec(OUTPUT_SIZE, 0);
+            bool complete = true;
+            for (int itop=0; itop<TOPN && complete; itop++) {
+              auto netState = states->second.find(ranking->second[itop]);
+              complete = netState != states->second.end() && netState->second.forecast.size() == OUTPUT_SIZE;
+              for (int iii=0; complete && iii<OUTPUT_SIZE; iii++)
+                forec[iii] += netState->second.forecast[iii] / TOPN;
+            }
+            if (!complete) {
+              sendLine(*request.connection, "error series shorter than the input window " + request.series);
+              continue;
+            }
+            ostringstream reply;
+            reply << "ok " << request.series;
+            for (float value : forec)
+              reply << " " << value;
+            sendLine(*request.connection, reply.str());
+          }
+        }
+        server.stop();
+        cout << "served " << numOfRequests << " requests in " << numOfBatches << " batches" << endl;
+        if (!saveOnlineStates(modelPath + ".state", onlineStates))
+          cerr << "could not save the online state to " << modelPath << ".state" << endl;
+        traceFinish();
+        mpiFinalize();
+        return 0;
+#endif
+      }
+    }
+    
     //nesting: ibig
-    for (int iEpoch=0; iEpoch<NUM_OF_TRAIN_EPOCHS; iEpoch++) {
+    for (int iEpoch=0; iEpoch<NUM_OF_EPOCHS_TO_RUN; iEpoch++) {
+      Metrics epochMetrics;
+      TraceSpan epochSpan("epoch");
+      size_t epochPoolHighWaterMark = 0;
       #if defined USE_ODBC
         TRYODBC(hInsertStmt,
         SQL_HANDLE_STMT,
         SQLBindParameter(hInsertStmt, 5, SQL_PARAM_INPUT, SQL_C_SLONG, SQL_INTEGER, 0, 0, (SQLPOINTER)&iEpoch, 0, NULL));
       #endif
     
-      clock_t begin_time = clock();
+      double begin_time = nowSecs();
       unordered_map<string, array<float, NUM_OF_NETS>> netPerf_map;
       for (int inet=0; inet<NUM_OF_NETS; inet++) {  //Parellalize here, if you can :-)
+        if (!ownsNet(inet) || forecastOnly) //USE_MPI: trained by another rank
+          continue;
+        TraceSpan netSpan("net epoch", inet);
         //initialize perf matrix
         for (auto iter = series_vect.begin() ; iter != series_vect.end(); ++iter) {
           string series=*iter;
@@ -783,336 +1798,492 @@ int main(int argc, char** argv) {
         
         vector<string> oneNetAssignments=seriesAssignment[inet];
         random_shuffle (oneNetAssignments.begin(), oneNetAssignments.end());
+        if (STREAM_SHARD_SIZE > 0) {//grouped by shard, the shards in random order
+          vector<int> shardRank(numOfShards);
+          iota(shardRank.begin(), shardRank.end(), 0);
+          random_shuffle(shardRank.begin(), shardRank.end());
+          stable_sort(oneNetAssignments.begin(), oneNetAssignments.end(), [&](const string& a, const string& b) {
+            return shardRank[shardOf(seriesIndex_map.at(a))] < shardRank[shardOf(seriesIndex_map.at(b))];
+          });
+        }
+        array<AdditionalParamsF, NUM_OF_TRAIN_EPOCHS> unkeptHistory; //STREAM_SHARD_SIZE: of the series not diagnosed
         
         vector<float> epochLosses;
         vector<float> forecLosses; vector<float> levVarLosses; vector<float> stateLosses;
         for (auto iter = oneNetAssignments.begin() ; iter != oneNetAssignments.end(); ++iter) {
           string series=*iter;
-          auto m4Obj=allSeries_map[series];
-        
-          ComputationGraph cg;
-          for (int il=0; il<dilations.size(); il++) {
-            rNNStack[il].new_graph(cg);
-            rNNStack[il].start_new_sequence(); 
+          if (STREAM_SHARD_SIZE > 0 && (streamedNet != inet || allSeries_map.count(series) == 0)) {//the first series of the next shard
+            int ishard = shardOf(seriesIndex_map.at(series));
+            auto next = find_if(iter, oneNetAssignments.end(), [&](const string& s) { return shardOf(seriesIndex_map.at(s)) != ishard; });
+            streamShard(ishard, next == oneNetAssignments.end() ? -1 : shardOf(seriesIndex_map.at(*next)), inet, true);
           }
-          
+          const M4TS& m4Obj=seriesOf(series);
+          if (healthMonitor.isQuarantined(series))
+            continue;
+        
+          double phaseStart = nowSecs();
           AdditionalParams& additionalParams=additionalParams_mapOfArr[series]->at(inet);
-          array<AdditionalParamsF, NUM_OF_TRAIN_EPOCHS>& historyOfAdditionalParams_arr=historyOfAdditionalParams_map[series]->at(inet);
-
-					Expression MLPW_ex,MLPB_ex;
-          if (ADD_NL_LAYER)  {
-            MLPW_ex = parameter(cg, MLPW_par);
-            MLPB_ex = parameter(cg, MLPB_par);
-          }
-          Expression adapterW_ex=parameter(cg, adapterW_par);
-          Expression adapterB_ex=parameter(cg, adapterB_par);
+          auto history = historyOfAdditionalParams_map.find(series); //STREAM_SHARD_SIZE: only of the diagnosed series
+          array<AdditionalParamsF, NUM_OF_TRAIN_EPOCHS>& historyOfAdditionalParams_arr = history != historyOfAdditionalParams_map.end() ? history->second->at(inet) : unkeptHistory;
+          AdditionalParamsF histAdditionalParams;
 
-          Expression levSmSerNet0_ex= parameter(cg, additionalParams.levSm);
-          Expression levSm_ex = logistic(levSmSerNet0_ex);
+          //Steps of the RNN (forecast windows) i=INPUT_SIZE-1..n-OUTPUT_SIZE-1, in segments of TBPTT_WINDOW (or CHECKPOINT_EVERY) steps, each with its own graph.
+          //A segment starts from the ES level and seasonality factors, and the RNN states, at the end of the previous one, as constants. Its ES recursion starts at the first point
+          //of its first input window, so consecutive segments overlap by INPUT_SIZE+OUTPUT_SIZE-1 points. With neither, or a short series, there is one segment: the whole series.
+          //Truncated BPTT: a pass per segment, forward, backward and update.
+          //Checkpointing: forward passes through all segments but the last, saving only the states at their starts, then backward passes from the last segment to the first.
+          //A backward pass adds to the segment's loss the dot product of its end state with the gradient the next segment got for it, and passes the gradient of its own start state on.
+          //The gradients of all segments add up to the gradient of the whole series, which is applied once.
+          const int pastLastStep = m4Obj.n - OUTPUT_SIZE;
+          const int stepsPerSegment = TBPTT_WINDOW > 0 ? TBPTT_WINDOW : CHECKPOINT_EVERY > 0 ? CHECKPOINT_EVERY : pastLastStep;
+          const int numOfSegments = (pastLastStep - (INPUT_SIZE - 1) + stepsPerSegment - 1) / stepsPerSegment;
+          const int numOfPasses = CHECKPOINT_EVERY > 0 ? 2 * numOfSegments - 1 : numOfSegments;
+          const unsigned noiseSeed = (unsigned)hash<string>()(series) + 7919u * (unsigned)((ibig*NUM_OF_EPOCHS_TO_RUN + iEpoch)*NUM_OF_NETS + inet);
+          vector<CarriedState> carried(numOfSegments); //[segment]
+          float seriesLoss = 0, seriesForecLoss = 0, seriesLevVarLoss = 0, seriesStateLoss = 0;
+          int numOfSegmentsDone = 0;
+          bool passOk = true;
+          for (int ipass = 0; ipass < numOfPasses && passOk; ipass++) {
+            const bool backwardPass = ipass >= numOfPasses - numOfSegments;
+            const int iseg = (CHECKPOINT_EVERY > 0 && backwardPass) ? numOfPasses - 1 - ipass : ipass;
+            const int iFirst = INPUT_SIZE - 1 + iseg*stepsPerSegment;
+            const int iPastLast = min(iFirst + stepsPerSegment, pastLastStep);
+            const bool firstSegment = iFirst == INPUT_SIZE - 1;
+            const bool lastSegment = iPastLast == pastLastStep;
+            const int esFirst = firstSegment ? 1 : iFirst + 1 - INPUT_SIZE; //first point of the ES recursion
+            const int esPastLast = lastSegment ? (int)m4Obj.vals.size() : iPastLast + OUTPUT_SIZE;
+            const int nextEsFirst = iPastLast + 1 - INPUT_SIZE;
+            if (ipass > 0)
+              phaseStart = nowSecs();
+            ComputationGraph cg;
+            vector<Expression> carriedIn_exVect; //inputs taken from carried[iseg].values
+            size_t carriedPos = 0;
+            auto carriedInput = [&](unsigned dim) {
+              auto first = carried[iseg].values.begin() + carriedPos;
+              carriedPos += dim;
+              carriedIn_exVect.push_back(input(cg, { dim }, vector<float>(first, first + dim)));
+              return carriedIn_exVect.back();
+            };
+            for (int il=0; il<dilations.size(); il++) {
+              rNNStack[il].new_graph(cg);
+              rNNStack[il].start_new_sequence(); 
+              if (!firstSegment) {
+                vector<vector<Expression>> h_hist, c_hist;
+                for (int it = 0; it < carried[iseg].rnnSteps[il]; it++) {
+                  h_hist.push_back(vector<Expression>());
+                  c_hist.push_back(vector<Expression>());
+                  for (int layer = 0; layer < dilations[il].size(); layer++) {
+                    h_hist.back().push_back(carriedInput(STATE_HSIZE));
+                    c_hist.back().push_back(carriedInput(STATE_HSIZE));
+                  }
+                }
+                rNNStack[il].continue_sequence(h_hist, c_hist);
+              }
+            }
+          
 
-          vector<Expression> season_exVect;//vector, because we do not know how long the series is
-          Expression sSm_ex;
-          if (SEASONALITY_NUM > 0) {
-            Expression sSmSerNet0_ex= parameter(cg, additionalParams.sSm);
-            sSm_ex = logistic(sSmSerNet0_ex);
-            
-            for (int isea = 0; isea<SEASONALITY; isea++) {
-              Expression sSerNet0 = parameter(cg, additionalParams.initSeasonality[isea]);  //per series, per net
-              Expression s1_ex = exp(sSerNet0);
-              season_exVect.push_back(s1_ex);//Expression is a simple struct, without any storage management, so the auto copy constructor works OK.            
+  					Expression MLPW_ex,MLPB_ex;
+            if (ADD_NL_LAYER)  {
+              MLPW_ex = parameter(cg, MLPW_par);
+              MLPB_ex = parameter(cg, MLPB_par);
             }
-            season_exVect.push_back(season_exVect[0]);
-          }
+            Expression adapterW_ex=parameter(cg, adapterW_par);
+            Expression adapterB_ex=parameter(cg, adapterB_par);
 
-          vector<Expression> season2_exVect;//vector, because we do not know how long the series is
-          Expression sSm2_ex;
-          if (SEASONALITY_NUM > 1) {
-            Expression sSm2SerNet0_ex= parameter(cg, additionalParams.sSm2);
-            sSm2_ex = logistic(sSm2SerNet0_ex);
+            Expression levSmSerNet0_ex= parameter(cg, additionalParams.levSm);
+            Expression levSm_ex = logistic(levSmSerNet0_ex);
+
+            vector<Expression> season_exVect;//vector, because we do not know how long the series is
+            Expression sSm_ex;
+            if (SEASONALITY_NUM > 0) {
+              Expression sSmSerNet0_ex= parameter(cg, additionalParams.sSm);
+              sSm_ex = logistic(sSmSerNet0_ex);
             
-            for (int isea = 0; isea<SEASONALITY2; isea++) {
-              Expression sSer2Net0 = parameter(cg, additionalParams.initSeasonality2[isea]);  //per series, per net
-              Expression s2_ex = exp(sSer2Net0);
-              season2_exVect.push_back(s2_ex);//Expression is a simple struct, without any storage management, so the auto copy constructor works OK.            
+              if (firstSegment) {
+                for (int isea = 0; isea<SEASONALITY; isea++) {
+                  Expression sSerNet0 = parameter(cg, additionalParams.initSeasonality[isea]);  //per series, per net
+                  Expression s1_ex = exp(sSerNet0);
+                  season_exVect.push_back(s1_ex);//Expression is a simple struct, without any storage management, so the auto copy constructor works OK.            
+                }
+                season_exVect.push_back(season_exVect[0]);
+              } else {//seasonality factors of points esFirst..esFirst+SEASONALITY-1, from the previous segment
+                season_exVect.resize(esFirst);
+                for (int isea = 0; isea<SEASONALITY; isea++)
+                  season_exVect.push_back(carriedInput(1));
+              }
             }
-            season2_exVect.push_back(season2_exVect[0]);
-          }
 
-		      vector<Expression> logDiffOfLevels_vect;
-          vector<Expression> levels_exVect;
-          if (SEASONALITY_NUM == 0) {
-            levels_exVect.push_back(input(cg, m4Obj.vals[0]));
-            for (int i = 1; i<m4Obj.vals.size(); i++) {
-              Expression newLevel_ex = levSm_ex*m4Obj.vals[i] + (1 - levSm_ex)*levels_exVect[i - 1];
-              levels_exVect.push_back(newLevel_ex);
+            vector<Expression> season2_exVect;//vector, because we do not know how long the series is
+            Expression sSm2_ex;
+            if (SEASONALITY_NUM > 1) {
+              Expression sSm2SerNet0_ex= parameter(cg, additionalParams.sSm2);
+              sSm2_ex = logistic(sSm2SerNet0_ex);
+            
+              if (firstSegment) {
+                for (int isea = 0; isea<SEASONALITY2; isea++) {
+                  Expression sSer2Net0 = parameter(cg, additionalParams.initSeasonality2[isea]);  //per series, per net
+                  Expression s2_ex = exp(sSer2Net0);
+                  season2_exVect.push_back(s2_ex);//Expression is a simple struct, without any storage management, so the auto copy constructor works OK.            
+                }
+                season2_exVect.push_back(season2_exVect[0]);
+              } else {
+                season2_exVect.resize(esFirst);
+                for (int isea = 0; isea<SEASONALITY2; isea++)
+                  season2_exVect.push_back(carriedInput(1));
+              }
             }
-          }
-          else if (SEASONALITY_NUM == 1) {
-            Expression lev = cdiv(input(cg, m4Obj.vals[0]), season_exVect[0]);
-            levels_exVect.push_back(lev);
-            for (int i = 1; i<m4Obj.vals.size(); i++) {//Exponential Smoothing-style deseasonalization and smoothing
-              Expression newLevel_ex = m4Obj.vals[i] * cdiv(levSm_ex, season_exVect[i]) + (1 - levSm_ex)*levels_exVect[i - 1];
-              levels_exVect.push_back(newLevel_ex);
-              Expression diff_ex = log(cdiv(newLevel_ex, levels_exVect[i - 1]));//penalty for wiggliness of level
-              logDiffOfLevels_vect.push_back(diff_ex);
 
-              Expression newSeason_ex = m4Obj.vals[i] * cdiv(sSm_ex, newLevel_ex) + (1 - sSm_ex)*season_exVect[i];
-              season_exVect.push_back(newSeason_ex);
+  		      vector<Expression> logDiffOfLevels_vect;
+            vector<Expression> levels_exVect;
+            if (!firstSegment) {//level of point esFirst-1, from the previous segment
+              levels_exVect.resize(esFirst - 1);
+              levels_exVect.push_back(carriedInput(1));
+              if (SEASONALITY_NUM > 0)
+                logDiffOfLevels_vect.push_back(carriedInput(1));
             }
-
-            //if prediction horizon is larger than seasonality, so we need to repeat some of the seasonality factors
-            if (OUTPUT_SIZE>SEASONALITY) {
-              unsigned long startSeasonalityIndx = season_exVect.size() - SEASONALITY;
-              for (int i = 0; i<(OUTPUT_SIZE - SEASONALITY); i++)
-                season_exVect.push_back(season_exVect[startSeasonalityIndx + i]);
+            if (SEASONALITY_NUM == 0) {
+              if (firstSegment)
+                levels_exVect.push_back(input(cg, m4Obj.vals[0]));
+              for (int i = esFirst; i<esPastLast; i++) {
+                Expression newLevel_ex = levSm_ex*m4Obj.vals[i] + (1 - levSm_ex)*levels_exVect[i - 1];
+                levels_exVect.push_back(newLevel_ex);
+              }
             }
-          }
-          else if (SEASONALITY_NUM == 2) {
-            Expression lev = cdiv(input(cg, m4Obj.vals[0]), season_exVect[0] * season2_exVect[0]);
-            levels_exVect.push_back(lev);
-            for (int i = 1; i<m4Obj.vals.size(); i++) {
-              Expression newLevel_ex = m4Obj.vals[i] * cdiv(levSm_ex, season_exVect[i] * season2_exVect[i]) + (1 - levSm_ex)*levels_exVect[i - 1];
-              levels_exVect.push_back(newLevel_ex);
-              Expression diff_ex = log(cdiv(newLevel_ex, levels_exVect[i - 1]));
-              logDiffOfLevels_vect.push_back(diff_ex);
+            else if (SEASONALITY_NUM == 1) {
+              if (firstSegment) {
+                Expression lev = cdiv(input(cg, m4Obj.vals[0]), season_exVect[0]);
+                levels_exVect.push_back(lev);
+              }
+              for (int i = esFirst; i<esPastLast; i++) {//Exponential Smoothing-style deseasonalization and smoothing
+                Expression newLevel_ex = m4Obj.vals[i] * cdiv(levSm_ex, season_exVect[i]) + (1 - levSm_ex)*levels_exVect[i - 1];
+                levels_exVect.push_back(newLevel_ex);
+                Expression diff_ex = log(cdiv(newLevel_ex, levels_exVect[i - 1]));//penalty for wiggliness of level
+                logDiffOfLevels_vect.push_back(diff_ex);
+
+                Expression newSeason_ex = m4Obj.vals[i] * cdiv(sSm_ex, newLevel_ex) + (1 - sSm_ex)*season_exVect[i];
+                season_exVect.push_back(newSeason_ex);
+              }
 
-              Expression newSeason_ex = m4Obj.vals[i] * cdiv(sSm_ex, newLevel_ex*season2_exVect[i]) + (1 - sSm_ex)*season_exVect[i];
-              season_exVect.push_back(newSeason_ex);
-              Expression newSeason2_ex = m4Obj.vals[i] * cdiv(sSm2_ex, newLevel_ex*season_exVect[i]) + (1 - sSm2_ex)*season2_exVect[i];
-              season2_exVect.push_back(newSeason2_ex);
+              //if prediction horizon is larger than seasonality, so we need to repeat some of the seasonality factors
+              if (OUTPUT_SIZE>SEASONALITY) {
+                unsigned long startSeasonalityIndx = season_exVect.size() - SEASONALITY;
+                for (int i = 0; i<(OUTPUT_SIZE - SEASONALITY); i++)
+                  season_exVect.push_back(season_exVect[startSeasonalityIndx + i]);
+              }
             }
+            else if (SEASONALITY_NUM == 2) {
+              if (firstSegment) {
+                Expression lev = cdiv(input(cg, m4Obj.vals[0]), season_exVect[0] * season2_exVect[0]);
+                levels_exVect.push_back(lev);
+              }
+              for (int i = esFirst; i<esPastLast; i++) {
+                Expression newLevel_ex = m4Obj.vals[i] * cdiv(levSm_ex, season_exVect[i] * season2_exVect[i]) + (1 - levSm_ex)*levels_exVect[i - 1];
+                levels_exVect.push_back(newLevel_ex);
+                Expression diff_ex = log(cdiv(newLevel_ex, levels_exVect[i - 1]));
+                logDiffOfLevels_vect.push_back(diff_ex);
+
+                Expression newSeason_ex = m4Obj.vals[i] * cdiv(sSm_ex, newLevel_ex*season2_exVect[i]) + (1 - sSm_ex)*season_exVect[i];
+                season_exVect.push_back(newSeason_ex);
+                Expression newSeason2_ex = m4Obj.vals[i] * cdiv(sSm2_ex, newLevel_ex*season_exVect[i]) + (1 - sSm2_ex)*season2_exVect[i];
+                season2_exVect.push_back(newSeason2_ex);
+              }
 
-            //if prediction horizon is larger than seasonality, so we need to repeat some of the seasonality factors
-            if (OUTPUT_SIZE>SEASONALITY) {
-              unsigned long startSeasonalityIndx = season_exVect.size() - SEASONALITY;
-              for (int i = 0; i<(OUTPUT_SIZE - SEASONALITY); i++)
-                season_exVect.push_back(season_exVect[startSeasonalityIndx + i]);
+              //if prediction horizon is larger than seasonality, so we need to repeat some of the seasonality factors
+              if (OUTPUT_SIZE>SEASONALITY) {
+                unsigned long startSeasonalityIndx = season_exVect.size() - SEASONALITY;
+                for (int i = 0; i<(OUTPUT_SIZE - SEASONALITY); i++)
+                  season_exVect.push_back(season_exVect[startSeasonalityIndx + i]);
+              }
+              //if prediction horizon is larger than seasonality, so we need to repeat some of the seasonality factors
+              if (OUTPUT_SIZE>SEASONALITY2) {
+                unsigned long startSeasonalityIndx = season2_exVect.size() - SEASONALITY2;
+                for (int i = 0; i<(OUTPUT_SIZE - SEASONALITY2); i++)
+                  season2_exVect.push_back(season2_exVect[startSeasonalityIndx + i]);
+              }
             }
-            //if prediction horizon is larger than seasonality, so we need to repeat some of the seasonality factors
-            if (OUTPUT_SIZE>SEASONALITY2) {
-              unsigned long startSeasonalityIndx = season2_exVect.size() - SEASONALITY2;
-              for (int i = 0; i<(OUTPUT_SIZE - SEASONALITY2); i++)
-                season2_exVect.push_back(season2_exVect[startSeasonalityIndx + i]);
+            else {
+              cerr<<"SEASONALITY_NUM="<< SEASONALITY_NUM;
+              exit(-1);
             }
-          }
-          else {
-            cerr<<"SEASONALITY_NUM="<< SEASONALITY_NUM;
-            exit(-1);
-          }
 		     
-          Expression levelVarLoss_ex;
-          if (LEVEL_VARIABILITY_PENALTY > 0) {
-            vector<Expression> levelVarLoss_v;
-            for (int i = 1; i<logDiffOfLevels_vect.size(); i++) {
-              Expression diff_ex = logDiffOfLevels_vect[i] - logDiffOfLevels_vect[i - 1];
-              levelVarLoss_v.push_back(diff_ex*diff_ex);
+            Expression levelVarLoss_ex;
+            if (LEVEL_VARIABILITY_PENALTY > 0 && backwardPass) {
+              vector<Expression> levelVarLoss_v;
+              //the terms of points esFirst..nextEsFirst-1, the next segment has the rest. logDiffOfLevels_vect[0] is of point esFirst-1 (or 1, in the first segment)
+              int pastLastTerm = lastSegment ? logDiffOfLevels_vect.size() : (firstSegment ? nextEsFirst - 1 : nextEsFirst - esFirst + 1);
+              for (int i = 1; i<pastLastTerm; i++) {
+                Expression diff_ex = logDiffOfLevels_vect[i] - logDiffOfLevels_vect[i - 1];
+                levelVarLoss_v.push_back(diff_ex*diff_ex);
+              }
+              levelVarLoss_ex = average(levelVarLoss_v);
+              if (CHECKPOINT_EVERY > 0) //the segment's share of the average over the series
+                levelVarLoss_ex = levelVarLoss_ex * ((float)levelVarLoss_v.size() / (m4Obj.vals.size() - 2));
             }
-            levelVarLoss_ex = average(levelVarLoss_v);
-          }
 			   
-          Expression inputSeasonality_ex; Expression inputSeasonality2_ex;
-          Expression outputSeasonality_ex; Expression outputSeasonality2_ex;
-          vector<Expression> losses;//losses of steps through single time series
-          for (int i=INPUT_SIZE-1; i<(m4Obj.n- OUTPUT_SIZE); i++) { 
-            vector<float>::const_iterator first = m4Obj.vals.begin() + i + 1 - INPUT_SIZE;
-            vector<float>::const_iterator pastLast = m4Obj.vals.begin() + i + 1; //not including the last one
-            vector<float> input_vect(first, pastLast); //[first,pastLast)
+            Expression inputSeasonality_ex; Expression inputSeasonality2_ex;
+            Expression outputSeasonality_ex; Expression outputSeasonality2_ex;
+            vector<Expression> losses;//losses of steps through single time series
+            mt19937 noiseRng(noiseSeed + iseg); //checkpointing: the same noise in the forward and the backward pass of a segment
+            normal_distribution<float> noiseDist(0, NOISE_STD);
+            vector<float> noise_vect(INPUT_SIZE);
+            for (int i=iFirst; i<iPastLast; i++) { 
+              vector<float>::const_iterator first = m4Obj.vals.begin() + i + 1 - INPUT_SIZE;
+              vector<float>::const_iterator pastLast = m4Obj.vals.begin() + i + 1; //not including the last one
+              vector<float> input_vect(first, pastLast); //[first,pastLast)
+
+              first = m4Obj.vals.begin() + i + 1;
+              pastLast = m4Obj.vals.begin() + i + 1 + OUTPUT_SIZE;
+              vector<float> labels_vect(first, pastLast);  //[first,pastLast)
 
-            first = m4Obj.vals.begin() + i + 1;
-            pastLast = m4Obj.vals.begin() + i + 1 + OUTPUT_SIZE;
-            vector<float> labels_vect(first, pastLast);  //[first,pastLast)
+              Expression input1_ex = input(cg, { INPUT_SIZE }, input_vect);
+              Expression labels1_ex = input(cg, { OUTPUT_SIZE }, labels_vect);
 
-            Expression input1_ex = input(cg, { INPUT_SIZE }, input_vect);
-            Expression labels1_ex = input(cg, { OUTPUT_SIZE }, labels_vect);
+              if (SEASONALITY_NUM > 0 ) {
+  			        vector<Expression>::const_iterator firstE = season_exVect.begin() +i+1-INPUT_SIZE;
+  			        vector<Expression>::const_iterator pastLastE = season_exVect.begin() +i+1; //not including the last one
+  			        vector<Expression> inputSeasonality_exVect(firstE, pastLastE);  //[first,pastLast)
+  			        inputSeasonality_ex=concatenate(inputSeasonality_exVect);
 
-            if (SEASONALITY_NUM > 0 ) {
-			        vector<Expression>::const_iterator firstE = season_exVect.begin() +i+1-INPUT_SIZE;
-			        vector<Expression>::const_iterator pastLastE = season_exVect.begin() +i+1; //not including the last one
-			        vector<Expression> inputSeasonality_exVect(firstE, pastLastE);  //[first,pastLast)
-			        inputSeasonality_ex=concatenate(inputSeasonality_exVect);
-
-              firstE = season_exVect.begin() + i + 1;
-              pastLastE = season_exVect.begin() + i + 1 + OUTPUT_SIZE;
-              vector<Expression> outputSeasonality_exVect(firstE, pastLastE);  //[first,pastLast)
-              outputSeasonality_ex = concatenate(outputSeasonality_exVect);
+                firstE = season_exVect.begin() + i + 1;
+                pastLastE = season_exVect.begin() + i + 1 + OUTPUT_SIZE;
+                vector<Expression> outputSeasonality_exVect(firstE, pastLastE);  //[first,pastLast)
+                outputSeasonality_ex = concatenate(outputSeasonality_exVect);
 
-              input1_ex = cdiv(input1_ex, inputSeasonality_ex); // input deseasonalization
-              labels1_ex = cdiv(labels1_ex, outputSeasonality_ex); //output deseasonalization
-            }
-            if (SEASONALITY_NUM > 1) {
-              vector<Expression>::const_iterator firstE = season2_exVect.begin() + i + 1 - INPUT_SIZE;
-              vector<Expression>::const_iterator pastLastE = season2_exVect.begin() + i + 1; //not including the last one
-              vector<Expression> inputSeasonality2_exVect(firstE, pastLastE);  //[first,pastLast)
-              inputSeasonality2_ex = concatenate(inputSeasonality2_exVect);
+                input1_ex = cdiv(input1_ex, inputSeasonality_ex); // input deseasonalization
+                labels1_ex = cdiv(labels1_ex, outputSeasonality_ex); //output deseasonalization
+              }
+              if (SEASONALITY_NUM > 1) {
+                vector<Expression>::const_iterator firstE = season2_exVect.begin() + i + 1 - INPUT_SIZE;
+                vector<Expression>::const_iterator pastLastE = season2_exVect.begin() + i + 1; //not including the last one
+                vector<Expression> inputSeasonality2_exVect(firstE, pastLastE);  //[first,pastLast)
+                inputSeasonality2_ex = concatenate(inputSeasonality2_exVect);
 
-              firstE = season2_exVect.begin() + i + 1;
-              pastLastE = season2_exVect.begin() + i + 1 + OUTPUT_SIZE;
-              vector<Expression> outputSeasonality2_exVect(firstE, pastLastE);  //[first,pastLast)
-              Expression outputSeasonality2_ex = concatenate(outputSeasonality2_exVect);
+                firstE = season2_exVect.begin() + i + 1;
+                pastLastE = season2_exVect.begin() + i + 1 + OUTPUT_SIZE;
+                vector<Expression> outputSeasonality2_exVect(firstE, pastLastE);  //[first,pastLast)
+                Expression outputSeasonality2_ex = concatenate(outputSeasonality2_exVect);
 
-              input1_ex = cdiv(input1_ex, inputSeasonality2_ex); //input deseasonalization
-              labels1_ex = cdiv(labels1_ex, outputSeasonality2_ex); //output deseasonalization
-            }
+                input1_ex = cdiv(input1_ex, inputSeasonality2_ex); //input deseasonalization
+                labels1_ex = cdiv(labels1_ex, outputSeasonality2_ex); //output deseasonalization
+              }
 
-            vector<Expression> joinedInput_ex;
-            joinedInput_ex.emplace_back(noise(squash(cdiv(input1_ex, levels_exVect[i])), NOISE_STD)); //input normalization+noise
-            joinedInput_ex.emplace_back(input(cg, { NUM_OF_CATEGORIES }, m4Obj.categories_vect));
-            Expression input_ex = concatenate(joinedInput_ex);
+              vector<Expression> joinedInput_ex;
+              if (CHECKPOINT_EVERY > 0) {
+                for (auto& noise_val : noise_vect)
+                  noise_val = noiseDist(noiseRng);
+                joinedInput_ex.emplace_back(squash(cdiv(input1_ex, levels_exVect[i])) + input(cg, { INPUT_SIZE }, noise_vect)); //input normalization+noise
+              } else
+                joinedInput_ex.emplace_back(noise(squash(cdiv(input1_ex, levels_exVect[i])), NOISE_STD)); //input normalization+noise
+              joinedInput_ex.emplace_back(input(cg, { NUM_OF_CATEGORIES }, m4Obj.categories_vect));
+              Expression input_ex = concatenate(joinedInput_ex);
 
-            Expression labels_ex = squash(cdiv(labels1_ex, levels_exVect[i]));//output normalization
+              Expression labels_ex = squash(cdiv(labels1_ex, levels_exVect[i]));//output normalization
 
-            Expression rnn_ex;
-            try {
-              rnn_ex = rNNStack[0].add_input(input_ex);
-              for (int il=1; il<dilations.size(); il++)
-                rnn_ex=rnn_ex+rNNStack[il].add_input(rnn_ex); //resNet-style
-            }  catch (exception& e) {
-              cerr<<"cought exception 2 while doing "<<series<<endl;
-              cerr << e.what() << endl;
-              cerr<<as_vector(input_ex.value())<<endl;
+              Expression rnn_ex;
+              try {
+                rnn_ex = rNNStack[0].add_input(input_ex);
+                for (int il=1; il<dilations.size(); il++)
+                  rnn_ex=rnn_ex+rNNStack[il].add_input(rnn_ex); //resNet-style
+              }  catch (exception& e) {
+                cerr<<"cought exception 2 while doing "<<series<<endl;
+                cerr << e.what() << endl;
+                cerr<<as_vector(input_ex.value())<<endl;
+              }
+              if (!backwardPass)
+                continue; //checkpointing: the forward pass needs only the states
+              Expression out_ex;
+              if (ADD_NL_LAYER) {
+                out_ex=MLPW_ex*rnn_ex+MLPB_ex;
+                out_ex = adapterW_ex*tanh(out_ex)+adapterB_ex;
+              } else 
+                out_ex=adapterW_ex*rnn_ex+adapterB_ex;
+
+              Expression loss_ex = pinBallLoss(out_ex, labels_ex);
+              if (i>=INPUT_SIZE+MIN_INP_SEQ_LEN)
+                  losses.push_back(loss_ex); 
+            }//through points of a series
+
+            vector<Expression> boundary_exVect; //the state at the start of the next segment, in the order of CarriedState
+            vector<int> boundaryRnnSteps;
+            if (!lastSegment) {
+              for (int il=0; il<dilations.size(); il++) {//the last max(dilation) steps, the reach of the dilated connections
+                auto& rnn = rNNStack[il];
+                int numOfSteps = min((int)rnn.h.size(), (int)*max_element(dilations[il].begin(), dilations[il].end()));
+                boundaryRnnSteps.push_back(numOfSteps);
+                for (int it = rnn.h.size() - numOfSteps; it < rnn.h.size(); it++)
+                  for (int layer = 0; layer < rnn.h[it].size(); layer++) {
+                    boundary_exVect.push_back(rnn.h[it][layer]);
+                    boundary_exVect.push_back(rnn.c[it][layer]);
+                  }
+              }
+              if (SEASONALITY_NUM > 0)
+                for (int isea = 0; isea<SEASONALITY; isea++)
+                  boundary_exVect.push_back(season_exVect[nextEsFirst + isea]);
+              if (SEASONALITY_NUM > 1)
+                for (int isea = 0; isea<SEASONALITY2; isea++)
+                  boundary_exVect.push_back(season2_exVect[nextEsFirst + isea]);
+              boundary_exVect.push_back(levels_exVect[nextEsFirst - 1]);
+              if (SEASONALITY_NUM > 0)
+                boundary_exVect.push_back(log(cdiv(levels_exVect[nextEsFirst - 1], levels_exVect[nextEsFirst - 2])));
             }
-            Expression out_ex;
-            if (ADD_NL_LAYER) {
-              out_ex=MLPW_ex*rnn_ex+MLPB_ex;
-              out_ex = adapterW_ex*tanh(out_ex)+adapterB_ex;
-            } else 
-              out_ex=adapterW_ex*rnn_ex+adapterB_ex;
 
-            Expression loss_ex = pinBallLoss(out_ex, labels_ex);
-            if (i>=INPUT_SIZE+MIN_INP_SEQ_LEN)
-                losses.push_back(loss_ex); 
-          }//through points of a series
-
-          Expression forecLoss_ex= average(losses);
-			    Expression loss_exp = forecLoss_ex;
-			    
-          float levVarLoss=0;
-          if (LEVEL_VARIABILITY_PENALTY > 0) {
-            Expression levelVarLossP_ex = levelVarLoss_ex*LEVEL_VARIABILITY_PENALTY;
-            levVarLoss = as_scalar(levelVarLossP_ex.value());
-            levVarLosses.push_back(levVarLoss);
-            loss_exp= loss_exp + levelVarLossP_ex;
-          }
+            //TBPTT: a segment with no loss (all its steps before INPUT_SIZE+MIN_INP_SEQ_LEN) only carries its end state on. Checkpointing: it still has to pass on
+            //the gradient of the later segments, and the first segment makes the update, so its forecast loss is just 0
+            if (backwardPass && (CHECKPOINT_EVERY > 0 || losses.size() > 0)) {
+              Expression forecLoss_ex = losses.size() > 0 ? average(losses) : input(cg, 0.f);
+              if (CHECKPOINT_EVERY > 0) //the segment's share of the average over the series
+                forecLoss_ex = forecLoss_ex * ((float)losses.size() / (pastLastStep - INPUT_SIZE - MIN_INP_SEQ_LEN));
+              Expression loss_exp = forecLoss_ex;
+
+              float levVarLoss=0;
+              if (LEVEL_VARIABILITY_PENALTY > 0) {
+                Expression levelVarLossP_ex = levelVarLoss_ex*LEVEL_VARIABILITY_PENALTY;
+                levVarLoss = as_scalar(levelVarLossP_ex.value());
+                seriesLevVarLoss += levVarLoss;
+                loss_exp= loss_exp + levelVarLossP_ex;
+              }
 
-          float cStateLoss=0;
-          if (C_STATE_PENALTY>0) {
-            vector<Expression> cStateLosses_vEx;
-            for (int irnn = 0; irnn < rNNStack.size(); irnn++)
-              for (int it = 0; it<rNNStack[irnn].c.size(); it++) {  //first index is time
-                auto& state_ex = rNNStack[irnn].c[it][0]; //c-state of first layer in a chunk at time it
-                Expression penalty_ex = square(state_ex);
-                cStateLosses_vEx.push_back(mean_elems(penalty_ex));
+              float cStateLoss=0;
+              if (C_STATE_PENALTY>0) {
+                vector<Expression> cStateLosses_vEx;
+                for (int irnn = 0; irnn < rNNStack.size(); irnn++)
+                  for (int it = rNNStack[irnn].carried_steps; it<rNNStack[irnn].c.size(); it++) {  //first index is time; the carried states are constants
+                    auto& state_ex = rNNStack[irnn].c[it][0]; //c-state of first layer in a chunk at time it
+                    Expression penalty_ex = square(state_ex);
+                    cStateLosses_vEx.push_back(mean_elems(penalty_ex));
+                  }
+                Expression cStateLossP_ex = average(cStateLosses_vEx)*C_STATE_PENALTY;
+                if (CHECKPOINT_EVERY > 0)
+                  cStateLossP_ex = cStateLossP_ex * ((float)cStateLosses_vEx.size() / (rNNStack.size()*(pastLastStep - INPUT_SIZE + 1)));
+                cStateLoss = as_scalar(cStateLossP_ex.value());
+                seriesStateLoss += cStateLoss;
+                loss_exp = loss_exp + cStateLossP_ex;
               }
-          Expression cStateLossP_ex = average(cStateLosses_vEx)*C_STATE_PENALTY;
-          cStateLoss = as_scalar(cStateLossP_ex.value());
-          stateLosses.push_back(cStateLoss);
-          loss_exp = loss_exp + cStateLossP_ex;
-        }
-          
-        float loss = as_scalar(cg.forward(loss_exp));
-        epochLosses.push_back(loss);//losses of all series in one epoch
 
-        float forecastLoss = loss - levVarLoss - cStateLoss;
-          forecLosses.push_back(forecastLoss);
-        
-          cg.backward(loss_exp);
-          try {
-          trainer->update();//update shared weights
-          perSeriesTrainer->update();  //update params of this series only
-        } catch (exception& e) {  //long diagnostics for this unlikely event :-)
-            cerr<<"cought exception while doing "<<series<<endl;
-            cerr << e.what() << endl;
-            
-            float minSeason=BIG_FLOAT;
-            for (int isea = 0; isea < season_exVect.size(); isea++) {
-              float val= as_scalar(season_exVect[isea].value());
-              //cout << " " << val;
-              if (val<minSeason)
-                minSeason=val;
-            }  
-            cout << "min season:"<<minSeason<<endl;
-
-            minSeason = BIG_FLOAT;
-            for (int isea = 0; isea < season2_exVect.size(); isea++) {
-              float val = as_scalar(season2_exVect[isea].value());
-              //cout << " " << val;
-              if (val<minSeason)
-                minSeason = val;
+              Expression objective_ex = loss_exp;
+              if (CHECKPOINT_EVERY > 0 && !lastSegment) //the later segments, through the state at the start of the next one
+                objective_ex = loss_exp + dot_product(concatenate(boundary_exVect), input(cg, { (unsigned)carried[iseg + 1].gradient.size() }, carried[iseg + 1].gradient));
+
+              epochMetrics.count(COUNTER_GRAPH_NODES, (double)cg.nodes.size());
+              phaseStart = epochMetrics.times.add(PHASE_BUILD, phaseStart, series, m4Obj.n); //includes forward of the few nodes evaluated while building, e.g. in pinBallLoss
+              float loss = as_scalar(cg.forward(loss_exp));
+              phaseStart = epochMetrics.times.add(PHASE_FORWARD, phaseStart, series, m4Obj.n);
+              seriesLoss += loss;
+              seriesForecLoss += loss - levVarLoss - cStateLoss;
+              numOfSegmentsDone++;
+
+              cg.backward(objective_ex, CHECKPOINT_EVERY > 0 && !firstSegment); //full: also the gradient of the carried state, which is constant
+              if (CHECKPOINT_EVERY > 0 && !firstSegment) {
+                carried[iseg].gradient.clear();
+                for (auto& carried_ex : carriedIn_exVect) {
+                  vector<float> gradient = as_vector(carried_ex.gradient());
+                  carried[iseg].gradient.insert(carried[iseg].gradient.end(), gradient.begin(), gradient.end());
+                }
+              }
+              phaseStart = epochMetrics.times.add(PHASE_BACKWARD, phaseStart, series, m4Obj.n);
+              size_t poolUsed = graphPoolsUsed();
+              if (poolUsed > epochPoolHighWaterMark)
+                epochPoolHighWaterMark = poolUsed;
+              healthMonitor.begin();
+              healthMonitor.addGradients(pc);
+              healthMonitor.addGradient(additionalParams.levSm);
+              healthMonitor.addGradient(additionalParams.sSm);
+              healthMonitor.addGradient(additionalParams.sSm2);
+              healthMonitor.addGradients(additionalParams.initSeasonality);
+              healthMonitor.addGradients(additionalParams.initSeasonality2);
+              healthMonitor.addStates(rNNStack);
+              passOk = false;
+              if (healthMonitor.healthy()) {
+                try {
+                  if (CHECKPOINT_EVERY == 0 || firstSegment) {//checkpointing: once the gradients of all segments are in
+                    trainer->update();//update shared weights
+                    if (STREAM_SHARD_SIZE > 0) {//the moments are in the shard
+                      float* moments = streamedMoments(series, inet);
+                      streamedAdamUpdate(additionalParams, moments, moments + ES_PARAMS_PER_SERIES, perSeriesTrainer->learning_rate, ++perSeriesUpdates[inet]);
+                    } else
+                      perSeriesTrainer->update();  //update params of this series only
+                  }
+                  passOk = true;
+                } catch (exception& e) {  //rare, the health check catches most of the numerical problems before
+                  epochMetrics.count(COUNTER_UPDATE_EXCEPTIONS);
+                  cerr<<"cought exception while doing "<<series<<endl;
+                  cerr << e.what() << endl;
+                }
+              }
+              if (!passOk) {//the remaining passes are skipped too
+                healthMonitor.strike(series, epochMetrics);
+                pc.reset_gradient();
+                perSeriesPC.reset_gradient();
+              }
+              epochMetrics.times.add(PHASE_UPDATE, phaseStart, series, m4Obj.n);
+            } else
+              phaseStart = epochMetrics.times.add(PHASE_BUILD, phaseStart, series, m4Obj.n);
+
+            if (!lastSegment && (CHECKPOINT_EVERY == 0 || !backwardPass)) {//the state at the start of the next segment
+              CarriedState& next = carried[iseg + 1];
+              next.rnnSteps = boundaryRnnSteps;
+              next.values.clear();
+              for (auto& boundary_ex : boundary_exVect) {
+                vector<float> value = as_vector(boundary_ex.value());
+                next.values.insert(next.values.end(), value.begin(), value.end());
+              }
             }
-            cout << "min season2:"<<minSeason<<endl;
-
-            float minLevel = BIG_FLOAT;
-            for (int isea = 0; isea < levels_exVect.size(); isea++) {
-              float val = as_scalar(levels_exVect[isea].value());
-              //cout << " " << val;
-              if (val<minLevel)
-                minLevel = val;
+            if (!backwardPass)
+              phaseStart = epochMetrics.times.add(PHASE_FORWARD, phaseStart, series, m4Obj.n);
+            if (backwardPass && CHECKPOINT_EVERY == 0)
+              carried[iseg] = CarriedState(); //used up
+            if (backwardPass && CHECKPOINT_EVERY > 0 && !lastSegment) {
+              carried[iseg + 1] = CarriedState();
+              continue; //the diagnostics were saved in the forward pass (of the last segment: here, in the first backward pass)
             }
-            cout << "min level:"<<minLevel<<endl;
-
-            float maxAbs = 0; int timeOfMax = 0; int layerOfMax = 0; int chunkOfMax=0;
-            for (int irnn = 0; irnn < rNNStack.size(); irnn++) {
-              auto state_vEx= rNNStack[irnn].c;//(time,layers)
-              for (int it = 0; it < state_vEx.size(); it++) {  //through time
-                for (int il = 0; il < state_vEx[it].size(); il++) {//through layers. Each layer has two states: c and h
-                  auto state=as_vector(state_vEx[it][il].value());
-                  for (int iv = 0; iv < state.size(); iv++) {
-                    if (abs(state[iv]) > maxAbs) {
-                      maxAbs = abs(state[iv]);
-                      timeOfMax=it;
-                      layerOfMax=il;
-                      chunkOfMax= irnn;
-                    }
-                  }
-                } //through layers/states
-              } //through time
-            }  //through chunks
-
-            cout << "levSm:" << as_scalar(levSm_ex.value()) << endl;
-            if (SEASONALITY_NUM > 0) 
-              cout << "sSm:" << as_scalar(sSm_ex.value()) << endl;
-            if (SEASONALITY_NUM > 1) 
-              cout << "sSm2:" << as_scalar(sSm2_ex.value()) << endl;
-            cout << "max abs:" << maxAbs <<" at time:"<< timeOfMax<<" at layer:"<< layerOfMax<<" and chunk:"<< chunkOfMax<<endl;
-
-            //diagSeries.insert(series);
-            pc.reset_gradient();
-            perSeriesPC.reset_gradient();
-          }
 
-          //diagnostics saving
-          AdditionalParamsF histAdditionalParams;
-          histAdditionalParams.levSm=as_scalar(levSm_ex.value());
-          if (iEpoch == 1 || iEpoch == NUM_OF_TRAIN_EPOCHS / 2 || iEpoch == NUM_OF_TRAIN_EPOCHS - 1) {
-            for (int iv = 0; iv<levels_exVect.size(); iv++) {
-              histAdditionalParams.levels.push_back(as_scalar(levels_exVect[iv].value()));
+            //diagnostics saving. A segment saves the levels and seasonality factors of points diagFirst..nextEsFirst-1, the next one the rest
+            int diagFirst = firstSegment ? 0 : esFirst;
+            histAdditionalParams.levSm=as_scalar(levSm_ex.value());
+            if (iEpoch == 1 || iEpoch == NUM_OF_TRAIN_EPOCHS / 2 || iEpoch == NUM_OF_TRAIN_EPOCHS - 1) {
+              for (int iv = diagFirst; iv<levels_exVect.size() && (lastSegment || iv<nextEsFirst); iv++) {
+                histAdditionalParams.levels.push_back(as_scalar(levels_exVect[iv].value()));
+              }
             }
-          }
 
-          if (SEASONALITY_NUM > 0) {
-            histAdditionalParams.sSm=as_scalar(sSm_ex.value());
-            for (int isea = 0; isea<SEASONALITY; isea++)
-              histAdditionalParams.initSeasonality[isea] = as_scalar(season_exVect[isea].value());
+            if (SEASONALITY_NUM > 0) {
+              histAdditionalParams.sSm=as_scalar(sSm_ex.value());
+              if (firstSegment)
+                for (int isea = 0; isea<SEASONALITY; isea++)
+                  histAdditionalParams.initSeasonality[isea] = as_scalar(season_exVect[isea].value());
 
-            if (iEpoch == 1 || iEpoch == NUM_OF_TRAIN_EPOCHS / 2 || iEpoch == NUM_OF_TRAIN_EPOCHS - 1) {
-              for (int iv = 0; iv<season_exVect.size(); iv++) {
-                histAdditionalParams.seasons.push_back(as_scalar(season_exVect[iv].value()));
+              if (iEpoch == 1 || iEpoch == NUM_OF_TRAIN_EPOCHS / 2 || iEpoch == NUM_OF_TRAIN_EPOCHS - 1) {
+                for (int iv = diagFirst; iv<season_exVect.size() && (lastSegment || iv<nextEsFirst); iv++) {
+                  histAdditionalParams.seasons.push_back(as_scalar(season_exVect[iv].value()));
+                }
               }
             }
-          }
          
-          if (SEASONALITY_NUM > 1) {
-            histAdditionalParams.sSm2 = as_scalar(sSm2_ex.value());
-		        for (int isea=0; isea<SEASONALITY2; isea++) 
-			        histAdditionalParams.initSeasonality2[isea]=as_scalar(season2_exVect[isea].value());   
+            if (SEASONALITY_NUM > 1) {
+              histAdditionalParams.sSm2 = as_scalar(sSm2_ex.value());
+              if (firstSegment)
+  		          for (int isea=0; isea<SEASONALITY2; isea++) 
+  			          histAdditionalParams.initSeasonality2[isea]=as_scalar(season2_exVect[isea].value());   
                
-            if (iEpoch == 1 || iEpoch == NUM_OF_TRAIN_EPOCHS / 2 || iEpoch == NUM_OF_TRAIN_EPOCHS - 1) {
-              for (int iv = 0; iv<season2_exVect.size(); iv++) {
-                histAdditionalParams.seasons2.push_back(as_scalar(season2_exVect[iv].value()));
+              if (iEpoch == 1 || iEpoch == NUM_OF_TRAIN_EPOCHS / 2 || iEpoch == NUM_OF_TRAIN_EPOCHS - 1) {
+                for (int iv = diagFirst; iv<season2_exVect.size() && (lastSegment || iv<nextEsFirst); iv++) {
+                  histAdditionalParams.seasons2.push_back(as_scalar(season2_exVect[iv].value()));
+                }
               }
-            }
-          }     
-
+            }     
+
+          }//through segments
+
+          epochMetrics.count(COUNTER_SERIES);
+          if (numOfSegmentsDone > 0) {
+            float lossDivisor = CHECKPOINT_EVERY > 0 ? 1 : numOfSegmentsDone; //checkpointing: the segments' losses are parts of the loss of the series
+            epochLosses.push_back(seriesLoss / lossDivisor);//losses of all series in one epoch
+            forecLosses.push_back(seriesForecLoss / lossDivisor);
+            if (LEVEL_VARIABILITY_PENALTY > 0)
+              levVarLosses.push_back(seriesLevVarLoss / lossDivisor);
+            if (C_STATE_PENALTY > 0)
+              stateLosses.push_back(seriesStateLoss / lossDivisor);
+          }
           historyOfAdditionalParams_arr[iEpoch]=histAdditionalParams;
         }//through series
 
@@ -1132,14 +2303,18 @@ int main(int argc, char** argv) {
         }
         cout<<endl;
       }//through nets. This should be done in parallel. One day it will, when Dynet allows it.
-      cout << (clock() - begin_time) / CLOCKS_PER_SEC<<"s"<<endl;
+      cout << nowSecs() - begin_time <<"s"<<endl;
 
 
       //Validation. We just save outputs of all nets on all series
       //We can't attach validation to training, because training happens across subset of series*nets, and we need to store results from all of these combinations, for future use
       //level: epoch, but we do not use the epoch value, we overwrite
-      begin_time = clock();
+      begin_time = nowSecs();
+      double validationStart = nowSecs();
       for (int inet=0; inet<NUM_OF_NETS; inet++) { //through _all_ nets. Paralellize here.
+        if (!ownsNet(inet))
+          continue;
+        TraceSpan tileSpan("validation tile", inet);
         auto& rNNStack=rnnStack_arr[inet];
         Parameter& MLPW_par = MLPW_parArr[inet];
         Parameter& MLPB_par = MLPB_parArr[inet];
@@ -1148,8 +2323,15 @@ int main(int argc, char** argv) {
 
         for (auto iter = series_vect.begin() ; iter != series_vect.end(); ++iter) {//through _all_ series.
           string series=*iter;
-          auto m4Obj=allSeries_map[series];
+          streamInOrder((int)(iter - series_vect.begin()), inet);
+          const M4TS& m4Obj=seriesOf(series);
+          if (forecastOnly) {//only the top nets of the series; --update: forecasted by the online update
+            auto ranking = netRanking_map.find(series);
+            if (!updatePath.empty() || ranking == netRanking_map.end() || find(ranking->second.begin(), ranking->second.begin() + TOPN, inet) == ranking->second.begin() + TOPN)
+              continue;
+          }
 
+          epochMetrics.count(COUNTER_VALIDATION_SERIES);
           ComputationGraph cg;
           for (int il=0; il<dilations.size(); il++) {
             rNNStack[il].new_graph(cg);
@@ -1369,9 +2551,49 @@ int main(int argc, char** argv) {
           } //time to average
         }//through series
       } //through nets
-      cout << (clock() - begin_time) / CLOCKS_PER_SEC << "s" << endl;
+      cout << nowSecs() - begin_time << "s" << endl;
+      
+      if (forecastOnly) {//the average of the top nets, no ranking or assignment to update
+        gatherForecasts(series_vect, testResults_map, 0, false, OUTPUT_SIZE);
+        if (mpiRank()==0)
+          for (auto& ranking : netRanking_map) {
+            bool complete = true; //--update: series still shorter than INPUT_SIZE have no forecast
+            for (int itop=0; itop<TOPN; itop++)
+              complete = complete && testResults_map[ranking.first][ranking.second[itop]][0].size() == OUTPUT_SIZE;
+            if (!complete)
+              continue;
+            vector<float> forec(OUTPUT_SIZE, 0);
+            for (int itop=0; itop<TOPN; itop++)
+              for (int iii=0; iii<OUTPUT_SIZE; iii++)
+                forec[iii] += testResults_map[ranking.first][ranking.second[itop]][0][iii] / TOPN;
+            finalResults_map[ranking.first] = forec;
+          }
+        for (auto& cached : cachedForecasts)
+          finalResults_map[cached.first] = cached.second;
+#if !defined _WINDOWS
+        if (forecastCache.isOpen()) {
+          for (auto& key : cacheKeys) {
+            auto forec = finalResults_map.find(key.first);
+            if (forec != finalResults_map.end())
+              forecastCache.insert(cacheModelKey, key.second, forec->second.data());
+          }
+          epochMetrics.count(COUNTER_CACHE_HITS, (double)forecastCache.run.hits);
+          epochMetrics.count(COUNTER_CACHE_MISSES, (double)forecastCache.run.misses);
+          cout << "forecast cache: " << forecastCache.run.hits << " hits, " << forecastCache.run.misses << " misses, hit rate " << 100 * forecastCache.run.hitRate()
+            << "%, " << forecastCache.run.evictions << " evictions, " << forecastCache.header->entries << " of " << forecastCache.capacity() << " entries used, lifetime hit rate "
+            << 100 * forecastCache.header->lifetime.hitRate() << "%" << endl;
+          forecastCache.close();
+        }
+#endif
+        epochMetrics.times.add(PHASE_VALIDATION, validationStart);
+        metricsExporter.writeEpoch(ibig, iEpoch, epochMetrics);
+        break;
+      }
       
-      if (iEpoch>0 && iEpoch % FREQ_OF_TEST==0) {
+      bool timeToReport = iEpoch>0 && iEpoch % FREQ_OF_TEST==0;
+      if (timeToReport)
+        gatherForecasts(series_vect, testResults_map, iEpoch%AVERAGING_LEVEL, iEpoch>=AVERAGING_LEVEL, OUTPUT_SIZE); //USE_MPI: to rank 0, from the owners of the nets
+      if (timeToReport && mpiRank()==0) {
         //now that we have saved outputs of all nets on all series, let's calc how best and topn combinations performed during current epoch.
         vector<float> bestEpochLosses;
         vector<float> bestEpochAvgLosses;
@@ -1380,7 +2602,8 @@ int main(int argc, char** argv) {
         
         for (auto iter = series_vect.begin() ; iter != series_vect.end(); ++iter) {
           string series=*iter;
-          auto m4Obj=allSeries_map[series];
+          streamInOrder((int)(iter - series_vect.begin()), -2); //the test values
+          M4TS m4Obj=seriesOf(series);
 
 #if defined USE_ODBC        
           TRYODBC(hInsertStmt,
@@ -1450,9 +2673,11 @@ int main(int argc, char** argv) {
                     SQL_HANDLE_STMT,
                     SQLBindParameter(hInsertStmt, ipos+1, SQL_PARAM_INPUT, SQL_C_FLOAT, SQL_FLOAT, 0, 0, (SQLPOINTER)&avgAvg[iii], 0, NULL));
               }
+              validationStart = epochMetrics.times.add(PHASE_VALIDATION, validationStart);
               TRYODBC(hInsertStmt,
                SQL_HANDLE_STMT,
                SQLExecute(hInsertStmt));
+              validationStart = epochMetrics.times.add(PHASE_ODBC, validationStart);
 #endif 
               float qLoss = errorFunc(avgAvg, m4Obj.testVals);
               topnEpochAvgLosses.push_back(qLoss);
@@ -1473,6 +2698,7 @@ int main(int argc, char** argv) {
       }//time to report
       
       //assign
+      allMinNetPerf(series_vect, netPerf_map, BIG_FLOAT); //USE_MPI: every rank gets the losses of all nets
       for (int inet=0; inet<NUM_OF_NETS; inet++)
         seriesAssignment[inet].clear();
       for (auto iter = series_vect.begin() ; iter != series_vect.end(); ++iter) {
@@ -1496,6 +2722,7 @@ int main(int argc, char** argv) {
           }
         }
       }
+      validationStart = epochMetrics.times.add(PHASE_VALIDATION, validationStart);
 #if defined USE_ODBC  
       TRYODBC(hDbc,
       SQL_HANDLE_DBC,
@@ -1503,12 +2730,17 @@ int main(int argc, char** argv) {
         SQL_HANDLE_DBC,
         hDbc,
         SQL_COMMIT));
+      epochMetrics.times.add(PHASE_ODBC, validationStart);
+#endif
+#if defined BENCHMARK_MODE
+      benchReport.writeEpoch(ibig, iEpoch, (double)series_len, epochMetrics.times, epochPoolHighWaterMark);
 #endif
+      metricsExporter.writeEpoch(ibig, iEpoch, epochMetrics);
     }//through epochs of RNN
     
     //some diagnostic info
-    set<string> diagSeries;
-    for (int i=0; i<1; i++) {//add a few normal ones
+    set<string> diagSeries = streamDiagSeries;
+    for (int i=0; i<1 && !forecastOnly && STREAM_SHARD_SIZE == 0; i++) {//add a few normal ones
       int irand=uniOnSeries(rng);
       diagSeries.insert(series_vect[irand]);
     }
@@ -1517,6 +2749,8 @@ int main(int argc, char** argv) {
       
       cout<<"lSm:"<<endl;
       for (int inet=0; inet<NUM_OF_NETS; inet++) {
+        if (!ownsNet(inet))
+          continue;
         cout<<"inet:"<<inet<<" ";
     	auto& historyOfAdditionalParams_arr=historyOfAdditionalParams_map[series]->at(inet);
         for (int iEpoch=0; iEpoch<NUM_OF_TRAIN_EPOCHS; iEpoch++)
@@ -1527,6 +2761,8 @@ int main(int argc, char** argv) {
       if (SEASONALITY_NUM > 0 ) {
         cout<<"sSm:"<<endl;
         for (int inet=0; inet<NUM_OF_NETS; inet++) {
+          if (!ownsNet(inet))
+            continue;
           cout<<"inet:"<<inet<<" ";
     	    auto& historyOfAdditionalParams_arr=historyOfAdditionalParams_map[series]->at(inet);
           for (int iEpoch=0; iEpoch<NUM_OF_TRAIN_EPOCHS; iEpoch++)
@@ -1538,6 +2774,8 @@ int main(int argc, char** argv) {
       if (SEASONALITY_NUM > 1 ) {
         cout<<"sSm2:"<<endl;
         for (int inet=0; inet<NUM_OF_NETS; inet++) {
+          if (!ownsNet(inet))
+            continue;
           cout<<"inet:"<<inet<<" ";
     	  auto& historyOfAdditionalParams_arr=historyOfAdditionalParams_map[series]->at(inet);
           for (int iEpoch=0; iEpoch<NUM_OF_TRAIN_EPOCHS; iEpoch++)
@@ -1547,6 +2785,8 @@ int main(int argc, char** argv) {
       }
       
       for (int inet = 0; inet<NUM_OF_NETS; inet++) {
+        if (!ownsNet(inet))
+          continue;
         cout<<"inet:"<<inet<<" ";
         auto& historyOfAdditionalParams_arr = historyOfAdditionalParams_map[series]->at(inet);
         for (int iEpoch = 0; iEpoch<NUM_OF_TRAIN_EPOCHS; iEpoch++) {
@@ -1573,16 +2813,64 @@ int main(int argc, char** argv) {
     }//end of diag printing
     
     //save the forecast to outputFile
-    ofstream outputFile;
-    outputFile.open(outputPath);
-    for (auto iter = series_vect.begin(); iter != series_vect.end(); ++iter) {
-      string series = *iter;
-      outputFile<< series;
-      for (int io=0; io<OUTPUT_SIZE; io++)
-        outputFile << ", " << finalResults_map[series][io];
-      outputFile<<endl;
+    Metrics outputMetrics;
+    double outputStart = nowSecs();
+    if (mpiRank()==0) { //USE_MPI: only rank 0 has the forecasts of all nets
+      ofstream outputFile;
+      outputFile.open(outputPath);
+      for (auto iter = series_vect.begin(); iter != series_vect.end(); ++iter) {
+        string series = *iter;
+        if (finalResults_map.find(series) == finalResults_map.end()) //--forecast-only: not in the model
+          continue;
+        outputFile<< series;
+        for (int io=0; io<OUTPUT_SIZE; io++)
+          outputFile << ", " << finalResults_map[series][io];
+        outputFile<<endl;
+      }
+      outputFile.close();
     }
-    outputFile.close();
+    if (EXPORT_MODEL && !forecastOnly) {//USE_MPI: every rank saves its nets
+      ModelArtifact artifact;
+      artifact.config = modelConfig();
+      for (auto iter = series_vect.begin(); iter != series_vect.end(); ++iter) {
+        string series = *iter;
+        streamInOrder((int)(iter - series_vect.begin()), -1);
+        for (int inet=0; inet<NUM_OF_NETS; inet++)
+          if (ownsNet(inet))
+            artifact.esParams[series][inet] = esParameterValues(additionalParams_mapOfArr[series]->at(inet));
+        artifact.rankings[series] = vector<int>(netRanking_map[series].begin(), netRanking_map[series].end());
+      }
+      if (!artifact.save(modelPath + ".model"))
+        cerr << "could not save the model to " << modelPath << ".model" << endl;
+      TextFileSaver weightsSaver(modelPath + ".weights");
+      for (int inet=0; inet<NUM_OF_NETS; inet++)
+        if (ownsNet(inet))
+          weightsSaver.save(paramsCollection_arr[inet], "/net" + to_string(inet));
+
+      if (ONLINE_STATE) {//one pass over the history of every series in its top nets
+        OnlineStates onlineStates;
+        for (auto iter = series_vect.begin(); iter != series_vect.end(); ++iter) {
+          string series = *iter;
+          streamInOrder((int)(iter - series_vect.begin()), -1);
+          const M4TS& m4Obj = seriesOf(series);
+          for (int itop=0; itop<TOPN; itop++) {
+            int inet = netRanking_map[series][itop];
+            if (!ownsNet(inet))
+              continue;
+            OnlineSeriesState& state = onlineStates[series][inet];
+            state = startOnlineState(additionalParams_mapOfArr[series]->at(inet), m4Obj.categories_vect);
+            updateOnlineState(state, m4Obj.vals, rnnStack_arr[inet], MLPW_parArr[inet], MLPB_parArr[inet], adapterW_parArr[inet], adapterB_parArr[inet]);
+          }
+        }
+        if (!saveOnlineStates(modelPath + ".state", onlineStates))
+          cerr << "could not save the online state to " << modelPath << ".state" << endl;
+      }
+    }
+    outputMetrics.times.add(PHASE_OUTPUT, outputStart);
+#if defined BENCHMARK_MODE
+    benchReport.addTimes(outputMetrics.times);
+#endif
+    metricsExporter.writeIbig(ibig, outputMetrics);
     
     
     //delete    
@@ -1591,14 +2879,18 @@ int main(int argc, char** argv) {
       perSeriesTrainers_arr[inet];
     }
 
-    for (auto iter = series_vect.begin() ; iter != series_vect.end(); ++iter) {
-      string series=*iter;
-      delete additionalParams_mapOfArr[series];
-      delete historyOfAdditionalParams_map[series];
-    }
+    for (auto additionalParams_arr : perSeriesParams_vect)
+      delete additionalParams_arr;
+    for (auto& history : historyOfAdditionalParams_map)
+      delete history.second;
     additionalParams_mapOfArr.clear();
     historyOfAdditionalParams_map.clear();
   }//big loop
+#if defined BENCHMARK_MODE
+  benchReport.writeSummary();
+#endif
+  traceFinish();
+  mpiFinalize();
 }//main
 
 
@@ -39,6 +39,10 @@ These blocks are as they were during the final forecasting run. You need comment
 #include "dynet/expr.h"
 #include "dynet/lstm.h"
 #include "slstm.h" //my implementation of dilated LSTMs
+#include "accuracy.h"
+#include "metrics.h"
+#include "health.h"
+#include "placement.h"
 
 
 #if defined USE_ODBC        
@@ -235,8 +239,14 @@ const float EPS=1e-6;
 const float NOISE_STD=0.001; 
 const int FREQ_OF_TEST=1;
 const float GRADIENT_CLIPPING=50;
+const float HEALTH_MAX_STATE_ABS = 1000; //a training step with a larger, or non-finite, c-state, or with a non-finite gradient, is skipped. See health.h
+const int HEALTH_STRIKES_TO_QUARANTINE = 3; //a series skipped that many times is not trained anymore in the ibig run
 const float BIG_FLOAT=1e38;//numeric_limits<float>::max();
 const bool PRINT_DIAGN = false;
+const string METRICS_FORMAT = "jsonl"; //"jsonl": <OUTPUT_DIR>/<VARIABLE>_<ibigOffset>_metrics.jsonl gets a line per epoch and per ibig, "prometheus": <...>_metrics.prom is rewritten after every epoch, "": no metrics file. See metrics.h
+const bool TRACE = false; //Chrome trace-event timeline of build/forward/backward/update/validation spans, per series, written to <OUTPUT_DIR>/<VARIABLE>_<ibigOffset>_trace.json, for Perfetto or chrome://tracing. See trace.h
+const int BLAS_THREADS = 1; //threads of the BLAS library (MKL, OpenBLAS) in this process. More than 1 only oversubscribes the cores when many workers run. See placement.h
+const bool PIN_TO_CORES = false; //pin to the core of the slot given by ESRNN_SLOT (or the MPI local rank), and prefer the memory of its NUMA node. Off by default; without a slot nothing is pinned anyway
 
 string INPUT_PATH = DATA_DIR + VARIABLE + "-train.csv";
 string INFO_INPUT_PATH = DATA_DIR + "M4-info.csv";
@@ -425,39 +435,17 @@ Expression MSIS(const Expression& out_ex, const Expression& actuals_ex) {
 
 // weighted quantile Loss
 float wQuantLoss(vector<float>& out_vect, vector<float>& actuals_vect, float tau, int offset) {//used just for diagnostics, if if LBACK>0 and PERCENTILE!=50
-  float sumf = 0; float suma = 0;
-  for (unsigned int indx = 0; indx<OUTPUT_SIZE; indx++) {
-    auto forec = out_vect[indx+ offset];
-    auto actual = actuals_vect[indx];
-    suma += abs(actual);
-    if (actual > forec)
-      sumf = sumf + (actual - forec)*tau;
-    else
-      sumf = sumf + (actual - forec)*(tau - 1);
-  }
-  return sumf / suma * 200;
+  return wQuantLoss(out_vect.data() + offset, actuals_vect.data(), OUTPUT_SIZE, tau);
 }
 
 float errorFunc(vector<float>& out_vect, vector<float>& actuals_vect, float meanAbsSeasDiff) {
-  float sumf=0;
-  for (unsigned int indx = 0; indx<OUTPUT_SIZE; indx++) {
-    auto forecL = out_vect[indx];
-    auto forecH = out_vect[indx + OUTPUT_SIZE];
-    auto actualf = actuals_vect[indx];
-
-    float loss = forecH - forecL;
-    if (actualf< forecL)
-      loss = loss + (forecL - actualf)*ALPHA_MULTIP;
-    if (actualf > forecH)
-      loss = loss + (actualf - forecH)*ALPHA_MULTIP;
-    sumf+=loss;
-  }
-  return sumf / (OUTPUT_SIZE*meanAbsSeasDiff);
+  return MSIS(out_vect.data(), out_vect.data() + OUTPUT_SIZE, actuals_vect.data(), OUTPUT_SIZE, ALPHA_MULTIP, meanAbsSeasDiff);
 }
 
 
 
 int main(int argc, char** argv) {
+  placeProcess(BLAS_THREADS, PIN_TO_CORES); //before Dynet allocates its memory
   dynet::initialize(argc, argv);
 
   int ibigOffset = 0;
@@ -655,10 +643,16 @@ int main(int argc, char** argv) {
   set<string> diagSeries;
   
   unordered_map<string, array<int, NUM_OF_NETS>> netRanking_map;
+  MetricsExporter metricsExporter;
+  metricsExporter.open(METRICS_FORMAT, OUTPUT_DIR + '/' + VARIABLE + "_" + to_string(ibigOffset) + "_metrics", "ES_RNN_E_PI", VARIABLE);
+  if (TRACE)
+    traceStart(OUTPUT_DIR + '/' + VARIABLE + "_" + to_string(ibigOffset) + "_trace.json");
+
   for (int ibig=0; ibig<BIG_LOOP; ibig++) {
   	int ibigDb= ibigOffset+ibig;
     string outputPathL = OUTPUT_DIR + '/'+ VARIABLE + "_" + to_string(ibigDb)+"_LLB"+ to_string(LBACK)+ ".csv";
     string outputPathH = OUTPUT_DIR + '/' + VARIABLE + "_" + to_string(ibigDb) + "_HLB" + to_string(LBACK) + ".csv";
+    HealthMonitor healthMonitor(HEALTH_MAX_STATE_ABS, HEALTH_STRIKES_TO_QUARANTINE);
     vector<float> perfValid_vect; 
     int epochOfLastChangeOfLRate = -1;
     
@@ -760,6 +754,9 @@ int main(int argc, char** argv) {
     
     //nesting: ibig
     for (int iEpoch=0; iEpoch<NUM_OF_TRAIN_EPOCHS; iEpoch++) {
+      Metrics epochMetrics;
+      TraceSpan epochSpan("epoch");
+      double begin_time = nowSecs();
       #if defined USE_ODBC
         TRYODBC(hInsertStmt,
         SQL_HANDLE_STMT,
@@ -768,6 +765,7 @@ int main(int argc, char** argv) {
     
       unordered_map<string, array<float, NUM_OF_NETS>> netPerf_map;
       for (int inet=0; inet<NUM_OF_NETS; inet++) {  //Parellalize here, if you can :-)
+        TraceSpan netSpan("net epoch", inet);
         //initialize perf matrix
         for (auto iter = series_vect.begin() ; iter != series_vect.end(); ++iter) {
           string series=*iter;
@@ -800,7 +798,10 @@ int main(int argc, char** argv) {
         for (auto iter = oneNetAssignments.begin() ; iter != oneNetAssignments.end(); ++iter) {
           string series=*iter;
           auto m4Obj=allSeries_map[series];
+          if (healthMonitor.isQuarantined(series))
+            continue;
         
+          double phaseStart = nowSecs();
           ComputationGraph cg;
           for (int il=0; il<dilations.size(); il++) {
             rNNStack[il].new_graph(cg);
@@ -1021,77 +1022,44 @@ int main(int argc, char** argv) {
           loss_exp = loss_exp + cStateLossP_ex;
         }
           
+        epochMetrics.count(COUNTER_SERIES);
+        epochMetrics.count(COUNTER_GRAPH_NODES, (double)cg.nodes.size());
+        phaseStart = epochMetrics.times.add(PHASE_BUILD, phaseStart, series, m4Obj.n); //includes forward of the few nodes evaluated while building, e.g. in pinBallLoss
         float loss = as_scalar(cg.forward(loss_exp));
+        phaseStart = epochMetrics.times.add(PHASE_FORWARD, phaseStart, series, m4Obj.n);
         epochLosses.push_back(loss);//losses of all series in one epoch
 
         float forecastLoss = loss - levVarLoss - cStateLoss;
           forecLosses.push_back(forecastLoss);
         
           cg.backward(loss_exp);
-          try {
-            trainer->update();//update shared weights
-            perSeriesTrainer->update();//update params of this series only
-          } catch (exception& e) {//it may happen occasionally. I believe it is due to not robust enough implementation of squashing functions in Dynet. When abs(x)>35 NAs appear.
-          //so the code below is trying to produce some diagnostics, hopefully useful when setting LEVEL_VARIABILITY_PENALTY and  C_STATE_PENALTY.
-            cerr<<"cought exception while doing "<<series<<endl;
-            cerr << e.what() << endl;
-            
-            float minSeason=BIG_FLOAT;
-            for (int isea = 0; isea < season_exVect.size(); isea++) {
-              float val= as_scalar(season_exVect[isea].value());
-              //cout << " " << val;
-              if (val<minSeason)
-                minSeason=val;
-            }  
-            cout << "min season:"<<minSeason<<endl;
-
-            minSeason = BIG_FLOAT;
-            for (int isea = 0; isea < season2_exVect.size(); isea++) {
-              float val = as_scalar(season2_exVect[isea].value());
-              //cout << " " << val;
-              if (val<minSeason)
-                minSeason = val;
-            }
-            cout << "min season2:"<<minSeason<<endl;
-
-            float minLevel = BIG_FLOAT;
-            for (int isea = 0; isea < levels_exVect.size(); isea++) {
-              float val = as_scalar(levels_exVect[isea].value());
-              //cout << " " << val;
-              if (val<minLevel)
-                minLevel = val;
+          phaseStart = epochMetrics.times.add(PHASE_BACKWARD, phaseStart, series, m4Obj.n);
+          healthMonitor.begin();
+          healthMonitor.addGradients(pc);
+          healthMonitor.addGradient(additionalParams.levSm);
+          healthMonitor.addGradient(additionalParams.sSm);
+          healthMonitor.addGradient(additionalParams.sSm2);
+          healthMonitor.addGradients(additionalParams.initSeasonality);
+          healthMonitor.addGradients(additionalParams.initSeasonality2);
+          healthMonitor.addStates(rNNStack);
+          bool updated = false;
+          if (healthMonitor.healthy()) {
+            try {
+              trainer->update();//update shared weights
+              perSeriesTrainer->update();  //update params of this series only
+              updated = true;
+            } catch (exception& e) {  //rare, the health check catches most of the numerical problems before
+              epochMetrics.count(COUNTER_UPDATE_EXCEPTIONS);
+              cerr<<"cought exception while doing "<<series<<endl;
+              cerr << e.what() << endl;
             }
-            cout << "min level:"<<minLevel<<endl;
-
-            float maxAbs = 0; int timeOfMax = 0; int layerOfMax = 0; int chunkOfMax=0;
-            for (int irnn = 0; irnn < rNNStack.size(); irnn++) {
-              auto state_vEx= rNNStack[irnn].c;//(time,layers)
-              for (int it = 0; it < state_vEx.size(); it++) {  //through time
-                for (int il = 0; il < state_vEx[it].size(); il++) {//through layers. Each layer has two states: c and h
-                  auto state=as_vector(state_vEx[it][il].value());
-                  for (int iv = 0; iv < state.size(); iv++) {
-                    if (abs(state[iv]) > maxAbs) {
-                      maxAbs = abs(state[iv]);
-                      timeOfMax=it;
-                      layerOfMax=il;
-                      chunkOfMax= irnn;
-                    }
-                  }
-                } //through layers/states
-              } //through time
-            }  //through chunks
-
-            cout << "levSm:" << as_scalar(levSm_ex.value()) << endl;
-            if (SEASONALITY_NUM > 0) 
-              cout << "sSm:" << as_scalar(sSm_ex.value()) << endl;
-            if (SEASONALITY_NUM > 1) 
-              cout << "sSm2:" << as_scalar(sSm2_ex.value()) << endl;
-            cout << "max abs:" << maxAbs <<" at time:"<< timeOfMax<<" at layer:"<< layerOfMax<<" and chunk:"<< chunkOfMax<<endl;
-
-            //diagSeries.insert(series);
+          }
+          if (!updated) {
+            healthMonitor.strike(series, epochMetrics);
             pc.reset_gradient();
             perSeriesPC.reset_gradient();
           }
+          epochMetrics.times.add(PHASE_UPDATE, phaseStart, series, m4Obj.n);
 
           //diagnostics saving
           AdditionalParamsF histAdditionalParams;
@@ -1145,12 +1113,16 @@ int main(int argc, char** argv) {
         }
         cout<<endl;
       }//through nets. This should be done in parallel. One day it will, when Dynet allows it.
+      cout << nowSecs() - begin_time << "s" << endl;
 
 
       //Validation. We just save outputs of all nets on all series
       //We can't attach validation to training, because training happens across subset of series*nets, and we need to store results from all of these combinations, for future use
       //level: epoch, but we do not use the epoch value, we overwrite
+      begin_time = nowSecs();
+      double validationStart = begin_time;
       for (int inet=0; inet<NUM_OF_NETS; inet++) { //through _all_ nets. Paralellize here.
+        TraceSpan tileSpan("validation tile", inet);
         auto& rNNStack=rnnStack_arr[inet];
         Parameter& MLPW_par = MLPW_parArr[inet];
         Parameter& MLPB_par = MLPB_parArr[inet];
@@ -1161,6 +1133,7 @@ int main(int argc, char** argv) {
           string series=*iter;
           auto m4Obj=allSeries_map[series];
 
+          epochMetrics.count(COUNTER_VALIDATION_SERIES);
           ComputationGraph cg;
           for (int il=0; il<dilations.size(); il++) {
             rNNStack[il].new_graph(cg);
@@ -1385,6 +1358,7 @@ int main(int argc, char** argv) {
           } //time to average
         }//through series
       } //through nets
+      cout << nowSecs() - begin_time << "s" << endl;
       
       if (iEpoch>0 && iEpoch % FREQ_OF_TEST==0) {
         //now that we have saved outputs of all nets on all series, let's calc how best and topn combinations performed during current epoch.
@@ -1503,9 +1477,11 @@ int main(int argc, char** argv) {
                       SQL_HANDLE_STMT,
                       SQLBindParameter(hInsertStmt, ipos+1, SQL_PARAM_INPUT, SQL_C_FLOAT, SQL_FLOAT, 0, 0, (SQLPOINTER)&avgAvg[iii+iv*OUTPUT_SIZE], 0, NULL));
                 }
+                validationStart = epochMetrics.times.add(PHASE_VALIDATION, validationStart);
                 TRYODBC(hInsertStmt,
                  SQL_HANDLE_STMT,
                  SQLExecute(hInsertStmt));                 
+                validationStart = epochMetrics.times.add(PHASE_ODBC, validationStart);
               }
 #endif               
               float qLoss = errorFunc(avgAvg, m4Obj.testVals, m4Obj.meanAbsSeasDiff);
@@ -1566,6 +1542,7 @@ int main(int argc, char** argv) {
           }
         }
       }
+      validationStart = epochMetrics.times.add(PHASE_VALIDATION, validationStart);
 #if defined USE_ODBC  
       TRYODBC(hDbc,
       SQL_HANDLE_DBC,
@@ -1573,7 +1550,9 @@ int main(int argc, char** argv) {
         SQL_HANDLE_DBC,
         hDbc,
         SQL_COMMIT));
+      epochMetrics.times.add(PHASE_ODBC, validationStart);
 #endif
+      metricsExporter.writeEpoch(ibig, iEpoch, epochMetrics);
     }//through epochs of RNN
     
     //some diagnostic info
@@ -1643,6 +1622,8 @@ int main(int argc, char** argv) {
     }//end of diag printing
     
     //save the forecast to outputFile
+    Metrics outputMetrics;
+    double outputStart = nowSecs();
     ofstream outputFile;
     outputFile.open(outputPathL);
     for (auto iter = series_vect.begin(); iter != series_vect.end(); ++iter) {
@@ -1663,6 +1644,8 @@ int main(int argc, char** argv) {
       outputFile << endl;
     }
     outputFile.close();
+    outputMetrics.times.add(PHASE_OUTPUT, outputStart);
+    metricsExporter.writeIbig(ibig, outputMetrics);
     
     //delete    
     for (int inet = 0; inet<NUM_OF_NETS; inet++) {
@@ -1678,6 +1661,7 @@ int main(int argc, char** argv) {
     additionalParams_mapOfArr.clear();
     historyOfAdditionalParams_map.clear();
   }//big loop
+  traceFinish();
 }//main
 
 
@@ -48,6 +48,10 @@ So, you need comment/uncomment to have one block of interest active.
 #include "dynet/expr.h"
 #include "dynet/lstm.h"
 #include "slstm.h" //my implementation of dilated LSTMs
+#include "accuracy.h"
+#include "metrics.h"
+#include "health.h"
+#include "placement.h"
 
 
 #if defined USE_ODBC        
@@ -179,10 +183,16 @@ const int MIDDLE_POS_FOR_AVG = 2; //if using medians
 const float NOISE_STD=0.001; 
 const int FREQ_OF_TEST=1;
 const float GRADIENT_CLIPPING=20;
+const float HEALTH_MAX_STATE_ABS = 1000; //a training step with a larger, or non-finite, c-state, or with a non-finite gradient, is skipped. See health.h
+const int HEALTH_STRIKES_TO_QUARANTINE = 3; //a series skipped that many times is not trained anymore in the ibig run
 const float C_STATE_PENALTY = 0;
 
 const float BIG_FLOAT=1e38;//numeric_limits<float>::max();
 const bool PRINT_DIAGN=true;
+const string METRICS_FORMAT = "jsonl"; //"jsonl": <OUTPUT_DIR>/<VARIABLE>_<seed>_<chunk>_metrics.jsonl gets a line per epoch and per ibig, "prometheus": <...>_metrics.prom is rewritten after every epoch, "": no metrics file. See metrics.h
+const bool TRACE = false; //Chrome trace-event timeline of build/forward/backward/update/validation spans, per series, written to <OUTPUT_DIR>/<VARIABLE>_<seed>_<chunk>_trace.json, for Perfetto or chrome://tracing. See trace.h
+const int BLAS_THREADS = 1; //threads of the BLAS library (MKL, OpenBLAS) in this process. More than 1 only oversubscribes the cores when many workers run. See placement.h
+const bool PIN_TO_CORES = false; //pin to the core of the slot given by ESRNN_SLOT (or the MPI local rank), and prefer the memory of its NUMA node. Off by default; without a slot nothing is pinned anyway
 const unsigned ATTENTION_HSIZE=STATE_HSIZE;
 
 const bool USE_AUTO_LEARNING_RATE=false;
@@ -349,41 +359,19 @@ Expression MSIS(const Expression& out_ex, const Expression& actuals_ex) {
 
 // weighted quantile Loss, used just for diagnostics, if if LBACK>0 and PERCENTILE!=50
 float wQuantLoss(vector<float>& out_vect, vector<float>& actuals_vect, float tau, int offset) {//used just for diagnostics, if if LBACK>0 and PERCENTILE!=50
-  float sumf = 0; float suma = 0;
-  for (unsigned int indx = 0; indx<OUTPUT_SIZE; indx++) {
-    auto forec = out_vect[indx+ offset];
-    auto actual = actuals_vect[indx];
-    suma += abs(actual);
-    if (actual > forec)
-      sumf = sumf + (actual - forec)*tau;
-    else
-      sumf = sumf + (actual - forec)*(tau - 1);
-  }
-  return sumf / suma * 200;
+  return wQuantLoss(out_vect.data() + offset, actuals_vect.data(), OUTPUT_SIZE_I, tau);
 }
 
 //MSIS operating on floats, used for validation
 float errorFunc(vector<float>& out_vect, vector<float>& actuals_vect, float meanAbsSeasDiff) {
-  float sumf=0;
-  for (unsigned int indx = 0; indx<OUTPUT_SIZE; indx++) {
-    auto forecL = out_vect[indx];
-    auto forecH = out_vect[indx + OUTPUT_SIZE];
-    auto actualf = actuals_vect[indx];
-
-    float loss = forecH - forecL;
-    if (actualf< forecL)
-      loss = loss + (forecL - actualf)*ALPHA_MULTIP;
-    if (actualf > forecH)
-      loss = loss + (actualf - forecH)*ALPHA_MULTIP;
-    sumf+=loss;
-  }
-  return sumf / (OUTPUT_SIZE*meanAbsSeasDiff);
+  return MSIS(out_vect.data(), out_vect.data() + OUTPUT_SIZE_I, actuals_vect.data(), OUTPUT_SIZE_I, ALPHA_MULTIP, meanAbsSeasDiff);
 }
 
 
 
 
 int main(int argc, char** argv) {
+  placeProcess(BLAS_THREADS, PIN_TO_CORES); //before Dynet allocates its memory
   dynet::initialize(argc, argv);
 
   int seedForChunks = 10; //Yes it runs, without any params, but it will work only on 1/NUM_OF_CHUNKS of all cases. The system is expected to run in NUM_OF_CHUNKS multiples.
@@ -600,11 +588,16 @@ int main(int argc, char** argv) {
   
   unordered_map<string, array<vector<float>, AVERAGING_LEVEL+1>> testResults_map((int)chunkSize*1.5);
   set<string> diagSeries;
+  MetricsExporter metricsExporter;
+  metricsExporter.open(METRICS_FORMAT, OUTPUT_DIR + '/' + VARIABLE + "_" + to_string(seedForChunks) + "_" + to_string(chunkNo) + "_metrics", "ES_RNN_PI", VARIABLE);
+  if (TRACE)
+    traceStart(OUTPUT_DIR + '/' + VARIABLE + "_" + to_string(seedForChunks) + "_" + to_string(chunkNo) + "_trace.json");
   
   for (int ibig=0; ibig<BIG_LOOP; ibig++) { //the loop :-)
 	  int ibigDb= ibigOffset+ibig;
     string outputPathL = OUTPUT_DIR + '/'+ VARIABLE + "_" + to_string(ibigDb)+"_LLB"+ to_string(LBACK)+ ".csv";
     string outputPathH = OUTPUT_DIR + '/' + VARIABLE + "_" + to_string(ibigDb) + "_HLB" + to_string(LBACK) + ".csv";
+    HealthMonitor healthMonitor(HEALTH_MAX_STATE_ABS, HEALTH_STRIKES_TO_QUARANTINE);
     vector<float> perfValid_vect; 
     int epochOfLastChangeOfLRate = -1;
     
@@ -677,6 +670,8 @@ int main(int argc, char** argv) {
     }
     
     for (int iEpoch=0; iEpoch<NUM_OF_TRAIN_EPOCHS; iEpoch++) {
+      Metrics epochMetrics;
+      TraceSpan epochSpan("epoch");
       if (!USE_AUTO_LEARNING_RATE && LEARNING_RATES.find(iEpoch) != LEARNING_RATES.end()) {
         trainer.learning_rate = LEARNING_RATES.at(iEpoch);
         cout << "changing LR to:" << trainer.learning_rate << endl;
@@ -711,6 +706,7 @@ int main(int argc, char** argv) {
           SQLBindParameter(hInsertStmt, OFFSET_TO_FIRST_ACTUAL + 2 * OUTPUT_SIZE_I + 3, SQL_PARAM_INPUT, SQL_C_SLONG, SQL_INTEGER, 0, 0, (SQLPOINTER)&m4Obj.n, 0, NULL));
         #endif
       
+        double phaseStart = nowSecs();
         ComputationGraph cg;
          for (int il=0; il<dilations.size(); il++) {
            rNNStack[il].new_graph(cg);
@@ -848,66 +844,44 @@ int main(int argc, char** argv) {
           loss_exp = loss_exp + cStateLossP_ex;
         }
           
+        epochMetrics.count(COUNTER_SERIES);
+        epochMetrics.count(COUNTER_GRAPH_NODES, (double)cg.nodes.size());
+        phaseStart = epochMetrics.times.add(PHASE_BUILD, phaseStart, series, m4Obj.n); //includes forward of the few nodes evaluated while building, e.g. in pinBallLoss
         float loss = as_scalar(cg.forward(loss_exp));
+        phaseStart = epochMetrics.times.add(PHASE_FORWARD, phaseStart, series, m4Obj.n);
         trainingLosses.push_back(loss);//losses of all series in one epoch
 
         float forecastLoss = loss - levVarLoss - cStateLoss;
         forecLosses.push_back(forecastLoss);
 
-        cg.backward(loss_exp);
-        try {
-          trainer.update();//update shared weights
-          perSeriesTrainer.update();  //apdate params of this series only
-        } catch (exception& e) {  //long diagnostics for this unlikely event :-)
-          cerr<<"cought exception while doing "<<series<<endl;
-          cerr << e.what() << endl;
-
-            float minSeason = BIG_FLOAT;
-            cout << "season:";
-            for (int isea = 0; isea < season_exVect.size(); isea++) {
-              float val = as_scalar(season_exVect[isea].value());
-              //cout << " " << val;
-              if (val<minSeason)
-                minSeason = val;
-            }
-
-            float minLevel = BIG_FLOAT;
-            cout << "levels:";
-            for (int isea = 0; isea < levels_exVect.size(); isea++) {
-              float val = as_scalar(levels_exVect[isea].value());
-              //cout << " " << val;
-              if (val<minLevel)
-                minLevel = val;
+        if (!healthMonitor.isQuarantined(series)) { //a quarantined series still gets its forecast, but does not train anymore
+          cg.backward(loss_exp);
+          phaseStart = epochMetrics.times.add(PHASE_BACKWARD, phaseStart, series, m4Obj.n);
+          healthMonitor.begin();
+          healthMonitor.addGradients(pc);
+          healthMonitor.addGradient(additionalParams.levSm);
+          healthMonitor.addGradient(additionalParams.sSm);
+          healthMonitor.addGradients(additionalParams.initSeasonality);
+          healthMonitor.addStates(rNNStack);
+          bool updated = false;
+          if (healthMonitor.healthy()) {
+            try {
+              trainer.update();//update shared weights
+              perSeriesTrainer.update();  //update params of this series only
+              updated = true;
+            } catch (exception& e) {  //rare, the health check catches most of the numerical problems before
+              epochMetrics.count(COUNTER_UPDATE_EXCEPTIONS);
+              cerr<<"cought exception while doing "<<series<<endl;
+              cerr << e.what() << endl;
             }
-
-            float maxAbs = 0; int timeOfMax = 0; int layerOfMax = 0; int chunkOfMax = 0;
-            for (int irnn = 0; irnn < rNNStack.size(); irnn++) {
-              auto state_vEx = rNNStack[irnn].c;//(time,layers)
-              for (int it = 0; it < state_vEx.size(); it++) {  //through time
-                for (int il = 0; il < state_vEx[it].size(); il++) {//through layers. Each layer has two states: c and h
-                  auto state = as_vector(state_vEx[it][il].value());
-                  for (int iv = 0; iv < state.size(); iv++) {
-                    if (abs(state[iv]) > maxAbs) {
-                      maxAbs = abs(state[iv]);
-                      timeOfMax = it;
-                      layerOfMax = il;
-                      chunkOfMax = irnn;
-                    }
-                  }
-                } //through layers/states
-              } //through time
-            }  //through chunks
-
-            cout << "levSm:" << as_scalar(levSm_ex.value()) << endl;
-            cout << "sSm:" << as_scalar(sSm_ex.value()) << endl;
-            cout << " min season=" << minSeason << endl;
-            cout << " min level=" << minLevel << endl;
-            cout << " max abs:" << maxAbs << " at time:" << timeOfMax << " at layer:" << layerOfMax << " and chunk:" << chunkOfMax << endl;
-
-            //diagSeries.insert(series);
-          pc.reset_gradient();
-          perSeriesPC.reset_gradient();
+          }
+          if (!updated) {
+            healthMonitor.strike(series, epochMetrics);
+            pc.reset_gradient();
+            perSeriesPC.reset_gradient();
+          }
         }
+        phaseStart = epochMetrics.times.add(PHASE_UPDATE, phaseStart, series, m4Obj.n);
 
         //saving per-series values for diagnostics purposes
         AdditionalParamsF &histAdditionalParams= historyOfAdditionalParams_map[series]->at(iEpoch);
@@ -1039,16 +1013,21 @@ int main(int argc, char** argv) {
                       SQL_HANDLE_STMT,
                       SQLBindParameter(hInsertStmt, ipos+1, SQL_PARAM_INPUT, SQL_C_FLOAT, SQL_FLOAT, 0, 0, (SQLPOINTER)&testResults_map[series][AVERAGING_LEVEL][io + iv*OUTPUT_SIZE_I], 0, NULL));
                   }
-                  if (MAX_NUM_OF_SERIES<0)
+                  if (MAX_NUM_OF_SERIES<0) {
+                    phaseStart = epochMetrics.times.add(PHASE_VALIDATION, phaseStart);
                     TRYODBC(hInsertStmt,
                       SQL_HANDLE_STMT,
                       SQLExecute(hInsertStmt));
+                    phaseStart = epochMetrics.times.add(PHASE_ODBC, phaseStart);
+                  }
                 }
                 #endif    
               } //lback>0
             } //time to average
           }//last anchor point of the series
         }//through TEST loop        
+        epochMetrics.times.add(PHASE_VALIDATION, phaseStart, series, m4Obj.n);
+        epochMetrics.count(COUNTER_VALIDATION_SERIES);
       }//through series
 
   
@@ -1104,13 +1083,17 @@ int main(int argc, char** argv) {
         }
       }
       #if defined USE_ODBC 
-      TRYODBC(hDbc,
-        SQL_HANDLE_DBC,
-        SQLEndTran(
+      {
+        ScopedTimer odbcTimer(epochMetrics.times, PHASE_ODBC);
+        TRYODBC(hDbc,
           SQL_HANDLE_DBC,
-          hDbc,
-          SQL_COMMIT));
+          SQLEndTran(
+            SQL_HANDLE_DBC,
+            hDbc,
+            SQL_COMMIT));
+      }
       #endif    
+      metricsExporter.writeEpoch(ibig, iEpoch, epochMetrics);
     }//through epochs
 
     if (PRINT_DIAGN) {//some diagnostic info
@@ -1153,6 +1136,8 @@ int main(int argc, char** argv) {
     }
 
     //save the forecast to outputFile
+    Metrics outputMetrics;
+    double outputStart = nowSecs();
     ofstream outputFile;
     outputFile.open(outputPathL);
     for (auto iter = oneChunk_vect.begin(); iter != oneChunk_vect.end(); ++iter) {
@@ -1173,6 +1158,8 @@ int main(int argc, char** argv) {
       outputFile<<endl;
     }
     outputFile.close();
+    outputMetrics.times.add(PHASE_OUTPUT, outputStart);
+    metricsExporter.writeIbig(ibig, outputMetrics);
 
     //delete
     for (auto iter = oneChunk_vect.begin(); iter != oneChunk_vect.end(); ++iter) {
@@ -1181,6 +1168,7 @@ int main(int argc, char** argv) {
       delete addHistArr_ptr;
     }
   }//ibig
+  traceFinish();
 }//main
 
 #if defined USE_ODBC
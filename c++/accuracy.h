@@ -0,0 +1,70 @@
+/**
+* file accuracy.h
+* accuracy measures shared by the ES-RNN programs and esrnn_merge
+  - sMAPE - symmetric MAPE, as used in M4, for point forecasts (PERCENTILE==50)
+  - wQuantLoss - weighted quantile loss, for other percentiles
+  - MASE - mean absolute scaled error, scaled by mean absolute seasonal difference of the series
+  - MSIS - mean scaled interval score, for prediction intervals
+* All take raw pointers and the horizon, so they can be used both on vector<float> in the programs and on packed buffers in the merger.
+*/
+
+#ifndef ESRNN_ACCURACY_H_
+#define ESRNN_ACCURACY_H_
+
+#include <math.h>
+
+//used just for diagnostics, if LBACK>0 and PERCENTILE==50
+inline float sMAPE(const float* forec, const float* actuals, int horizon) {
+  float sumf = 0;
+  for (int indx = 0; indx<horizon; indx++)
+    sumf += fabsf(forec[indx] - actuals[indx]) / (fabsf(forec[indx]) + fabsf(actuals[indx]));
+  return sumf / horizon * 200;
+}
+
+// weighted quantile Loss, used just for diagnostics, if LBACK>0 and PERCENTILE!=50
+inline float wQuantLoss(const float* forec, const float* actuals, int horizon, float tau) {
+  float sumf = 0; float suma = 0;
+  for (int indx = 0; indx<horizon; indx++) {
+    float actual = actuals[indx];
+    suma += fabsf(actual);
+    if (actual > forec[indx])
+      sumf = sumf + (actual - forec[indx])*tau;
+    else
+      sumf = sumf + (actual - forec[indx])*(tau - 1);
+  }
+  return sumf / suma * 200;
+}
+
+//mean of abs(vals[i]-vals[i-seasonality]). Scaling denominator of MASE and MSIS. Returns 0 if the series is flat or too short.
+inline float meanAbsSeasDiff(const float* vals, int n, int seasonality) {
+  float sumf = 0;
+  for (int ip = seasonality; ip<n; ip++)
+    sumf += fabsf(vals[ip] - vals[ip - seasonality]);
+  if (sumf>0)
+    return sumf / (n - seasonality);
+  return 0;
+}
+
+inline float MASE(const float* forec, const float* actuals, int horizon, float meanAbsSeasDiff) {
+  float sumf = 0;
+  for (int indx = 0; indx<horizon; indx++)
+    sumf += fabsf(forec[indx] - actuals[indx]);
+  return sumf / (horizon*meanAbsSeasDiff);
+}
+
+//alphaMultip==2/ALPHA
+inline float MSIS(const float* forecL, const float* forecH, const float* actuals, int horizon, float alphaMultip, float meanAbsSeasDiff) {
+  float sumf = 0;
+  for (int indx = 0; indx<horizon; indx++) {
+    float actualf = actuals[indx];
+    float loss = forecH[indx] - forecL[indx];
+    if (actualf< forecL[indx])
+      loss = loss + (forecL[indx] - actualf)*alphaMultip;
+    if (actualf > forecH[indx])
+      loss = loss + (actualf - forecH[indx])*alphaMultip;
+    sumf += loss;
+  }
+  return sumf / (horizon*meanAbsSeasDiff);
+}
+
+#endif
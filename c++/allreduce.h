@@ -0,0 +1,125 @@
+/**
+* file allreduce.h
+* synchronous, deterministic data-parallel training of the shared weights of ES_RNN (DATA_PARALLEL), Linux/Mac only, CPU only.
+* The workers are the processes of workers.h. In every round each worker does one series, backward writes the gradients of the shared weights (pc)
+* into the worker's own slot of a preallocated shared buffer, and then:
+  - the slots are summed by a binary tree, always in the same order, so the sum does not depend on timing,
+  - worker 0 averages the sum over the series that contributed a gradient (not skipped by the health check, nor quarantined) and makes one trainer step on the shared weights (they live in the shared parameter memory),
+  - all workers wait for the step to finish, and start the next round.
+* The per-series parameters are updated by the worker doing the series, as before. Their gradients are moved to private memory,
+* so that the gradient clipping of a worker does not see the gradients of the other workers.
+* PrivateGradients, used by HOGWILD for all the gradients, is that private memory.
+* For a given number of workers the results are reproducible, provided the BLAS library runs single-threaded.
+*/
+
+#ifndef ESRNN_ALLREDUCE_H_
+#define ESRNN_ALLREDUCE_H_
+
+#include <vector>
+#include <initializer_list>
+#include <algorithm>
+#include <exception>
+#include <iostream>
+#include "dynet/dynet.h"
+#include "dynet/model.h"
+#include "dynet/training.h"
+#include "metrics.h"
+#include "workers.h"
+
+const size_t GRADIENT_ALIGNMENT = 16; //floats, every tensor starts on a 64 byte boundary
+
+inline size_t gradientFloats(const dynet::ParameterCollection& pc) {
+  size_t size = 0;
+  for (auto& storage : pc.parameters_list())
+    size += (storage->g.d.size() + GRADIENT_ALIGNMENT - 1) / GRADIENT_ALIGNMENT * GRADIENT_ALIGNMENT;
+  return size;
+}
+
+//points the gradient tensors of pc into memory[], and zeroes them
+inline void moveGradients(const dynet::ParameterCollection& pc, float* memory) {
+  for (auto& storage : pc.parameters_list()) {
+    size_t size = storage->g.d.size();
+    storage->g.v = memory;
+    std::fill(memory, memory + size, 0.f);
+    memory += (size + GRADIENT_ALIGNMENT - 1) / GRADIENT_ALIGNMENT * GRADIENT_ALIGNMENT;
+  }
+}
+
+//Gradients of the collections in private memory. The parameter memory (dynetParams.shared_parameters) holds the gradients too,
+//so without it every worker would add into, clip and reset the gradients of the others. Create it before the first fork: the vector is copied on write by the children.
+struct PrivateGradients {
+  std::vector<float> memory;
+
+  PrivateGradients(std::initializer_list<const dynet::ParameterCollection*> pcs) {
+    size_t size = GRADIENT_ALIGNMENT;
+    for (auto pc : pcs)
+      size += gradientFloats(*pc);
+    memory.resize(size);
+    float* at = memory.data();
+    while ((size_t)at % (GRADIENT_ALIGNMENT*sizeof(float)) != 0)
+      at++;
+    for (auto pc : pcs) {
+      moveGradients(*pc, at);
+      at += gradientFloats(*pc);
+    }
+  }
+};
+
+struct GradientAllReduce {
+  int numOfWorkers;
+  size_t slotSize;
+  SharedArray<float> slots; //[worker][slotSize]
+  SharedArray<char> contributed; //[worker], in the current round
+  SpinBarrier barrier;
+  PrivateGradients perSeriesGradients;
+
+  //call before the first fork
+  GradientAllReduce(int numOfWorkers_, const dynet::ParameterCollection& pc, const dynet::ParameterCollection& perSeriesPC) :
+    numOfWorkers(numOfWorkers_), slotSize(gradientFloats(pc)), slots(numOfWorkers_*gradientFloats(pc)), contributed(numOfWorkers_), barrier(numOfWorkers_),
+    perSeriesGradients({ &perSeriesPC }) {
+    moveGradients(pc, &slots[0]);
+  }
+
+  //call in every worker, right after the fork
+  void attach(int worker, const dynet::ParameterCollection& pc) {
+    moveGradients(pc, &slots[worker*slotSize]);
+  }
+
+  //Called by all workers at the end of a round, also by those that had no series in it. hasGradient: the worker's slot holds the gradient of its series,
+  //otherwise it is zero (no series, or the update was skipped) and the series does not count in the average.
+  void reduceAndUpdate(int worker, dynet::ParameterCollection& pc, dynet::Trainer& trainer, bool hasGradient, Metrics& metrics) {
+    contributed[worker] = hasGradient;
+    barrier.wait(); //all gradients ready
+    int roundSize = 0;
+    for (int w = 0; w < numOfWorkers; w++)
+      roundSize += contributed[w];
+    for (int step = 1; step < numOfWorkers; step *= 2) {
+      if (worker % (2 * step) == 0 && worker + step < numOfWorkers) {
+        float* sum = &slots[worker*slotSize];
+        const float* other = &slots[(worker + step)*slotSize];
+        for (size_t i = 0; i < slotSize; i++)
+          sum[i] += other[i];
+      }
+      barrier.wait();
+    }
+    if (worker == 0 && roundSize > 0) {
+      float* sum = &slots[0];
+      const float scale = 1.f / roundSize;
+      for (size_t i = 0; i < slotSize; i++)
+        sum[i] *= scale;
+      for (auto& storage : pc.parameters_list())
+        storage->nonzero_grad = true; //some may have been touched only by the other workers
+      try {
+        trainer.update();
+      } catch (std::exception& e) {  //the health check already removed the non-finite gradients, so it is rare
+        metrics.count(COUNTER_UPDATE_EXCEPTIONS);
+        std::cerr << "cought exception while updating shared weights" << std::endl;
+        std::cerr << e.what() << std::endl;
+      }
+    }
+    barrier.wait(); //the step has been made, the slots can be reused
+    pc.reset_gradient();
+  }
+};
+
+#endif
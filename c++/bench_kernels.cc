@@ -0,0 +1,548 @@
+/*bench_kernels: micro-benchmarks of the ES-RNN hot kernels
+
+Measures, in isolation and on synthetic data, the pieces that dominate the run time of ES_RNN*.cc:
+  - the Exponential Smoothing recurrence (levels, seasonality, level variability penalty), as built in the programs,
+  - one step of the dilated LSTM stack (DilatedLSTMBuilder, ResidualDilatedLSTMBuilder, AttentiveDilatedLSTMBuilder) for the dilation configs shipped in the programs,
+  - the learning loss functions: pinBallLoss and MSIS (Dynet expressions), and the float accuracy measures from accuracy.h,
+  - one full per-series training step: forward, backward, and both AdamTrainer updates,
+  - the validation (TEST walk) forward of one series,
+  - the decode of the compressed series store (series_store.h), with its compression ratio.
+Besides time per iteration (ns/op), every benchmark reports heap allocations per iteration (allocs/op), counted by replacing the global operator new.
+Dynet tensor memory comes from its own pools, so it is not included in allocs/op; fxsBytes/op reports how much of the forward pool a benchmark used.
+
+It uses Google Benchmark (https://github.com/google/benchmark) and Dynet, see linux_example_scripts/build_bench.
+Usage, e.g.:
+bench_kernels --benchmark_filter=Step
+bench_kernels --benchmark_format=json --benchmark_out=bench.json
+Dynet options, e.g. --dynet-mem, can be given too, they are removed before Google Benchmark parses the rest.
+*/
+
+#include "dynet/dynet.h"
+#include "dynet/training.h"
+#include "dynet/expr.h"
+#include "dynet/model.h"
+#include "dynet/globals.h"
+#include "slstm.h" //my implementation of dilated LSTMs
+#include "accuracy.h"
+#include "series_store.h"
+
+#include "benchmark/benchmark.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <array>
+#include <math.h>
+
+using namespace std;
+using namespace dynet;
+
+//PARAMS--------------
+//The defaults correspond to Quarterly in ES_RNN.cc; the dilation configs of all the programs are benchmarked separately, see stackConfigs below.
+const int SEASONALITY = 4;
+const unsigned int INPUT_SIZE = 4;
+const int INPUT_SIZE_I = INPUT_SIZE;
+const unsigned int OUTPUT_SIZE = 8;
+const int OUTPUT_SIZE_I = OUTPUT_SIZE;
+const unsigned int STATE_HSIZE = 40;
+const vector<vector<unsigned>> dilations = { { 1,2 },{ 4,8 } };
+const int SERIES_LENGTH = 72; //of the synthetic series used by the train step and validation forward benchmarks
+const float LEVEL_VARIABILITY_PENALTY = 80;
+const float TRAINING_TAU = 0.45;
+const float ALPHA = 0.05;
+const float ALPHA_MULTIP = 2 / ALPHA;
+
+const unsigned int NUM_OF_CATEGORIES = 6;
+const float NOISE_STD = 0.001;
+const float EPS = 1e-6;
+const float GRADIENT_CLIPPING = 20;
+const float INITIAL_LEARNING_RATE = 0.001f;
+const unsigned SEED = 17;
+
+Expression squash(const Expression& x) {
+  return log(x);
+}
+
+Expression expand(const Expression& x) {
+  return exp(x);
+}
+
+
+//allocation counting
+static atomic<size_t> numOfAllocs(0);
+
+void* operator new(size_t size) {
+  numOfAllocs.fetch_add(1, memory_order_relaxed);
+  void* p = malloc(size == 0 ? 1 : size);
+  if (p == nullptr)
+    throw bad_alloc();
+  return p;
+}
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+void operator delete(void* p) noexcept {
+  free(p);
+}
+void operator delete[](void* p) noexcept {
+  free(p);
+}
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+void operator delete[](void* p, size_t) noexcept {
+  free(p);
+}
+
+//Call at the start of the timed loop; at the end of it, report() puts allocs/op and fxsBytes/op into the counters.
+struct AllocCounter {
+  size_t allocsAtStart;
+  size_t fxsBytes;
+  AllocCounter() : allocsAtStart(numOfAllocs.load()), fxsBytes(0) {}
+  void noteFxs() { //call while the graph is still alive
+    fxsBytes += default_device->pools[(int)DeviceMempool::FXS]->used();
+  }
+  void report(benchmark::State& state) {
+    state.counters["allocs/op"] = benchmark::Counter(double(numOfAllocs.load() - allocsAtStart), benchmark::Counter::kAvgIterations);
+    if (fxsBytes>0)
+      state.counters["fxsBytes/op"] = benchmark::Counter(double(fxsBytes), benchmark::Counter::kAvgIterations);
+  }
+};
+
+
+//synthetic data
+struct SynthSeries {
+  vector<float> vals;
+  vector<float> categories_vect;
+};
+
+//trend * seasonality * lognormal noise, always positive, as the ES recurrence requires
+SynthSeries makeSeries(int length, unsigned seed) {
+  mt19937 rng(seed);
+  normal_distribution<float> noise(0, 0.03f);
+  uniform_real_distribution<float> uni(0, 1);
+  SynthSeries ret;
+  float level = 1000 + 4000 * uni(rng);
+  float growth = 0.002f + 0.01f*uni(rng);
+  array<float, SEASONALITY> seas;
+  float sumSeas = 0;
+  for (int isea = 0; isea<SEASONALITY; isea++) {
+    seas[isea] = 1 + 0.3f*sinf(2 * 3.14159265f*isea / SEASONALITY + uni(rng));
+    sumSeas += seas[isea];
+  }
+  for (int i = 0; i<length; i++) {
+    level *= 1 + growth;
+    ret.vals.push_back(level*seas[i%SEASONALITY] * SEASONALITY / sumSeas*expf(noise(rng)));
+  }
+  ret.categories_vect.assign(NUM_OF_CATEGORIES, 0);
+  ret.categories_vect[seed%NUM_OF_CATEGORIES] = 1;
+  return ret;
+}
+
+const SynthSeries& theSeries() {
+  static SynthSeries series = makeSeries(SERIES_LENGTH, SEED);
+  return series;
+}
+
+
+//dilation configs, as in the PARAMS blocks of the programs
+struct StackConfig {
+  const char* name;
+  vector<vector<unsigned>> dilations;
+  unsigned inputSize;
+  unsigned stateHSize;
+};
+
+const vector<StackConfig> stackConfigs = {
+  { "Quarterly",{ { 1,2 },{ 4,8 } }, 4, 40 },
+  { "Monthly",{ { 1,3,6,12 } }, 12, 50 },
+  { "Daily",{ { 1,7,28 } }, 7, 40 },
+  { "Hourly_E",{ { 1,4 },{ 24,168 } }, 24, 40 },
+  { "Weekly_E",{ { 1,52 } }, 10, 40 },
+  { "Daily_E",{ { 1,3 },{ 7,14 } }, 7, 40 },
+  { "Yearly_E",{ { 1,6 } }, 4, 30 }
+};
+
+template <class Builder> Builder makeBuilder(const vector<unsigned>& dil, unsigned inputDim, unsigned hiddenDim, ParameterCollection& pc);
+template <> DilatedLSTMBuilder makeBuilder<DilatedLSTMBuilder>(const vector<unsigned>& dil, unsigned inputDim, unsigned hiddenDim, ParameterCollection& pc) {
+  return DilatedLSTMBuilder(dil, inputDim, hiddenDim, pc);
+}
+template <> ResidualDilatedLSTMBuilder makeBuilder<ResidualDilatedLSTMBuilder>(const vector<unsigned>& dil, unsigned inputDim, unsigned hiddenDim, ParameterCollection& pc) {
+  return ResidualDilatedLSTMBuilder(dil, inputDim, hiddenDim, pc);
+}
+template <> AttentiveDilatedLSTMBuilder makeBuilder<AttentiveDilatedLSTMBuilder>(const vector<unsigned>& dil, unsigned inputDim, unsigned hiddenDim, ParameterCollection& pc) {
+  return AttentiveDilatedLSTMBuilder(dil, inputDim, hiddenDim, hiddenDim, pc);
+}
+
+template <class Builder> vector<Builder> makeStack(const vector<vector<unsigned>>& dils, unsigned inputDim, unsigned hiddenDim, ParameterCollection& pc) {
+  vector<Builder> rNNStack;
+  rNNStack.emplace_back(makeBuilder<Builder>(dils[0], inputDim, hiddenDim, pc));
+  for (int il = 1; il<dils.size(); il++)
+    rNNStack.emplace_back(makeBuilder<Builder>(dils[il], hiddenDim, hiddenDim, pc));
+  return rNNStack;
+}
+
+template <class Builder> Expression stackStep(vector<Builder>& rNNStack, const Expression& input_ex) {
+  Expression rnn_ex = rNNStack[0].add_input(input_ex);
+  for (int il = 1; il<rNNStack.size(); il++)
+    rnn_ex = rnn_ex + rNNStack[il].add_input(rnn_ex); //resNet-style
+  return rnn_ex;
+}
+
+
+//the model of ES_RNN.cc: shared RNN stack + adapter, and per-series ES parameters
+struct AdditionalParams {
+  Parameter levSm;
+  Parameter sSm;
+  array<Parameter, SEASONALITY> initSeasonality;
+};
+
+template <class Builder> struct EsRnnModel {
+  ParameterCollection pc;
+  ParameterCollection perSeriesPC;
+  AdamTrainer trainer;
+  AdamTrainer perSeriesTrainer;
+  vector<Builder> rNNStack;
+  Parameter adapterW_par, adapterB_par;
+  AdditionalParams additionalParams;
+
+  EsRnnModel() : trainer(pc, INITIAL_LEARNING_RATE, 0.9, 0.999, EPS), perSeriesTrainer(perSeriesPC, INITIAL_LEARNING_RATE, 0.9, 0.999, EPS) {
+    trainer.clip_threshold = GRADIENT_CLIPPING;
+    perSeriesTrainer.clip_threshold = GRADIENT_CLIPPING;
+    rNNStack = makeStack<Builder>(dilations, INPUT_SIZE + NUM_OF_CATEGORIES, STATE_HSIZE, pc);
+    adapterW_par = pc.add_parameters({ OUTPUT_SIZE, STATE_HSIZE });
+    adapterB_par = pc.add_parameters({ OUTPUT_SIZE });
+    additionalParams.levSm = perSeriesPC.add_parameters({ 1 }, 0.5);
+    additionalParams.sSm = perSeriesPC.add_parameters({ 1 }, 0.5);
+    for (int isea = 0; isea<SEASONALITY; isea++)
+      additionalParams.initSeasonality[isea] = perSeriesPC.add_parameters({ 1 }, 0.5);
+  }
+};
+
+struct ESGraph {
+  vector<Expression> season_exVect;
+  vector<Expression> levels_exVect;
+  Expression levelVarLoss_ex;
+};
+
+//Exponential Smoothing-style deseasonalization and smoothing, exactly as in ES_RNN.cc
+ESGraph buildES(ComputationGraph& cg, const AdditionalParams& additionalParams, const vector<float>& vals) {
+  ESGraph ret;
+  Expression levSm_ex = logistic(parameter(cg, additionalParams.levSm));
+  Expression sSm_ex = logistic(parameter(cg, additionalParams.sSm));
+
+  for (int iseas = 0; iseas<SEASONALITY; iseas++)
+    ret.season_exVect.push_back(exp(parameter(cg, additionalParams.initSeasonality[iseas])));
+  ret.season_exVect.push_back(ret.season_exVect[0]);
+
+  vector<Expression> logDiffOfLevels_vect;
+  ret.levels_exVect.push_back(cdiv(input(cg, vals[0]), ret.season_exVect[0]));
+  for (int i = 1; i<vals.size(); i++) {
+    Expression newLevel_ex = vals[i] * cdiv(levSm_ex, ret.season_exVect[i]) + (1 - levSm_ex)*ret.levels_exVect[i - 1];
+    ret.levels_exVect.push_back(newLevel_ex);
+    logDiffOfLevels_vect.push_back(log(cdiv(newLevel_ex, ret.levels_exVect[i - 1])));
+    Expression newSeason_ex = vals[i] * cdiv(sSm_ex, newLevel_ex) + (1 - sSm_ex)*ret.season_exVect[i];
+    ret.season_exVect.push_back(newSeason_ex);
+  }
+
+  vector<Expression> levelVarLoss_v;
+  for (int i = 1; i<logDiffOfLevels_vect.size(); i++) {
+    Expression diff_ex = logDiffOfLevels_vect[i] - logDiffOfLevels_vect[i - 1];
+    levelVarLoss_v.push_back(diff_ex*diff_ex);
+  }
+  ret.levelVarLoss_ex = average(levelVarLoss_v);
+
+  if (OUTPUT_SIZE_I>SEASONALITY) {
+    unsigned long startSeasonalityIndx = ret.season_exVect.size() - SEASONALITY;
+    for (int i = 0; i<(OUTPUT_SIZE_I - SEASONALITY); i++)
+      ret.season_exVect.push_back(ret.season_exVect[startSeasonalityIndx + i]);
+  }
+  return ret;
+}
+
+//deseasonalized, normalized and squashed input window ending at i, joined with the categories
+Expression buildInput(ComputationGraph& cg, const ESGraph& es, const SynthSeries& series, int i, bool addNoise) {
+  vector<Expression> inputSeasonality_exVect(es.season_exVect.begin() + i + 1 - INPUT_SIZE_I, es.season_exVect.begin() + i + 1);
+  Expression inputSeasonality_ex = concatenate(inputSeasonality_exVect);
+  vector<float> input_vect(series.vals.begin() + i + 1 - INPUT_SIZE_I, series.vals.begin() + i + 1);
+  Expression input1_ex = cdiv(cdiv(input(cg, { INPUT_SIZE }, input_vect), inputSeasonality_ex), es.levels_exVect[i]);
+  vector<Expression> joinedInput_ex;
+  if (addNoise)
+    joinedInput_ex.emplace_back(noise(squash(input1_ex), NOISE_STD));
+  else
+    joinedInput_ex.emplace_back(squash(input1_ex));
+  joinedInput_ex.emplace_back(input(cg, { NUM_OF_CATEGORIES }, series.categories_vect));
+  return concatenate(joinedInput_ex);
+}
+
+Expression pinBallLoss(const Expression& out_ex, const Expression& actuals_ex) {//as in ES_RNN.cc
+  vector<Expression> losses;
+  for (unsigned int indx = 0; indx<OUTPUT_SIZE; indx++) {
+    auto forec = pick(out_ex, indx);
+    auto actual = pick(actuals_ex, indx);
+    if (as_scalar(actual.value()) > as_scalar(forec.value()))
+      losses.push_back((actual - forec)*TRAINING_TAU);
+    else
+      losses.push_back((actual - forec)*(TRAINING_TAU - 1));
+  }
+  return sum(losses) / OUTPUT_SIZE * 2;
+}
+
+Expression MSIS(const Expression& out_ex, const Expression& actuals_ex) {//as in ES_RNN_PI.cc, out_ex holds lower, then upper bounds
+  vector<Expression> losses;
+  for (unsigned int indx = 0; indx<OUTPUT_SIZE; indx++) {
+    auto forecL = pick(out_ex, indx);
+    auto forecH = pick(out_ex, indx + OUTPUT_SIZE);
+    auto actual = pick(actuals_ex, indx);
+    float actualf = as_scalar(actual.value());
+
+    Expression loss = forecH - forecL;
+    if (actualf< as_scalar(forecL.value()))
+      loss = loss + (forecL - actual)*ALPHA_MULTIP;
+    if (actualf > as_scalar(forecH.value()))
+      loss = loss + (actual - forecH)*ALPHA_MULTIP;
+    losses.push_back(loss);
+  }
+  return sum(losses) / OUTPUT_SIZE;
+}
+
+
+//benchmarks
+static void BM_esRecurrence(benchmark::State& state) {
+  SynthSeries series = makeSeries((int)state.range(0), SEED);
+  ParameterCollection perSeriesPC;
+  AdditionalParams additionalParams;
+  additionalParams.levSm = perSeriesPC.add_parameters({ 1 }, 0.5);
+  additionalParams.sSm = perSeriesPC.add_parameters({ 1 }, 0.5);
+  for (int isea = 0; isea<SEASONALITY; isea++)
+    additionalParams.initSeasonality[isea] = perSeriesPC.add_parameters({ 1 }, 0.5);
+
+  AllocCounter allocs;
+  for (auto _ : state) {
+    ComputationGraph cg;
+    ESGraph es = buildES(cg, additionalParams, series.vals);
+    benchmark::DoNotOptimize(as_scalar(cg.forward(es.levelVarLoss_ex * LEVEL_VARIABILITY_PENALTY)));
+    allocs.noteFxs();
+  }
+  allocs.report(state);
+  state.SetItemsProcessed(state.iterations()*state.range(0));
+}
+BENCHMARK(BM_esRecurrence)->Arg(24)->Arg(72)->Arg(174);
+
+
+//One step of a dilated LSTM stack, graph building plus its incremental forward. The graph is rebuilt, outside of the timing, every SEQ_LEN steps.
+template <class Builder> static void BM_stackStep(benchmark::State& state) {
+  const int SEQ_LEN = 64;
+  const StackConfig& config = stackConfigs[state.range(0)];
+  state.SetLabel(config.name);
+  ParameterCollection pc;
+  vector<Builder> rNNStack = makeStack<Builder>(config.dilations, config.inputSize + NUM_OF_CATEGORIES, config.stateHSize, pc);
+  mt19937 rng(SEED);
+  normal_distribution<float> nd(0, 1);
+  vector<float> input_vect(config.inputSize + NUM_OF_CATEGORIES);
+  for (auto& v : input_vect)
+    v = nd(rng);
+
+  ComputationGraph* cg = nullptr;
+  int step = SEQ_LEN;
+  AllocCounter allocs;
+  for (auto _ : state) {
+    if (step == SEQ_LEN) {
+      state.PauseTiming();
+      delete cg; //only one ComputationGraph may exist at a time
+      cg = new ComputationGraph();
+      for (int il = 0; il<rNNStack.size(); il++) {
+        rNNStack[il].new_graph(*cg);
+        rNNStack[il].start_new_sequence();
+      }
+      step = 0;
+      state.ResumeTiming();
+    }
+    Expression input_ex = input(*cg, { config.inputSize + NUM_OF_CATEGORIES }, input_vect);
+    Expression rnn_ex = stackStep(rNNStack, input_ex);
+    benchmark::DoNotOptimize(cg->incremental_forward(rnn_ex).v);
+    step++;
+  }
+  allocs.report(state);
+  delete cg;
+}
+BENCHMARK_TEMPLATE(BM_stackStep, DilatedLSTMBuilder)->DenseRange(0, 6);
+BENCHMARK_TEMPLATE(BM_stackStep, ResidualDilatedLSTMBuilder)->DenseRange(0, 6);
+BENCHMARK_TEMPLATE(BM_stackStep, AttentiveDilatedLSTMBuilder)->DenseRange(0, 6);
+
+
+static void BM_pinBallLoss(benchmark::State& state) {
+  mt19937 rng(SEED);
+  normal_distribution<float> nd(0, 1);
+  vector<float> out_vect(OUTPUT_SIZE), actuals_vect(OUTPUT_SIZE);
+  for (int i = 0; i<OUTPUT_SIZE_I; i++) {
+    out_vect[i] = nd(rng);
+    actuals_vect[i] = nd(rng);
+  }
+  AllocCounter allocs;
+  for (auto _ : state) {
+    ComputationGraph cg;
+    Expression loss_ex = pinBallLoss(input(cg, { OUTPUT_SIZE }, out_vect), input(cg, { OUTPUT_SIZE }, actuals_vect));
+    benchmark::DoNotOptimize(as_scalar(cg.forward(loss_ex)));
+  }
+  allocs.report(state);
+}
+BENCHMARK(BM_pinBallLoss);
+
+static void BM_MSISLoss(benchmark::State& state) {
+  mt19937 rng(SEED);
+  normal_distribution<float> nd(0, 1);
+  vector<float> out_vect(2 * OUTPUT_SIZE), actuals_vect(OUTPUT_SIZE);
+  for (int i = 0; i<OUTPUT_SIZE_I; i++) {
+    float mid = nd(rng);
+    out_vect[i] = mid - 1;
+    out_vect[i + OUTPUT_SIZE_I] = mid + 1;
+    actuals_vect[i] = nd(rng);
+  }
+  AllocCounter allocs;
+  for (auto _ : state) {
+    ComputationGraph cg;
+    Expression loss_ex = MSIS(input(cg, { 2 * OUTPUT_SIZE }, out_vect), input(cg, { OUTPUT_SIZE }, actuals_vect));
+    benchmark::DoNotOptimize(as_scalar(cg.forward(loss_ex)));
+  }
+  allocs.report(state);
+}
+BENCHMARK(BM_MSISLoss);
+
+//the float versions from accuracy.h, used in diagnostics and by esrnn_merge
+static void BM_accuracyMeasures(benchmark::State& state) {
+  const SynthSeries& series = theSeries();
+  const float* actuals = series.vals.data() + SERIES_LENGTH - OUTPUT_SIZE_I;
+  vector<float> forecL(actuals, actuals + OUTPUT_SIZE_I), forecH(actuals, actuals + OUTPUT_SIZE_I);
+  for (int i = 0; i<OUTPUT_SIZE_I; i++) {
+    forecL[i] *= 0.9f + 0.02f*i;
+    forecH[i] *= 1.05f + 0.01f*i;
+  }
+  AllocCounter allocs;
+  for (auto _ : state) {
+    float scale = meanAbsSeasDiff(series.vals.data(), SERIES_LENGTH - OUTPUT_SIZE_I, SEASONALITY);
+    benchmark::DoNotOptimize(sMAPE(forecL.data(), actuals, OUTPUT_SIZE_I));
+    benchmark::DoNotOptimize(MASE(forecL.data(), actuals, OUTPUT_SIZE_I, scale));
+    benchmark::DoNotOptimize(MSIS(forecL.data(), forecH.data(), actuals, OUTPUT_SIZE_I, ALPHA_MULTIP, scale));
+  }
+  allocs.report(state);
+}
+BENCHMARK(BM_accuracyMeasures);
+
+
+//COMPRESS_SERIES of ES_RNN_E: decode of a catalog of synthetic series of 24..400 values. Arg: decimals the values are rounded to, as in the M4 files; -1: not rounded, mostly XOR blocks.
+//Reports values decoded per second (items_per_second) and the compression ratio against vector<float>s.
+static void BM_seriesStoreDecode(benchmark::State& state) {
+  const int numOfSeries = 10000;
+  int decimals = (int)state.range(0);
+  SeriesStore store;
+  for (int iseries = 0; iseries<numOfSeries; iseries++) {
+    SynthSeries series = makeSeries(24 + (iseries*37) % 377, SEED + iseries);
+    if (decimals >= 0)
+      for (auto& val : series.vals) //as atof reads the rounded value
+        val = (float)atof(to_string(round(val*STORE_POW10[decimals]) / STORE_POW10[decimals]).c_str());
+    vector<float> testVals(series.vals.end() - OUTPUT_SIZE_I, series.vals.end());
+    series.vals.resize(series.vals.size() - OUTPUT_SIZE_I);
+    store.add(series.vals, testVals);
+  }
+  store.shrink();
+  vector<float> vals, testVals;
+  AllocCounter allocs;
+  for (auto _ : state) {
+    for (int iseries = 0; iseries<numOfSeries; iseries++) {
+      store.decode(iseries, vals, testVals);
+      benchmark::DoNotOptimize(vals.data());
+    }
+  }
+  allocs.report(state);
+  SeriesStoreStats stats = store.stats();
+  state.SetItemsProcessed(state.iterations()*stats.numOfValues);
+  state.counters["ratio"] = stats.ratio();
+  state.counters["decimalBlocks%"] = 100. * stats.decimalBlocks / (stats.decimalBlocks + stats.xorBlocks);
+}
+BENCHMARK(BM_seriesStoreDecode)->Arg(0)->Arg(1)->Arg(2)->Arg(-1);
+
+
+//One per-series training step of ES_RNN.cc: graph building, forward, backward, and both AdamTrainer updates
+template <class Builder> static void BM_trainStep(benchmark::State& state) {
+  const SynthSeries& series = theSeries();
+  const int n = SERIES_LENGTH;
+  EsRnnModel<Builder> model;
+  AllocCounter allocs;
+  for (auto _ : state) {
+    ComputationGraph cg;
+    for (int il = 0; il<model.rNNStack.size(); il++) {
+      model.rNNStack[il].new_graph(cg);
+      model.rNNStack[il].start_new_sequence();
+    }
+    Expression adapterW_ex = parameter(cg, model.adapterW_par);
+    Expression adapterB_ex = parameter(cg, model.adapterB_par);
+    ESGraph es = buildES(cg, model.additionalParams, series.vals);
+
+    vector<Expression> losses;
+    for (int i = INPUT_SIZE_I - 1; i<(n - OUTPUT_SIZE_I); i++) {
+      Expression input_ex = buildInput(cg, es, series, i, true);
+      Expression rnn_ex = stackStep(model.rNNStack, input_ex);
+      Expression out_ex = adapterW_ex*rnn_ex + adapterB_ex;
+
+      vector<Expression> outputSeasonality_exVect(es.season_exVect.begin() + i + 1, es.season_exVect.begin() + i + 1 + OUTPUT_SIZE_I);
+      vector<float> labels_vect(series.vals.begin() + i + 1, series.vals.begin() + i + 1 + OUTPUT_SIZE_I);
+      Expression labels1_ex = cdiv(cdiv(input(cg, { OUTPUT_SIZE }, labels_vect), concatenate(outputSeasonality_exVect)), es.levels_exVect[i]);
+      losses.push_back(pinBallLoss(out_ex, squash(labels1_ex)));
+    }
+    Expression loss_exp = average(losses) + es.levelVarLoss_ex*LEVEL_VARIABILITY_PENALTY;
+    benchmark::DoNotOptimize(as_scalar(cg.forward(loss_exp)));
+    allocs.noteFxs();
+    cg.backward(loss_exp);
+    model.trainer.update();
+    model.perSeriesTrainer.update();
+  }
+  allocs.report(state);
+}
+BENCHMARK_TEMPLATE(BM_trainStep, DilatedLSTMBuilder);
+BENCHMARK_TEMPLATE(BM_trainStep, ResidualDilatedLSTMBuilder);
+BENCHMARK_TEMPLATE(BM_trainStep, AttentiveDilatedLSTMBuilder);
+
+
+//Validation forward of one series: ES, the RNN walk over the whole history without noise, and the forecast at the last point, back in the original scale.
+template <class Builder> static void BM_validationForward(benchmark::State& state) {
+  const SynthSeries& series = theSeries();
+  const int n = SERIES_LENGTH;
+  EsRnnModel<Builder> model;
+  AllocCounter allocs;
+  for (auto _ : state) {
+    ComputationGraph cg;
+    for (int il = 0; il<model.rNNStack.size(); il++) {
+      model.rNNStack[il].new_graph(cg, false);
+      model.rNNStack[il].start_new_sequence();
+    }
+    Expression adapterW_ex = const_parameter(cg, model.adapterW_par);
+    Expression adapterB_ex = const_parameter(cg, model.adapterB_par);
+    ESGraph es = buildES(cg, model.additionalParams, series.vals);
+
+    Expression rnn_ex;
+    for (int i = INPUT_SIZE_I - 1; i<n; i++)
+      rnn_ex = stackStep(model.rNNStack, buildInput(cg, es, series, i, false));
+
+    vector<Expression> outputSeasonality_exVect(es.season_exVect.begin() + n, es.season_exVect.begin() + n + OUTPUT_SIZE_I);
+    Expression out_ex = adapterW_ex*rnn_ex + adapterB_ex;
+    out_ex = cmult(expand(out_ex), concatenate(outputSeasonality_exVect))*es.levels_exVect[n - 1];
+    benchmark::DoNotOptimize(cg.forward(out_ex).v);
+    allocs.noteFxs();
+  }
+  allocs.report(state);
+}
+BENCHMARK_TEMPLATE(BM_validationForward, DilatedLSTMBuilder);
+BENCHMARK_TEMPLATE(BM_validationForward, ResidualDilatedLSTMBuilder);
+BENCHMARK_TEMPLATE(BM_validationForward, AttentiveDilatedLSTMBuilder);
+
+
+int main(int argc, char** argv) {
+  dynet::initialize(argc, argv);
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    return 1;
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+}
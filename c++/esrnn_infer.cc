@@ -0,0 +1,473 @@
+/*esrnn_infer: batch forecasting with a model exported by ES_RNN_E (EXPORT_MODEL, see model_artifact.h), without Dynet, see inference.h.
+
+Streams the series file (format of the training file) in chunks of CHUNK_SIZE series, forecasts every chunk in THREADS threads, each with its own workspace,
+as the average of the top nets of every series, and writes OUTPUT_PATH in the format of the forecasts of ES_RNN_E (series, then the forecasts), in the order of the input.
+Memory is that of the model and of one chunk, so it runs over millions of series. Series not in the model, or shorter than the input window, are counted and skipped.
+The series are cut as in ES_RNN_E: LBACK must be that of the run (the _LB<LBACK> of the model file name), the maximum length comes from the model.
+The categories come from INFO_PATH (M4-info.csv), "Other" for series not in it or of an unknown category.
+
+With PARITY=1 it checks instead the numerics against the Dynet path: every series of the file that is in the online state of the model (<MODEL_PREFIX>.state,
+written by ES_RNN_E with ONLINE_STATE, from the same history, through Dynet) is forecast by each of its nets, and compared with the forecast in the state.
+Prints the largest relative difference and fails (exit code 1) if it exceeds PARITY_TOLERANCE.
+
+QUANTIZE=1 runs the LSTM gates and the adapter on int8 weights (see inference.h), but only if the model has passed the accuracy gate:
+QUANT_GATE=1, with LBACK>0, backtests the model in floats and in int8 against the OUTPUT_SIZE points after the history of every series,
+and writes <MODEL_PREFIX>.int8 with the mean sMAPE and MASE of both and the verdict (the MASE scale as in esrnn_merge: over the whole line, test points included,
+with the Frequency of M4-info.csv, 1 for series not in it; series with a zero scale count only in sMAPE): passed if int8 is worse by at most QUANT_MAX_SMAPE_DELTA and QUANT_MAX_MASE_DELTA.
+The report holds a hash of the weights, so it does not carry over to a retrained model. A final model (LB0) can be gated with LBACK=1, on the last points it was trained on:
+the gate is about the difference between the two, not the accuracy itself.
+
+With CACHE_PATH the forecasts go through a persistent cache of CACHE_ENTRIES entries (see forecast_cache.h): a series whose history, category and model
+have not changed since an earlier run is not forecast again. The hit rate, the evictions and the lifetime counters of the cache are printed at the end. Linux/Mac only.
+
+It does not need Dynet. Build with linux_example_scripts/build_tool, e.g. ./build_tool esrnn_infer
+Usage:
+  esrnn_infer <MODEL_PREFIX> <SERIES_PATH> [<OUTPUT_PATH>] [NAME=value ...]
+e.g.
+  esrnn_infer /data/M4/Hourly_0_LB0 /data/M4DataSet/Hourly-train.csv /data/M4/Hourly_0_LB0_infer.csv THREADS=16
+  esrnn_infer /data/M4/Hourly_0_LB0 /data/M4DataSet/Hourly-train.csv PARITY=1
+  esrnn_infer /data/M4/Hourly_0_LB0 /data/M4DataSet/Hourly-train.csv QUANT_GATE=1 LBACK=1
+  esrnn_infer /data/M4/Hourly_0_LB0 /data/M4DataSet/Hourly-train.csv /data/M4/Hourly_0_LB0_infer.csv QUANTIZE=1
+  esrnn_infer /data/M4/Hourly_0_LB0 /data/M4DataSet/Hourly-train.csv /data/M4/Hourly_0_LB0_infer.csv CACHE_PATH=/data/M4/Hourly_0_LB0.cache
+*/
+
+#include "inference.h"
+#include "online_state.h"
+#include "accuracy.h"
+#if !defined _WINDOWS
+  #include "forecast_cache.h"
+#endif
+
+#include <ctime>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <unordered_map>
+#include <math.h>
+#include <stdio.h>
+
+using namespace std;
+
+string MODEL_PREFIX;
+string SERIES_PATH;
+string OUTPUT_PATH;
+string INFO_PATH = "f:\\progs\\data\\M4DataSet\\M4-info.csv";
+int LBACK = 0;
+int THREADS = (int)max(1u, thread::hardware_concurrency());
+int CHUNK_SIZE = 16384;
+bool PARITY = false;
+float PARITY_TOLERANCE = 1e-3f; //relative; Dynet's (Eigen's) tanh and exp are approximations
+bool QUANTIZE = false;
+bool QUANT_GATE = false;
+float QUANT_MAX_SMAPE_DELTA = 0.02f; //sMAPE is in %
+float QUANT_MAX_MASE_DELTA = 0.002f;
+string CACHE_PATH; //empty: no cache
+long CACHE_ENTRIES = 1 << 20;
+
+const char* CATEGORIES[] = { "Demographic", "Finance", "Industry", "Macro", "Micro", "Other" }; //the one-hot order of M4TS in ES_RNN_E
+
+
+void setParam(const string& name, const string& value) {
+  if (name == "INFO_PATH") INFO_PATH = value;
+  else if (name == "LBACK") LBACK = atoi(value.c_str());
+  else if (name == "THREADS") THREADS = max(1, atoi(value.c_str()));
+  else if (name == "CHUNK_SIZE") CHUNK_SIZE = max(1, atoi(value.c_str()));
+  else if (name == "PARITY") PARITY = atoi(value.c_str()) != 0;
+  else if (name == "PARITY_TOLERANCE") PARITY_TOLERANCE = (float)atof(value.c_str());
+  else if (name == "QUANTIZE") QUANTIZE = atoi(value.c_str()) != 0;
+  else if (name == "QUANT_GATE") QUANT_GATE = atoi(value.c_str()) != 0;
+  else if (name == "QUANT_MAX_SMAPE_DELTA") QUANT_MAX_SMAPE_DELTA = (float)atof(value.c_str());
+  else if (name == "QUANT_MAX_MASE_DELTA") QUANT_MAX_MASE_DELTA = (float)atof(value.c_str());
+  else if (name == "CACHE_PATH") CACHE_PATH = value;
+  else if (name == "CACHE_ENTRIES") CACHE_ENTRIES = max(1L, atol(value.c_str()));
+  else {
+    cerr << "unknown parameter " << name << endl;
+    exit(-1);
+  }
+}
+
+template<class F> void parallelFor(int n, unsigned numOfThreads, F func) {
+  vector<thread> threads;
+  atomic<int> next(0);
+  for (unsigned it = 0; it < numOfThreads; it++)
+    threads.emplace_back([&, it]() {
+      for (int i = next++; i < n; i = next++)
+        func(it, i);
+    });
+  for (auto& th : threads)
+    th.join();
+}
+
+string stripPunct(const string& text) {
+  string stripped;
+  for (const auto c : text)
+    if (!ispunct(c))
+      stripped.push_back(c);
+  return stripped;
+}
+
+//series -> one-hot category, and series -> the Frequency column, for the MASE scale of QUANT_GATE
+unordered_map<string, vector<float>> readCategories(const string& path, int numOfCategories, unordered_map<string, int>& frequencies) {
+  unordered_map<string, vector<float>> categories;
+  ifstream file(path);
+  string line;
+  getline(file, line); //header
+  while (getline(file, line)) {
+    stringstream line_stream(line);
+    string series, category, frequency;
+    getline(line_stream, series, ',');
+    getline(line_stream, category, ',');
+    getline(line_stream, frequency, ',');
+    int icat = 5; //"Other", also for an unknown category
+    for (int i = 0; i < 6; i++)
+      if (stripPunct(category) == CATEGORIES[i])
+        icat = i;
+    vector<float> oneHot(numOfCategories, 0.f);
+    if (icat < numOfCategories)
+      oneHot[icat] = 1;
+    categories[stripPunct(series)] = oneHot;
+    frequencies[stripPunct(series)] = atoi(stripPunct(frequency).c_str());
+  }
+  return categories;
+}
+
+struct SeriesRow {
+  string series;
+  vector<float> vals; //reused between chunks
+  vector<float> testVals; //LBACK>0: the OUTPUT_SIZE points after the history
+  float maseScale = 0; //LBACK>0: mean absolute seasonal difference over all the points of the line, with the M4-info frequency, as in esrnn_merge
+  int n = 0;
+};
+
+//next line of the series file, cut as M4TS of ES_RNN_E does; false at the end
+bool readSeriesRow(istream& file, const InferenceModel& model, const unordered_map<string, int>& frequencies, SeriesRow& row) {
+  string line;
+  if (!getline(file, line))
+    return false;
+  stringstream line_stream(line);
+  string series0, tmp_str;
+  getline(line_stream, series0, ',');
+  row.series = stripPunct(series0);
+  row.vals.clear();
+  while (getline(line_stream, tmp_str, ',')) {
+    string val_str;
+    for (const auto c : tmp_str)
+      if (c != '\"' && c != '\r')
+        val_str.push_back(c);
+    if (val_str.size() == 0)
+      break;
+    row.vals.push_back((float)atof(val_str.c_str()));
+  }
+  int n = (int)row.vals.size();
+  row.testVals.clear();
+  if (LBACK > 0) {//the last LBACK*OUTPUT_SIZE points are the test values of the run
+    auto frequency = frequencies.find(row.series);
+    int seasonality = frequency == frequencies.end() ? 1 : max(1, frequency->second);
+    row.maseScale = n >= LBACK*model.outputSize + seasonality ? meanAbsSeasDiff(row.vals.data(), n, seasonality) : 0;
+    n = n > LBACK*model.outputSize ? n - LBACK*model.outputSize : 0;
+    if (n > 0)
+      row.testVals.assign(row.vals.begin() + n, row.vals.begin() + n + model.outputSize);
+  }
+  row.vals.resize(n);
+  if (model.maxSeriesLength > 0 && n > model.maxSeriesLength) {//chop long series
+    row.vals.erase(row.vals.begin(), row.vals.begin() + (n - model.maxSeriesLength));
+    n = model.maxSeriesLength;
+  }
+  row.n = n;
+  return true;
+}
+
+struct GateReport {
+  uint64_t weightsHash = 0;
+  long numOfSeries = 0;
+  double sMAPE_fp32 = 0, sMAPE_int8 = 0, MASE_fp32 = 0, MASE_int8 = 0;
+  bool passed = false;
+
+  bool save(const string& path) const {
+    ofstream file(path);
+    file << "ESRNN_INT8_GATE 1\n" << "weights_hash " << weightsHash << "\n" << "series " << numOfSeries << "\n"
+      << "smape_fp32 " << sMAPE_fp32 << "\n" << "smape_int8 " << sMAPE_int8 << "\n" << "mase_fp32 " << MASE_fp32 << "\n" << "mase_int8 " << MASE_int8 << "\n"
+      << "passed " << passed << "\n";
+    return bool(file);
+  }
+
+  bool load(const string& path) {
+    ifstream file(path);
+    string tag;
+    int version = 0;
+    if (!(file >> tag >> version) || tag != "ESRNN_INT8_GATE" || version != 1)
+      return false;
+    string key;
+    while (file >> key) {
+      if (key == "weights_hash") file >> weightsHash;
+      else if (key == "series") file >> numOfSeries;
+      else if (key == "smape_fp32") file >> sMAPE_fp32;
+      else if (key == "smape_int8") file >> sMAPE_int8;
+      else if (key == "mase_fp32") file >> MASE_fp32;
+      else if (key == "mase_int8") file >> MASE_int8;
+      else if (key == "passed") file >> passed;
+    }
+    return true;
+  }
+};
+
+int main(int argc, char** argv) {
+  int ipos = 0;
+  for (int iarg = 1; iarg < argc; iarg++) {
+    string arg = argv[iarg];
+    size_t eq = arg.find('=');
+    if (eq != string::npos) {
+      setParam(arg.substr(0, eq), arg.substr(eq + 1));
+      continue;
+    }
+    if (ipos == 0)
+      MODEL_PREFIX = arg;
+    else if (ipos == 1)
+      SERIES_PATH = arg;
+    else if (ipos == 2)
+      OUTPUT_PATH = arg;
+    ipos++;
+  }
+  bool writesForecasts = !PARITY && !QUANT_GATE;
+  if (MODEL_PREFIX.empty() || SERIES_PATH.empty() || (OUTPUT_PATH.empty() && writesForecasts)) {
+    cerr << "usage: esrnn_infer <MODEL_PREFIX> <SERIES_PATH> [<OUTPUT_PATH>] [NAME=value ...]" << endl;
+    return -1;
+  }
+  if (QUANT_GATE && LBACK <= 0) {
+    cerr << "QUANT_GATE needs LBACK>0, the points to backtest on" << endl;
+    return -1;
+  }
+
+  auto begin_time = chrono::steady_clock::now();
+  InferenceModel model;
+  string error;
+  if (!model.load(MODEL_PREFIX, error)) {
+    cerr << error << endl;
+    return -1;
+  }
+  OnlineStates onlineStates;
+  if (PARITY && !loadOnlineStates(MODEL_PREFIX + ".state", onlineStates, error)) {
+    cerr << error << endl;
+    return -1;
+  }
+  unordered_map<string, int> frequency_map;
+  unordered_map<string, vector<float>> categories_map = readCategories(INFO_PATH, model.numOfCategories, frequency_map);
+  vector<float> otherCategory(model.numOfCategories, 0.f);
+  if (model.numOfCategories >= 6)
+    otherCategory[5] = 1;
+  double loadTime = chrono::duration<double>(chrono::steady_clock::now() - begin_time).count();
+  cout << "model of " << model.artifact.esParams.size() << " series loaded in " << loadTime << "s, " << THREADS << " threads" << endl;
+  if (QUANTIZE && writesForecasts) {
+    GateReport report;
+    if (!report.load(MODEL_PREFIX + ".int8"))
+      cout << "no int8 gate report " << MODEL_PREFIX << ".int8 (run QUANT_GATE=1 first), forecasting in floats" << endl;
+    else if (report.weightsHash != model.weightsHash)
+      cout << "the int8 gate report is of other weights, forecasting in floats" << endl;
+    else if (!report.passed)
+      cout << "the model failed the int8 gate (sMAPE " << report.sMAPE_fp32 << " -> " << report.sMAPE_int8 << "), forecasting in floats" << endl;
+    else {
+      model.quantize();
+      cout << "forecasting with int8 weights" << endl;
+    }
+  }
+
+#if defined _WINDOWS
+  if (!CACHE_PATH.empty()) {
+    cerr << "CACHE_PATH is not available on Windows" << endl;
+    return -1;
+  }
+#else
+  ForecastCache cache;
+  uint64_t modelKey = 0;
+  if (!CACHE_PATH.empty() && writesForecasts) {//the forecasts of this program, this artifact, and this precision
+    modelKey = hashBytes("esrnn_infer", 11);
+    modelKey = hashBytes(&model.weightsHash, sizeof(model.weightsHash), modelKey);
+    uint64_t artifactHash = fileHash(MODEL_PREFIX + ".model");
+    modelKey = hashBytes(&artifactHash, sizeof(artifactHash), modelKey);
+    modelKey = hashBytes(&model.int8, sizeof(model.int8), modelKey);
+    if (!cache.open(CACHE_PATH, (uint64_t)CACHE_ENTRIES, model.outputSize, error)) {
+      cerr << error << endl;
+      return -1;
+    }
+    cout << "forecast cache " << CACHE_PATH << ": " << cache.header->entries << " of " << cache.capacity() << " entries used" << endl;
+  }
+#endif
+
+  ifstream file(SERIES_PATH);
+  if (!file) {
+    cerr << "could not open " << SERIES_PATH << endl;
+    return -1;
+  }
+  ofstream outputFile;
+  if (writesForecasts) {
+    outputFile.open(OUTPUT_PATH);
+    if (!outputFile) {
+      cerr << "could not open " << OUTPUT_PATH << endl;
+      return -1;
+    }
+  }
+  string line;
+  getline(file, line); //header
+
+  vector<InferenceWorkspace> workspaces(THREADS, InferenceWorkspace(model));
+  vector<SeriesRow> chunk(CHUNK_SIZE);
+  vector<float> forecasts((size_t)CHUNK_SIZE*model.outputSize);
+  vector<char> done(CHUNK_SIZE);
+  vector<char> cached(CHUNK_SIZE, 0);
+  vector<uint64_t> seriesKeys(CHUNK_SIZE);
+  vector<float> forecastsInt8;
+  vector<char> doneInt8;
+  GateReport gate;
+  long numOfMASE = 0;
+  if (QUANT_GATE) {
+    forecastsInt8.resize(forecasts.size());
+    doneInt8.resize(done.size());
+    gate.weightsHash = model.weightsHash;
+  }
+  vector<float> maxRelDiffs(THREADS, 0.f);
+  vector<long> comparisons(THREADS, 0);
+  long numOfSeries = 0, numOfForecasts = 0;
+  begin_time = chrono::steady_clock::now();
+  while (true) {
+    int size = 0;
+    while (size < CHUNK_SIZE && readSeriesRow(file, model, frequency_map, chunk[size]))
+      size++;
+    if (size == 0)
+      break;
+    auto categoriesOf = [&](const SeriesRow& row) {
+      auto category = categories_map.find(row.series);
+      return category == categories_map.end() ? otherCategory.data() : category->second.data();
+    };
+#if !defined _WINDOWS
+    if (cache.isOpen())
+      for (int is = 0; is < size; is++) {
+        const SeriesRow& row = chunk[is];
+        seriesKeys[is] = seriesKey(row.series, categoriesOf(row), model.numOfCategories, row.vals.data(), row.n);
+        cached[is] = cache.find(modelKey, seriesKeys[is], forecasts.data() + (size_t)is*model.outputSize);
+      }
+#endif
+    parallelFor(size, THREADS, [&](unsigned ithread, int is) {
+      const SeriesRow& row = chunk[is];
+      const float* categories = categoriesOf(row);
+      InferenceWorkspace& ws = workspaces[ithread];
+      if (cached[is]) {
+        done[is] = true;
+        return;
+      }
+      if (!PARITY) {
+        done[is] = forecastSeries(model, row.series, categories, row.vals.data(), row.n, forecasts.data() + (size_t)is*model.outputSize, ws);
+        return;
+      }
+      auto states = onlineStates.find(row.series);
+      auto esParams = model.artifact.esParams.find(row.series);
+      if (states == onlineStates.end() || esParams == model.artifact.esParams.end())
+        return;
+      float* forecast = forecasts.data() + (size_t)is*model.outputSize;
+      for (auto& net : states->second) {
+        auto es = esParams->second.find(net.first);
+        if (es == esParams->second.end() || net.second.forecast.size() != (size_t)model.outputSize
+            || !forecastNet(model, net.first, es->second, categories, row.vals.data(), row.n, forecast, ws))
+          continue;
+        for (int k = 0; k < model.outputSize; k++) {
+          float expected = net.second.forecast[k];
+          maxRelDiffs[ithread] = max(maxRelDiffs[ithread], fabs(forecast[k] - expected) / max(fabs(expected), 1e-6f));
+        }
+        comparisons[ithread]++;
+      }
+    });
+    if (QUANT_GATE) {//the same chunk again, in int8
+      if (!model.int8)
+        model.quantize();
+      parallelFor(size, THREADS, [&](unsigned ithread, int is) {
+        const SeriesRow& row = chunk[is];
+        doneInt8[is] = forecastSeries(model, row.series, categoriesOf(row), row.vals.data(), row.n, forecastsInt8.data() + (size_t)is*model.outputSize, workspaces[ithread]);
+      });
+      model.int8 = false;
+      for (int is = 0; is < size; is++) {
+        const SeriesRow& row = chunk[is];
+        if (!done[is] || !doneInt8[is] || (int)row.testVals.size() != model.outputSize)
+          continue;
+        const float* forec = forecasts.data() + (size_t)is*model.outputSize;
+        const float* forecInt8 = forecastsInt8.data() + (size_t)is*model.outputSize;
+        gate.numOfSeries++;
+        gate.sMAPE_fp32 += sMAPE(forec, row.testVals.data(), model.outputSize);
+        gate.sMAPE_int8 += sMAPE(forecInt8, row.testVals.data(), model.outputSize);
+        if (row.maseScale > 0) {
+          numOfMASE++;
+          gate.MASE_fp32 += MASE(forec, row.testVals.data(), model.outputSize, row.maseScale);
+          gate.MASE_int8 += MASE(forecInt8, row.testVals.data(), model.outputSize, row.maseScale);
+        }
+      }
+    }
+#if !defined _WINDOWS
+    if (cache.isOpen())
+      for (int is = 0; is < size; is++)
+        if (done[is] && !cached[is])
+          cache.insert(modelKey, seriesKeys[is], forecasts.data() + (size_t)is*model.outputSize);
+#endif
+    numOfSeries += size;
+    if (writesForecasts)
+      for (int is = 0; is < size; is++) {
+        if (!done[is])
+          continue;
+        numOfForecasts++;
+        outputFile << chunk[is].series;
+        for (int k = 0; k < model.outputSize; k++)
+          outputFile << ", " << forecasts[(size_t)is*model.outputSize + k];
+        outputFile << "\n";
+      }
+  }
+  double elapsed = chrono::duration<double>(chrono::steady_clock::now() - begin_time).count();
+
+  if (QUANT_GATE) {
+    if (gate.numOfSeries > 0) {
+      gate.sMAPE_fp32 /= gate.numOfSeries;
+      gate.sMAPE_int8 /= gate.numOfSeries;
+    }
+    if (numOfMASE > 0) {
+      gate.MASE_fp32 /= numOfMASE;
+      gate.MASE_int8 /= numOfMASE;
+    }
+    gate.passed = gate.numOfSeries > 0 && gate.sMAPE_int8 - gate.sMAPE_fp32 <= QUANT_MAX_SMAPE_DELTA && gate.MASE_int8 - gate.MASE_fp32 <= QUANT_MAX_MASE_DELTA;
+    printf("int8 gate over %ld series: sMAPE %.4f -> %.4f (%+.4f), MASE %.5f -> %.5f (%+.5f) over %ld series (scale as in esrnn_merge): %s\n", gate.numOfSeries, gate.sMAPE_fp32, gate.sMAPE_int8,
+      gate.sMAPE_int8 - gate.sMAPE_fp32, gate.MASE_fp32, gate.MASE_int8, gate.MASE_int8 - gate.MASE_fp32, numOfMASE, gate.passed ? "passed" : "FAILED");
+    if (!gate.save(MODEL_PREFIX + ".int8"))
+      cerr << "could not write " << MODEL_PREFIX << ".int8" << endl;
+    return gate.passed ? 0 : 1;
+  }
+  if (PARITY) {
+    long numOfComparisons = 0;
+    float maxRelDiff = 0;
+    for (int it = 0; it < THREADS; it++) {
+      numOfComparisons += comparisons[it];
+      maxRelDiff = max(maxRelDiff, maxRelDiffs[it]);
+    }
+    cout << numOfComparisons << " (series, net) forecasts compared with " << MODEL_PREFIX << ".state, largest relative difference " << maxRelDiff << endl;
+    if (numOfComparisons == 0 || maxRelDiff > PARITY_TOLERANCE) {
+      cout << "PARITY FAILED, tolerance " << PARITY_TOLERANCE << endl;
+      return 1;
+    }
+    cout << "parity ok" << endl;
+    return 0;
+  }
+  outputFile.close();
+  cout << numOfSeries << " series read, " << numOfForecasts << " forecast (" << numOfSeries - numOfForecasts << " not in the model or too short) in "
+    << elapsed << "s, " << numOfSeries / max(elapsed, 1e-9) << " series/s" << endl;
+#if !defined _WINDOWS
+  if (cache.isOpen()) {
+    const ForecastCacheStats& lifetime = cache.header->lifetime;
+    printf("forecast cache: %llu hits, %llu misses, hit rate %.1f%%, %llu inserts, %llu evictions, %llu of %llu entries used\n",
+      (unsigned long long)cache.run.hits, (unsigned long long)cache.run.misses, 100 * cache.run.hitRate(), (unsigned long long)cache.run.inserts,
+      (unsigned long long)cache.run.evictions, (unsigned long long)cache.header->entries, (unsigned long long)cache.capacity());
+    printf("forecast cache lifetime: %llu hits, %llu misses, hit rate %.1f%%, %llu evictions\n", (unsigned long long)lifetime.hits,
+      (unsigned long long)lifetime.misses, 100 * lifetime.hitRate(), (unsigned long long)lifetime.evictions);
+  }
+#endif
+  return 0;
+}
@@ -0,0 +1,219 @@
+/*esrnn_ingest: maintenance of the binary series store (see series_ingest.h) that ES_RNN and ES_RNN_E read, with STORE_PATH, instead of parsing the training csv.
+
+  esrnn_ingest init <STORE_PATH> <TRAIN_CSV>
+    a new store of all the series of a file in the format of the training files ("V1","V2",... header, then "<id>","<val>",...). Replaces the store at STORE_PATH, if any.
+  esrnn_ingest append <STORE_PATH> <DELTA_CSV> [COMPACT=1]
+    appends the points of a delta file: a header line, then <series>,<index>,<value> lines, index being the 0-based position of the value in the series
+    (the current length of the series appends a point, a smaller index corrects one). Points that would leave a gap are rejected and counted.
+    COMPACT=1 compacts the store afterwards.
+  esrnn_ingest compact <STORE_PATH>
+    folds the log into a new snapshot, crash-safe: a crash at any point leaves either the old snapshot with its log, or the new one.
+  esrnn_ingest info <STORE_PATH>
+    series, values, generation, and the records in the log
+  esrnn_ingest export <STORE_PATH> <CSV>
+    writes the series, with the log applied, in the format of the training files, e.g. to compare with a csv, or for programs without STORE_PATH
+
+It does not need Dynet. Linux/Mac only. Build with linux_example_scripts/build_tool, e.g. ./build_tool esrnn_ingest
+e.g.
+  esrnn_ingest init /data/M4DataSet/Hourly-train.store /data/M4DataSet/Hourly-train.csv
+  esrnn_ingest append /data/M4DataSet/Hourly-train.store /data/incoming/Hourly-2018-06-01.csv COMPACT=1
+*/
+
+#include "series_ingest.h"
+
+#include <chrono>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdlib.h>
+
+using namespace std;
+
+double secsSince(chrono::steady_clock::time_point start) {
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+void dieIf(bool failed, const string& error) {
+  if (failed) {
+    cerr << error << endl;
+    exit(-1);
+  }
+}
+
+//the fields of a csv line, without quotes and carriage returns
+vector<string> csvFields(const string& line) {
+  vector<string> fields;
+  stringstream line_stream(line);
+  string field;
+  while (getline(line_stream, field, ',')) {
+    string cleaned;
+    for (const auto c : field)
+      if (c != '\"' && c != '\r')
+        cleaned.push_back(c);
+    fields.push_back(cleaned);
+  }
+  return fields;
+}
+
+//the shortest decimal that reads back as the same float
+string floatText(float value) {
+  char text[32];
+  for (int precision = 6; precision <= 9; precision++) {
+    snprintf(text, sizeof(text), "%.*g", precision, value);
+    if (strtof(text, NULL) == value)
+      break;
+  }
+  return text;
+}
+
+void printInfo(const IngestedSeries& store) {
+  cout << store.path << ": " << store.numOfSeries() << " series, " << store.numOfValues() << " values, generation " << store.generation
+    << ", log: " << store.logRecords << " records" << endl;
+}
+
+void init(const string& storePath, const string& csvPath) {
+  auto start = chrono::steady_clock::now();
+  ifstream file(csvPath);
+  dieIf(!file, "can't open " + csvPath);
+  vector<string> names;
+  vector<float> values;
+  vector<uint64_t> firstValue;
+  string line;
+  getline(file, line); //header
+  while (getline(file, line)) {//as M4TS reads the lines
+    vector<string> fields = csvFields(line);
+    if (fields.empty())
+      continue;
+    names.push_back(seriesName(fields[0]));
+    firstValue.push_back(values.size());
+    for (size_t ifield = 1; ifield < fields.size() && !fields[ifield].empty(); ifield++)
+      values.push_back((float)atof(fields[ifield].c_str()));
+  }
+  firstValue.push_back(values.size());
+  double parseSecs = secsSince(start);
+
+  IngestedSeries store;
+  string error;
+  auto seriesAt = [&](int i, string& name, const float*& vals, int& length) {
+    name = names[i];
+    vals = values.data() + firstValue[i];
+    length = (int)(firstValue[i + 1] - firstValue[i]);
+  };
+  dieIf(!store.create(storePath, (int)names.size(), seriesAt, error), error);
+  cout << "parsed " << csvPath << " in " << parseSecs << "s, stored in " << secsSince(start) - parseSecs << "s" << endl;
+
+  start = chrono::steady_clock::now();
+  store.close();
+  dieIf(!store.open(storePath, false, error), error);
+  double sum = 0; //touches every value, as a program loading the store does
+  for (int i = 0; i < store.numOfSeries(); i++) {
+    const float* vals = store.values(i);
+    for (int ival = 0; ival < store.length(i); ival++)
+      sum += vals[ival];
+  }
+  cout << "loads in " << secsSince(start) << "s (checksum " << sum << ")" << endl;
+  printInfo(store);
+}
+
+void append(const string& storePath, const string& deltaPath, bool compact) {
+  ifstream file(deltaPath);
+  dieIf(!file, "can't open " + deltaPath);
+  vector<IngestRecord> records;
+  size_t malformed = 0;
+  string line;
+  getline(file, line); //header
+  while (getline(file, line)) {
+    vector<string> fields = csvFields(line);
+    if (fields.size() < 3 || fields[1].empty() || fields[2].empty() || fields[1].find_first_not_of("0123456789") != string::npos) {
+      malformed++;
+      continue;
+    }
+    IngestRecord record;
+    record.series = seriesName(fields[0]);
+    record.index = (uint32_t)strtoul(fields[1].c_str(), NULL, 10);
+    record.value = (float)atof(fields[2].c_str());
+    records.push_back(record);
+  }
+
+  IngestedSeries store;
+  string error;
+  dieIf(!store.open(storePath, true, error), error);
+  IngestStats stats;
+  dieIf(!store.append(records, stats, error), error);
+  cout << records.size() << " points: " << stats.appended << " appended (" << stats.newSeries << " new series), " << stats.corrected << " corrected, "
+    << stats.rejected << " rejected (gaps)";
+  if (malformed > 0)
+    cout << ", " << malformed << " malformed lines skipped";
+  cout << endl;
+  if (compact)
+    dieIf(!store.compact(error), error);
+  printInfo(store);
+}
+
+void compact(const string& storePath) {
+  IngestedSeries store;
+  string error;
+  dieIf(!store.open(storePath, true, error), error);
+  auto start = chrono::steady_clock::now();
+  dieIf(!store.compact(error), error);
+  cout << "compacted in " << secsSince(start) << "s" << endl;
+  printInfo(store);
+}
+
+void exportCsv(const string& storePath, const string& csvPath) {
+  IngestedSeries store;
+  string error;
+  dieIf(!store.open(storePath, false, error), error);
+  ofstream file(csvPath);
+  dieIf(!file, "can't write " + csvPath);
+  int maxLength = 0;
+  for (int i = 0; i < store.numOfSeries(); i++)
+    maxLength = max(maxLength, store.length(i));
+  file << "\"V1\"";
+  for (int ival = 0; ival < maxLength; ival++)
+    file << ",\"V" << ival + 2 << "\"";
+  file << "\n";
+  for (int i = 0; i < store.numOfSeries(); i++) {
+    file << '\"' << store.name(i) << '\"';
+    const float* vals = store.values(i);
+    for (int ival = 0; ival < store.length(i); ival++)
+      file << ",\"" << floatText(vals[ival]) << '\"';
+    file << "\n";
+  }
+  dieIf(!file.flush(), "can't write " + csvPath);
+  printInfo(store);
+}
+
+int main(int argc, char** argv) {
+  vector<string> args;
+  bool compactAfter = false;
+  for (int iarg = 1; iarg < argc; iarg++) {
+    string arg = argv[iarg];
+    if (arg == "COMPACT=1")
+      compactAfter = true;
+    else
+      args.push_back(arg);
+  }
+  string command = args.empty() ? "" : args[0];
+  if (command == "init" && args.size() == 3)
+    init(args[1], args[2]);
+  else if (command == "append" && args.size() == 3)
+    append(args[1], args[2], compactAfter);
+  else if (command == "compact" && args.size() == 2)
+    compact(args[1]);
+  else if (command == "info" && args.size() == 2) {
+    IngestedSeries store;
+    string error;
+    dieIf(!store.open(args[1], false, error), error);
+    printInfo(store);
+  } else if (command == "export" && args.size() == 3)
+    exportCsv(args[1], args[2]);
+  else {
+    cerr << "usage: esrnn_ingest init <STORE_PATH> <TRAIN_CSV> | append <STORE_PATH> <DELTA_CSV> [COMPACT=1] | compact <STORE_PATH> | info <STORE_PATH> | export <STORE_PATH> <CSV>" << endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,177 @@
+/*esrnn_loadgen: load generator of the forecast server (ES_RNN_E --serve, see serving.h), reporting QPS and latency percentiles.
+
+Opens CONNECTIONS connections to the Unix domain socket of the server, each sending one request at a time (closed loop) for SECONDS seconds,
+about a random series of SERIES_PATH (the first column of a csv with a header line, e.g. the <VARIABLE>-train.csv the model was trained on).
+UPDATE_SHARE of the requests are updates with one new point (the first value of the last forecast of the series seen by the connection), the rest are forecasts.
+Updates change the served state, which the server saves at shutdown, so use a copy of the model directory for load tests.
+Reports requests/sec, p50, p90, p99, p99.9 and max latency, and the number of error replies; with SHUTDOWN=1 it then stops the server.
+
+It does not need Dynet. Build with linux_example_scripts/build_tool, e.g. ./build_tool esrnn_loadgen
+Usage:
+  esrnn_loadgen [<SOCKET_PATH> [<SERIES_PATH> [<CONNECTIONS> [<SECONDS>]]]] [NAME=value ...]
+e.g.
+  esrnn_loadgen /tmp/esrnn.sock /data/M4/Hourly-train.csv 16 30 UPDATE_SHARE=0.5
+*/
+
+#include "serving.h"
+
+#include <thread>
+#include <atomic>
+#include <random>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdio.h>
+
+using namespace std;
+
+string SOCKET_PATH = "/tmp/esrnn.sock";
+string SERIES_PATH = "/home/uber/progs/data/M4DataSet/Hourly-train.csv";
+int CONNECTIONS = 8;
+double SECONDS = 10;
+float UPDATE_SHARE = 0;
+unsigned SEED = 1;
+bool SHUTDOWN = false;
+
+
+void setParam(const string& name, const string& value) {
+  if (name == "UPDATE_SHARE") UPDATE_SHARE = (float)atof(value.c_str());
+  else if (name == "SEED") SEED = (unsigned)atoi(value.c_str());
+  else if (name == "SHUTDOWN") SHUTDOWN = atoi(value.c_str()) != 0;
+  else {
+    cerr << "unknown parameter " << name << endl;
+    exit(-1);
+  }
+}
+
+vector<string> readSeries(const string& path) {
+  vector<string> series_vect;
+  ifstream file(path);
+  string line;
+  getline(file, line); //header
+  while (getline(file, line)) {
+    stringstream line_stream(line);
+    string series0, series;
+    getline(line_stream, series0, ',');
+    for (const auto c : series0) {
+      if (!ispunct(c))
+        series.push_back(c);
+    }
+    if (!series.empty())
+      series_vect.push_back(series);
+  }
+  return series_vect;
+}
+
+struct ConnectionStats {
+  vector<double> latencies; //secs
+  long errors = 0;
+};
+
+void runConnection(int iconn, const vector<string>& series_vect, double endSecs, ConnectionStats& stats) {
+  int fd = connectUnixSocket(SOCKET_PATH);
+  if (fd < 0) {
+    cerr << "connection " << iconn << ": can't connect to " << SOCKET_PATH << endl;
+    stats.errors++;
+    return;
+  }
+  mt19937 rng(SEED * 1000 + iconn);
+  uniform_int_distribution<size_t> uniOnSeries(0, series_vect.size() - 1);
+  uniform_real_distribution<float> uni(0, 1);
+  unordered_map<string, float> lastForecast;
+  string buffer, reply;
+  while (nowSecs() < endSecs) {
+    const string& series = series_vect[uniOnSeries(rng)];
+    auto last = lastForecast.find(series);
+    ostringstream request;
+    if (last != lastForecast.end() && uni(rng) < UPDATE_SHARE)
+      request << "update " << series << " " << last->second;
+    else
+      request << "forecast " << series;
+    double startSecs = nowSecs();
+    if (!writeAll(fd, request.str() + "\n") || !readLine(fd, buffer, reply)) {
+      cerr << "connection " << iconn << ": the server closed the connection" << endl;
+      stats.errors++;
+      break;
+    }
+    stats.latencies.push_back(nowSecs() - startSecs);
+    istringstream reply_stream(reply);
+    string status, replySeries;
+    float firstValue;
+    if (reply_stream >> status >> replySeries >> firstValue && status == "ok")
+      lastForecast[series] = firstValue;
+    else
+      stats.errors++;
+  }
+  close(fd);
+}
+
+double percentile(const vector<double>& sorted, double p) {
+  if (sorted.empty())
+    return 0;
+  size_t index = min(sorted.size() - 1, (size_t)(p / 100 * sorted.size()));
+  return sorted[index];
+}
+
+int main(int argc, char** argv) {
+  int ipos = 0;
+  for (int iarg = 1; iarg < argc; iarg++) {
+    string arg = argv[iarg];
+    size_t eq = arg.find('=');
+    if (eq != string::npos) {
+      setParam(arg.substr(0, eq), arg.substr(eq + 1));
+      continue;
+    }
+    if (ipos == 0)
+      SOCKET_PATH = arg;
+    else if (ipos == 1)
+      SERIES_PATH = arg;
+    else if (ipos == 2)
+      CONNECTIONS = atoi(arg.c_str());
+    else if (ipos == 3)
+      SECONDS = atof(arg.c_str());
+    ipos++;
+  }
+
+  vector<string> series_vect = readSeries(SERIES_PATH);
+  if (series_vect.empty()) {
+    cerr << "no series in " << SERIES_PATH << endl;
+    return -1;
+  }
+  cout << series_vect.size() << " series, " << CONNECTIONS << " connections, " << SECONDS << "s, update share " << UPDATE_SHARE << endl;
+
+  vector<ConnectionStats> stats(CONNECTIONS);
+  vector<thread> threads;
+  double startSecs = nowSecs();
+  double endSecs = startSecs + SECONDS;
+  for (int iconn = 0; iconn < CONNECTIONS; iconn++)
+    threads.push_back(thread(runConnection, iconn, cref(series_vect), endSecs, ref(stats[iconn])));
+  for (auto& t : threads)
+    t.join();
+  double elapsedSecs = nowSecs() - startSecs;
+
+  vector<double> latencies;
+  long errors = 0;
+  for (auto& s : stats) {
+    latencies.insert(latencies.end(), s.latencies.begin(), s.latencies.end());
+    errors += s.errors;
+  }
+  sort(latencies.begin(), latencies.end());
+  printf("requests: %zu, errors: %ld, QPS: %.1f\n", latencies.size(), errors, latencies.size() / elapsedSecs);
+  printf("latency ms: p50 %.3f, p90 %.3f, p99 %.3f, p99.9 %.3f, max %.3f\n", percentile(latencies, 50) * 1000, percentile(latencies, 90) * 1000,
+    percentile(latencies, 99) * 1000, percentile(latencies, 99.9) * 1000, (latencies.empty() ? 0 : latencies.back()) * 1000);
+
+  if (SHUTDOWN) {
+    int fd = connectUnixSocket(SOCKET_PATH);
+    string buffer, reply;
+    if (fd < 0 || !writeAll(fd, "shutdown\n") || !readLine(fd, buffer, reply))
+      cerr << "could not shut the server down" << endl;
+    if (fd >= 0)
+      close(fd);
+  }
+  return 0;
+}
@@ -0,0 +1,470 @@
+/*esrnn_merge: merging (ensembling) outputs of the ES-RNN workers, and calculating accuracy. Native replacement of R/merge.R and R/merge_PI.R.
+
+The c++ executables write one file per (seed, chunk, ibig), see outputPath in the .cc files:
+  <VARIABLE>_<seed>_<chunk>_<ibig>_LB<LBACK>.csv        for ES_RNN
+  <VARIABLE>_<ibig>_LB<LBACK>.csv                        for ES_RNN_E
+  <VARIABLE>_..._LLB<LBACK>.csv and ..._HLB<LBACK>.csv    for the PI programs (lower and upper bounds)
+This program reads all of them in parallel, averages (or takes median of) forecasts per series and horizon,
+writes <VARIABLE>Forec.csv (or <VARIABLE>ForecL.csv and <VARIABLE>ForecH.csv) into the same directory, in the same format as the R scripts,
+and if LBACK>0 calculates sMAPE and MASE (point forecasts) or MSIS (prediction intervals) in the same pass, using the definitions in accuracy.h.
+
+It does not need Dynet. Build with linux_example_scripts/build_tool, e.g. ./build_tool esrnn_merge
+Usage:
+  esrnn_merge [<FOREC_DIR> [<VARIABLE> [<LBACK> [<numOfExpectedFiles>]]]]
+Without parameters, the values below are used. numOfExpectedFiles==0 switches off the check of the number of files.
+*/
+
+#include "accuracy.h"
+
+#if defined _WINDOWS
+  #include <io.h>
+#else
+  #include <dirent.h>
+#endif
+
+#if defined __AVX__
+  #include <immintrin.h>
+#endif
+
+#include <ctime>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <numeric>
+#include <array>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <algorithm>
+#include <unordered_map>
+#include <math.h>
+
+using namespace std;
+
+string DATA_DIR = "f:\\progs\\data\\M4DataSet\\"; //with the competition data csvs, used only if LBACK>0 or for the count check when LBACK==0
+//string DATA_DIR="/home/uber/progs/data/M4DataSet/";
+string FOREC_DIR = "f:\\progs\\data\\M4\\Quarterly2018-05-31_09_30"; //directory with all the output files produced by the c++ code we want to merge. Do not end with separator
+
+int LBACK = 1; //should be as in the c++ code, LBACK>0 means backtesting
+string VARIABLE = "Quarterly";
+
+//for ES_RNN_E, so for all except Monthly and Quarterly runs: NUM_OF_SEEDS=1, NUM_OF_CHUNKS=1, IBIGS=<number of input files in FOREC_DIR>
+//for ES_RNN (Monthly and Quarterly): see comments in R/merge.R
+int NUM_OF_SEEDS = 3;
+int NUM_OF_CHUNKS = 2;
+int IBIGS = 3;
+
+const bool PREDICTION_INTERVALS = false; //true for outputs of ES_RNN_PI and ES_RNN_E_PI
+const bool USE_MEDIAN = false; //R scripts use mean
+const float ALPHA = 0.05;
+const float ALPHA_MULTIP = 2 / ALPHA;
+
+const unsigned NUM_OF_THREADS = 0; //0 means all hardware threads
+
+
+struct ForecFile {//content of one output file of a worker
+  vector<string> series_vect;
+  vector<float> forecs; //series_vect.size() x horizon, row-major
+  int horizon = 0;
+};
+
+struct MergedForecs {//one row per series, ordered as in R, by the number in the series id
+  vector<string> series_vect;
+  vector<float> forecs; //series_vect.size() x horizon
+  vector<int> counts; //how many forecasts were averaged
+  int horizon = 0;
+};
+
+
+vector<string> listFiles(const string& dir) {
+  vector<string> files_vect;
+#if defined _WINDOWS
+  struct _finddata_t fileInfo;
+  intptr_t handle = _findfirst((dir + "\\*").c_str(), &fileInfo);
+  if (handle != -1) {
+    do {
+      if (!(fileInfo.attrib & _A_SUBDIR))
+        files_vect.push_back(fileInfo.name);
+    } while (_findnext(handle, &fileInfo) == 0);
+    _findclose(handle);
+  }
+#else
+  DIR* dirp = opendir(dir.c_str());
+  if (dirp == NULL) {
+    cerr << "can't open " << dir << endl;
+    exit(-1);
+  }
+  struct dirent* entry;
+  while ((entry = readdir(dirp)) != NULL) {
+    if (entry->d_name[0] != '.')
+      files_vect.push_back(entry->d_name);
+  }
+  closedir(dirp);
+#endif
+  sort(files_vect.begin(), files_vect.end());
+  return files_vect;
+}
+
+
+//equivalent of R's list.files(pattern=paste0(VARIABLE,".*",suffix)), so VARIABLE followed anywhere later by the suffix
+vector<string> selectFiles(const vector<string>& files_vect, const string& suffix) {
+  vector<string> selected_vect;
+  for (const auto& fileName : files_vect) {
+    size_t pos = fileName.find(VARIABLE);
+    if (pos != string::npos && fileName.find(suffix, pos + VARIABLE.size()) != string::npos)
+      selected_vect.push_back(fileName);
+  }
+  return selected_vect;
+}
+
+
+string cleanSeriesName(const string& series0) {
+  string series;
+  for (const auto c : series0) {
+    if (c != '\"' && c != ' ' && c != '\r')
+      series.push_back(c);
+  }
+  return series;
+}
+
+
+void readForecFile(const string& path, ForecFile& forecFile) {
+  ifstream file(path);
+  if (!file) {
+    cerr << "can't open " << path << endl;
+    exit(-1);
+  }
+  string line;
+  while (getline(file, line)) {
+    if (line.size() == 0 || line == "\r")
+      continue;
+    const char* p = line.c_str();
+    const char* comma = strchr(p, ',');
+    if (comma == NULL)
+      continue;
+    forecFile.series_vect.push_back(cleanSeriesName(string(p, comma)));
+    int horizon = 0;
+    p = comma + 1;
+    while (*p != '\0' && *p != '\r') {
+      char* endp;
+      float val = strtof(p, &endp);
+      if (endp == p)
+        break;
+      forecFile.forecs.push_back(val);
+      horizon++;
+      p = endp;
+      while (*p == ' ' || *p == ',')
+        p++;
+    }
+    if (forecFile.horizon == 0)
+      forecFile.horizon = horizon;
+    else if (horizon != forecFile.horizon) {
+      cerr << "inconsistent number of forecasts in " << path << " for " << forecFile.series_vect.back() << endl;
+      exit(-1);
+    }
+  }
+}
+
+
+//runs func(i) for i in [0,n) on numOfThreads threads, in an interleaved fashion
+template<class F> void parallelFor(int n, unsigned numOfThreads, F func) {
+  vector<thread> threads;
+  atomic<int> next(0);
+  for (unsigned it = 0; it < numOfThreads; it++)
+    threads.emplace_back([&]() {
+      for (int i = next++; i < n; i = next++)
+        func(i);
+    });
+  for (auto& th : threads)
+    th.join();
+}
+
+
+//acc[0..horizon) += row[0..horizon)
+inline void addRow(float* acc, const float* row, int horizon) {
+  int ih = 0;
+#if defined __AVX__
+  for (; ih + 8 <= horizon; ih += 8)
+    _mm256_storeu_ps(acc + ih, _mm256_add_ps(_mm256_loadu_ps(acc + ih), _mm256_loadu_ps(row + ih)));
+#endif
+  for (; ih < horizon; ih++)
+    acc[ih] += row[ih];
+}
+
+inline void scaleRow(float* acc, float multip, int horizon) {
+  int ih = 0;
+#if defined __AVX__
+  __m256 multip_v = _mm256_set1_ps(multip);
+  for (; ih + 8 <= horizon; ih += 8)
+    _mm256_storeu_ps(acc + ih, _mm256_mul_ps(_mm256_loadu_ps(acc + ih), multip_v));
+#endif
+  for (; ih < horizon; ih++)
+    acc[ih] *= multip;
+}
+
+
+int seriesNumber(const string& series) {
+  return atoi(series.c_str() + 1); //e.g. Q123 -> 123
+}
+
+
+MergedForecs mergeFiles(const vector<string>& inputFiles, unsigned numOfThreads) {
+  auto begin_time = chrono::steady_clock::now();
+  vector<ForecFile> forecFiles(inputFiles.size());
+  parallelFor((int)inputFiles.size(), numOfThreads, [&](int ifile) {
+    readForecFile(FOREC_DIR + "/" + inputFiles[ifile], forecFiles[ifile]);
+  });
+  double readTime = chrono::duration<double>(chrono::steady_clock::now() - begin_time).count();
+
+  MergedForecs merged;
+  for (const auto& forecFile : forecFiles) {
+    if (merged.horizon == 0)
+      merged.horizon = forecFile.horizon;
+    else if (forecFile.horizon != 0 && forecFile.horizon != merged.horizon) {
+      cerr << "files have different horizons" << endl;
+      exit(-1);
+    }
+  }
+  const int horizon = merged.horizon;
+
+  //index of series
+  unordered_map<string, int> seriesIndex_map;
+  for (const auto& forecFile : forecFiles)
+    for (const auto& series : forecFile.series_vect)
+      if (seriesIndex_map.find(series) == seriesIndex_map.end()) {
+        seriesIndex_map[series] = (int)merged.series_vect.size();
+        merged.series_vect.push_back(series);
+      }
+  stable_sort(merged.series_vect.begin(), merged.series_vect.end(), [](const string& a, const string& b) {
+    return seriesNumber(a) < seriesNumber(b);
+  });
+  for (int is = 0; is < (int)merged.series_vect.size(); is++)
+    seriesIndex_map[merged.series_vect[is]] = is;
+  const int numOfSeries = (int)merged.series_vect.size();
+
+  //rows of all the forecasts of every series
+  vector<vector<const float*>> rows_vect(numOfSeries);
+  for (const auto& forecFile : forecFiles)
+    for (size_t ir = 0; ir < forecFile.series_vect.size(); ir++)
+      rows_vect[seriesIndex_map[forecFile.series_vect[ir]]].push_back(forecFile.forecs.data() + ir*horizon);
+
+  merged.forecs.assign((size_t)numOfSeries*horizon, 0);
+  merged.counts.assign(numOfSeries, 0);
+  parallelFor(numOfSeries, numOfThreads, [&](int is) {
+    const auto& rows = rows_vect[is];
+    float* out = merged.forecs.data() + (size_t)is*horizon;
+    merged.counts[is] = (int)rows.size();
+    if (USE_MEDIAN) {
+      vector<float> temp_vect(rows.size());
+      for (int ih = 0; ih < horizon; ih++) {
+        for (size_t ir = 0; ir < rows.size(); ir++)
+          temp_vect[ir] = rows[ir][ih];
+        size_t mid = temp_vect.size() / 2;
+        nth_element(temp_vect.begin(), temp_vect.begin() + mid, temp_vect.end());
+        float med = temp_vect[mid];
+        if (temp_vect.size() % 2 == 0) //as R median()
+          med = (med + *max_element(temp_vect.begin(), temp_vect.begin() + mid)) / 2;
+        out[ih] = med;
+      }
+    } else {
+      for (const float* row : rows)
+        addRow(out, row, horizon);
+      scaleRow(out, 1.f / rows.size(), horizon);
+    }
+  });
+  double mergeTime = chrono::duration<double>(chrono::steady_clock::now() - begin_time).count() - readTime;
+  cout << inputFiles.size() << " files, " << numOfSeries << " series, read:" << readTime << "s merge:" << mergeTime << "s" << endl;
+  return merged;
+}
+
+
+void writeMerged(const MergedForecs& merged, const string& outPath) {//as R write.csv(row.names=F)
+  ofstream outputFile(outPath);
+  outputFile << "\"id\"";
+  for (int ih = 0; ih < merged.horizon; ih++)
+    outputFile << ",\"V" << ih + 2 << "\"";
+  outputFile << endl;
+  outputFile.precision(9);
+  for (size_t is = 0; is < merged.series_vect.size(); is++) {
+    outputFile << "\"" << merged.series_vect[is] << "\"";
+    const float* row = merged.forecs.data() + is*merged.horizon;
+    for (int ih = 0; ih < merged.horizon; ih++)
+      outputFile << "," << row[ih];
+    outputFile << endl;
+  }
+  outputFile.close();
+  cout << "saved " << outPath << endl;
+}
+
+
+struct SeriesInfo {
+  int horizon = 0;
+  int frequency = 1;
+};
+
+//M4-info.csv: M4id,category,Frequency,Horizon,SP,StartingDate
+unordered_map<string, SeriesInfo> readInfo(const string& path) {
+  unordered_map<string, SeriesInfo> info_map(120000);
+  ifstream infoFile(path);
+  string line;
+  getline(infoFile, line); //header
+  while (getline(infoFile, line)) {
+    stringstream line_stream(line);
+    string series, category, frequency, horizon, sp;
+    getline(line_stream, series, ',');
+    getline(line_stream, category, ',');
+    getline(line_stream, frequency, ',');
+    getline(line_stream, horizon, ',');
+    getline(line_stream, sp, ',');
+    if (cleanSeriesName(sp) != VARIABLE)
+      continue;
+    SeriesInfo info;
+    info.frequency = atoi(cleanSeriesName(frequency).c_str());
+    info.horizon = atoi(cleanSeriesName(horizon).c_str());
+    info_map[cleanSeriesName(series)] = info;
+  }
+  return info_map;
+}
+
+
+//reads <VARIABLE>-train.csv, only the series present in series_vect
+unordered_map<string, vector<float>> readActuals(const string& path, const vector<string>& series_vect) {
+  unordered_map<string, vector<float>> actuals_map((int)series_vect.size()*1.5);
+  for (const auto& series : series_vect)
+    actuals_map[series];
+  ifstream file(path);
+  string line;
+  getline(file, line); //header
+  while (getline(file, line)) {
+    stringstream line_stream(line);
+    string series0;
+    getline(line_stream, series0, ',');
+    auto iter = actuals_map.find(cleanSeriesName(series0));
+    if (iter == actuals_map.end())
+      continue;
+    string tmp_str;
+    while (getline(line_stream, tmp_str, ',')) {
+      string val_str = cleanSeriesName(tmp_str);
+      if (val_str.size() == 0 || val_str == "NA")
+        break;
+      iter->second.push_back((float)atof(val_str.c_str()));
+    }
+  }
+  return actuals_map;
+}
+
+
+int main(int argc, char** argv) {
+  if (argc >= 2)
+    FOREC_DIR = argv[1];
+  if (argc >= 3)
+    VARIABLE = argv[2];
+  if (argc >= 4)
+    LBACK = atoi(argv[3]);
+  int numOfExpectedFiles = NUM_OF_SEEDS*NUM_OF_CHUNKS*IBIGS;
+  if (argc >= 5)
+    numOfExpectedFiles = atoi(argv[4]);
+
+  unsigned numOfThreads = NUM_OF_THREADS;
+  if (numOfThreads == 0)
+    numOfThreads = max(1u, thread::hardware_concurrency());
+  cout << VARIABLE << " LBACK:" << LBACK << " dir:" << FOREC_DIR << " threads:" << numOfThreads << endl;
+
+  vector<string> allFiles_vect = listFiles(FOREC_DIR);
+  vector<string> suffixes;
+  if (PREDICTION_INTERVALS) {
+    suffixes.push_back("LLB" + to_string(LBACK));
+    suffixes.push_back("HLB" + to_string(LBACK));
+  } else
+    suffixes.push_back("LB" + to_string(LBACK));
+
+  vector<MergedForecs> merged_vect;
+  for (const auto& suffix : suffixes) {
+    vector<string> inputFiles = selectFiles(allFiles_vect, suffix);
+    if (numOfExpectedFiles > 0 && (int)inputFiles.size() != numOfExpectedFiles) {
+      cerr << "number of input files:" << inputFiles.size() << " != NUM_OF_SEEDS*NUM_OF_CHUNKS*IBIGS:" << numOfExpectedFiles << endl;
+      exit(-1);
+    }
+    if (inputFiles.size() == 0) {
+      cerr << "no input files" << endl;
+      exit(-1);
+    }
+    merged_vect.push_back(mergeFiles(inputFiles, numOfThreads));
+  }
+  if (PREDICTION_INTERVALS && merged_vect[0].series_vect != merged_vect[1].series_vect) {
+    cerr << "lower and upper files have different series" << endl;
+    exit(-1);
+  }
+
+  const MergedForecs& merged = merged_vect[0];
+  unordered_map<string, SeriesInfo> info_map = readInfo(DATA_DIR + "M4-info.csv");
+  if (LBACK == 0 && info_map.size() > 0 && merged.series_vect.size() != info_map.size()) {
+    cerr << "Expected number of cases:" << info_map.size() << " but got:" << merged.series_vect.size() << endl;
+    exit(-1);
+  }
+
+  if (PREDICTION_INTERVALS) {
+    writeMerged(merged_vect[0], FOREC_DIR + "/" + VARIABLE + "ForecL.csv");
+    writeMerged(merged_vect[1], FOREC_DIR + "/" + VARIABLE + "ForecH.csv");
+  } else
+    writeMerged(merged, FOREC_DIR + "/" + VARIABLE + "Forec.csv");
+
+  if (LBACK > 0) {
+    auto begin_time = chrono::steady_clock::now();
+    const int horizon = merged.horizon;
+    unordered_map<string, vector<float>> actuals_map = readActuals(DATA_DIR + VARIABLE + "-train.csv", merged.series_vect);
+    int seasonality = 1;
+    if (info_map.size() > 0)
+      seasonality = info_map.begin()->second.frequency;
+
+    const int numOfSeries = (int)merged.series_vect.size();
+    vector<float> sMAPE_vect(numOfSeries, 0), MASE_vect(numOfSeries, 0), MSIS_vect(numOfSeries, 0);
+    vector<char> valid_vect(numOfSeries, 0), scaled_vect(numOfSeries, 0); //has the actuals; and a nonzero MASE scale, for MASE and MSIS
+    parallelFor(numOfSeries, numOfThreads, [&](int is) {
+      const vector<float>& vals = actuals_map[merged.series_vect[is]];
+      int n = (int)vals.size();
+      if (n < LBACK*horizon + seasonality)
+        return;
+      valid_vect[is] = 1;
+      const float* actuals = vals.data() + n - LBACK*horizon;
+      float scale = meanAbsSeasDiff(vals.data(), n, seasonality); //as in the PI programs and merge_PI.R, over the whole series
+      if (!PREDICTION_INTERVALS) {
+        const float* forec = merged.forecs.data() + (size_t)is*horizon;
+        sMAPE_vect[is] = sMAPE(forec, actuals, horizon); //every series, as in merge.R; a flat history only leaves out its MASE
+        if (scale > 0)
+          MASE_vect[is] = MASE(forec, actuals, horizon, scale);
+      } else if (scale > 0)
+        MSIS_vect[is] = MSIS(merged_vect[0].forecs.data() + (size_t)is*horizon, merged_vect[1].forecs.data() + (size_t)is*horizon,
+          actuals, horizon, ALPHA_MULTIP, scale);
+      scaled_vect[is] = scale > 0;
+    });
+
+    int numOfValid = accumulate(valid_vect.begin(), valid_vect.end(), 0);
+    int numOfScaled = accumulate(scaled_vect.begin(), scaled_vect.end(), 0);
+    if (numOfValid == 0) {
+      cerr << "no actuals found in " << DATA_DIR + VARIABLE + "-train.csv" << endl;
+      exit(-1);
+    }
+    double sumSMAPE = 0, sumMASE = 0, sumMSIS = 0;
+    for (int is = 0; is < numOfSeries; is++) {
+      if (valid_vect[is])
+        sumSMAPE += sMAPE_vect[is];
+      if (scaled_vect[is]) {
+        sumMASE += MASE_vect[is];
+        sumMSIS += MSIS_vect[is];
+      }
+    }
+    double evalTime = chrono::duration<double>(chrono::steady_clock::now() - begin_time).count();
+    cout << "series evaluated:" << numOfValid;
+    if (numOfScaled < numOfValid)
+      cout << " (" << numOfValid - numOfScaled << " with a flat history, left out of " << (PREDICTION_INTERVALS ? "MSIS)" : "MASE)");
+    if (PREDICTION_INTERVALS)
+      cout << " avg MSIS:" << (numOfScaled > 0 ? sumMSIS / numOfScaled : 0);
+    else
+      cout << " avg sMAPE:" << sumSMAPE / numOfValid << " avg MASE:" << (numOfScaled > 0 ? sumMASE / numOfScaled : 0);
+    cout << " (" << evalTime << "s)" << endl;
+  }
+}
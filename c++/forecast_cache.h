@@ -0,0 +1,238 @@
+/**
+* file forecast_cache.h
+* persistent cache of forecasts, in front of the forecast path of esrnn_infer and of ES_RNN_E --forecast-only, Linux/Mac only. Does not need Dynet.
+* A repeated forecasting job mostly sees series whose data has not changed since the last run; their forecasts come from the cache, without a forward pass.
+* The key is a pair:
+  - model key - the version of the model artifact (hash of its files, see fileHash()) and of whatever else changes the forecasts, e.g. the program and int8
+  - series key - hash of the series name, its categories, and the values the forecast is made from: the history after the cut to the maximum length,
+    i.e. exactly what the ES state and the last input window are computed from (see seriesKey())
+* The file is a memory-mapped hash table of sets of CACHE_WAYS slots, each slot the two keys, the time of its last use and valuesPerEntry floats
+  (OUTPUT_SIZE, a point forecast). A full set evicts its least recently used slot.
+* Prediction intervals are not cached: ES_RNN_PI and ES_RNN_E_PI, which make them, forecast only with the weights of the run that trains them,
+  there is no forecast path of a saved model to put the cache in front of.
+* The header keeps lifetime counters (hits, misses, inserts, evictions) next to those of the current run, for the hit rate.
+* One process at a time: open() takes an exclusive flock, and fails if another process has the cache. Not thread safe, the callers look up and insert
+  from one thread. A cache not closed cleanly (a crash), or of another size or layout, is emptied by open().
+*/
+
+#ifndef ESRNN_FORECAST_CACHE_H_
+#define ESRNN_FORECAST_CACHE_H_
+
+#if defined _WINDOWS
+  #error "the forecast cache uses mmap and flock, not available on Windows"
+#endif
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+const int CACHE_WAYS = 8;
+const uint32_t CACHE_FORMAT_VERSION = 1;
+const uint64_t FNV_OFFSET = 14695981039346656037ull;
+const uint64_t FNV_PRIME = 1099511628211ull;
+
+inline uint64_t hashBytes(const void* data, size_t size, uint64_t hash = FNV_OFFSET) {
+  const unsigned char* bytes = (const unsigned char*)data;
+  for (size_t i = 0; i < size; i++)
+    hash = (hash ^ bytes[i]) * FNV_PRIME;
+  return hash;
+}
+
+//by 32-bit words, as the weights hash of inference.h: 4x fewer multiplications than by bytes, this runs over every series
+inline uint64_t hashFloats(const float* values, size_t n, uint64_t hash = FNV_OFFSET) {
+  for (size_t i = 0; i < n; i++) {
+    uint32_t bits;
+    memcpy(&bits, values + i, sizeof(bits));
+    hash = (hash ^ bits) * FNV_PRIME;
+  }
+  return hash;
+}
+
+//0 if the file can't be read
+inline uint64_t fileHash(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file)
+    return 0;
+  uint64_t hash = FNV_OFFSET;
+  std::vector<char> buffer(1 << 20);
+  while (file.read(buffer.data(), buffer.size()) || file.gcount() > 0)
+    hash = hashBytes(buffer.data(), (size_t)file.gcount(), hash);
+  return hash;
+}
+
+inline uint64_t seriesKey(const std::string& series, const float* categories, int numOfCategories, const float* values, int n) {
+  uint64_t hash = hashBytes(series.data(), series.size());
+  hash = hashFloats(categories, numOfCategories, hash);
+  hash = hashBytes(&n, sizeof(n), hash);
+  return hashFloats(values, n, hash);
+}
+
+struct ForecastCacheStats {
+  uint64_t hits = 0, misses = 0, inserts = 0, evictions = 0;
+  double hitRate() const { return hits + misses > 0 ? (double)hits / (hits + misses) : 0; }
+};
+
+struct ForecastCacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t valuesPerEntry;
+  uint64_t numOfSets;
+  uint64_t clock; //of the last uses, 0 marks an empty slot
+  uint64_t entries;
+  ForecastCacheStats lifetime;
+  uint32_t clean; //0 while a process has it open
+};
+
+struct ForecastCacheSlot {//followed by valuesPerEntry floats
+  uint64_t modelKey;
+  uint64_t seriesKey;
+  uint64_t lastUse;
+};
+
+struct ForecastCache {
+  int fd = -1;
+  char* mem = NULL;
+  size_t mappedSize = 0;
+  size_t slotSize = 0;
+  ForecastCacheHeader* header = NULL;
+  ForecastCacheStats run;
+
+  ForecastCache() {}
+  ForecastCache(const ForecastCache&) = delete;
+  ForecastCache& operator=(const ForecastCache&) = delete;
+  ~ForecastCache() { close(); }
+
+  static size_t headerSize() { return 4096; } //a page, the slots stay aligned
+
+  bool isOpen() const { return header != NULL; }
+
+  //Opens, or creates, the cache of at least numOfEntries entries (rounded up to a power of 2) of valuesPerEntry floats. False, with the reason in error, on failure.
+  bool open(const std::string& path, uint64_t numOfEntries, int valuesPerEntry, std::string& error) {
+    close();
+    uint64_t numOfSets = 1;
+    while (numOfSets * CACHE_WAYS < numOfEntries)
+      numOfSets *= 2;
+    slotSize = (sizeof(ForecastCacheSlot) + valuesPerEntry * sizeof(float) + 7) / 8 * 8;
+    mappedSize = headerSize() + numOfSets * CACHE_WAYS * slotSize;
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+      error = "can't open the forecast cache " + path;
+      return false;
+    }
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+      error = "the forecast cache " + path + " is in use by another process";
+      ::close(fd);
+      fd = -1;
+      return false;
+    }
+    struct stat fileStat;
+    bool reuse = fstat(fd, &fileStat) == 0 && (size_t)fileStat.st_size == mappedSize;
+    if (reuse) {
+      ForecastCacheHeader existing;
+      reuse = pread(fd, &existing, sizeof(existing), 0) == (ssize_t)sizeof(existing) && memcmp(existing.magic, "ESRNNFC", 8) == 0
+        && existing.version == CACHE_FORMAT_VERSION && existing.valuesPerEntry == (uint32_t)valuesPerEntry && existing.numOfSets == numOfSets && existing.clean;
+    }
+    if (!reuse && (ftruncate(fd, 0) != 0 || ftruncate(fd, (off_t)mappedSize) != 0)) {//sparse and zeroed: all slots empty
+      error = "can't size the forecast cache " + path;
+      close();
+      return false;
+    }
+    void* mapped = mmap(NULL, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+      error = "can't map the forecast cache " + path;
+      close();
+      return false;
+    }
+    mem = (char*)mapped;
+    header = (ForecastCacheHeader*)mem;
+    if (!reuse) {
+      memcpy(header->magic, "ESRNNFC", 8);
+      header->version = CACHE_FORMAT_VERSION;
+      header->valuesPerEntry = (uint32_t)valuesPerEntry;
+      header->numOfSets = numOfSets;
+    }
+    header->clean = 0;
+    msync(mem, headerSize(), MS_SYNC); //a crash from here on empties the cache at the next open
+    run = ForecastCacheStats();
+    return true;
+  }
+
+  //flushes and marks the file clean
+  void close() {
+    if (mem != NULL) {
+      msync(mem, mappedSize, MS_SYNC);
+      header->clean = 1;
+      msync(mem, headerSize(), MS_SYNC);
+      munmap(mem, mappedSize);
+    }
+    if (fd >= 0)
+      ::close(fd); //releases the flock
+    mem = NULL;
+    header = NULL;
+    fd = -1;
+  }
+
+  ForecastCacheSlot* slot(uint64_t modelKey, uint64_t seriesKey, int way) const {
+    uint64_t set = ((seriesKey ^ (modelKey * 0x9E3779B97F4A7C15ull)) >> 7) & (header->numOfSets - 1);
+    return (ForecastCacheSlot*)(mem + headerSize() + (set * CACHE_WAYS + way) * slotSize);
+  }
+  float* slotValues(ForecastCacheSlot* s) const {
+    return (float*)(s + 1);
+  }
+
+  //copies the entry into values, true on a hit
+  bool find(uint64_t modelKey, uint64_t seriesKey, float* values) {
+    for (int way = 0; way < CACHE_WAYS; way++) {
+      ForecastCacheSlot* s = slot(modelKey, seriesKey, way);
+      if (s->lastUse != 0 && s->modelKey == modelKey && s->seriesKey == seriesKey) {
+        s->lastUse = ++header->clock;
+        memcpy(values, slotValues(s), header->valuesPerEntry * sizeof(float));
+        run.hits++;
+        header->lifetime.hits++;
+        return true;
+      }
+    }
+    run.misses++;
+    header->lifetime.misses++;
+    return false;
+  }
+
+  //into the slot of the key, an empty one, or the least recently used of the set
+  void insert(uint64_t modelKey, uint64_t seriesKey, const float* values) {
+    ForecastCacheSlot* target = NULL;
+    for (int way = 0; way < CACHE_WAYS; way++) {
+      ForecastCacheSlot* s = slot(modelKey, seriesKey, way);
+      if (s->lastUse != 0 && s->modelKey == modelKey && s->seriesKey == seriesKey) {
+        target = s;
+        break;
+      }
+      if (target == NULL || s->lastUse < target->lastUse)
+        target = s;
+    }
+    bool replaces = target->lastUse != 0 && !(target->modelKey == modelKey && target->seriesKey == seriesKey);
+    if (target->lastUse == 0)
+      header->entries++;
+    else if (replaces) {
+      run.evictions++;
+      header->lifetime.evictions++;
+    }
+    target->lastUse = 0; //the values are not valid while they are written
+    memcpy(slotValues(target), values, header->valuesPerEntry * sizeof(float));
+    target->modelKey = modelKey;
+    target->seriesKey = seriesKey;
+    target->lastUse = ++header->clock;
+    run.inserts++;
+    header->lifetime.inserts++;
+  }
+
+  uint64_t capacity() const { return header->numOfSets * CACHE_WAYS; }
+};
+
+#endif
@@ -0,0 +1,150 @@
+/**
+* file health.h
+* numerical health check of a training step, done after backward and before the trainer updates.
+* One pass over the gradients of the trained parameters and over the LSTM c-states, looking for NaN/Inf and, for the states, excessive magnitude.
+* An unhealthy step is skipped (the caller resets the gradients), so a bad series does not reach the shared weights,
+* and a series that fails STRIKES_TO_QUARANTINE times stops being trained (until the monitor is reset, i.e. for the rest of the ibig run).
+* Only CPU tensors are supported.
+*/
+
+#ifndef ESRNN_HEALTH_H_
+#define ESRNN_HEALTH_H_
+
+#include <array>
+#include <cmath>
+#include <cfloat>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <iostream>
+#include "dynet/dynet.h"
+#include "metrics.h"
+
+#if defined __AVX__
+  #include <immintrin.h>
+#endif
+
+//Accumulates, over v[0..n), whether any element is NaN/Inf, and the max abs of the elements
+inline void scanFloats(const float* v, size_t n, bool& nonFinite, float& maxAbs) {
+  size_t i = 0;
+#if defined __AVX__
+  const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+  const __m256 fltMax = _mm256_set1_ps(FLT_MAX);
+  __m256 max_v = _mm256_setzero_ps();
+  __m256 bad_v = _mm256_setzero_ps();
+  for (; i + 8 <= n; i += 8) {
+    __m256 abs_v = _mm256_and_ps(_mm256_loadu_ps(v + i), absMask);
+    bad_v = _mm256_or_ps(bad_v, _mm256_cmp_ps(abs_v, fltMax, _CMP_NLE_UQ)); //true for Inf and NaN
+    max_v = _mm256_max_ps(max_v, abs_v);
+  }
+  if (_mm256_movemask_ps(bad_v))
+    nonFinite = true;
+  float maxs[8];
+  _mm256_storeu_ps(maxs, max_v);
+  for (int j = 0; j < 8; j++)
+    if (maxs[j] > maxAbs)
+      maxAbs = maxs[j];
+#endif
+  for (; i < n; i++) {
+    float a = std::fabs(v[i]);
+    if (!(a <= FLT_MAX))
+      nonFinite = true;
+    else if (a > maxAbs)
+      maxAbs = a;
+  }
+}
+
+struct HealthMonitor {
+  float maxStateAbs;
+  int strikesToQuarantine;
+  std::unordered_map<std::string, int> strikes;
+  std::unordered_set<std::string> quarantined;
+  //of the current check
+  bool nonFiniteGradient;
+  bool nonFiniteState;
+  float maxGradientAbs_;
+  float maxStateAbs_;
+
+  HealthMonitor(float maxStateAbs, int strikesToQuarantine) : maxStateAbs(maxStateAbs), strikesToQuarantine(strikesToQuarantine) {
+    begin();
+  }
+
+  void reset() {
+    strikes.clear();
+    quarantined.clear();
+  }
+
+  bool isQuarantined(const std::string& series) const {
+    return quarantined.find(series) != quarantined.end();
+  }
+
+  void begin() {
+    nonFiniteGradient = false;
+    nonFiniteState = false;
+    maxGradientAbs_ = 0;
+    maxStateAbs_ = 0;
+  }
+
+  //only the parameters touched by the current graph, others have zero gradients
+  void addGradients(const dynet::ParameterCollection& pc) {
+    for (auto& storage : pc.parameters_list())
+      if (storage->nonzero_grad)
+        scanFloats(storage->g.v, storage->g.d.size(), nonFiniteGradient, maxGradientAbs_);
+  }
+
+  void addGradient(const dynet::Parameter& par) {
+    if (par.p)
+      scanFloats(par.p->g.v, par.p->g.d.size(), nonFiniteGradient, maxGradientAbs_);
+  }
+
+  template <size_t N>
+  void addGradients(const std::array<dynet::Parameter, N>& pars) {
+    for (auto& par : pars)
+      addGradient(par);
+  }
+
+  //c-states of all layers at all time steps, already computed by the forward pass
+  template <class Builder>
+  void addStates(const std::vector<Builder>& rNNStack) {
+    for (auto& builder : rNNStack)
+      for (auto& layers : builder.c)
+        for (auto& state_ex : layers) {
+          const dynet::Tensor& state = state_ex.value();
+          scanFloats(state.v, state.d.size(), nonFiniteState, maxStateAbs_);
+        }
+  }
+
+  bool healthy() const {
+    return !nonFiniteGradient && !nonFiniteState && maxStateAbs_ <= maxStateAbs;
+  }
+
+  //The update of the series was skipped: count and report it. strike() also counts it against the series.
+  void reportSkipped(const std::string& series, Metrics& metrics) const {
+    metrics.count(COUNTER_SKIPPED_UPDATES);
+    std::cerr << "skipped update of " << series;
+    if (nonFiniteGradient)
+      std::cerr << ", non-finite gradient";
+    if (nonFiniteState)
+      std::cerr << ", non-finite state";
+    std::cerr << ", max abs of gradients:" << maxGradientAbs_ << " of states:" << maxStateAbs_ << std::endl;
+  }
+
+  //The update of the series was skipped: count it, and quarantine the series if it keeps failing
+  void strike(const std::string& series, Metrics& metrics) {
+    reportSkipped(series, metrics);
+    addStrike(series, metrics);
+  }
+
+  //returns true if the series got quarantined now
+  bool addStrike(const std::string& series, Metrics& metrics) {
+    if (++strikes[series] != strikesToQuarantine)
+      return false;
+    quarantined.insert(series);
+    metrics.count(COUNTER_QUARANTINED_SERIES);
+    std::cerr << series << " quarantined" << std::endl;
+    return true;
+  }
+};
+
+#endif
@@ -0,0 +1,626 @@
+/**
+* file inference.h
+* forward pass of an exported ES_RNN_E model (model_artifact.h) without Dynet, for batch forecasting (esrnn_infer.cc) and serving.
+* Reads the .model (configuration, ES parameters, rankings) and the .weights (Dynet text format, parameters of every net in creation order, column-major),
+* and makes the forecasts after the last point of a series as ES_RNN_E does: the ES recurrence (deseasonalization, level normalization, log squashing of the input window),
+* the stack of dilated LSTMs - plain, residual or attentive, as in slstm.cpp - with the stacks after the first one added as shortcuts, the optional ADD_NL_LAYER tanh layer, and the adapter.
+* No autodiff, no graph: every step runs in the buffers of an InferenceWorkspace, so after the workspace has grown to the longest series a forecast does not allocate.
+* The matrix-vector products run in AVX/FMA blocks when built with -march=native (as by build_tool); the LSTM output is computed only after the last point.
+* One workspace per thread; the model is read-only once loaded.
+* quantize() adds an int8 copy of the gate weights (Wx, Wh) of every LSTM layer and of the adapter, with a scale per row; with int8 set, those products run on it,
+  the inputs quantized per step with a scale per vector (AVX-VNNI / AVX512-VNNI dot products, or AVX2 maddubs). The attention and the ADD_NL_LAYER stay in floats.
+  The int8 path changes the forecasts slightly, so esrnn_infer uses it only after its accuracy gate (QUANT_GATE) has passed for the model.
+*/
+
+#ifndef ESRNN_INFERENCE_H_
+#define ESRNN_INFERENCE_H_
+
+#include "model_artifact.h"
+
+#if defined __AVX__
+  #include <immintrin.h>
+#endif
+
+#include <vector>
+#include <map>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+enum InferenceLstmType { DILATED_LSTM, RESIDUAL_LSTM, ATTENTIVE_LSTM };
+
+struct InferenceMatrix {//as Dynet stores it: column-major, a vector is a single column
+  int rows = 0, cols = 0;
+  std::vector<float> values;
+};
+
+struct QuantizedMatrix {//int8, in blocks of 8 rows x 4 columns: 32 bytes, row after row, each row 4 consecutive columns, so a 32-bit lane holds a row. Zero padded
+  int rows = 0, cols = 0;
+  int rowBlocks = 0, colGroups = 0;
+  std::vector<int8_t> values; //[rowBlock][colGroup][row in the block][column in the group]
+  std::vector<float> scales; //per row, padded
+};
+
+struct InferenceLayer {
+  int inputDim = 0;
+  int dilation = 1;
+  InferenceMatrix Wx, Wh, b; //gates i, f, o, g
+  QuantizedMatrix WxQ, WhQ;
+  InferenceMatrix Wxa1, Wha1, Wsa1, ba1, Wa2, ba2; //attention over the last dilation steps, ATTENTIVE_LSTM only
+};
+
+struct InferenceNet {
+  bool loaded = false;
+  std::vector<std::vector<InferenceLayer>> stacks; //[rnn][layer]
+  InferenceMatrix MLPW, MLPB, adapterW, adapterB;
+  QuantizedMatrix adapterWQ;
+};
+
+//y[0..rows) += W*x, W column-major rows x cols
+inline void gemvAdd(float* y, const InferenceMatrix& W, const float* x) {
+  const int rows = W.rows, cols = W.cols;
+  const float* w = W.values.data();
+  int r = 0;
+#if defined __AVX__
+  for (; r + 32 <= rows; r += 32) {//4 accumulators stay in registers over all columns
+    __m256 acc0 = _mm256_loadu_ps(y + r), acc1 = _mm256_loadu_ps(y + r + 8), acc2 = _mm256_loadu_ps(y + r + 16), acc3 = _mm256_loadu_ps(y + r + 24);
+    for (int c = 0; c < cols; c++) {
+      const float* col = w + (size_t)c*rows + r;
+      __m256 x_v = _mm256_set1_ps(x[c]);
+  #if defined __FMA__
+      acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(col), x_v, acc0);
+      acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(col + 8), x_v, acc1);
+      acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(col + 16), x_v, acc2);
+      acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(col + 24), x_v, acc3);
+  #else
+      acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_loadu_ps(col), x_v));
+      acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(_mm256_loadu_ps(col + 8), x_v));
+      acc2 = _mm256_add_ps(acc2, _mm256_mul_ps(_mm256_loadu_ps(col + 16), x_v));
+      acc3 = _mm256_add_ps(acc3, _mm256_mul_ps(_mm256_loadu_ps(col + 24), x_v));
+  #endif
+    }
+    _mm256_storeu_ps(y + r, acc0);
+    _mm256_storeu_ps(y + r + 8, acc1);
+    _mm256_storeu_ps(y + r + 16, acc2);
+    _mm256_storeu_ps(y + r + 24, acc3);
+  }
+  for (; r + 8 <= rows; r += 8) {
+    __m256 acc = _mm256_loadu_ps(y + r);
+    for (int c = 0; c < cols; c++)
+      acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(w + (size_t)c*rows + r), _mm256_set1_ps(x[c])));
+    _mm256_storeu_ps(y + r, acc);
+  }
+#endif
+  for (; r < rows; r++) {
+    float acc = y[r];
+    for (int c = 0; c < cols; c++)
+      acc += w[(size_t)c*rows + r] * x[c];
+    y[r] = acc;
+  }
+}
+
+//symmetric, [-127,127] (never -128, so the sign trick below can't overflow)
+inline QuantizedMatrix quantizeMatrix(const InferenceMatrix& W) {
+  QuantizedMatrix Q;
+  Q.rows = W.rows;
+  Q.cols = W.cols;
+  Q.rowBlocks = (W.rows + 7) / 8;
+  Q.colGroups = (W.cols + 3) / 4;
+  Q.values.assign((size_t)Q.rowBlocks*Q.colGroups * 32, 0);
+  Q.scales.assign(Q.rowBlocks * 8, 0.f);
+  for (int r = 0; r < W.rows; r++) {
+    float maxAbs = 0;
+    for (int c = 0; c < W.cols; c++)
+      maxAbs = std::max(maxAbs, std::fabs(W.values[(size_t)c*W.rows + r]));
+    if (maxAbs == 0)
+      continue;
+    Q.scales[r] = maxAbs / 127;
+    for (int c = 0; c < W.cols; c++)
+      Q.values[((size_t)(r / 8)*Q.colGroups + c / 4) * 32 + (r % 8) * 4 + c % 4] = (int8_t)std::lround(W.values[(size_t)c*W.rows + r] / Q.scales[r]);
+  }
+  return Q;
+}
+
+//x[0..n) -> xq[0..n), returns the scale. xq beyond n does not matter, the padding of the matrices is 0
+inline float quantizeVector(const float* x, int n, int8_t* xq) {
+  float maxAbs = 0;
+  for (int i = 0; i < n; i++)
+    maxAbs = std::max(maxAbs, std::fabs(x[i]));
+  float scale = maxAbs > 0 ? maxAbs / 127 : 1;
+  float invScale = 1 / scale;
+  for (int i = 0; i < n; i++)
+    xq[i] = (int8_t)std::lrint(x[i] * invScale); //vectorized with -Ofast, unlike lround
+  return scale;
+}
+
+#if defined __AVX2__
+//acc += products of the 8 rows of a block with 4 columns of x, per 32-bit lane: |x| * (w with the sign of x), unsigned x signed bytes
+inline __m256i dotInt8Block(__m256i acc, __m256i absX, __m256i x_v, const int8_t* w) {
+  __m256i signedW = _mm256_sign_epi8(_mm256_loadu_si256((const __m256i*)w), x_v);
+  #if defined __AVXVNNI__
+  return _mm256_dpbusd_avx_epi32(acc, absX, signedW);
+  #elif defined __AVX512VNNI__ && defined __AVX512VL__
+  return _mm256_dpbusd_epi32(acc, absX, signedW);
+  #else
+  return _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_maddubs_epi16(absX, signedW), _mm256_set1_epi16(1))); //pairs <= 2*127*127, no saturation
+  #endif
+}
+#endif
+
+//y[0..rows) += W*x, x quantized with xScale, at least 4*colGroups long
+inline void gemvAddInt8(float* y, const QuantizedMatrix& W, const int8_t* xq, float xScale) {
+  const size_t blockSize = (size_t)W.colGroups * 32;
+  int rb = 0;
+#if defined __AVX2__
+  const __m256 xScale_v = _mm256_set1_ps(xScale);
+  for (; rb + 4 <= W.rowBlocks && (rb + 4) * 8 <= W.rows; rb += 4) {//4 independent accumulators, sharing the broadcasts of x
+    const int8_t* w = W.values.data() + rb*blockSize;
+    __m256i acc0 = _mm256_setzero_si256(), acc1 = acc0, acc2 = acc0, acc3 = acc0;
+    for (int k = 0; k < W.colGroups; k++, w += 32) {
+      int32_t x4;
+      memcpy(&x4, xq + 4 * k, sizeof(x4));
+      __m256i x_v = _mm256_set1_epi32(x4);
+      __m256i absX = _mm256_abs_epi8(x_v);
+      acc0 = dotInt8Block(acc0, absX, x_v, w);
+      acc1 = dotInt8Block(acc1, absX, x_v, w + blockSize);
+      acc2 = dotInt8Block(acc2, absX, x_v, w + 2 * blockSize);
+      acc3 = dotInt8Block(acc3, absX, x_v, w + 3 * blockSize);
+    }
+    __m256i accs[4] = { acc0, acc1, acc2, acc3 };
+    for (int ib = 0; ib < 4; ib++) {
+      float* yb = y + (rb + ib) * 8;
+      __m256 scaled = _mm256_mul_ps(_mm256_cvtepi32_ps(accs[ib]), _mm256_mul_ps(_mm256_loadu_ps(W.scales.data() + (rb + ib) * 8), xScale_v));
+      _mm256_storeu_ps(yb, _mm256_add_ps(_mm256_loadu_ps(yb), scaled));
+    }
+  }
+#endif
+  for (; rb < W.rowBlocks; rb++) {
+    const int8_t* w = W.values.data() + rb*blockSize;
+    int32_t sums[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    for (int k = 0; k < W.colGroups; k++, w += 32)
+      for (int lane = 0; lane < 8; lane++)
+        for (int j = 0; j < 4; j++)
+          sums[lane] += (int32_t)w[lane * 4 + j] * xq[4 * k + j];
+    int rows = std::min(8, W.rows - rb * 8);
+    for (int lane = 0; lane < rows; lane++)
+      y[rb * 8 + lane] += W.scales[rb * 8 + lane] * xScale * sums[lane];
+  }
+}
+
+inline float inferenceLogistic(float x) {
+  return 1 / (1 + std::exp(-x));
+}
+
+#if defined __AVX2__
+//exp of 8 floats: Cephes' expf polynomial after the range reduction by log(2), relative error ~1e-7
+inline __m256 exp256(__m256 x) {
+  x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-87.3f)), _mm256_set1_ps(88.7f));
+  __m256 fx = _mm256_floor_ps(_mm256_fmadd_ps(x, _mm256_set1_ps(1.44269504088896341f), _mm256_set1_ps(0.5f)));
+  x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(0.693359375f), x);
+  x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(-2.12194440e-4f), x);
+  __m256 y = _mm256_set1_ps(1.9875691500e-4f);
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.3981999507e-3f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(8.3334519073e-3f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(4.1665795894e-2f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.6666665459e-1f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(5.0000001201e-1f));
+  y = _mm256_fmadd_ps(y, _mm256_mul_ps(x, x), _mm256_add_ps(x, _mm256_set1_ps(1.f)));
+  __m256i pow2n = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(fx), _mm256_set1_epi32(127)), 23);
+  return _mm256_mul_ps(y, _mm256_castsi256_ps(pow2n));
+}
+#endif
+
+//in place, on x[0..n). The activations cost as much as the products, so they are vectorized too
+inline void logisticInPlace(float* x, int n) {
+  int i = 0;
+#if defined __AVX2__ && defined __FMA__
+  const __m256 one = _mm256_set1_ps(1.f);
+  for (; i + 8 <= n; i += 8) {
+    __m256 e = exp256(_mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(x + i)));
+    _mm256_storeu_ps(x + i, _mm256_div_ps(one, _mm256_add_ps(one, e)));
+  }
+#endif
+  for (; i < n; i++)
+    x[i] = inferenceLogistic(x[i]);
+}
+
+//y[0..n) = tanh(x[0..n)), as 2*logistic(2x)-1
+inline void tanhTo(const float* x, float* y, int n) {
+  int i = 0;
+#if defined __AVX2__ && defined __FMA__
+  const __m256 one = _mm256_set1_ps(1.f), two = _mm256_set1_ps(2.f);
+  for (; i + 8 <= n; i += 8) {
+    __m256 e = exp256(_mm256_mul_ps(_mm256_set1_ps(-2.f), _mm256_loadu_ps(x + i)));
+    _mm256_storeu_ps(y + i, _mm256_sub_ps(_mm256_div_ps(two, _mm256_add_ps(one, e)), one));
+  }
+#endif
+  for (; i < n; i++)
+    y[i] = std::tanh(x[i]);
+}
+
+struct InferenceModel {
+  InferenceLstmType lstmType = DILATED_LSTM;
+  std::vector<std::vector<unsigned>> dilations;
+  bool addNlLayer = false;
+  int seasonalityNum = 0, seasonality = 0, seasonality2 = 0;
+  int inputSize = 0, outputSize = 0, stateHSize = 0, attentionHSize = 0, numOfCategories = 0, topn = 0;
+  int maxSeriesLength = 0; //0: no limit
+  bool int8 = false; //after quantize()
+  uint64_t weightsHash = 0; //FNV-1a of the float weights, identifies them in the report of the int8 gate
+  std::vector<InferenceNet> nets;
+  ModelArtifact artifact; //ES parameters and rankings
+
+  //<prefix>.model and <prefix>.weights; false, with the reason in error, if they can't be read or do not fit each other
+  bool load(const std::string& prefix, std::string& error) {
+    if (!artifact.load(prefix + ".model", ModelConfig(), error))
+      return false;
+    auto value = [this](const std::string& key) {
+      for (auto& entry : artifact.config)
+        if (entry.first == key)
+          return entry.second;
+      return std::string();
+    };
+    if (value("program") != "ES_RNN_E") {
+      error = prefix + ".model: not a model of ES_RNN_E";
+      return false;
+    }
+    if (!value("mpi_ranks").empty() && std::stoi(value("mpi_ranks")) > 1) {
+      error = prefix + ".model: trained with USE_MPI on " + value("mpi_ranks") + " ranks, the nets are split over their files";
+      return false;
+    }
+    std::string type = value("lstm_type");
+    lstmType = type == "ResidualDilatedLSTM" ? RESIDUAL_LSTM : type == "AttentiveDilatedLSTM" ? ATTENTIVE_LSTM : DILATED_LSTM;
+    addNlLayer = value("add_nl_layer") == "1";
+    seasonalityNum = std::stoi(value("seasonality_num"));
+    seasonality = seasonalityNum > 0 ? std::stoi(value("seasonality")) : 0;
+    seasonality2 = seasonalityNum > 1 ? std::stoi(value("seasonality2")) : 0;
+    inputSize = std::stoi(value("input_size"));
+    outputSize = std::stoi(value("output_size"));
+    stateHSize = std::stoi(value("state_hsize"));
+    attentionHSize = lstmType == ATTENTIVE_LSTM ? std::stoi(value("attention_hsize")) : 0;
+    numOfCategories = std::stoi(value("num_of_categories"));
+    topn = std::stoi(value("topn"));
+    maxSeriesLength = value("max_series_length").empty() ? 0 : std::stoi(value("max_series_length"));
+    dilations.clear();
+    std::istringstream dilations_stream(value("dilations"));
+    std::string layers;
+    while (std::getline(dilations_stream, layers, '|')) {
+      dilations.push_back(std::vector<unsigned>());
+      std::istringstream layers_stream(layers);
+      std::string dilation;
+      while (std::getline(layers_stream, dilation, ','))
+        dilations.back().push_back((unsigned)std::stoi(dilation));
+    }
+    nets.assign(std::stoi(value("num_of_nets")), InferenceNet());
+    return loadWeights(prefix + ".weights", error);
+  }
+
+  //Dynet TextFileSaver format: a header line "#Parameter# /net<inet>/<name> {rows,cols} <bytes> ..." followed by the values (and maybe the gradient)
+  bool loadWeights(const std::string& path, std::string& error) {
+    std::ifstream file(path);
+    if (!file) {
+      error = path + ": can't open";
+      return false;
+    }
+    std::map<int, std::vector<InferenceMatrix>> netParams;
+    weightsHash = 14695981039346656037ull;
+    std::string line;
+    bool haveHeader = bool(std::getline(file, line));
+    while (haveHeader) {
+      std::istringstream header(line);
+      std::string tag, name, dim;
+      header >> tag >> name >> dim;
+      bool isParameter = tag == "#Parameter#" && name.compare(0, 4, "/net") == 0;
+      if (isParameter) {
+        InferenceMatrix matrix;
+        std::vector<int> sizes;
+        std::string size;
+        std::istringstream dim_stream(dim.substr(1, dim.find_first_of("}X") - 1));
+        while (std::getline(dim_stream, size, ','))
+          sizes.push_back(std::stoi(size));
+        matrix.rows = sizes.empty() ? 1 : sizes[0];
+        matrix.cols = sizes.size() > 1 ? sizes[1] : 1;
+        matrix.values.resize((size_t)matrix.rows*matrix.cols);
+        for (auto& v : matrix.values)
+          file >> v;
+        if (!file) {
+          error = path + ": bad values of " + name;
+          return false;
+        }
+        for (float v : matrix.values) {
+          uint32_t bits;
+          memcpy(&bits, &v, sizeof(bits));
+          weightsHash = (weightsHash ^ bits) * 1099511628211ull;
+        }
+        netParams[std::stoi(name.substr(4))].push_back(std::move(matrix));
+      }
+      haveHeader = false; //skip the rest of the values line and a gradient, up to the next header
+      while (std::getline(file, line))
+        if (!line.empty() && line[0] == '#') {
+          haveHeader = true;
+          break;
+        }
+    }
+    for (auto& net : netParams) {
+      if (net.first < 0 || net.first >= (int)nets.size() || !assignParams(net.second, nets[net.first])) {
+        error = path + ": parameters of net " + std::to_string(net.first) + " do not fit the configuration";
+        return false;
+      }
+    }
+    return true;
+  }
+
+  //in the order ES_RNN_E creates them: the builders of the stack (per layer), then MLPW, MLPB, adapterW, adapterB
+  bool assignParams(std::vector<InferenceMatrix>& params, InferenceNet& net) {
+    size_t ip = 0;
+    auto take = [&](InferenceMatrix& matrix, int rows, int cols) {
+      if (ip >= params.size() || params[ip].rows != rows || params[ip].cols != cols)
+        return false;
+      matrix = std::move(params[ip++]);
+      return true;
+    };
+    net.stacks.assign(dilations.size(), std::vector<InferenceLayer>());
+    for (size_t il = 0; il < dilations.size(); il++) {
+      int inputDim = il == 0 ? inputSize + numOfCategories : stateHSize;
+      for (size_t layer = 0; layer < dilations[il].size(); layer++) {
+        net.stacks[il].push_back(InferenceLayer());
+        InferenceLayer& l = net.stacks[il].back();
+        l.inputDim = inputDim;
+        l.dilation = (int)dilations[il][layer];
+        if (!take(l.Wx, 4 * stateHSize, inputDim) || !take(l.Wh, 4 * stateHSize, stateHSize) || !take(l.b, 4 * stateHSize, 1))
+          return false;
+        if (lstmType == ATTENTIVE_LSTM && (!take(l.Wxa1, attentionHSize, inputDim) || !take(l.Wha1, attentionHSize, stateHSize)
+            || !take(l.Wsa1, attentionHSize, stateHSize) || !take(l.ba1, attentionHSize, 1) || !take(l.Wa2, l.dilation, attentionHSize) || !take(l.ba2, l.dilation, 1)))
+          return false;
+        inputDim = stateHSize;
+      }
+    }
+    if (addNlLayer && (!take(net.MLPW, stateHSize, stateHSize) || !take(net.MLPB, stateHSize, 1)))
+      return false;
+    if (!take(net.adapterW, outputSize, stateHSize) || !take(net.adapterB, outputSize, 1) || ip != params.size())
+      return false;
+    net.loaded = true;
+    return true;
+  }
+
+  //int8 copies of the gate and adapter weights; sets int8
+  void quantize() {
+    for (auto& net : nets) {
+      if (!net.loaded)
+        continue;
+      for (auto& layers : net.stacks)
+        for (auto& l : layers) {
+          l.WxQ = quantizeMatrix(l.Wx);
+          l.WhQ = quantizeMatrix(l.Wh);
+        }
+      net.adapterWQ = quantizeMatrix(net.adapterW);
+    }
+    int8 = true;
+  }
+};
+
+struct InferenceWorkspace {
+  std::vector<float> seasons, seasons2; //factors of every point, then of the next seasonality points; grow with the longest series
+  std::vector<float> input, gates, attention, attentionWeights, hPrev, hNew, cNew, rnn, mlp, out, netForecast;
+  std::vector<int8_t> quantizedIn, quantizedH; //int8 inputs of the products, zero padded
+  std::vector<std::vector<float>> hRing, cRing; //per stack layer: h and c of its last dilation steps, step t in slot t % dilation
+  std::vector<int> ringIndex; //[rnn] -> index of its first layer in hRing
+
+  explicit InferenceWorkspace(const InferenceModel& model) {
+    int maxDilation = 1;
+    for (auto& layers : model.dilations) {
+      ringIndex.push_back((int)hRing.size());
+      for (unsigned dilation : layers) {
+        hRing.push_back(std::vector<float>((size_t)dilation*model.stateHSize));
+        cRing.push_back(std::vector<float>((size_t)dilation*model.stateHSize));
+        maxDilation = std::max(maxDilation, (int)dilation);
+      }
+    }
+    input.resize(model.inputSize + model.numOfCategories);
+    gates.resize(4 * model.stateHSize);
+    attention.resize(model.attentionHSize);
+    attentionWeights.resize(maxDilation);
+    hPrev.resize(model.stateHSize);
+    hNew.resize(model.stateHSize);
+    cNew.resize(model.stateHSize);
+    rnn.resize(model.stateHSize);
+    mlp.resize(model.stateHSize);
+    out.resize(model.outputSize);
+    netForecast.resize(model.outputSize);
+    quantizedIn.resize((std::max(model.inputSize + model.numOfCategories, model.stateHSize) + 3) / 4 * 4);
+    quantizedH.resize((model.stateHSize + 3) / 4 * 4);
+  }
+};
+
+//One step of layer (iring in the workspace rings) at time t of its stack: reads in, leaves h in the ring (returned)
+inline const float* lstmStep(const InferenceModel& model, const InferenceLayer& l, bool firstLayer, int iring, int t, const float* in, InferenceWorkspace& ws) {
+  const int hid = model.stateHSize;
+  const int d = l.dilation;
+  float* hRing = ws.hRing[iring].data();
+  float* cRing = ws.cRing[iring].data();
+  const bool hasPrev = t >= d; //prev=t-1 reaches back dilation-1 steps, zeros before
+  const float* cPrev = hasPrev ? cRing + (size_t)(t % d)*hid : nullptr; //slot of t-d
+  const float* hPrev = cPrev ? hRing + (size_t)(t % d)*hid : nullptr;
+  if (hasPrev && model.lstmType == ATTENTIVE_LSTM && d > 1) {//softmax weighted average of h of the last d steps, scored from the input and the state of t-1
+    const int last = (t - 1) % d;
+    std::copy(l.ba1.values.begin(), l.ba1.values.end(), ws.attention.begin());
+    gemvAdd(ws.attention.data(), l.Wxa1, in);
+    gemvAdd(ws.attention.data(), l.Wha1, hRing + (size_t)last*hid);
+    gemvAdd(ws.attention.data(), l.Wsa1, cRing + (size_t)last*hid);
+    for (int a = 0; a < model.attentionHSize; a++)
+      ws.attention[a] = std::tanh(ws.attention[a]);
+    float* w = ws.attentionWeights.data();
+    std::copy(l.ba2.values.begin(), l.ba2.values.end(), w);
+    gemvAdd(w, l.Wa2, ws.attention.data());
+    float maxW = *std::max_element(w, w + d);
+    float sumW = 0;
+    for (int k = 0; k < d; k++)
+      sumW += w[k] = std::exp(w[k] - maxW);
+    std::fill(ws.hPrev.begin(), ws.hPrev.end(), 0.f);
+    for (int k = 0; k < d; k++) {//k steps before t-1
+      const float* h = hRing + (size_t)((t - 1 - k) % d)*hid;
+      float wk = w[k] / sumW;
+      for (int j = 0; j < hid; j++)
+        ws.hPrev[j] += wk*h[j];
+    }
+    hPrev = ws.hPrev.data();
+  }
+
+  float* g = ws.gates.data();
+  std::copy(l.b.values.begin(), l.b.values.end(), g);
+  if (model.int8) {
+    float inScale = quantizeVector(in, l.inputDim, ws.quantizedIn.data());
+    gemvAddInt8(g, l.WxQ, ws.quantizedIn.data(), inScale);
+    if (hasPrev) {
+      float hScale = quantizeVector(hPrev, hid, ws.quantizedH.data());
+      gemvAddInt8(g, l.WhQ, ws.quantizedH.data(), hScale);
+    }
+  } else {
+    gemvAdd(g, l.Wx, in);
+    if (hasPrev)
+      gemvAdd(g, l.Wh, hPrev);
+  }
+  if (model.lstmType == RESIDUAL_LSTM) //ResidualDilatedLSTMBuilder's default forget bias; Dynet's vanilla_lstm_gates has none
+    for (int j = hid; j < 2 * hid; j++)
+      g[j] += 1;
+  logisticInPlace(g, 3 * hid);
+  tanhTo(g + 3 * hid, g + 3 * hid, hid);
+  float* c = cRing + (size_t)(t % d)*hid; //overwrites the slot of t-d, cPrev, in place
+  float* h = hRing + (size_t)(t % d)*hid;
+  if (hasPrev)
+    for (int j = 0; j < hid; j++)
+      c[j] = g[hid + j] * cPrev[j] + g[j] * g[3 * hid + j];
+  else
+    for (int j = 0; j < hid; j++)
+      c[j] = g[j] * g[3 * hid + j];
+  tanhTo(c, ws.hNew.data(), hid);
+  if (model.lstmType == RESIDUAL_LSTM && !firstLayer)
+    for (int j = 0; j < hid; j++)
+      h[j] = g[2 * hid + j] * (in[j] + ws.hNew[j]);
+  else
+    for (int j = 0; j < hid; j++)
+      h[j] = g[2 * hid + j] * ws.hNew[j];
+  return h;
+}
+
+//Forecast of net inet after the last of values[0..n), into forecast[0..outputSize). esValues as in the model (unconstrained, see esParameterValues() of ES_RNN_E).
+//false if the series is shorter than inputSize or the net is not loaded
+inline bool forecastNet(const InferenceModel& model, int inet, const std::vector<float>& esValues, const float* categories,
+    const float* values, int n, float* forecast, InferenceWorkspace& ws) {
+  if (inet < 0 || inet >= (int)model.nets.size() || !model.nets[inet].loaded || n < model.inputSize)
+    return false;
+  const InferenceNet& net = model.nets[inet];
+  const int S = model.seasonality, S2 = model.seasonality2;
+  if ((int)ws.seasons.size() < n + S)
+    ws.seasons.resize(n + S);
+  if ((int)ws.seasons2.size() < n + S2)
+    ws.seasons2.resize(n + S2);
+  float* seasons = ws.seasons.data();
+  float* seasons2 = ws.seasons2.data();
+  float levSm = inferenceLogistic(esValues[0]), sSm = 0, sSm2 = 0;
+  if (S > 0) {
+    sSm = inferenceLogistic(esValues[1]);
+    for (int isea = 0; isea < S; isea++)
+      seasons[isea] = std::exp(esValues[2 + isea]);
+  }
+  if (S2 > 0) {
+    sSm2 = inferenceLogistic(esValues[2 + S]);
+    for (int isea = 0; isea < S2; isea++)
+      seasons2[isea] = std::exp(esValues[3 + S + isea]);
+  }
+  std::copy(categories, categories + model.numOfCategories, ws.input.begin() + model.inputSize);
+
+  float level = 0;
+  for (int p = 0; p < n; p++) {//ES step of point p, as OnlineSeriesState::advance(), then an LSTM step once the input window is full
+    float value = values[p];
+    float s = S > 0 ? seasons[p] : 1;
+    float s2 = S2 > 0 ? seasons2[p] : 1;
+    if (p == 0) {
+      level = value / (s*s2);
+      if (S > 0)
+        seasons[S] = s;
+      if (S2 > 0)
+        seasons2[S2] = s2;
+    } else {
+      level = levSm*value / (s*s2) + (1 - levSm)*level;
+      if (S > 0)
+        seasons[S + p] = sSm*value / (level*s2) + (1 - sSm)*s;
+      if (S2 > 0)
+        seasons2[S2 + p] = sSm2*value / (level*s) + (1 - sSm2)*s2;
+    }
+    if (p < model.inputSize - 1)
+      continue;
+
+    for (int i = 0; i < model.inputSize; i++) {
+      int q = p - model.inputSize + 1 + i;
+      float x = values[q];
+      if (S > 0)
+        x /= seasons[q];
+      if (S2 > 0)
+        x /= seasons2[q];
+      ws.input[i] = std::log(x / level);
+    }
+    int t = p - model.inputSize + 1;
+    const float* in = ws.input.data();
+    for (size_t il = 0; il < net.stacks.size(); il++) {
+      for (size_t layer = 0; layer < net.stacks[il].size(); layer++)
+        in = lstmStep(model, net.stacks[il][layer], layer == 0, ws.ringIndex[il] + (int)layer, t, in, ws);
+      if (il == 0)
+        std::copy(in, in + model.stateHSize, ws.rnn.begin());
+      else
+        for (int j = 0; j < model.stateHSize; j++)
+          ws.rnn[j] += in[j];
+      in = ws.rnn.data();
+    }
+  }
+
+  const float* rnn = ws.rnn.data();
+  if (model.addNlLayer) {
+    std::copy(net.MLPB.values.begin(), net.MLPB.values.end(), ws.mlp.begin());
+    gemvAdd(ws.mlp.data(), net.MLPW, rnn);
+    for (auto& v : ws.mlp)
+      v = std::tanh(v);
+    rnn = ws.mlp.data();
+  }
+  std::copy(net.adapterB.values.begin(), net.adapterB.values.end(), ws.out.begin());
+  if (model.int8) {
+    float rnnScale = quantizeVector(rnn, model.stateHSize, ws.quantizedH.data());
+    gemvAddInt8(ws.out.data(), net.adapterWQ, ws.quantizedH.data(), rnnScale);
+  } else
+    gemvAdd(ws.out.data(), net.adapterW, rnn);
+  for (int k = 0; k < model.outputSize; k++) {
+    forecast[k] = std::exp(ws.out[k])*level;
+    if (S > 0) //periodic beyond the last points
+      forecast[k] *= seasons[n + k % S];
+    if (S2 > 0)
+      forecast[k] *= seasons2[n + k % S2];
+  }
+  return true;
+}
+
+//Average of the forecasts of the top nets of the series, as ES_RNN_E --forecast-only. false if the series is not in the model or is too short
+inline bool forecastSeries(const InferenceModel& model, const std::string& series, const float* categories, const float* values, int n,
+    float* forecast, InferenceWorkspace& ws) {
+  auto esParams = model.artifact.esParams.find(series);
+  auto ranking = model.artifact.rankings.find(series);
+  if (esParams == model.artifact.esParams.end() || ranking == model.artifact.rankings.end() || (int)ranking->second.size() < model.topn)
+    return false;
+  std::fill(forecast, forecast + model.outputSize, 0.f);
+  for (int itop = 0; itop < model.topn; itop++) {
+    int inet = ranking->second[itop];
+    auto es = esParams->second.find(inet);
+    if (es == esParams->second.end() || !forecastNet(model, inet, es->second, categories, values, n, ws.netForecast.data(), ws))
+      return false;
+    for (int k = 0; k < model.outputSize; k++)
+      forecast[k] += ws.netForecast[k];
+  }
+  for (int k = 0; k < model.outputSize; k++)
+    forecast[k] /= model.topn;
+  return true;
+}
+
+#endif
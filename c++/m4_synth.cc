@@ -0,0 +1,328 @@
+/*m4_synth: deterministic generator of synthetic, M4-like datasets.
+
+Writes, into OUTPUT_DIR, files in the format of the M4 competition data, as read by M4TS and the info loader of the ES-RNN programs (and by esrnn_merge):
+  <VARIABLE>-train.csv   "V1","V2",... header, then one row per series: "<id>","<val>","<val>",...  (rows are not padded, the readers stop at the first empty field anyway)
+  <VARIABLE>-test.csv    same, with the next <Horizon> values of every series (unless WRITE_TEST=0)
+  M4-info.csv            M4id,category,Frequency,Horizon,SP,StartingDate  for all the variables generated in the run
+so DATA_DIR of the programs can simply point to OUTPUT_DIR.
+
+Each series is multiplicative: level (log random walk with drift) * seasonality (none, single or dual, as in the PARAMS blocks) * lognormal noise.
+Lengths are lognormal around MEDIAN_LENGTH, clipped to [MIN_LENGTH, MAX_LENGTH]. Categories are drawn with CATEGORY_MIX weights (by default, as in M4).
+Every series has its own random generator, seeded with (SEED, variable, series number), so the output depends only on the parameters, not on the number of threads,
+and e.g. the first 10k series of a 10M run are the same as in a 10k run.
+
+It does not need Dynet. Build with linux_example_scripts/build_tool, e.g. ./build_tool m4_synth
+Usage:
+  m4_synth [<OUTPUT_DIR> [<VARIABLES> [<NUM_OF_SERIES> [<SEED>]]]] [NAME=value ...]
+VARIABLES is one or more (comma separated) of Yearly,Quarterly,Monthly,Weekly,Daily,Hourly, which set the defaults of frequency, horizon, seasonalities and lengths.
+NAME=value pairs override the parameters below, e.g.
+  m4_synth /data/synth Quarterly,Monthly 100000 1 MEDIAN_LENGTH=120 NOISE_STD=0.05 CATEGORY_MIX=1,1,1,1,1,1
+*/
+
+#include <thread>
+#include <atomic>
+#include <random>
+#include <array>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+
+using namespace std;
+
+string OUTPUT_DIR = "f:\\progs\\data\\M4Synth"; //do not end with separator
+//string OUTPUT_DIR="/home/uber/progs/data/M4Synth";
+string VARIABLES = "Quarterly";
+int NUM_OF_SERIES = 10000; //per variable
+unsigned SEED = 1;
+
+//per variable defaults, see frequencyDefaults below; negative means: take the default of the variable
+int MIN_LENGTH = -1;
+int MEDIAN_LENGTH = -1;
+int MAX_LENGTH = -1;
+int SEASONALITY = -1; //0 means no seasonality
+int SEASONALITY2 = -1; //0 means no second seasonality
+
+float LENGTH_SIGMA = 0.6f; //std of log(length)
+float SEASONAL_AMPLITUDE = 0.4f; //max amplitude of log seasonality factors, drawn uniformly from [0, SEASONAL_AMPLITUDE] per series
+float TREND_MEAN = 0.003f; //mean of the per-step log drift, scaled by 12/frequency (i.e. by time)
+float TREND_STD = 0.004f; //std, across series, of the per-step log drift, scaled as above
+float LEVEL_STD = 0.01f; //std of the per-step log level innovations
+float NOISE_STD = 0.03f; //std of the multiplicative (log) observation noise
+vector<float> CATEGORY_MIX = { 8708, 24534, 18798, 19402, 25121, 3437 }; //weights of Demographic, Finance, Industry, Macro, Micro, Other; as in M4
+bool WRITE_TEST = true;
+unsigned NUM_OF_THREADS = 0; //0 means all hardware threads
+
+const int NUM_OF_CATEGORIES = 6;
+const array<string, NUM_OF_CATEGORIES> CATEGORIES = { "Demographic", "Finance", "Industry", "Macro", "Micro", "Other" };
+const int BLOCK_SIZE = 4096; //series generated in parallel, then written in order
+
+struct FrequencyDefaults {
+  string variable;
+  char prefix;
+  int frequency; //as in M4-info.csv
+  int horizon;
+  int seasonality;
+  int seasonality2;
+  int minLength, medianLength, maxLength; //of the train part; roughly as in M4
+  const char* startingDate;
+};
+
+const vector<FrequencyDefaults> frequencyDefaults = {
+  { "Yearly", 'Y', 1, 6, 0, 0, 13, 29, 835, "01-01-79 12:00" },
+  { "Quarterly", 'Q', 4, 8, 4, 0, 16, 88, 866, "01-01-90 12:00" },
+  { "Monthly", 'M', 12, 18, 12, 0, 42, 202, 2794, "01-01-95 12:00" },
+  { "Weekly", 'W', 1, 13, 52, 0, 80, 934, 2597, "01-01-05 12:00" },
+  { "Daily", 'D', 1, 14, 7, 0, 93, 2940, 9919, "01-01-10 12:00" },
+  { "Hourly", 'H', 24, 48, 24, 168, 700, 960, 960, "01-07-15 12:00" }
+};
+
+struct GenParams {
+  FrequencyDefaults def;
+  int variableNo;
+  int minLength, medianLength, maxLength;
+  int seasonality, seasonality2;
+  int trainColumns; //in the train file header
+};
+
+struct GeneratedSeries {
+  string trainRow;
+  string testRow;
+  string infoRow;
+};
+
+
+//runs func(i) for i in [0,n) on numOfThreads threads, in an interleaved fashion
+template<class F> void parallelFor(int n, unsigned numOfThreads, F func) {
+  vector<thread> threads;
+  atomic<int> next(0);
+  for (unsigned it = 0; it < numOfThreads; it++)
+    threads.emplace_back([&]() {
+      for (int i = next++; i < n; i = next++)
+        func(i);
+    });
+  for (auto& th : threads)
+    th.join();
+}
+
+
+//log seasonality factors of one cycle, with mean zero, so the factors have geometric mean of 1
+vector<float> makeLogSeasonality(int period, float amplitude, mt19937_64& rng) {
+  vector<float> ret;
+  if (period <= 1)
+    return ret;
+  uniform_real_distribution<float> uni(0, 1);
+  normal_distribution<float> nd(0, 1);
+  float phase = 2 * 3.14159265f * uni(rng);
+  float sum = 0;
+  for (int isea = 0; isea < period; isea++) {
+    float val = amplitude*(sinf(2 * 3.14159265f*isea / period + phase) + 0.3f*nd(rng));
+    ret.push_back(val);
+    sum += val;
+  }
+  for (auto& val : ret)
+    val -= sum / period;
+  return ret;
+}
+
+void appendQuoted(string& row, const char* str) {
+  row.push_back(',');
+  row.push_back('"');
+  row.append(str);
+  row.push_back('"');
+}
+
+GeneratedSeries generateSeries(const GenParams& gp, int iseries) {
+  seed_seq seeds = { SEED, (unsigned)gp.variableNo, (unsigned)iseries };
+  mt19937_64 rng(seeds);
+  normal_distribution<float> nd(0, 1);
+  uniform_real_distribution<float> uni(0, 1);
+  discrete_distribution<int> categoryDist(CATEGORY_MIX.begin(), CATEGORY_MIX.end());
+
+  float lenf = gp.medianLength*expf(LENGTH_SIGMA*nd(rng));
+  int length = max(gp.minLength, min(gp.maxLength, (int)roundf(lenf)));
+  int category = categoryDist(rng);
+
+  float timeScale = 12.f / gp.def.frequency;
+  if (gp.def.variable == "Weekly")
+    timeScale = 12.f / 52;
+  else if (gp.def.variable == "Daily")
+    timeScale = 12.f / 365;
+  else if (gp.def.variable == "Hourly")
+    timeScale = 12.f / (365 * 24);
+  float drift = (TREND_MEAN + TREND_STD*nd(rng))*timeScale;
+  float levelStd = LEVEL_STD*sqrtf(timeScale);
+  float logLevel = logf(100) + uni(rng)*logf(200); //from 100 to 20000
+  vector<float> seas1 = makeLogSeasonality(gp.seasonality, SEASONAL_AMPLITUDE*uni(rng), rng);
+  vector<float> seas2 = makeLogSeasonality(gp.seasonality2, SEASONAL_AMPLITUDE*uni(rng), rng);
+  int offset1 = gp.seasonality > 1 ? (int)(uni(rng)*gp.seasonality) : 0;
+  int offset2 = gp.seasonality2 > 1 ? (int)(uni(rng)*gp.seasonality2) : 0;
+
+  GeneratedSeries ret;
+  string id = gp.def.prefix + to_string(iseries + 1);
+  ret.trainRow = "\"" + id + "\"";
+  ret.testRow = ret.trainRow;
+  int total = length + (WRITE_TEST ? gp.def.horizon : 0);
+  char buffer[32];
+  for (int t = 0; t < total; t++) {
+    logLevel += drift + levelStd*nd(rng);
+    float logVal = logLevel + NOISE_STD*nd(rng);
+    if (seas1.size() > 0)
+      logVal += seas1[(t + offset1) % gp.seasonality];
+    if (seas2.size() > 0)
+      logVal += seas2[(t + offset2) % gp.seasonality2];
+    snprintf(buffer, sizeof(buffer), "%.6g", expf(logVal));
+    appendQuoted(t < length ? ret.trainRow : ret.testRow, buffer);
+  }
+  ret.trainRow.push_back('\n');
+  ret.testRow.push_back('\n');
+
+  ret.infoRow = id + "," + CATEGORIES[category] + "," + to_string(gp.def.frequency) + "," + to_string(gp.def.horizon) + "," +
+    gp.def.variable + "," + gp.def.startingDate + "\n";
+  return ret;
+}
+
+void writeHeader(ofstream& file, int numOfColumns) {
+  for (int ic = 1; ic <= numOfColumns; ic++) {
+    if (ic > 1)
+      file << ',';
+    file << "\"V" << ic << "\"";
+  }
+  file << '\n';
+}
+
+void openOrDie(ofstream& file, const string& path) {
+  file.open(path, ios::binary);
+  if (!file) {
+    cerr << "can't open " << path << endl;
+    exit(-1);
+  }
+}
+
+vector<string> split(const string& str, char sep) {
+  vector<string> ret;
+  stringstream stream(str);
+  string item;
+  while (getline(stream, item, sep))
+    if (item.size() > 0)
+      ret.push_back(item);
+  return ret;
+}
+
+//NAME=value overrides
+void setParam(const string& name, const string& value) {
+  if (name == "MIN_LENGTH") MIN_LENGTH = atoi(value.c_str());
+  else if (name == "MEDIAN_LENGTH") MEDIAN_LENGTH = atoi(value.c_str());
+  else if (name == "MAX_LENGTH") MAX_LENGTH = atoi(value.c_str());
+  else if (name == "SEASONALITY") SEASONALITY = atoi(value.c_str());
+  else if (name == "SEASONALITY2") SEASONALITY2 = atoi(value.c_str());
+  else if (name == "LENGTH_SIGMA") LENGTH_SIGMA = (float)atof(value.c_str());
+  else if (name == "SEASONAL_AMPLITUDE") SEASONAL_AMPLITUDE = (float)atof(value.c_str());
+  else if (name == "TREND_MEAN") TREND_MEAN = (float)atof(value.c_str());
+  else if (name == "TREND_STD") TREND_STD = (float)atof(value.c_str());
+  else if (name == "LEVEL_STD") LEVEL_STD = (float)atof(value.c_str());
+  else if (name == "NOISE_STD") NOISE_STD = (float)atof(value.c_str());
+  else if (name == "WRITE_TEST") WRITE_TEST = atoi(value.c_str()) != 0;
+  else if (name == "NUM_OF_THREADS") NUM_OF_THREADS = (unsigned)atoi(value.c_str());
+  else if (name == "CATEGORY_MIX") {
+    CATEGORY_MIX.clear();
+    for (const auto& weight : split(value, ','))
+      CATEGORY_MIX.push_back((float)atof(weight.c_str()));
+    if (CATEGORY_MIX.size() != NUM_OF_CATEGORIES) {
+      cerr << "CATEGORY_MIX needs " << NUM_OF_CATEGORIES << " weights" << endl;
+      exit(-1);
+    }
+  } else {
+    cerr << "unknown parameter " << name << endl;
+    exit(-1);
+  }
+}
+
+
+int main(int argc, char** argv) {
+  int ipos = 0;
+  for (int iarg = 1; iarg < argc; iarg++) {
+    string arg = argv[iarg];
+    size_t eq = arg.find('=');
+    if (eq != string::npos) {
+      setParam(arg.substr(0, eq), arg.substr(eq + 1));
+      continue;
+    }
+    if (ipos == 0)
+      OUTPUT_DIR = arg;
+    else if (ipos == 1)
+      VARIABLES = arg;
+    else if (ipos == 2)
+      NUM_OF_SERIES = atoi(arg.c_str());
+    else if (ipos == 3)
+      SEED = (unsigned)atoi(arg.c_str());
+    ipos++;
+  }
+
+  unsigned numOfThreads = NUM_OF_THREADS;
+  if (numOfThreads == 0)
+    numOfThreads = max(1u, thread::hardware_concurrency());
+
+  #if defined _WINDOWS
+    string exec = string("mkdir ") + OUTPUT_DIR;
+  #else
+    string exec = string("mkdir -p ") + OUTPUT_DIR;
+  #endif
+  system(exec.c_str());
+
+  ofstream infoFile;
+  openOrDie(infoFile, OUTPUT_DIR + "/M4-info.csv");
+  infoFile << "M4id,category,Frequency,Horizon,SP,StartingDate\n";
+
+  for (const auto& variable : split(VARIABLES, ',')) {
+    GenParams gp;
+    auto defIter = find_if(frequencyDefaults.begin(), frequencyDefaults.end(), [&](const FrequencyDefaults& def) { return def.variable == variable; });
+    if (defIter == frequencyDefaults.end()) {
+      cerr << "unknown variable " << variable << endl;
+      exit(-1);
+    }
+    gp.def = *defIter;
+    gp.variableNo = (int)(defIter - frequencyDefaults.begin());
+    gp.minLength = MIN_LENGTH >= 0 ? MIN_LENGTH : gp.def.minLength;
+    gp.medianLength = MEDIAN_LENGTH >= 0 ? MEDIAN_LENGTH : gp.def.medianLength;
+    gp.maxLength = MAX_LENGTH >= 0 ? MAX_LENGTH : gp.def.maxLength;
+    gp.seasonality = SEASONALITY >= 0 ? SEASONALITY : gp.def.seasonality;
+    gp.seasonality2 = SEASONALITY2 >= 0 ? SEASONALITY2 : gp.def.seasonality2;
+    if (gp.minLength < 1 || gp.maxLength < gp.minLength) {
+      cerr << "wrong lengths, min:" << gp.minLength << " max:" << gp.maxLength << endl;
+      exit(-1);
+    }
+    cout << variable << " series:" << NUM_OF_SERIES << " lengths:" << gp.minLength << "/" << gp.medianLength << "/" << gp.maxLength
+      << " seasonalities:" << gp.seasonality << "," << gp.seasonality2 << " seed:" << SEED << " threads:" << numOfThreads << endl;
+
+    ofstream trainFile, testFile;
+    openOrDie(trainFile, OUTPUT_DIR + "/" + variable + "-train.csv");
+    writeHeader(trainFile, gp.maxLength + 1);
+    if (WRITE_TEST) {
+      openOrDie(testFile, OUTPUT_DIR + "/" + variable + "-test.csv");
+      writeHeader(testFile, gp.def.horizon + 1);
+    }
+
+    vector<GeneratedSeries> block(BLOCK_SIZE);
+    for (int first = 0; first < NUM_OF_SERIES; first += BLOCK_SIZE) {
+      int blockSize = min(BLOCK_SIZE, NUM_OF_SERIES - first);
+      parallelFor(blockSize, numOfThreads, [&](int i) {
+        block[i] = generateSeries(gp, first + i);
+      });
+      for (int i = 0; i < blockSize; i++) {
+        trainFile << block[i].trainRow;
+        if (WRITE_TEST)
+          testFile << block[i].testRow;
+        infoFile << block[i].infoRow;
+      }
+    }
+    trainFile.close();
+    if (WRITE_TEST)
+      testFile.close();
+  }
+  infoFile.close();
+}
@@ -0,0 +1,293 @@
+/**
+* file metrics.h
+* wall-clock timing and resource measurements of the ES-RNN programs
+  - PhaseTimes - steady clock seconds spent per phase (graph build, forward, backward, update, validation, output, ODBC)
+  - ScopedTimer - adds the lifetime of a scope to a phase
+  - Metrics - phase times and counters (series, graph nodes, exceptions caught in trainer updates, updates skipped by the health check, forecast cache hits and misses), aggregated per epoch
+  - MetricsExporter - writes Metrics per epoch and per ibig as JSON lines, or keeps a Prometheus text file up to date
+  - peakRSSBytes - peak resident set size of the process
+  - BenchmarkReport - machine-readable (JSON lines) report of a benchmark run, one line per epoch and a summary
+* It does not depend on Dynet, the programs pass Dynet memory pool figures in.
+*/
+
+#ifndef ESRNN_METRICS_H_
+#define ESRNN_METRICS_H_
+
+#include <cstdlib>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdio.h>
+#include "trace.h"
+
+#if defined _WINDOWS
+  #include <windows.h>
+  #include <psapi.h>
+#else
+  #include <sys/resource.h>
+#endif
+
+enum Phase { PHASE_BUILD, PHASE_FORWARD, PHASE_BACKWARD, PHASE_UPDATE, PHASE_VALIDATION, PHASE_OUTPUT, PHASE_ODBC, NUM_OF_PHASES };
+const char* const PHASE_NAMES[NUM_OF_PHASES] = { "build", "forward", "backward", "update", "validation", "output", "odbc" };
+
+enum Counter { COUNTER_SERIES, COUNTER_VALIDATION_SERIES, COUNTER_GRAPH_NODES, COUNTER_UPDATE_EXCEPTIONS, COUNTER_SKIPPED_UPDATES, COUNTER_QUARANTINED_SERIES,
+  COUNTER_CACHE_HITS, COUNTER_CACHE_MISSES, NUM_OF_COUNTERS };
+const char* const COUNTER_NAMES[NUM_OF_COUNTERS] = { "series", "validationSeries", "graphNodes", "updateExceptions", "skippedUpdates", "quarantinedSeries",
+  "cacheHits", "cacheMisses" };
+
+struct PhaseTimes {
+  double secs[NUM_OF_PHASES];
+
+  PhaseTimes() { reset(); }
+  void reset() {
+    for (int iph = 0; iph < NUM_OF_PHASES; iph++)
+      secs[iph] = 0;
+  }
+  //adds time elapsed since startSecs (a nowSecs() value) to the phase, and returns now, so consecutive phases can be chained.
+  //If tracing is on, the interval is also recorded as a span, with the series, if given, as arguments.
+  double add(Phase phase, double startSecs, const std::string& series = std::string(), int seriesLen = -1) {
+    double now = nowSecs();
+    secs[phase] += now - startSecs;
+    traceSpan(PHASE_NAMES[phase], startSecs, now, series, seriesLen);
+    return now;
+  }
+  void add(const PhaseTimes& other) {
+    for (int iph = 0; iph < NUM_OF_PHASES; iph++)
+      secs[iph] += other.secs[iph];
+  }
+  double total() const {
+    double sum = 0;
+    for (int iph = 0; iph < NUM_OF_PHASES; iph++)
+      sum += secs[iph];
+    return sum;
+  }
+};
+
+struct ScopedTimer {
+  PhaseTimes& times;
+  Phase phase;
+  double startSecs;
+
+  ScopedTimer(PhaseTimes& times_, Phase phase_) : times(times_), phase(phase_), startSecs(nowSecs()) {}
+  ~ScopedTimer() { times.add(phase, startSecs); }
+};
+
+struct Metrics {
+  PhaseTimes times;
+  double counters[NUM_OF_COUNTERS];
+
+  Metrics() { reset(); }
+  void reset() {
+    times.reset();
+    for (int ic = 0; ic < NUM_OF_COUNTERS; ic++)
+      counters[ic] = 0;
+  }
+  void count(Counter counter, double n = 1) {
+    counters[counter] += n;
+  }
+  void add(const Metrics& other) {
+    times.add(other.times);
+    for (int ic = 0; ic < NUM_OF_COUNTERS; ic++)
+      counters[ic] += other.counters[ic];
+  }
+  //trained series (for the ensemble: series*nets) per second of the phases
+  double seriesPerSec() const {
+    double secs = times.total();
+    return secs > 0 ? counters[COUNTER_SERIES] / secs : 0;
+  }
+};
+
+inline size_t peakRSSBytes() {
+#if defined _WINDOWS
+  PROCESS_MEMORY_COUNTERS counters;
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    return counters.PeakWorkingSetSize;
+  return 0;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+  #if defined __APPLE__
+    return (size_t)usage.ru_maxrss; //bytes on Mac
+  #else
+    return (size_t)usage.ru_maxrss * 1024; //kilobytes on Linux
+  #endif
+#endif
+}
+
+//format "jsonl": appends one JSON object per epoch and per ibig to the file.
+//format "prometheus": rewrites the file (atomically, through rename) after every epoch, with run totals as counters and the latest epoch as gauges, for a textfile collector or a local scraper.
+//Any other format, e.g. "", switches the export off.
+struct MetricsExporter {
+  std::string format;
+  std::string path;
+  std::string jsonPrefix; //common fields
+  std::string promLabels; //common labels
+  Metrics ibigTotals;
+  Metrics runTotals;
+
+  bool enabled() const { return format == "jsonl" || format == "prometheus"; }
+
+  //pathWithoutExtension gets .jsonl or .prom appended
+  void open(const std::string& format_, const std::string& pathWithoutExtension, const std::string& program, const std::string& variable) {
+    format = format_;
+    if (!enabled())
+      return;
+    jsonPrefix = "\"program\":\"" + program + "\",\"variable\":\"" + variable + "\"";
+    promLabels = "program=\"" + program + "\",variable=\"" + variable + "\"";
+    if (format == "jsonl") {
+      path = pathWithoutExtension + ".jsonl";
+      std::ofstream file(path); //truncate
+    } else
+      path = pathWithoutExtension + ".prom";
+    std::cout << "metrics go to " << path << std::endl;
+  }
+
+  void writeEpoch(int ibig, int iEpoch, const Metrics& epochMetrics) {
+    ibigTotals.add(epochMetrics);
+    runTotals.add(epochMetrics);
+    if (format == "jsonl")
+      appendJson("epoch", ibig, iEpoch, epochMetrics);
+    else if (format == "prometheus")
+      writeProm(ibig, iEpoch, epochMetrics);
+  }
+
+  //outsideOfEpochs - e.g. time of writing the output file
+  void writeIbig(int ibig, const Metrics& outsideOfEpochs) {
+    ibigTotals.add(outsideOfEpochs);
+    runTotals.add(outsideOfEpochs);
+    if (format == "jsonl")
+      appendJson("ibig", ibig, -1, ibigTotals);
+    else if (format == "prometheus")
+      writeProm(ibig, -1, ibigTotals);
+    ibigTotals.reset();
+  }
+
+private:
+  void appendJson(const char* type, int ibig, int iEpoch, const Metrics& metrics) {
+    std::ofstream file(path, std::ios::app);
+    file << "{\"type\":\"" << type << "\"," << jsonPrefix << ",\"ibig\":" << ibig;
+    if (iEpoch >= 0)
+      file << ",\"epoch\":" << iEpoch;
+    for (int iph = 0; iph < NUM_OF_PHASES; iph++)
+      file << ",\"" << PHASE_NAMES[iph] << "Secs\":" << metrics.times.secs[iph];
+    for (int ic = 0; ic < NUM_OF_COUNTERS; ic++)
+      file << ",\"" << COUNTER_NAMES[ic] << "\":" << metrics.counters[ic];
+    double series = metrics.counters[COUNTER_SERIES];
+    file << ",\"graphNodesPerSeries\":" << (series > 0 ? metrics.counters[COUNTER_GRAPH_NODES] / series : 0)
+      << ",\"seriesPerSec\":" << metrics.seriesPerSec() << ",\"peakRSSBytes\":" << peakRSSBytes() << "}" << std::endl;
+  }
+
+  void writeProm(int ibig, int iEpoch, const Metrics& latest) {
+    std::ostringstream out;
+    out << "# HELP esrnn_phase_seconds_total Wall-clock seconds spent per phase.\n# TYPE esrnn_phase_seconds_total counter\n";
+    for (int iph = 0; iph < NUM_OF_PHASES; iph++)
+      out << "esrnn_phase_seconds_total{" << promLabels << ",phase=\"" << PHASE_NAMES[iph] << "\"} " << runTotals.times.secs[iph] << "\n";
+    for (int ic = 0; ic < NUM_OF_COUNTERS; ic++) {
+      std::string name = promName(COUNTER_NAMES[ic]);
+      out << "# TYPE esrnn_" << name << "_total counter\nesrnn_" << name << "_total{" << promLabels << "} " << runTotals.counters[ic] << "\n";
+    }
+    if (iEpoch >= 0) {
+      double series = latest.counters[COUNTER_SERIES];
+      out << "# TYPE esrnn_series_per_second gauge\nesrnn_series_per_second{" << promLabels << "} " << latest.seriesPerSec() << "\n";
+      out << "# TYPE esrnn_graph_nodes_per_series gauge\nesrnn_graph_nodes_per_series{" << promLabels << "} "
+        << (series > 0 ? latest.counters[COUNTER_GRAPH_NODES] / series : 0) << "\n";
+      out << "# TYPE esrnn_epoch gauge\nesrnn_epoch{" << promLabels << "} " << iEpoch << "\n";
+    }
+    out << "# TYPE esrnn_ibig gauge\nesrnn_ibig{" << promLabels << "} " << ibig << "\n";
+    out << "# TYPE esrnn_peak_rss_bytes gauge\nesrnn_peak_rss_bytes{" << promLabels << "} " << peakRSSBytes() << "\n";
+
+    std::string tmpPath = path + ".tmp";
+    {
+      std::ofstream file(tmpPath);
+      file << out.str();
+    }
+  #if defined _WINDOWS
+    remove(path.c_str());
+  #endif
+    rename(tmpPath.c_str(), path.c_str());
+  }
+
+  //graphNodes -> graph_nodes
+  static std::string promName(const char* camel) {
+    std::string ret;
+    for (const char* pc = camel; *pc; pc++) {
+      if (*pc >= 'A' && *pc <= 'Z') {
+        ret.push_back('_');
+        ret.push_back(*pc - 'A' + 'a');
+      } else
+        ret.push_back(*pc);
+    }
+    return ret;
+  }
+};
+
+//One JSON object per line: an "epoch" line per epoch and a "summary" line at the end, so runs of different builds can be compared by a script.
+struct BenchmarkReport {
+  std::ofstream file;
+  std::string prefix; //common fields, written at the start of each line
+  double startSecs;
+  PhaseTimes allTimes;
+  double seriesProcessed;
+  size_t poolHighWaterMark;
+
+  BenchmarkReport() : startSecs(0), seriesProcessed(0), poolHighWaterMark(0) {}
+
+  void open(const std::string& path, const std::string& program, const std::string& variable, const std::string& run, const std::string& lstm, int numOfSeries) {
+    file.open(path);
+    if (!file) {
+      std::cerr << "can't open benchmark output file " << path << std::endl;
+      exit(-1);
+    }
+    prefix = "\"program\":\"" + program + "\",\"variable\":\"" + variable + "\",\"run\":\"" + escape(run) +
+      "\",\"lstm\":\"" + lstm + "\",\"numOfSeries\":" + std::to_string(numOfSeries);
+    startSecs = nowSecs();
+    std::cout << "benchmark report goes to " << path << std::endl;
+  }
+
+  //numOfSeries - series (or series*nets, for the ensemble) processed in the epoch, poolUsed - max bytes used by Dynet graph memory pools in the epoch
+  void writeEpoch(int ibig, int iEpoch, double numOfSeries, const PhaseTimes& times, size_t poolUsed) {
+    double epochSecs = times.total();
+    allTimes.add(times);
+    seriesProcessed += numOfSeries;
+    if (poolUsed > poolHighWaterMark)
+      poolHighWaterMark = poolUsed;
+
+    file << "{\"type\":\"epoch\"," << prefix << ",\"ibig\":" << ibig << ",\"epoch\":" << iEpoch
+      << ",\"seriesPerSec\":" << (epochSecs > 0 ? numOfSeries / epochSecs : 0) << ",\"epochSecs\":" << epochSecs;
+    writePhases(times);
+    file << ",\"peakRSSBytes\":" << peakRSSBytes() << ",\"poolHighWaterMarkBytes\":" << poolUsed << "}" << std::endl;
+  }
+
+  //times spent outside of the epochs, e.g. on writing the output file, are reported in the summary only
+  void addTimes(const PhaseTimes& times) {
+    allTimes.add(times);
+  }
+
+  void writeSummary() {
+    double phasesSecs = allTimes.total();
+    file << "{\"type\":\"summary\"," << prefix << ",\"wallSecs\":" << nowSecs() - startSecs
+      << ",\"seriesPerSec\":" << (phasesSecs > 0 ? seriesProcessed / phasesSecs : 0);
+    writePhases(allTimes);
+    file << ",\"peakRSSBytes\":" << peakRSSBytes() << ",\"poolHighWaterMarkBytes\":" << poolHighWaterMark << "}" << std::endl;
+    file.close();
+  }
+
+private:
+  void writePhases(const PhaseTimes& times) {
+    for (int iph = 0; iph < NUM_OF_PHASES; iph++)
+      file << ",\"" << PHASE_NAMES[iph] << "Secs\":" << times.secs[iph];
+  }
+  static std::string escape(const std::string& str) {
+    std::string ret;
+    for (const auto c : str) {
+      if (c == '"' || c == '\\')
+        ret.push_back('\\');
+      ret.push_back(c);
+    }
+    return ret;
+  }
+};
+
+#endif
@@ -0,0 +1,136 @@
+/**
+* file model_artifact.h
+* versioned model artifact of ES_RNN_E, so the forecasts can be made without training (--forecast-only), e.g. after a refresh of the data.
+* The artifact of a run (ibig) is a pair of files <OUTPUT_DIR>/<VARIABLE>_<ibig>_LB<LBACK>[_rank<r>], next to the forecasts:
+  - .model - text: format version, the configuration the model was trained with, the ES parameters of every series and net
+    (unconstrained values, as in the per series ParameterCollection), and the ranking of the nets for every series
+  - .weights - the global weights (LSTMs, adapter) of every net, in the Dynet text format, under the key /net<inet>
+* The configuration holds everything that shapes the model (sizes, seasonality, dilations, LSTM type, ...); a loader refuses an artifact of another format version or configuration.
+* Artifacts of an older version are read too; the configuration keys added since (CONFIG_KEY_VERSIONS) are not checked in them.
+* With USE_MPI every rank writes, and reads, the nets it owns, so forecasting needs the same number of ranks.
+*/
+
+#ifndef ESRNN_MODEL_ARTIFACT_H_
+#define ESRNN_MODEL_ARTIFACT_H_
+
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <limits>
+#include <cstdlib>
+
+const int MODEL_ARTIFACT_VERSION = 2; //2: max_series_length in the configuration
+
+//configuration keys added after version 1, with the version that added them
+const std::map<std::string, int> CONFIG_KEY_VERSIONS = { { "max_series_length", 2 } };
+
+typedef std::vector<std::pair<std::string, std::string>> ModelConfig; //key, value (no white space in keys)
+
+struct ModelArtifact {
+  ModelConfig config;
+  std::unordered_map<std::string, std::map<int, std::vector<float>>> esParams; //series -> net -> values
+  std::unordered_map<std::string, std::vector<int>> rankings; //series -> nets, best first
+
+  bool save(const std::string& path) const {
+    std::ofstream file(path);
+    file.precision(std::numeric_limits<float>::max_digits10); //exact round trip
+    file << "ESRNN_MODEL " << MODEL_ARTIFACT_VERSION << "\n";
+    for (auto& entry : config)
+      file << "config " << entry.first << " " << entry.second << "\n";
+    for (auto& series : esParams)
+      for (auto& net : series.second) {
+        file << "es " << series.first << " " << net.first << " " << net.second.size();
+        for (float value : net.second)
+          file << " " << value;
+        file << "\n";
+      }
+    for (auto& series : rankings) {
+      file << "ranking " << series.first << " " << series.second.size();
+      for (int inet : series.second)
+        file << " " << inet;
+      file << "\n";
+    }
+    file << "end\n";
+    return bool(file);
+  }
+
+  //false, with the reason in error, if the file can't be read, is incomplete, or is of another version or configuration
+  bool load(const std::string& path, const ModelConfig& expectedConfig, std::string& error) {
+    config.clear();
+    esParams.clear();
+    rankings.clear();
+    std::ifstream file(path);
+    std::string line, tag;
+    int version = 0;
+    if (!std::getline(file, line) || !(std::istringstream(line) >> tag >> version) || tag != "ESRNN_MODEL") {
+      error = path + ": not a model artifact";
+      return false;
+    }
+    if (version < 1 || version > MODEL_ARTIFACT_VERSION) {
+      error = path + ": format version " + std::to_string(version) + ", expected 1 to " + std::to_string(MODEL_ARTIFACT_VERSION);
+      return false;
+    }
+    bool complete = false;
+    while (!complete && std::getline(file, line)) {
+      std::istringstream line_stream(line);
+      line_stream >> tag;
+      if (tag == "config") {
+        std::string key, value;
+        line_stream >> key;
+        std::getline(line_stream >> std::ws, value);
+        config.push_back(std::make_pair(key, value));
+      } else if (tag == "es") {
+        std::string series;
+        int inet = 0;
+        size_t size = 0;
+        line_stream >> series >> inet >> size;
+        std::vector<float>& values = esParams[series][inet];
+        values.resize(size);
+        for (auto& value : values) {//by strtof: operator>> fails on the nan and inf written for non-finite values
+          std::string text;
+          char* end = nullptr;
+          if (line_stream >> text)
+            value = std::strtof(text.c_str(), &end);
+          if (end == nullptr || *end != 0)
+            line_stream.setstate(std::ios::failbit);
+        }
+      } else if (tag == "ranking") {
+        std::string series;
+        size_t size = 0;
+        line_stream >> series >> size;
+        std::vector<int>& nets = rankings[series];
+        nets.resize(size);
+        for (auto& inet : nets)
+          line_stream >> inet;
+      } else if (tag == "end")
+        complete = true;
+      if (!line_stream && !complete) {
+        error = path + ": bad line: " + line;
+        return false;
+      }
+    }
+    if (!complete) {
+      error = path + ": truncated";
+      return false;
+    }
+    for (auto& expected : expectedConfig) {
+      std::string value = "<missing>";
+      for (auto& entry : config)
+        if (entry.first == expected.first)
+          value = entry.second;
+      auto keyVersion = CONFIG_KEY_VERSIONS.find(expected.first);
+      if (value == "<missing>" && keyVersion != CONFIG_KEY_VERSIONS.end() && version < keyVersion->second)
+        continue; //written before the key existed
+      if (value != expected.second) {
+        error = path + ": trained with " + expected.first + "=" + value + ", this executable has " + expected.second;
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+#endif
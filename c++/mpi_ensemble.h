@@ -0,0 +1,135 @@
+/**
+* file mpi_ensemble.h
+* distribution of the ensemble of ES_RNN_E over MPI ranks (USE_MPI), e.g. mpirun -np 4 <executable> 0
+* The nets are sharded: rank r trains and validates the nets inet with inet%size==r. Each epoch
+  - allMinNetPerf() exchanges the per series validation losses of all nets, so every rank computes the same rankings and series assignments,
+  - gatherForecasts() brings the forecasts of all nets to rank 0, which calculates the best/topn losses and writes the output file.
+* All ranks have to use the same random generator seed for the series assignments, see commonSeed().
+* Without USE_MPI the functions describe a single process owning all nets, so the callers do not need #ifs.
+*/
+
+#ifndef ESRNN_MPI_ENSEMBLE_H_
+#define ESRNN_MPI_ENSEMBLE_H_
+
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <iostream>
+#if defined USE_MPI
+  #include <mpi.h>
+#endif
+
+struct MpiWorld {
+  int rank = 0;
+  int size = 1;
+
+  static MpiWorld& instance() {
+    static MpiWorld world;
+    return world;
+  }
+};
+
+inline void mpiInit(int& argc, char**& argv) {
+#if defined USE_MPI
+  MpiWorld& world = MpiWorld::instance();
+  MPI_Init(&argc, &argv);
+  MPI_Comm_rank(MPI_COMM_WORLD, &world.rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &world.size);
+  if (world.rank == 0)
+    std::cout << "MPI ranks:" << world.size << std::endl;
+#endif
+}
+
+inline void mpiFinalize() {
+#if defined USE_MPI
+  MPI_Finalize();
+#endif
+}
+
+inline int mpiRank() {
+  return MpiWorld::instance().rank;
+}
+
+//"" or "_rank<rank>", for the names of the per process files
+inline std::string mpiRankSuffix() {
+  MpiWorld& world = MpiWorld::instance();
+  return world.size > 1 ? "_rank" + std::to_string(world.rank) : std::string();
+}
+
+inline bool ownsNet(int inet) {
+  MpiWorld& world = MpiWorld::instance();
+  return inet % world.size == world.rank;
+}
+
+//the seed of rank 0
+inline unsigned commonSeed(unsigned seed) {
+#if defined USE_MPI
+  MPI_Bcast(&seed, 1, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
+#endif
+  return seed;
+}
+
+//After it every rank has the losses of all nets, taken from their owners. Collective.
+template <size_t NUM_OF_NETS>
+void allMinNetPerf(const std::vector<std::string>& series_vect, std::unordered_map<std::string, std::array<float, NUM_OF_NETS>>& netPerf_map, float notOwned) {
+#if defined USE_MPI
+  if (MpiWorld::instance().size == 1)
+    return;
+  std::vector<float> perf(series_vect.size()*NUM_OF_NETS);
+  for (size_t i = 0; i < series_vect.size(); i++) {
+    auto& perf_arr = netPerf_map[series_vect[i]];
+    for (int inet = 0; inet < (int)NUM_OF_NETS; inet++)
+      perf[i*NUM_OF_NETS + inet] = ownsNet(inet) ? perf_arr[inet] : notOwned;
+  }
+  MPI_Allreduce(MPI_IN_PLACE, perf.data(), (int)perf.size(), MPI_FLOAT, MPI_MIN, MPI_COMM_WORLD);
+  for (size_t i = 0; i < series_vect.size(); i++) {
+    auto& perf_arr = netPerf_map[series_vect[i]];
+    for (int inet = 0; inet < (int)NUM_OF_NETS; inet++)
+      perf_arr[inet] = perf[i*NUM_OF_NETS + inet];
+  }
+#endif
+}
+
+//Copies, on rank 0, the forecasts of slot islot, and, if withAverage, of the averaged slot (the last one) of the nets owned by other ranks. Collective.
+//The other ranks send zeros for the nets they do not own, so a sum reduction is an exact gather.
+template <size_t NUM_OF_NETS, size_t NUM_OF_SLOTS>
+void gatherForecasts(const std::vector<std::string>& series_vect,
+  std::unordered_map<std::string, std::array<std::array<std::vector<float>, NUM_OF_SLOTS>, NUM_OF_NETS>>& testResults_map,
+  int islot, bool withAverage, int outputSize) {
+#if defined USE_MPI
+  if (MpiWorld::instance().size == 1)
+    return;
+  const int numOfSlots = withAverage ? 2 : 1;
+  const int slots[2] = { islot, (int)NUM_OF_SLOTS - 1 };
+  const size_t seriesStride = NUM_OF_NETS*numOfSlots*outputSize;
+  std::vector<float> forecasts(series_vect.size()*seriesStride, 0.f);
+  for (size_t i = 0; i < series_vect.size(); i++) {
+    auto& results = testResults_map[series_vect[i]];
+    for (int inet = 0; inet < (int)NUM_OF_NETS; inet++)
+      if (ownsNet(inet))
+        for (int is = 0; is < numOfSlots; is++) {
+          const std::vector<float>& forec = results[inet][slots[is]];
+          std::copy(forec.begin(), forec.end(), &forecasts[i*seriesStride + (inet*numOfSlots + is)*outputSize]);
+        }
+  }
+  if (mpiRank() == 0)
+    MPI_Reduce(MPI_IN_PLACE, forecasts.data(), (int)forecasts.size(), MPI_FLOAT, MPI_SUM, 0, MPI_COMM_WORLD);
+  else
+    MPI_Reduce(forecasts.data(), NULL, (int)forecasts.size(), MPI_FLOAT, MPI_SUM, 0, MPI_COMM_WORLD);
+  if (mpiRank() != 0)
+    return;
+  for (size_t i = 0; i < series_vect.size(); i++) {
+    auto& results = testResults_map[series_vect[i]];
+    for (int inet = 0; inet < (int)NUM_OF_NETS; inet++)
+      if (!ownsNet(inet))
+        for (int is = 0; is < numOfSlots; is++) {
+          const float* forec = &forecasts[i*seriesStride + (inet*numOfSlots + is)*outputSize];
+          results[inet][slots[is]].assign(forec, forec + outputSize);
+        }
+  }
+#endif
+}
+
+#endif
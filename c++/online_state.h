@@ -0,0 +1,195 @@
+/**
+* file online_state.h
+* persisted per series state of ES_RNN_E for online updates (--update): when new points of a series arrive, the ES recurrence and the dilated LSTMs
+* advance over the new points only, instead of a pass over the whole history.
+* Per series and (top) net, after the last point seen:
+  - the smoothing coefficients (after logistic), the level of the last point, the categories
+  - values of the last inputSize points, seasonality factors of the last inputSize points and of the next seasonality points (the ring), the same for the second seasonality
+  - per dilated LSTM of the stack, h and c of the last max(dilation) steps, per layer - the reach of the dilated connections
+  - the latest forecast
+* advance() does the ES step of one new point in floats, as the graph of ES_RNN_E does it; the LSTM step, which needs the nets, is done by the caller.
+* Saved as text, next to the model artifact (model_artifact.h): <model prefix>.state
+*/
+
+#ifndef ESRNN_ONLINE_STATE_H_
+#define ESRNN_ONLINE_STATE_H_
+
+#include <vector>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <limits>
+#include <cmath>
+
+const int ONLINE_STATE_VERSION = 1;
+
+struct OnlineSeriesState {
+  int seasonality = 0; //0: none
+  int seasonality2 = 0; //0: none
+  int numOfPoints = 0;
+  float levSm = 0, sSm = 0, sSm2 = 0;
+  float level = 0;
+  std::vector<float> categories;
+  std::deque<float> values; //of the last inputSize points
+  std::deque<float> seasons; //factors of the last (up to) inputSize points, then of the next seasonality points
+  std::deque<float> seasons2;
+  std::vector<std::vector<std::vector<std::vector<float>>>> h, c; //[rnn][time][layer] -> state vector
+  std::vector<float> forecast;
+
+  //factor of the current point, i.e. the first of the ring
+  float season() const { return seasonality > 0 ? seasons[seasons.size() - seasonality] : 1; }
+  float season2() const { return seasonality2 > 0 ? seasons2[seasons2.size() - seasonality2] : 1; }
+
+  //ES step of a new point
+  void advance(float value, int inputSize) {
+    float s = season();
+    float s2 = season2();
+    if (numOfPoints == 0) {
+      level = value / (s*s2);
+      if (seasonality > 0)
+        seasons.push_back(s); //the first factor repeats, as in the graph
+      if (seasonality2 > 0)
+        seasons2.push_back(s2);
+    } else {
+      level = levSm*value / (s*s2) + (1 - levSm)*level;
+      if (seasonality > 0)
+        seasons.push_back(sSm*value / (level*s2) + (1 - sSm)*s);
+      if (seasonality2 > 0)
+        seasons2.push_back(sSm2*value / (level*s) + (1 - sSm2)*s2);
+    }
+    numOfPoints++;
+    values.push_back(value);
+    if ((int)values.size() > inputSize)
+      values.pop_front();
+    while (seasonality > 0 && (int)seasons.size() - seasonality > inputSize)
+      seasons.pop_front();
+    while (seasonality2 > 0 && (int)seasons2.size() - seasonality2 > inputSize)
+      seasons2.pop_front();
+  }
+
+  //deseasonalized, normalized and squashed (log) input window of the last point; numOfPoints>=inputSize
+  std::vector<float> normalizedInput(int inputSize) const {
+    std::vector<float> input(inputSize);
+    for (int i = 0; i < inputSize; i++) {
+      float value = values[values.size() - inputSize + i];
+      if (seasonality > 0)
+        value /= seasons[seasons.size() - seasonality - inputSize + i];
+      if (seasonality2 > 0)
+        value /= seasons2[seasons2.size() - seasonality2 - inputSize + i];
+      input[i] = std::log(value / level);
+    }
+    return input;
+  }
+
+  //output of the net (squashed, normalized) -> forecast of the next points
+  std::vector<float> denormalize(const std::vector<float>& out) const {
+    std::vector<float> forec(out.size());
+    for (size_t k = 0; k < out.size(); k++) {
+      forec[k] = std::exp(out[k])*level;
+      if (seasonality > 0) //periodic beyond the ring
+        forec[k] *= seasons[seasons.size() - seasonality + k % seasonality];
+      if (seasonality2 > 0)
+        forec[k] *= seasons2[seasons2.size() - seasonality2 + k % seasonality2];
+    }
+    return forec;
+  }
+};
+
+typedef std::unordered_map<std::string, std::map<int, OnlineSeriesState>> OnlineStates; //series -> net -> state
+
+template <class C>
+void writeOnlineVector(std::ostream& out, const C& values) {
+  out << " " << values.size();
+  for (float value : values)
+    out << " " << value;
+}
+
+template <class C>
+bool readOnlineVector(std::istream& in, C& values) {
+  size_t size = 0;
+  in >> size;
+  values.resize(size);
+  for (auto& value : values)
+    in >> value;
+  return bool(in);
+}
+
+//a line per series and net
+inline bool saveOnlineStates(const std::string& path, const OnlineStates& states) {
+  std::ofstream file(path);
+  file.precision(std::numeric_limits<float>::max_digits10);
+  file << "ESRNN_ONLINE_STATE " << ONLINE_STATE_VERSION << "\n";
+  for (auto& series : states)
+    for (auto& net : series.second) {
+      const OnlineSeriesState& state = net.second;
+      file << series.first << " " << net.first << " " << state.seasonality << " " << state.seasonality2 << " " << state.numOfPoints << " "
+        << state.levSm << " " << state.sSm << " " << state.sSm2 << " " << state.level;
+      writeOnlineVector(file, state.categories);
+      writeOnlineVector(file, state.values);
+      writeOnlineVector(file, state.seasons);
+      writeOnlineVector(file, state.seasons2);
+      writeOnlineVector(file, state.forecast);
+      file << " " << state.h.size();
+      for (size_t il = 0; il < state.h.size(); il++) {
+        file << " " << state.h[il].size() << " " << (state.h[il].empty() ? 0 : state.h[il][0].size());
+        for (size_t it = 0; it < state.h[il].size(); it++)
+          for (size_t layer = 0; layer < state.h[il][it].size(); layer++) {
+            writeOnlineVector(file, state.h[il][it][layer]);
+            writeOnlineVector(file, state.c[il][it][layer]);
+          }
+      }
+      file << "\n";
+    }
+  return bool(file);
+}
+
+//false, with the reason in error, if the file can't be read or is of another version
+inline bool loadOnlineStates(const std::string& path, OnlineStates& states, std::string& error) {
+  states.clear();
+  std::ifstream file(path);
+  std::string line, tag;
+  int version = 0;
+  if (!std::getline(file, line) || !(std::istringstream(line) >> tag >> version) || tag != "ESRNN_ONLINE_STATE") {
+    error = path + ": not an online state file";
+    return false;
+  }
+  if (version != ONLINE_STATE_VERSION) {
+    error = path + ": format version " + std::to_string(version) + ", expected " + std::to_string(ONLINE_STATE_VERSION);
+    return false;
+  }
+  while (std::getline(file, line)) {
+    if (line.empty())
+      continue;
+    std::istringstream line_stream(line);
+    std::string series;
+    int inet = 0;
+    line_stream >> series >> inet;
+    OnlineSeriesState& state = states[series][inet];
+    line_stream >> state.seasonality >> state.seasonality2 >> state.numOfPoints >> state.levSm >> state.sSm >> state.sSm2 >> state.level;
+    bool ok = readOnlineVector(line_stream, state.categories) && readOnlineVector(line_stream, state.values)
+      && readOnlineVector(line_stream, state.seasons) && readOnlineVector(line_stream, state.seasons2) && readOnlineVector(line_stream, state.forecast);
+    size_t numOfRnns = 0;
+    line_stream >> numOfRnns;
+    state.h.resize(numOfRnns);
+    state.c.resize(numOfRnns);
+    for (size_t il = 0; ok && il < numOfRnns; il++) {
+      size_t numOfSteps = 0, numOfLayers = 0;
+      line_stream >> numOfSteps >> numOfLayers;
+      state.h[il].assign(numOfSteps, std::vector<std::vector<float>>(numOfLayers));
+      state.c[il].assign(numOfSteps, std::vector<std::vector<float>>(numOfLayers));
+      for (size_t it = 0; ok && it < numOfSteps; it++)
+        for (size_t layer = 0; ok && layer < numOfLayers; layer++)
+          ok = readOnlineVector(line_stream, state.h[il][it][layer]) && readOnlineVector(line_stream, state.c[il][it][layer]);
+    }
+    if (!ok || !line_stream) {
+      error = path + ": bad state of " + series;
+      return false;
+    }
+  }
+  return true;
+}
+
+#endif
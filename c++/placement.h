@@ -0,0 +1,229 @@
+/**
+* file placement.h
+* placement of the worker processes on cores and NUMA nodes, and the cap on the threads of the BLAS library used by Dynet (MKL, OpenBLAS, OpenMP Eigen).
+* Many single-threaded workers run on one host (e.g. run18, mpirun, or the forked workers of ES_RNN), so letting the BLAS library start its own threads only oversubscribes the cores.
+  - CpuTopology - the cpus this process may run on, with their core, package (socket) and NUMA node, read from /sys
+  - placeProcess(blasThreads, pinToCores) - called first in main(). Caps the BLAS threads and, if the process has a slot, pins it to the core of the slot
+    and prefers its NUMA node for memory allocations, so the series and the Dynet memory pools, allocated later, are local. Reports all of it.
+  - pinToSlot(slot) - pins the calling process to the core of the slot
+  - pinWorker(slot, worker, numOfWorkers) - pins a forked worker of the process in slot to a core of the node of the slot, so its cpu and memory stay on one node
+* Slots are spread over the nodes round-robin: slot 0 -> first core of node 0, slot 1 -> first core of node 1, ... and use the second hardware threads of the cores only when there are more slots than cores.
+* The slot of a process comes from the environment: ESRNN_SLOT (set by run18), or the node-local rank set by mpirun/srun. Without it neither the process nor its workers are pinned.
+* Pinning and memory policy are implemented for Linux only; elsewhere only the BLAS cap is applied.
+*/
+
+#ifndef ESRNN_PLACEMENT_H_
+#define ESRNN_PLACEMENT_H_
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#if defined _OPENMP
+  #include <omp.h>
+#endif
+#if defined __linux__
+  #include <sched.h>
+  #include <unistd.h>
+  #include <sys/syscall.h>
+  #include <linux/mempolicy.h>
+#endif
+
+struct CpuInfo {
+  int cpu;
+  int core;
+  int package;
+  int node;
+};
+
+//parses a /sys cpu (or node) list, e.g. "0-3,8,10-11"
+inline std::vector<int> parseCpuList(const std::string& list) {
+  std::vector<int> cpus;
+  std::stringstream list_stream(list);
+  std::string range;
+  while (std::getline(list_stream, range, ',')) {
+    if (range.empty() || range == "\n")
+      continue;
+    size_t dash = range.find('-');
+    int first = std::atoi(range.c_str());
+    int last = dash == std::string::npos ? first : std::atoi(range.c_str() + dash + 1);
+    for (int cpu = first; cpu <= last; cpu++)
+      cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
+inline std::string readSysFile(const std::string& path) {
+  std::ifstream file(path);
+  std::string content;
+  std::getline(file, content);
+  return content;
+}
+
+struct CpuTopology {
+  std::vector<CpuInfo> cpus; //allowed for this process
+  int numOfNodes = 1;
+  int numOfCores = 0;
+  std::vector<int> slotOrder; //indexes into cpus, see the file comment
+
+  CpuTopology() {
+#if defined __linux__
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    const std::string sysCpu = "/sys/devices/system/cpu/";
+    for (int cpu : parseCpuList(readSysFile(sysCpu + "online"))) {
+      if (!CPU_ISSET(cpu, &allowed))
+        continue;
+      std::string topology = sysCpu + "cpu" + std::to_string(cpu) + "/topology/";
+      CpuInfo info = { cpu, std::atoi(readSysFile(topology + "core_id").c_str()), std::atoi(readSysFile(topology + "physical_package_id").c_str()), 0 };
+      cpus.push_back(info);
+    }
+    std::vector<int> nodes = parseCpuList(readSysFile("/sys/devices/system/node/online")); //the ids need not be contiguous, e.g. "0,2"
+    numOfNodes = std::max((int)nodes.size(), 1);
+    for (int node : nodes)
+      for (int cpu : parseCpuList(readSysFile("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist")))
+        for (auto& info : cpus)
+          if (info.cpu == cpu)
+            info.node = node;
+#endif
+    orderSlots();
+  }
+
+  void orderSlots() {
+    //per node, the first hardware thread of each core, then the second ones, etc.
+    int maxNode = 0;
+    for (auto& info : cpus)
+      maxNode = std::max(maxNode, info.node);
+    std::vector<std::vector<std::vector<int>>> threadsOfNodes(maxNode + 1); //[node id][thread of core] -> cpu indexes
+    std::vector<std::pair<int, int>> seenCores; //package, core
+    numOfCores = 0;
+    slotOrder.clear();
+    for (size_t i = 0; i < cpus.size(); i++) {
+      std::pair<int, int> core(cpus[i].package, cpus[i].core);
+      int thread = (int)std::count(seenCores.begin(), seenCores.end(), core);
+      if (thread == 0)
+        numOfCores++;
+      seenCores.push_back(core);
+      auto& threads = threadsOfNodes[cpus[i].node];
+      if ((int)threads.size() <= thread)
+        threads.resize(thread + 1);
+      threads[thread].push_back((int)i);
+    }
+    for (int thread = 0; slotOrder.size() < cpus.size(); thread++) {
+      size_t maxCores = 0;
+      for (auto& threads : threadsOfNodes)
+        if ((int)threads.size() > thread)
+          maxCores = std::max(maxCores, threads[thread].size());
+      for (size_t icore = 0; icore < maxCores; icore++)
+        for (auto& threads : threadsOfNodes)
+          if ((int)threads.size() > thread && icore < threads[thread].size())
+            slotOrder.push_back(threads[thread][icore]);
+    }
+  }
+
+  const CpuInfo* cpuOfSlot(int slot) const {
+    if (slot < 0 || slotOrder.empty())
+      return nullptr;
+    return &cpus[slotOrder[slot % slotOrder.size()]];
+  }
+
+  //The cpu of one of the numOfWorkers worker processes of the process in slot. All stay on the node of the slot, whose memory the process prefers,
+  //on its cores in slot order: the workers of the j-th slot of the node get the cores j*numOfWorkers .. j*numOfWorkers+numOfWorkers-1 of the node.
+  const CpuInfo* cpuOfWorker(int slot, int worker, int numOfWorkers) const {
+    const CpuInfo* slotCpu = cpuOfSlot(slot);
+    if (slotCpu == nullptr)
+      return nullptr;
+    std::vector<int> nodeOrder; //slotOrder of the node
+    int slotOfNode = 0;
+    for (size_t i = 0; i < slotOrder.size(); i++)
+      if (cpus[slotOrder[i]].node == slotCpu->node) {
+        if ((int)i < slot % (int)slotOrder.size())
+          slotOfNode++;
+        nodeOrder.push_back(slotOrder[i]);
+      }
+    return &cpus[nodeOrder[(slotOfNode*numOfWorkers + worker) % nodeOrder.size()]];
+  }
+};
+
+inline const CpuTopology& cpuTopology() {
+  static CpuTopology topology; //of the startup affinity, before any pinning
+  return topology;
+}
+
+//-1 if none
+inline int slotFromEnvironment() {
+  const char* names[] = { "ESRNN_SLOT", "OMPI_COMM_WORLD_LOCAL_RANK", "MPI_LOCALRANKID", "SLURM_LOCALID" };
+  for (const char* name : names) {
+    const char* value = std::getenv(name);
+    if (value != nullptr && *value != 0)
+      return std::atoi(value);
+  }
+  return -1;
+}
+
+//pins the calling process to the cpu, and prefers the memory of its node. Returns the cpu, or nullptr if not pinned
+inline const CpuInfo* pinToCpu(const CpuInfo* info) {
+#if defined __linux__
+  if (info == nullptr)
+    return nullptr;
+  cpu_set_t cpuSet;
+  CPU_ZERO(&cpuSet);
+  CPU_SET(info->cpu, &cpuSet);
+  if (sched_setaffinity(0, sizeof(cpuSet), &cpuSet) != 0) {
+    std::cerr << "could not pin to cpu " << info->cpu << std::endl;
+    return nullptr;
+  }
+  unsigned long nodeMask = 1UL << info->node;
+  if (cpuTopology().numOfNodes > 1 && info->node < (int)(8 * sizeof(nodeMask)))
+    syscall(SYS_set_mempolicy, MPOL_PREFERRED, &nodeMask, 8 * sizeof(nodeMask)); //not MPOL_BIND: a full node should not fail the allocation
+  return info;
+#else
+  return nullptr;
+#endif
+}
+
+//returns the cpu, or nullptr if not pinned
+inline const CpuInfo* pinToSlot(int slot) {
+  return pinToCpu(cpuTopology().cpuOfSlot(slot));
+}
+
+//pins a forked worker of the process in slot, on the node of the slot, see cpuOfWorker(). Returns the cpu, or nullptr if not pinned
+inline const CpuInfo* pinWorker(int slot, int worker, int numOfWorkers) {
+  return pinToCpu(cpuTopology().cpuOfWorker(slot, worker, numOfWorkers));
+}
+
+//MKL reads the variables at its first call, so setting them here is enough. OpenBLAS and the OpenMP runtime read them when loaded, before main(),
+//so for them the start script has to export them too (run18 does); omp_set_num_threads() covers OpenMP builds of this program.
+inline void capBlasThreads(int blasThreads) {
+  std::string threads = std::to_string(blasThreads);
+  const char* names[] = { "OMP_NUM_THREADS", "MKL_NUM_THREADS", "OPENBLAS_NUM_THREADS" };
+  for (const char* name : names) {
+#if defined _WINDOWS
+    _putenv_s(name, threads.c_str());
+#else
+    setenv(name, threads.c_str(), 1);
+#endif
+  }
+#if defined _OPENMP
+  omp_set_num_threads(blasThreads);
+#endif
+}
+
+inline void placeProcess(int blasThreads, bool pinToCores) {
+  const CpuTopology& topology = cpuTopology();
+  capBlasThreads(blasThreads);
+  int slot = slotFromEnvironment();
+  const CpuInfo* info = pinToCores ? pinToSlot(slot) : nullptr;
+  std::cout << "placement: " << topology.numOfNodes << " NUMA node(s), " << topology.numOfCores << " core(s), " << topology.cpus.size() << " cpu(s) available";
+  if (info != nullptr)
+    std::cout << "; slot " << slot << " pinned to cpu " << info->cpu << " (node " << info->node << ", package " << info->package << ", core " << info->core << "), memory preferred on node " << info->node;
+  else
+    std::cout << "; not pinned";
+  std::cout << "; BLAS threads " << blasThreads << std::endl;
+}
+
+#endif
@@ -0,0 +1,101 @@
+/**
+* file prefetch.h
+* two-stage pipeline of the per-series work: a helper thread prepares the next item (the Dynet-free part: data copies, input/label windows)
+* while the main thread builds, runs and updates the graph of the current item. Dynet itself is used only by the main thread.
+  - Prefetcher<T>(enabled, prepare) - prepare(item, T&) fills a T. Two T buffers are reused, so their vectors keep their capacity between items.
+  - get(item, nextItem) - returns the prepared item (prepares it now, if it was not prefetched) and starts preparing nextItem (if >=0) in the background.
+    The returned reference is valid until the next get().
+* The thread is started by the first get(), so an object created before a fork() works in the parent and in the children.
+*/
+
+#ifndef ESRNN_PREFETCH_H_
+#define ESRNN_PREFETCH_H_
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <utility>
+
+template <class T>
+struct Prefetcher {
+  bool enabled;
+  std::function<void(int, T&)> prepare;
+  T current;
+  T next;
+  int nextItem = -1; //prepared, or being prepared, into next
+  bool busy = false;
+  bool stop = false;
+  std::exception_ptr error;
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable cv;
+
+  Prefetcher(bool enabled_, std::function<void(int, T&)> prepare_) : enabled(enabled_), prepare(prepare_) {}
+  Prefetcher(const Prefetcher&) = delete;
+  Prefetcher& operator=(const Prefetcher&) = delete;
+
+  ~Prefetcher() {
+    if (thread.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+      }
+      cv.notify_all();
+      thread.join();
+    }
+  }
+
+  T& get(int item, int nextItem_) {
+    bool schedule = enabled && nextItem_ >= 0;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock, [this] { return !busy; });
+      if (error) {
+        std::exception_ptr e = error;
+        error = nullptr;
+        std::rethrow_exception(e);
+      }
+      if (nextItem == item)
+        std::swap(current, next);
+      else
+        prepare(item, current);
+      nextItem = -1;
+      if (schedule) {
+        nextItem = nextItem_;
+        busy = true;
+      }
+    }
+    if (schedule) {
+      if (!thread.joinable())
+        thread = std::thread(&Prefetcher::run, this);
+      cv.notify_all();
+    }
+    return current;
+  }
+
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      cv.wait(lock, [this] { return busy || stop; });
+      if (stop)
+        return;
+      lock.unlock();
+      std::exception_ptr e;
+      try {
+        prepare(nextItem, next); //nextItem and next are not touched by get() while busy
+      } catch (...) {
+        e = std::current_exception();
+      }
+      lock.lock();
+      error = e;
+      if (e)
+        nextItem = -1;
+      busy = false;
+      cv.notify_all();
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,530 @@
+/**
+* file series_ingest.h
+* binary, append-only store of the series of a training file, so that a production run does not re-read and re-parse the whole *-train.csv
+* when only a few new points per series arrived since the last one (STORE_PATH of ES_RNN and ES_RNN_E, written by esrnn_ingest). Linux/Mac only. Does not need Dynet.
+* Two files:
+  - <path> - snapshot: header, an entry per series, the names (cleaned as the programs clean them), and all the values, before the LBACK split.
+    It is mapped read-only, so loading it involves no parsing: the programs cut the LBACK split and MAX_SERIES_LENGTH from the mapped values (see the M4TS constructor from values).
+  - <path>.log - delta log: batches of records (series, index, value), appended by esrnn_ingest append. Index is the 0-based position in the series:
+    the next one appends a point, an earlier one corrects one, a later one (a gap) is rejected; a new series starts at index 0.
+    A batch goes out in one write and is fsync'ed, with its length and checksum: a batch torn by a crash is ignored, and cut off by the next append.
+    Records set the value at an index, so replaying them is idempotent.
+* compact() folds the log into a new snapshot: written to <path>.tmp, fsync'ed, renamed over <path>, the directory fsync'ed, then the log is reset.
+  The snapshot and the log carry a generation; a log older than its snapshot (a crash between the rename and the reset) is stale and ignored.
+* Writers (create, append, compact) hold an exclusive flock of the log, readers a shared one while loading. A loaded snapshot stays valid after a later compaction,
+  the replaced file stays mapped.
+*/
+
+#ifndef ESRNN_SERIES_INGEST_H_
+#define ESRNN_SERIES_INGEST_H_
+
+#if defined _WINDOWS
+  #error "the series store uses mmap, flock and fsync, not available on Windows"
+#endif
+
+#include "forecast_cache.h" //hashBytes
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstring>
+#include <cctype>
+#include <cerrno>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+const uint32_t INGEST_FORMAT_VERSION = 1;
+const uint32_t LOG_BATCH_MAGIC = 0x4c425345;
+
+struct SnapshotHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t numOfSeries;
+  uint64_t generation;
+  uint64_t entriesOffset, namesOffset, valuesOffset; //bytes from the start of the file
+  uint64_t fileSize; //a snapshot cut short is rejected
+};
+
+struct SnapshotEntry {
+  uint64_t nameOffset; //in the names
+  uint64_t valuesOffset; //floats, in the values
+  uint32_t nameLength;
+  uint32_t length;
+};
+
+struct LogHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t generation; //of the snapshot the records apply to
+};
+
+struct LogBatchHeader {//followed by the records: index (uint32), value (float), name length (uint16), name
+  uint32_t magic;
+  uint32_t numOfRecords;
+  uint64_t payloadSize;
+  uint64_t checksum; //of the fields above and the records, see batchChecksum()
+};
+
+inline uint64_t batchChecksum(const LogBatchHeader& header, const char* payload) {
+  uint64_t hash = hashBytes(&header.magic, sizeof(header.magic));
+  hash = hashBytes(&header.numOfRecords, sizeof(header.numOfRecords), hash);
+  hash = hashBytes(&header.payloadSize, sizeof(header.payloadSize), hash);
+  return hashBytes(payload, (size_t)header.payloadSize, hash);
+}
+
+//true if the numOfRecords records of the batch fill its payload exactly, so reading them stays within the batch
+inline bool batchRecordsFit(const LogBatchHeader& header, const char* payload) {
+  uint64_t at = 0;
+  for (uint32_t irec = 0; irec < header.numOfRecords; irec++) {
+    uint16_t nameLength;
+    if (at + 10 > header.payloadSize)
+      return false;
+    memcpy(&nameLength, payload + at + 8, sizeof(nameLength));
+    at += 10 + nameLength;
+  }
+  return at == header.payloadSize;
+}
+
+struct IngestRecord {
+  std::string series;
+  uint32_t index;
+  float value;
+};
+
+struct IngestStats {
+  uint64_t appended = 0, corrected = 0, rejected = 0, newSeries = 0;
+};
+
+//as the programs clean the names read from the csv files
+inline std::string seriesName(const std::string& raw) {
+  std::string name;
+  for (const auto c : raw)
+    if (!ispunct(c))
+      name.push_back(c);
+  return name;
+}
+
+inline bool writeAllAt(int fd, const void* data, size_t size, uint64_t offset) {
+  const char* p = (const char*)data;
+  while (size > 0) {
+    ssize_t written = pwrite(fd, p, size, (off_t)offset);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written <= 0)
+      return false;
+    p += written;
+    offset += written;
+    size -= written;
+  }
+  return true;
+}
+
+//so that a rename in it is durable
+inline bool syncDirectoryOf(const std::string& path) {
+  size_t slash = path.rfind('/');
+  std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+  int fd = ::open(dir.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  bool ok = fsync(fd) == 0;
+  ::close(fd);
+  return ok;
+}
+
+//Writes a snapshot of numOfSeries series, seriesAt(i, name, values, length) giving series i, to <path>.tmp, then renames it over path.
+template <class SeriesAt>
+bool writeSnapshot(const std::string& path, uint64_t generation, int numOfSeries, SeriesAt seriesAt, std::string& error) {
+  std::vector<SnapshotEntry> entries(numOfSeries);
+  std::string name;
+  const float* values;
+  int length;
+  uint64_t namesSize = 0, numOfValues = 0;
+  for (int i = 0; i < numOfSeries; i++) {
+    seriesAt(i, name, values, length);
+    entries[i].nameOffset = namesSize;
+    entries[i].nameLength = (uint32_t)name.size();
+    entries[i].valuesOffset = numOfValues;
+    entries[i].length = (uint32_t)length;
+    namesSize += name.size();
+    numOfValues += length;
+  }
+  SnapshotHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, "ESRNNSS", 8);
+  header.version = INGEST_FORMAT_VERSION;
+  header.numOfSeries = (uint32_t)numOfSeries;
+  header.generation = generation;
+  header.entriesOffset = sizeof(header);
+  header.namesOffset = header.entriesOffset + entries.size() * sizeof(SnapshotEntry);
+  header.valuesOffset = (header.namesOffset + namesSize + 7) / 8 * 8;
+  header.fileSize = header.valuesOffset + numOfValues * sizeof(float);
+
+  std::string tmpPath = path + ".tmp";
+  FILE* file = fopen(tmpPath.c_str(), "wb");
+  if (file == NULL) {
+    error = "can't write " + tmpPath;
+    return false;
+  }
+  std::vector<char> buffer(1 << 20);
+  setvbuf(file, buffer.data(), _IOFBF, buffer.size());
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+  ok = ok && (entries.empty() || fwrite(entries.data(), sizeof(SnapshotEntry), entries.size(), file) == entries.size());
+  for (int i = 0; i < numOfSeries && ok; i++) {
+    seriesAt(i, name, values, length);
+    ok = fwrite(name.data(), 1, name.size(), file) == name.size();
+  }
+  const char padding[8] = { 0 };
+  size_t paddingSize = (size_t)(header.valuesOffset - header.namesOffset - namesSize);
+  ok = ok && fwrite(padding, 1, paddingSize, file) == paddingSize;
+  for (int i = 0; i < numOfSeries && ok; i++) {
+    seriesAt(i, name, values, length);
+    ok = length == 0 || fwrite(values, sizeof(float), length, file) == (size_t)length;
+  }
+  ok = ok && fflush(file) == 0 && fsync(fileno(file)) == 0;
+  ok = fclose(file) == 0 && ok;
+  if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0 || !syncDirectoryOf(path)) {
+    error = "can't write the snapshot " + path;
+    unlink(tmpPath.c_str());
+    return false;
+  }
+  return true;
+}
+
+struct IngestedSeries {
+  std::string path;
+  int logFd = -1;
+  bool exclusive = false;
+  char* mem = NULL;
+  size_t mappedSize = 0;
+  uint64_t generation = 0;
+  uint64_t logEnd = 0; //bytes of the log up to the end of its last complete batch, 0: to be reset
+  uint64_t logRecords = 0;
+  IngestStats logStats; //of the records replayed from the log
+  std::vector<std::string> newNames; //of the series only in the log, ids from numOfSnapshotSeries()
+  std::unordered_map<int, std::vector<float>> changed; //values of the series changed by the log
+  std::unordered_map<std::string, int> ids; //built by the first record
+
+  IngestedSeries() {}
+  IngestedSeries(const IngestedSeries&) = delete;
+  IngestedSeries& operator=(const IngestedSeries&) = delete;
+  ~IngestedSeries() { close(); }
+
+  const SnapshotHeader& header() const { return *(const SnapshotHeader*)mem; }
+  int numOfSnapshotSeries() const { return (int)header().numOfSeries; }
+  int numOfSeries() const { return numOfSnapshotSeries() + (int)newNames.size(); }
+  const SnapshotEntry& entry(int i) const {
+    return ((const SnapshotEntry*)(mem + header().entriesOffset))[i];
+  }
+  std::string name(int i) const {
+    if (i >= numOfSnapshotSeries())
+      return newNames[i - numOfSnapshotSeries()];
+    return std::string(mem + header().namesOffset + entry(i).nameOffset, entry(i).nameLength);
+  }
+  //all the values of series i, with the log applied; valid until the next append() or compact()
+  const float* values(int i) const {
+    if (!changed.empty()) {
+      auto iter = changed.find(i);
+      if (iter != changed.end())
+        return iter->second.data();
+    }
+    return (const float*)(mem + header().valuesOffset) + entry(i).valuesOffset;
+  }
+  int length(int i) const {
+    if (!changed.empty()) {
+      auto iter = changed.find(i);
+      if (iter != changed.end())
+        return (int)iter->second.size();
+    }
+    return (int)entry(i).length;
+  }
+
+  //Opens the store for reading, or, exclusive, for append() and compact(). False, with the reason in error, on failure.
+  bool open(const std::string& path_, bool exclusive_, std::string& error) {
+    close();
+    path = path_;
+    exclusive = exclusive_;
+    if (!lockLog(error))
+      return false;
+    if (!mapSnapshot(error)) {
+      close();
+      return false;
+    }
+    generation = header().generation;
+    if (logFd >= 0 && !replayLog(error)) {
+      close();
+      return false;
+    }
+    if (exclusive && logEnd == 0 && !resetLog(generation, error)) {
+      close();
+      return false;
+    }
+    if (!exclusive && logFd >= 0) {//the shared lock is needed only while loading
+      ::close(logFd);
+      logFd = -1;
+    }
+    return true;
+  }
+
+  void close() {
+    unmapSnapshot();
+    if (logFd >= 0)
+      ::close(logFd); //releases the flock
+    logFd = -1;
+    logEnd = 0;
+    logRecords = 0;
+    logStats = IngestStats();
+    newNames.clear();
+    changed.clear();
+    ids.clear();
+  }
+
+  //A new store of numOfSeries series, seriesAt as of writeSnapshot(). A store already at path is replaced, its log becomes stale.
+  template <class SeriesAt>
+  bool create(const std::string& path_, int numOfSeries, SeriesAt seriesAt, std::string& error) {
+    close();
+    path = path_;
+    exclusive = true;
+    if (!lockLog(error))
+      return false;
+    std::string ignored;
+    uint64_t previous = mapSnapshot(ignored) ? header().generation : 0;
+    unmapSnapshot();
+    bool ok = writeSnapshot(path, previous + 1, numOfSeries, seriesAt, error) && resetLog(previous + 1, error);
+    close();
+    return ok && open(path, true, error);
+  }
+
+  //Applies the records and appends the accepted ones to the log as one batch. Needs open(..., true).
+  bool append(const std::vector<IngestRecord>& records, IngestStats& stats, std::string& error) {
+    if (!exclusive || logFd < 0) {
+      error = "the series store is not open for writing";
+      return false;
+    }
+    if (ftruncate(logFd, (off_t)logEnd) != 0) {//a torn batch, if any
+      error = "can't truncate the log of " + path;
+      return false;
+    }
+    std::vector<char> batch(sizeof(LogBatchHeader));
+    uint32_t numOfRecords = 0;
+    for (const auto& record : records) {
+      if (record.series.empty() || record.series.size() > 0xffff || !apply(record.series, record.index, record.value, stats))
+        continue;
+      uint16_t nameLength = (uint16_t)record.series.size();
+      size_t at = batch.size();
+      batch.resize(at + sizeof(record.index) + sizeof(record.value) + sizeof(nameLength) + nameLength);
+      memcpy(&batch[at], &record.index, sizeof(record.index));
+      memcpy(&batch[at + 4], &record.value, sizeof(record.value));
+      memcpy(&batch[at + 8], &nameLength, sizeof(nameLength));
+      memcpy(&batch[at + 10], record.series.data(), nameLength);
+      numOfRecords++;
+    }
+    if (numOfRecords == 0)
+      return true;
+    LogBatchHeader batchHeader;
+    batchHeader.magic = LOG_BATCH_MAGIC;
+    batchHeader.numOfRecords = numOfRecords;
+    batchHeader.payloadSize = batch.size() - sizeof(batchHeader);
+    batchHeader.checksum = batchChecksum(batchHeader, batch.data() + sizeof(batchHeader));
+    memcpy(batch.data(), &batchHeader, sizeof(batchHeader));
+    if (!writeAllAt(logFd, batch.data(), batch.size(), logEnd) || fsync(logFd) != 0) {
+      error = "can't append to the log of " + path;
+      return false;
+    }
+    logEnd += batch.size();
+    logRecords += numOfRecords;
+    return true;
+  }
+
+  //Folds the log into a new snapshot. Needs open(..., true).
+  bool compact(std::string& error) {
+    if (!exclusive || logFd < 0) {
+      error = "the series store is not open for writing";
+      return false;
+    }
+    if (changed.empty())
+      return resetLog(generation, error);
+    auto seriesAt = [&](int i, std::string& name_, const float*& values_, int& length_) {
+      name_ = name(i);
+      values_ = values(i);
+      length_ = length(i);
+    };
+    if (!writeSnapshot(path, generation + 1, numOfSeries(), seriesAt, error) || !resetLog(generation + 1, error))
+      return false;
+    close();
+    return open(path, true, error);
+  }
+
+  uint64_t numOfValues() const {
+    uint64_t sum = 0;
+    for (int i = 0; i < numOfSeries(); i++)
+      sum += length(i);
+    return sum;
+  }
+
+  //one record onto the view; false if rejected (a gap)
+  bool apply(const std::string& series, uint32_t index, float value, IngestStats& stats) {
+    if (ids.empty()) {
+      ids.reserve((size_t)numOfSeries() * 2);
+      for (int i = 0; i < numOfSeries(); i++)
+        ids[name(i)] = i;
+    }
+    auto id = ids.find(series);
+    if (id == ids.end()) {
+      if (index != 0) {
+        stats.rejected++;
+        return false;
+      }
+      int i = numOfSeries();
+      newNames.push_back(series);
+      ids[series] = i;
+      changed[i].push_back(value);
+      stats.newSeries++;
+      stats.appended++;
+      return true;
+    }
+    int i = id->second;
+    if (index > (uint32_t)length(i)) {
+      stats.rejected++;
+      return false;
+    }
+    auto iter = changed.find(i);
+    if (iter == changed.end())
+      iter = changed.emplace(i, std::vector<float>(values(i), values(i) + length(i))).first;
+    if (index == iter->second.size()) {
+      iter->second.push_back(value);
+      stats.appended++;
+    } else {
+      iter->second[index] = value;
+      stats.corrected++;
+    }
+    return true;
+  }
+
+  bool lockLog(std::string& error) {
+    std::string logPath = path + ".log";
+    logFd = ::open(logPath.c_str(), exclusive ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+    if (logFd < 0 && (exclusive || errno != ENOENT)) {
+      error = "can't open " + logPath;
+      return false;
+    }
+    if (logFd >= 0 && flock(logFd, exclusive ? LOCK_EX : LOCK_SH) != 0) {
+      error = "can't lock " + logPath;
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  bool mapSnapshot(std::string& error) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    struct stat fileStat;
+    if (fd < 0 || fstat(fd, &fileStat) != 0 || (size_t)fileStat.st_size < sizeof(SnapshotHeader)) {
+      error = "can't open the series store " + path + ", create it with esrnn_ingest init";
+      if (fd >= 0)
+        ::close(fd);
+      return false;
+    }
+    mappedSize = (size_t)fileStat.st_size;
+    void* mapped = mmap(NULL, mappedSize, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd); //the mapping keeps the file
+    if (mapped == MAP_FAILED) {
+      error = "can't map the series store " + path;
+      return false;
+    }
+    mem = (char*)mapped;
+    madvise(mem, mappedSize, MADV_SEQUENTIAL);
+    if (memcmp(header().magic, "ESRNNSS", 8) != 0 || header().version != INGEST_FORMAT_VERSION || header().fileSize != mappedSize) {
+      error = path + " is not a series store, or is incomplete";
+      unmapSnapshot();
+      return false;
+    }
+    return true;
+  }
+
+  void unmapSnapshot() {
+    if (mem != NULL)
+      munmap(mem, mappedSize);
+    mem = NULL;
+    mappedSize = 0;
+  }
+
+  //applies the complete batches of the log; logEnd 0 if the log is empty or stale
+  bool replayLog(std::string& error) {
+    struct stat fileStat;
+    if (fstat(logFd, &fileStat) != 0) {
+      error = "can't read the log of " + path;
+      return false;
+    }
+    std::vector<char> log((size_t)fileStat.st_size);
+    if (!log.empty() && pread(logFd, log.data(), log.size(), 0) != (ssize_t)log.size()) {
+      error = "can't read the log of " + path;
+      return false;
+    }
+    logEnd = 0;
+    LogHeader logHeader;
+    if (log.size() < sizeof(logHeader))
+      return true;
+    memcpy(&logHeader, log.data(), sizeof(logHeader));
+    if (memcmp(logHeader.magic, "ESRNNSL", 8) != 0 || logHeader.version != INGEST_FORMAT_VERSION) {
+      error = path + ".log is not a series store log";
+      return false;
+    }
+    if (logHeader.generation > generation) {
+      error = path + ".log is newer than its snapshot, was the snapshot replaced by an older one?";
+      return false;
+    }
+    if (logHeader.generation < generation) //already in the snapshot
+      return true;
+    size_t pos = sizeof(logHeader);
+    LogBatchHeader batchHeader;
+    while (pos + sizeof(batchHeader) <= log.size()) {
+      memcpy(&batchHeader, &log[pos], sizeof(batchHeader));
+      const char* payload = &log[pos + sizeof(batchHeader)];
+      if (batchHeader.magic != LOG_BATCH_MAGIC || batchHeader.payloadSize > log.size() - pos - sizeof(batchHeader)
+        || batchChecksum(batchHeader, payload) != batchHeader.checksum)
+        break; //torn by a crash
+      if (!batchRecordsFit(batchHeader, payload)) {
+        error = path + ".log: a batch at byte " + std::to_string(pos) + " has records past its end";
+        return false;
+      }
+      size_t at = 0;
+      for (uint32_t irec = 0; irec < batchHeader.numOfRecords; irec++) {
+        uint32_t index;
+        float value;
+        uint16_t nameLength;
+        memcpy(&index, payload + at, sizeof(index));
+        memcpy(&value, payload + at + 4, sizeof(value));
+        memcpy(&nameLength, payload + at + 8, sizeof(nameLength));
+        apply(std::string(payload + at + 10, nameLength), index, value, logStats);
+        at += 10 + nameLength;
+      }
+      pos += sizeof(batchHeader) + (size_t)batchHeader.payloadSize;
+      logRecords += batchHeader.numOfRecords;
+    }
+    logEnd = pos;
+    return true;
+  }
+
+  bool resetLog(uint64_t generation_, std::string& error) {
+    LogHeader logHeader;
+    memset(&logHeader, 0, sizeof(logHeader));
+    memcpy(logHeader.magic, "ESRNNSL", 8);
+    logHeader.version = INGEST_FORMAT_VERSION;
+    logHeader.generation = generation_;
+    if (ftruncate(logFd, 0) != 0 || !writeAllAt(logFd, &logHeader, sizeof(logHeader), 0) || fsync(logFd) != 0) {
+      error = "can't reset the log of " + path;
+      return false;
+    }
+    logEnd = sizeof(logHeader);
+    logRecords = 0;
+    return true;
+  }
+};
+
+#endif
@@ -0,0 +1,223 @@
+/**
+* file series_shards.h
+* sharded, memory-mapped storage of the series and of their per series parameters, for training on more series than fit in RAM
+* (STREAM_SHARD_SIZE of ES_RNN_E), Linux/Mac only. Does not need Dynet.
+* Shard k holds the series [k*shardSize, (k+1)*shardSize) of the run, in the file shardPath(prefix, k):
+  - header, an entry per series, the names, and the values of every series (the history, then the test values, as cut by M4TS)
+  - per net, per series: the per series parameters (ES) and their Adam moments m and v, paramsPerSeries floats each.
+    Zero when the file is written (sparse); the program initializes the parameters of a net on the first use of the shard in an ibig run, see paramsRun.
+* ShardWriter writes the files in one pass over the input, holding one shard in memory.
+* MappedShard maps a shard file read-write: the program copies the series and the parameters out of it, and updates the parameters and moments in place.
+  The shards are streamed through a Prefetcher<MappedShard> (prefetch.h): its helper thread writes the previous shard back (msync, munmap) and maps and reads in
+  the next one while the main thread trains on the current one, so at most two shards are in memory.
+*/
+
+#ifndef ESRNN_SERIES_SHARDS_H_
+#define ESRNN_SERIES_SHARDS_H_
+
+#if defined _WINDOWS
+  #error "the series shards use mmap, not available on Windows"
+#endif
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+const uint32_t SHARD_FORMAT_VERSION = 1;
+const int SHARD_MAX_NETS = 64;
+
+struct ShardHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t numOfSeries;
+  uint32_t numOfNets;
+  uint32_t paramsPerSeries;
+  uint64_t entriesOffset, namesOffset, valuesOffset, paramsOffset; //bytes from the start of the file
+  int32_t paramsRun[SHARD_MAX_NETS]; //ibig run the parameters of a net were initialized for, -1: not yet
+};
+
+struct ShardSeriesEntry {
+  uint64_t nameOffset; //in the names
+  uint64_t valuesOffset; //floats, in the values
+  uint32_t nameLength;
+  uint32_t category; //index of the one-hot
+  uint32_t n; //history
+  uint32_t numOfTestVals;
+};
+
+inline std::string shardPath(const std::string& prefix, int ishard) {
+  return prefix + "_shard" + std::to_string(ishard) + ".bin";
+}
+
+inline uint64_t alignedToPage(uint64_t offset) {
+  return (offset + 4095) / 4096 * 4096;
+}
+
+struct ShardWriter {
+  std::string prefix;
+  int shardSize = 0, numOfNets = 0, paramsPerSeries = 0;
+  int numOfShards = 0;
+  std::vector<ShardSeriesEntry> entries;
+  std::string names;
+  std::vector<float> values;
+
+  ShardWriter(const std::string& prefix_, int shardSize_, int numOfNets_, int paramsPerSeries_) :
+    prefix(prefix_), shardSize(shardSize_), numOfNets(numOfNets_), paramsPerSeries(paramsPerSeries_) {
+    if (numOfNets > SHARD_MAX_NETS)
+      throw std::runtime_error("the series shards take at most " + std::to_string(SHARD_MAX_NETS) + " nets");
+  }
+
+  void add(const std::string& series, int category, const std::vector<float>& vals, const std::vector<float>& testVals) {
+    ShardSeriesEntry entry;
+    entry.nameOffset = names.size();
+    entry.nameLength = (uint32_t)series.size();
+    entry.category = (uint32_t)category;
+    entry.valuesOffset = values.size();
+    entry.n = (uint32_t)vals.size();
+    entry.numOfTestVals = (uint32_t)testVals.size();
+    entries.push_back(entry);
+    names += series;
+    values.insert(values.end(), vals.begin(), vals.end());
+    values.insert(values.end(), testVals.begin(), testVals.end());
+    if ((int)entries.size() == shardSize)
+      flush();
+  }
+
+  //writes the last, partial, shard; returns the number of shards
+  int finish() {
+    if (!entries.empty())
+      flush();
+    return numOfShards;
+  }
+
+  void flush() {
+    ShardHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "ESRNNSH", 8);
+    header.version = SHARD_FORMAT_VERSION;
+    header.numOfSeries = (uint32_t)entries.size();
+    header.numOfNets = (uint32_t)numOfNets;
+    header.paramsPerSeries = (uint32_t)paramsPerSeries;
+    header.entriesOffset = sizeof(header);
+    header.namesOffset = header.entriesOffset + entries.size() * sizeof(ShardSeriesEntry);
+    header.valuesOffset = (header.namesOffset + names.size() + 7) / 8 * 8;
+    header.paramsOffset = alignedToPage(header.valuesOffset + values.size() * sizeof(float));
+    for (int inet = 0; inet < SHARD_MAX_NETS; inet++)
+      header.paramsRun[inet] = -1;
+    uint64_t fileSize = header.paramsOffset + (uint64_t)numOfNets * entries.size() * 3 * paramsPerSeries * sizeof(float);
+
+    std::string path = shardPath(prefix, numOfShards);
+    FILE* file = fopen(path.c_str(), "wb");
+    bool ok = file != NULL;
+    auto writeAt = [&](uint64_t offset, const void* data, size_t size) {
+      ok = ok && fseeko(file, (off_t)offset, SEEK_SET) == 0 && fwrite(data, 1, size, file) == size;
+    };
+    writeAt(0, &header, sizeof(header));
+    writeAt(header.entriesOffset, entries.data(), entries.size() * sizeof(ShardSeriesEntry));
+    writeAt(header.namesOffset, names.data(), names.size());
+    writeAt(header.valuesOffset, values.data(), values.size() * sizeof(float));
+    if (file != NULL)
+      ok = fclose(file) == 0 && ok;
+    ok = ok && truncate(path.c_str(), (off_t)fileSize) == 0; //the parameters: sparse zeros
+    if (!ok)
+      throw std::runtime_error("could not write the series shard " + path);
+    numOfShards++;
+    entries.clear();
+    names.clear();
+    values.clear();
+  }
+};
+
+struct MappedShard {
+  int index = -1;
+  int fd = -1;
+  char* mem = NULL;
+  size_t size = 0;
+
+  MappedShard() {}
+  MappedShard(const MappedShard&) = delete;
+  MappedShard& operator=(const MappedShard&) = delete;
+  MappedShard(MappedShard&& other) { *this = std::move(other); }
+  MappedShard& operator=(MappedShard&& other) {//Prefetcher swaps its buffers
+    if (this != &other) {
+      close();
+      std::swap(index, other.index);
+      std::swap(fd, other.fd);
+      std::swap(mem, other.mem);
+      std::swap(size, other.size);
+    }
+    return *this;
+  }
+  ~MappedShard() { close(); }
+
+  //write-back of the current shard, if any, then maps and reads in the new one. Throws on failure
+  void open(const std::string& path, int index_) {
+    close();
+    fd = ::open(path.c_str(), O_RDWR);
+    struct stat fileStat;
+    if (fd < 0 || fstat(fd, &fileStat) != 0)
+      throw std::runtime_error("could not open the series shard " + path);
+    size = (size_t)fileStat.st_size;
+    int flags = MAP_SHARED;
+#if defined MAP_POPULATE
+    flags |= MAP_POPULATE; //the read-ahead: the whole shard is read in here, on the prefetch thread
+#endif
+    void* mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, fd, 0);
+    if (mapped == MAP_FAILED) {
+      mem = NULL;
+      close();
+      throw std::runtime_error("could not map the series shard " + path);
+    }
+    mem = (char*)mapped;
+#if !defined MAP_POPULATE
+    madvise(mem, size, MADV_WILLNEED);
+#endif
+    if (memcmp(header().magic, "ESRNNSH", 8) != 0 || header().version != SHARD_FORMAT_VERSION) {
+      close();
+      throw std::runtime_error(path + " is not a series shard");
+    }
+    index = index_;
+  }
+
+  void close() {
+    if (mem != NULL) {
+      msync(mem, size, MS_SYNC);
+      munmap(mem, size);
+    }
+    if (fd >= 0)
+      ::close(fd);
+    mem = NULL;
+    fd = -1;
+    index = -1;
+  }
+
+  ShardHeader& header() const { return *(ShardHeader*)mem; }
+  int numOfSeries() const { return (int)header().numOfSeries; }
+  const ShardSeriesEntry& entry(int i) const {
+    return ((const ShardSeriesEntry*)(mem + header().entriesOffset))[i];
+  }
+  std::string name(int i) const {
+    return std::string(mem + header().namesOffset + entry(i).nameOffset, entry(i).nameLength);
+  }
+  const float* vals(int i) const {
+    return (const float*)(mem + header().valuesOffset) + entry(i).valuesOffset;
+  }
+  const float* testVals(int i) const {
+    return vals(i) + entry(i).n;
+  }
+  //the parameters of series i in net inet, then their Adam moments m and v
+  float* params(int inet, int i) const {
+    const ShardHeader& h = header();
+    return (float*)(mem + h.paramsOffset) + ((size_t)inet*h.numOfSeries + i) * 3 * h.paramsPerSeries;
+  }
+};
+
+#endif
@@ -0,0 +1,327 @@
+/**
+* file series_store.h
+* compressed in-memory column store of the series values, to hold far larger catalogs per node (COMPRESS_SERIES of ES_RNN_E). Does not need Dynet.
+* The history and the test values of a series are encoded in blocks of up to STORE_BLOCK_SIZE values, each decodable on its own, in the smaller of two modes:
+  - decimal (frame of reference): values that are exact decimals with at most STORE_MAX_DECIMALS digits after the point, as the M4 data read by atof,
+    are kept as the integers q=value*10^d: the first q, then the deltas of q, minus the smallest one, bit-packed to the width of the largest
+  - XOR (as Gorilla): the first value, then the XOR of every value with the previous one, as its meaningful bits between the leading and trailing zeros,
+    reusing the window of the previous XOR when they fit in it, a single bit if the value repeats
+  Lossless: a decimal block is used only if every value decodes to the same bits, so training on the decoded series is unchanged.
+* decode() expands a series into the caller's vectors, e.g. of a per thread scratch series reused across series, right before its graph is built.
+  Reading is thread safe, add() is not.
+* stats() compares the size with the vector<float>s it replaces; bench_kernels (BM_seriesStoreDecode) measures the ratio and decode throughput on
+  synthetic series, ES_RNN_E prints both for its data at load.
+* The bit streams are little endian, read 8 bytes at a time.
+*/
+
+#ifndef ESRNN_SERIES_STORE_H_
+#define ESRNN_SERIES_STORE_H_
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+const int STORE_BLOCK_SIZE = 128;
+const int STORE_MAX_DECIMALS = 6;
+const int64_t STORE_MAX_DECIMAL = int64_t(1) << 40; //largest |q|, so the deltas, bit-packed, stay under 57 bits
+const double STORE_POW10[STORE_MAX_DECIMALS + 1] = { 1, 10, 100, 1000, 10000, 100000, 1000000 };
+const int STORE_PADDING = 8; //after the last block, so the bit reader can always load 8 bytes
+
+enum StoreBlockMode { STORE_XOR = 0, STORE_DECIMAL = 1 }; //STORE_DECIMAL+d: d decimals
+
+struct StoredSeries {
+  uint64_t offset; //bytes, in SeriesStore::data
+  uint32_t n; //values of the history
+  uint32_t numOfTestVals;
+};
+
+struct SeriesStoreStats {
+  uint64_t numOfSeries = 0, numOfValues = 0;
+  uint64_t decimalBlocks = 0, xorBlocks = 0;
+  uint64_t rawBytes = 0; //as two vector<float> per series
+  uint64_t storedBytes = 0; //data and index
+  double ratio() const { return storedBytes > 0 ? (double)rawBytes / storedBytes : 0; }
+};
+
+struct StoreBitWriter {
+  std::vector<uint8_t>& out;
+  uint64_t acc = 0;
+  int numOfBits = 0;
+
+  StoreBitWriter(std::vector<uint8_t>& out_) : out(out_) {}
+
+  //numOfBits_ <= 57
+  void put(uint64_t value, int numOfBits_) {
+    if (numOfBits_ == 0)
+      return;
+    acc |= (value & (~0ull >> (64 - numOfBits_))) << numOfBits;
+    numOfBits += numOfBits_;
+    while (numOfBits >= 8) {
+      out.push_back((uint8_t)acc);
+      acc >>= 8;
+      numOfBits -= 8;
+    }
+  }
+  //to the byte boundary
+  void flush() {
+    if (numOfBits > 0)
+      out.push_back((uint8_t)acc);
+    acc = 0;
+    numOfBits = 0;
+  }
+};
+
+struct StoreBitReader {
+  const uint8_t* base;
+  uint64_t pos = 0; //bits
+
+  StoreBitReader(const uint8_t* base_) : base(base_) {}
+
+  //numOfBits <= 57
+  uint64_t get(int numOfBits) {
+    if (numOfBits == 0)
+      return 0;
+    uint64_t word;
+    memcpy(&word, base + (pos >> 3), sizeof(word));
+    uint64_t value = (word >> (pos & 7)) & (~0ull >> (64 - numOfBits));
+    pos += numOfBits;
+    return value;
+  }
+  const uint8_t* end() const { return base + (pos + 7) / 8; }
+};
+
+inline void putVarint(std::vector<uint8_t>& out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back((uint8_t)(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back((uint8_t)value);
+}
+
+inline uint64_t getVarint(const uint8_t*& p) {
+  uint64_t value = 0;
+  for (int shift = 0; ; shift += 7) {
+    uint8_t byte = *p++;
+    value |= (uint64_t)(byte & 0x7f) << shift;
+    if (byte < 0x80)
+      return value;
+  }
+}
+
+inline uint64_t zigzag(int64_t v) { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+inline int64_t unzigzag(uint64_t v) { return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
+
+inline uint32_t floatBits(float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+inline float bitsFloat(uint32_t bits) {
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+inline int bitWidth(uint64_t value) {
+  int width = 0;
+  while (value != 0) {
+    width++;
+    value >>= 1;
+  }
+  return width;
+}
+
+inline float decimalValue(int64_t q, int decimals) {
+  return (float)((double)q / STORE_POW10[decimals]);
+}
+
+//the fewest decimals that represent all the values exactly, -1 if none does
+inline int blockDecimals(const float* values, int count, std::vector<int64_t>& q) {
+  q.resize(count);
+  for (int decimals = 0; decimals <= STORE_MAX_DECIMALS; decimals++) {
+    bool fits = true;
+    for (int i = 0; i < count && fits; i++) {
+      double scaled = (double)values[i] * STORE_POW10[decimals];
+      fits = std::fabs(scaled) < (double)STORE_MAX_DECIMAL;
+      if (fits) {
+        q[i] = (int64_t)std::llround(scaled);
+        fits = floatBits(decimalValue(q[i], decimals)) == floatBits(values[i]);
+      }
+    }
+    if (fits)
+      return decimals;
+  }
+  return -1;
+}
+
+//mode, count, first q, smallest delta, width, then the packed deltas
+inline void encodeDecimalBlock(const std::vector<int64_t>& q, int decimals, std::vector<uint8_t>& out) {
+  int count = (int)q.size();
+  out.push_back((uint8_t)(STORE_DECIMAL + decimals));
+  out.push_back((uint8_t)count);
+  putVarint(out, zigzag(q[0]));
+  int64_t minDelta = 0, maxDelta = 0;
+  for (int i = 1; i < count; i++) {
+    int64_t delta = q[i] - q[i - 1];
+    if (i == 1 || delta < minDelta)
+      minDelta = delta;
+    if (i == 1 || delta > maxDelta)
+      maxDelta = delta;
+  }
+  putVarint(out, zigzag(minDelta));
+  int width = bitWidth((uint64_t)(maxDelta - minDelta));
+  out.push_back((uint8_t)width);
+  StoreBitWriter writer(out);
+  for (int i = 1; i < count; i++)
+    writer.put((uint64_t)(q[i] - q[i - 1] - minDelta), width);
+  writer.flush();
+}
+
+//mode, count, then the bit stream: the first value, per next value 0 (repeats), or 1 and 0 (XOR within the previous window) and its bits,
+//or 1 and 1, the leading zeros (5 bits), the meaningful length - 1 (5 bits) and the bits
+inline void encodeXorBlock(const float* values, int count, std::vector<uint8_t>& out) {
+  out.push_back((uint8_t)STORE_XOR);
+  out.push_back((uint8_t)count);
+  StoreBitWriter writer(out);
+  uint32_t prev = floatBits(values[0]);
+  writer.put(prev, 32);
+  int leading = -1, trailing = 0;
+  for (int i = 1; i < count; i++) {
+    uint32_t bits = floatBits(values[i]);
+    uint32_t x = bits ^ prev;
+    prev = bits;
+    if (x == 0) {
+      writer.put(0, 1);
+      continue;
+    }
+    int lead = 0, trail = 0;
+    while (!(x & (0x80000000u >> lead)))
+      lead++;
+    while (!(x & (1u << trail)))
+      trail++;
+    if (leading >= 0 && lead >= leading && trail >= trailing) {
+      writer.put(1, 1);
+      writer.put(0, 1);
+      writer.put(x >> trailing, 32 - leading - trailing);
+    } else {
+      int length = 32 - lead - trail;
+      writer.put(1, 1);
+      writer.put(1, 1);
+      writer.put((uint64_t)lead, 5);
+      writer.put((uint64_t)(length - 1), 5);
+      writer.put(x >> trail, length);
+      leading = lead;
+      trailing = trail;
+    }
+  }
+  writer.flush();
+}
+
+//decodes one block into out, returns the pointer past it
+inline const uint8_t* decodeBlock(const uint8_t* p, float* out) {
+  int mode = p[0];
+  int count = p[1];
+  p += 2;
+  if (mode >= STORE_DECIMAL) {
+    int decimals = mode - STORE_DECIMAL;
+    int64_t q = unzigzag(getVarint(p));
+    int64_t minDelta = unzigzag(getVarint(p));
+    int width = *p++;
+    out[0] = decimalValue(q, decimals);
+    StoreBitReader reader(p);
+    for (int i = 1; i < count; i++) {
+      q += (int64_t)reader.get(width) + minDelta;
+      out[i] = decimalValue(q, decimals);
+    }
+    return reader.end();
+  }
+  StoreBitReader reader(p);
+  uint32_t prev = (uint32_t)reader.get(32);
+  out[0] = bitsFloat(prev);
+  int leading = 0, trailing = 0;
+  for (int i = 1; i < count; i++) {
+    if (reader.get(1)) {
+      if (reader.get(1)) {
+        leading = (int)reader.get(5);
+        trailing = 32 - leading - ((int)reader.get(5) + 1);
+      }
+      prev ^= (uint32_t)reader.get(32 - leading - trailing) << trailing;
+    }
+    out[i] = bitsFloat(prev);
+  }
+  return reader.end();
+}
+
+struct SeriesStore {
+  std::vector<uint8_t> data;
+  std::vector<StoredSeries> series;
+  SeriesStoreStats counts;
+  std::vector<int64_t> q; //scratch of add()
+  std::vector<uint8_t> decimalBlock, xorBlock;
+
+  //returns the index of the series
+  int add(const std::vector<float>& vals, const std::vector<float>& testVals) {
+    if (!data.empty())
+      data.resize(data.size() - STORE_PADDING);
+    StoredSeries stored;
+    stored.offset = data.size();
+    stored.n = (uint32_t)vals.size();
+    stored.numOfTestVals = (uint32_t)testVals.size();
+    encode(vals.data(), (int)vals.size());
+    encode(testVals.data(), (int)testVals.size());
+    data.insert(data.end(), STORE_PADDING, 0);
+    series.push_back(stored);
+    counts.numOfSeries++;
+    counts.numOfValues += vals.size() + testVals.size();
+    counts.rawBytes += 2 * sizeof(std::vector<float>) + (vals.capacity() + testVals.capacity()) * sizeof(float);
+    return (int)series.size() - 1;
+  }
+
+  void encode(const float* values, int numOfValues) {
+    for (int first = 0; first < numOfValues; first += STORE_BLOCK_SIZE) {
+      int count = std::min(STORE_BLOCK_SIZE, numOfValues - first);
+      xorBlock.clear();
+      encodeXorBlock(values + first, count, xorBlock);
+      int decimals = blockDecimals(values + first, count, q);
+      decimalBlock.clear();
+      if (decimals >= 0)
+        encodeDecimalBlock(q, decimals, decimalBlock);
+      bool decimal = decimals >= 0 && decimalBlock.size() < xorBlock.size();
+      const std::vector<uint8_t>& block = decimal ? decimalBlock : xorBlock;
+      data.insert(data.end(), block.begin(), block.end());
+      (decimal ? counts.decimalBlocks : counts.xorBlocks)++;
+    }
+  }
+
+  //the values of series i into vals and testVals, whose capacity is reused
+  void decode(int i, std::vector<float>& vals, std::vector<float>& testVals) const {
+    const StoredSeries& stored = series[i];
+    vals.resize(stored.n);
+    testVals.resize(stored.numOfTestVals);
+    const uint8_t* p = data.data() + stored.offset;
+    for (uint32_t first = 0; first < stored.n; first += STORE_BLOCK_SIZE)
+      p = decodeBlock(p, vals.data() + first);
+    for (uint32_t first = 0; first < stored.numOfTestVals; first += STORE_BLOCK_SIZE)
+      p = decodeBlock(p, testVals.data() + first);
+  }
+
+  //after the last add()
+  void shrink() {
+    data.shrink_to_fit();
+    series.shrink_to_fit();
+    std::vector<int64_t>().swap(q);
+    std::vector<uint8_t>().swap(decimalBlock);
+    std::vector<uint8_t>().swap(xorBlock);
+  }
+
+  SeriesStoreStats stats() const {
+    SeriesStoreStats ret = counts;
+    ret.storedBytes = data.capacity() + series.capacity() * sizeof(StoredSeries);
+    return ret;
+  }
+};
+
+#endif
@@ -0,0 +1,200 @@
+/**
+* file serving.h
+* forecast serving over a Unix domain socket (ES_RNN_E --serve) and its load generator (esrnn_loadgen.cc), Linux/Mac only. Does not need Dynet.
+* Protocol: text lines, one request and one reply per line:
+  - forecast <series>                 -> ok <series> <forecast values...>
+  - update <series> <new values...>   -> ok <series> <forecast values...>, after the new points
+  - shutdown                          -> ok, the server saves its state and exits
+  - any failure                       -> error <reason>
+* Every connection has a reader thread that only parses the requests into the RequestQueue. The serving thread (the only one using Dynet) takes
+  micro-batches out of it - all requests that arrived within a window after the first one, up to a maximum - and writes the replies.
+  The requests of a series are answered in the order they arrived: a forecast reflects the updates of the series queued before it, and no later ones.
+*/
+
+#ifndef ESRNN_SERVING_H_
+#define ESRNN_SERVING_H_
+
+#if defined _WINDOWS
+  #error "serving uses Unix domain sockets, not available on Windows"
+#endif
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <sstream>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "trace.h"
+
+//the fd is closed by the reader thread, and written only while open, so a late reply can't reach a new connection reusing the fd
+struct ServeConnection {
+  int fd;
+  bool open = true;
+  std::mutex mutex;
+  explicit ServeConnection(int fd_) : fd(fd_) {}
+};
+
+inline bool writeAll(int fd, const std::string& data) {
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t n = write(fd, data.data() + written, data.size() - written);
+    if (n <= 0)
+      return false;
+    written += (size_t)n;
+  }
+  return true;
+}
+
+inline void sendLine(ServeConnection& connection, const std::string& line) {
+  std::lock_guard<std::mutex> lock(connection.mutex);
+  if (connection.open)
+    writeAll(connection.fd, line + "\n");
+}
+
+//reads up to '\n' (not included) through buffer; false at the end of the stream
+inline bool readLine(int fd, std::string& buffer, std::string& line) {
+  while (true) {
+    size_t eol = buffer.find('\n');
+    if (eol != std::string::npos) {
+      line = buffer.substr(0, eol);
+      buffer.erase(0, eol + 1);
+      return true;
+    }
+    char chunk[4096];
+    ssize_t n = read(fd, chunk, sizeof(chunk));
+    if (n <= 0)
+      return false;
+    buffer.append(chunk, (size_t)n);
+  }
+}
+
+struct ServeRequest {
+  enum Kind { FORECAST, UPDATE, SHUTDOWN, INVALID };
+  Kind kind = INVALID;
+  std::string series;
+  std::vector<float> values; //update
+  double arrivalSecs = 0;
+  std::shared_ptr<ServeConnection> connection;
+};
+
+inline ServeRequest parseServeRequest(const std::string& line) {
+  ServeRequest request;
+  std::istringstream line_stream(line);
+  std::string command;
+  line_stream >> command;
+  if (command == "shutdown")
+    request.kind = ServeRequest::SHUTDOWN;
+  else if ((command == "forecast" || command == "update") && line_stream >> request.series) {
+    request.kind = command == "forecast" ? ServeRequest::FORECAST : ServeRequest::UPDATE;
+    float value;
+    while (line_stream >> value)
+      request.values.push_back(value);
+    if (request.kind == ServeRequest::UPDATE && request.values.empty())
+      request.kind = ServeRequest::INVALID;
+  }
+  return request;
+}
+
+struct RequestQueue {
+  std::deque<ServeRequest> requests;
+  std::mutex mutex;
+  std::condition_variable cv;
+
+  void push(ServeRequest&& request) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      requests.push_back(std::move(request));
+    }
+    cv.notify_one();
+  }
+
+  //Waits for a request, then for more until maxBatch requests or windowSecs after the arrival of the first one, whichever comes first
+  std::vector<ServeRequest> nextBatch(size_t maxBatch, double windowSecs) {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this] { return !requests.empty(); });
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(std::max(0.0, requests.front().arrivalSecs + windowSecs - nowSecs()));
+    cv.wait_until(lock, deadline, [this, maxBatch] { return requests.size() >= maxBatch; });
+    size_t size = std::min(maxBatch, requests.size());
+    std::vector<ServeRequest> batch(std::make_move_iterator(requests.begin()), std::make_move_iterator(requests.begin() + size));
+    requests.erase(requests.begin(), requests.begin() + size);
+    return batch;
+  }
+};
+
+struct UnixSocketServer {
+  std::string path;
+  int listenFd = -1;
+
+  //binds path (replacing a stale socket file) and starts accepting connections in the background
+  void start(const std::string& path_, RequestQueue& queue) {
+    path = path_;
+    signal(SIGPIPE, SIG_IGN); //a client gone before its reply
+    listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (listenFd < 0 || path.size() >= sizeof(address.sun_path))
+      throw std::runtime_error("can't create the socket " + path);
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    unlink(path.c_str());
+    if (bind(listenFd, (sockaddr*)&address, sizeof(address)) != 0 || listen(listenFd, 128) != 0)
+      throw std::runtime_error("can't listen on " + path);
+    int fd = listenFd;
+    std::thread([fd, &queue] {
+      while (true) {
+        int connectionFd = accept(fd, NULL, NULL);
+        if (connectionFd < 0)
+          return; //closed by stop()
+        auto connection = std::make_shared<ServeConnection>(connectionFd);
+        std::thread([connection, &queue] {
+          std::string buffer, line;
+          while (readLine(connection->fd, buffer, line)) {
+            ServeRequest request = parseServeRequest(line);
+            request.arrivalSecs = nowSecs();
+            request.connection = connection;
+            queue.push(std::move(request));
+          }
+          std::lock_guard<std::mutex> lock(connection->mutex);
+          connection->open = false;
+          close(connection->fd);
+        }).detach();
+      }
+    }).detach();
+  }
+
+  void stop() {
+    if (listenFd >= 0) {
+      shutdown(listenFd, SHUT_RDWR);
+      close(listenFd);
+      unlink(path.c_str());
+      listenFd = -1;
+    }
+  }
+};
+
+//client side, -1 on failure
+inline int connectUnixSocket(const std::string& path) {
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+  if (fd < 0 || connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+    if (fd >= 0)
+      close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+#endif
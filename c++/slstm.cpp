@@ -88,6 +88,7 @@ namespace dynet {
   void ResidualDilatedLSTMBuilder::start_new_sequence_impl(const vector<Expression>& hinit) {
     h.clear();
     c.clear();
+    carried_steps = 0;
 
     if (hinit.size() > 0) {
       DYNET_ARG_CHECK(layers * 2 == hinit.size(),
@@ -170,7 +171,16 @@ namespace dynet {
     return h[t].back();
   }
 
+  void ResidualDilatedLSTMBuilder::continue_sequence(const vector<vector<Expression>>& h_hist, const vector<vector<Expression>>& c_hist) {
+    DYNET_ARG_CHECK(h.empty() && h_hist.size() == c_hist.size(),
+      "ResidualDilatedLSTMBuilder::continue_sequence must be called right after start_new_sequence, with as many h as c states");
+    h = h_hist;
+    c = c_hist;
+    carried_steps = unsigned(h.size());
+  }
+
   Expression ResidualDilatedLSTMBuilder::add_input_impl(int prev, const Expression& x) {
+    prev += int(carried_steps); //index into h and c
     h.push_back(vector<Expression>(layers));
     c.push_back(vector<Expression>(layers));
     vector<Expression>& ht = h.back();
@@ -352,6 +362,7 @@ namespace dynet {
   void AttentiveDilatedLSTMBuilder::start_new_sequence_impl(const vector<Expression>& hinit) {
     h.clear();
     c.clear();
+    carried_steps = 0;
     
     if (hinit.size() > 0) {
       DYNET_ARG_CHECK(layers * 2 == hinit.size(),
@@ -434,7 +445,16 @@ namespace dynet {
     return h[t].back();
   }
   
+  void AttentiveDilatedLSTMBuilder::continue_sequence(const vector<vector<Expression>>& h_hist, const vector<vector<Expression>>& c_hist) {
+    DYNET_ARG_CHECK(h.empty() && h_hist.size() == c_hist.size(),
+      "AttentiveDilatedLSTMBuilder::continue_sequence must be called right after start_new_sequence, with as many h as c states");
+    h = h_hist;
+    c = c_hist;
+    carried_steps = unsigned(h.size());
+  }
+
   Expression AttentiveDilatedLSTMBuilder::add_input_impl(int prev, const Expression& x) {
+    prev += int(carried_steps); //index into h and c
     h.push_back(vector<Expression>(layers));
     c.push_back(vector<Expression>(layers));
     vector<Expression>& ht = h.back();
@@ -573,6 +593,7 @@ namespace dynet {
   void DilatedLSTMBuilder::start_new_sequence_impl(const vector<Expression>& hinit) {
     h.clear();
     c.clear();
+    carried_steps = 0;
 
     if (hinit.size() > 0) {
       DYNET_ARG_CHECK(layers * 2 == hinit.size(),
@@ -654,7 +675,16 @@ namespace dynet {
     return h[t].back();
   }
 
+  void DilatedLSTMBuilder::continue_sequence(const vector<vector<Expression>>& h_hist, const vector<vector<Expression>>& c_hist) {
+    DYNET_ARG_CHECK(h.empty() && h_hist.size() == c_hist.size(),
+      "DilatedLSTMBuilder::continue_sequence must be called right after start_new_sequence, with as many h as c states");
+    h = h_hist;
+    c = c_hist;
+    carried_steps = unsigned(h.size());
+  }
+
   Expression DilatedLSTMBuilder::add_input_impl(int prev, const Expression& x) {
+    prev += int(carried_steps); //index into h and c
     h.push_back(vector<Expression>(layers));
     c.push_back(vector<Expression>(layers));
     vector<Expression>& ht = h.back();
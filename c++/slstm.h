@@ -42,7 +42,7 @@ namespace dynet {
       bool ln_lstm = false,
       float forget_bias = 1.f);
 
-    Expression back() const override { return (cur == -1 ? h0.back() : h[cur].back()); }
+    Expression back() const override { return (cur == -1 && carried_steps == 0 ? h0.back() : h[cur + carried_steps].back()); }
     std::vector<Expression> final_h() const override { return (h.size() == 0 ? h0 : h.back()); }
     std::vector<Expression> final_s() const override {
       std::vector<Expression> ret = (c.size() == 0 ? c0 : c.back());
@@ -51,9 +51,9 @@ namespace dynet {
     }
     unsigned num_h0_components() const override { return 2 * layers; }
 
-    std::vector<Expression> get_h(RNNPointer i) const override { return (i == -1 ? h0 : h[i]); }
+    std::vector<Expression> get_h(RNNPointer i) const override { return (i == -1 && carried_steps == 0 ? h0 : h[i + carried_steps]); }
     std::vector<Expression> get_s(RNNPointer i) const override {
-      std::vector<Expression> ret = (i == -1 ? c0 : c[i]);
+      std::vector<Expression> ret = (i == -1 && carried_steps == 0 ? c0 : c[i + carried_steps]);
       for (auto my_h : get_h(i)) ret.push_back(my_h);
       return ret;
     }
@@ -103,6 +103,14 @@ namespace dynet {
     */
     void set_dropout_masks(unsigned batch_size = 1);
     /**
+    * \brief Continue the sequence of the previous segment of a series (truncated BPTT)
+    * \details Call after start_new_sequence(). The states become the time steps before the first add_input(),
+    * so the dilated connections (and the attention) reach into the previous segment. Pass constants, e.g. input(), so no gradient flows back into it.
+    * \param h_hist Hidden states of the last time steps of the previous segment, first index is time, second is layer
+    * \param c_hist Cell states, same layout
+    */
+    void continue_sequence(const std::vector<std::vector<Expression>>& h_hist, const std::vector<std::vector<Expression>>& c_hist);
+    /**
     * \brief Get parameters in ResidualDilatedLSTMBuilder
     * \return list of points to ParameterStorage objects
     */
@@ -137,6 +145,7 @@ namespace dynet {
     bool has_initial_state; // if this is false, treat h0 and c0 as 0
     std::vector<Expression> h0;
     std::vector<Expression> c0;
+    unsigned carried_steps = 0; // the first time steps of h and c come from the previous segment, see continue_sequence()
     unsigned layers;
     unsigned input_dim, hid;
     float dropout_rate_h;
@@ -169,7 +178,7 @@ namespace dynet {
       unsigned hidden_dim,
       ParameterCollection& model);
 
-    Expression back() const override { return (cur == -1 ? h0.back() : h[cur].back()); }
+    Expression back() const override { return (cur == -1 && carried_steps == 0 ? h0.back() : h[cur + carried_steps].back()); }
     std::vector<Expression> final_h() const override { return (h.size() == 0 ? h0 : h.back()); }
     std::vector<Expression> final_s() const override {
       std::vector<Expression> ret = (c.size() == 0 ? c0 : c.back());
@@ -178,9 +187,9 @@ namespace dynet {
     }
     unsigned num_h0_components() const override { return 2 * layers; }
 
-    std::vector<Expression> get_h(RNNPointer i) const override { return (i == -1 ? h0 : h[i]); }
+    std::vector<Expression> get_h(RNNPointer i) const override { return (i == -1 && carried_steps == 0 ? h0 : h[i + carried_steps]); }
     std::vector<Expression> get_s(RNNPointer i) const override {
-      std::vector<Expression> ret = (i == -1 ? c0 : c[i]);
+      std::vector<Expression> ret = (i == -1 && carried_steps == 0 ? c0 : c[i + carried_steps]);
       for (auto my_h : get_h(i)) ret.push_back(my_h);
       return ret;
     }
@@ -228,6 +237,14 @@ namespace dynet {
     * \param batch_size Batch size
     */
     void set_dropout_masks(unsigned batch_size = 1);
+    /**
+    * \brief Continue the sequence of the previous segment of a series (truncated BPTT)
+    * \details Call after start_new_sequence(). The states become the time steps before the first add_input(),
+    * so the dilated connections (and the attention) reach into the previous segment. Pass constants, e.g. input(), so no gradient flows back into it.
+    * \param h_hist Hidden states of the last time steps of the previous segment, first index is time, second is layer
+    * \param c_hist Cell states, same layout
+    */
+    void continue_sequence(const std::vector<std::vector<Expression>>& h_hist, const std::vector<std::vector<Expression>>& c_hist);
 
     void set_weightnoise(float std);
     ParameterCollection & get_parameter_collection() override;
@@ -257,6 +274,7 @@ namespace dynet {
     bool has_initial_state; // if this is false, treat h0 and c0 as 0
     std::vector<Expression> h0;
     std::vector<Expression> c0;
+    unsigned carried_steps = 0; // the first time steps of h and c come from the previous segment, see continue_sequence()
     unsigned layers;
     unsigned input_dim, hid;
     float dropout_rate_h;
@@ -289,7 +307,7 @@ namespace dynet {
                                 unsigned attention_dim,
                                 ParameterCollection& model);
     
-    Expression back() const override { return (cur == -1 ? h0.back() : h[cur].back()); }
+    Expression back() const override { return (cur == -1 && carried_steps == 0 ? h0.back() : h[cur + carried_steps].back()); }
     std::vector<Expression> final_h() const override { return (h.size() == 0 ? h0 : h.back()); }
     std::vector<Expression> final_s() const override {
       std::vector<Expression> ret = (c.size() == 0 ? c0 : c.back());
@@ -298,9 +316,9 @@ namespace dynet {
     }
     unsigned num_h0_components() const override { return 2 * layers; }
     
-    std::vector<Expression> get_h(RNNPointer i) const override { return (i == -1 ? h0 : h[i]); }
+    std::vector<Expression> get_h(RNNPointer i) const override { return (i == -1 && carried_steps == 0 ? h0 : h[i + carried_steps]); }
     std::vector<Expression> get_s(RNNPointer i) const override {
-      std::vector<Expression> ret = (i == -1 ? c0 : c[i]);
+      std::vector<Expression> ret = (i == -1 && carried_steps == 0 ? c0 : c[i + carried_steps]);
       for (auto my_h : get_h(i)) ret.push_back(my_h);
       return ret;
     }
@@ -348,6 +366,14 @@ namespace dynet {
      * \param batch_size Batch size
      */
     void set_dropout_masks(unsigned batch_size = 1);
+    /**
+    * \brief Continue the sequence of the previous segment of a series (truncated BPTT)
+    * \details Call after start_new_sequence(). The states become the time steps before the first add_input(),
+    * so the dilated connections (and the attention) reach into the previous segment. Pass constants, e.g. input(), so no gradient flows back into it.
+    * \param h_hist Hidden states of the last time steps of the previous segment, first index is time, second is layer
+    * \param c_hist Cell states, same layout
+    */
+    void continue_sequence(const std::vector<std::vector<Expression>>& h_hist, const std::vector<std::vector<Expression>>& c_hist);
 
     void set_weightnoise(float std);
     ParameterCollection & get_parameter_collection() override;
@@ -377,6 +403,7 @@ namespace dynet {
     bool has_initial_state; // if this is false, treat h0 and c0 as 0
     std::vector<Expression> h0;
     std::vector<Expression> c0;
+    unsigned carried_steps = 0; // the first time steps of h and c come from the previous segment, see continue_sequence()
     unsigned layers;
     unsigned input_dim, hid;
     unsigned attention_dim;
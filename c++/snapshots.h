@@ -0,0 +1,83 @@
+/**
+* file snapshots.h
+* queue of parameter snapshots from one process to another (OVERLAP_TEST of ES_RNN), Linux/Mac only, CPU only.
+* The trainer pushes, before it trains a series, the values of the parameters the series uses. The forecasting process pops them into its own copy of the model,
+* replays the forward pass of the series and makes the forecast, while the trainer already works on the next series.
+* Single producer, single consumer; a ring of capacity snapshots in shared memory, so a slow consumer blocks the producer only when the ring is full.
+*/
+
+#ifndef ESRNN_SNAPSHOTS_H_
+#define ESRNN_SNAPSHOTS_H_
+
+#include <atomic>
+#include <new>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sched.h>
+#include "dynet/dynet.h"
+#include "dynet/model.h"
+#include "workers.h"
+
+inline size_t snapshotFloats(const std::vector<dynet::ParameterStorage*>& storages) {
+  size_t size = 0;
+  for (auto storage : storages)
+    size += storage->values.d.size();
+  return size;
+}
+
+struct ParameterSnapshotQueue {
+  int capacity;
+  size_t snapshotSize;
+  SharedArray<float> values; //[capacity][snapshotSize]
+  SharedArray<int> items; //[capacity]
+  SharedArray<std::atomic<long>> counters; //pushed, popped
+
+  ParameterSnapshotQueue(int capacity_, size_t snapshotSize_) :
+    capacity(capacity_), snapshotSize(snapshotSize_), values(capacity_*snapshotSize_), items(capacity_), counters(2) {
+    reset();
+  }
+
+  //before the fork
+  void reset() {
+    new (&counters[0]) std::atomic<long>(0);
+    new (&counters[1]) std::atomic<long>(0);
+  }
+
+  //Waits while the ring is full. consumer is the pid of the consuming process, to give up if it died.
+  void push(int item, const std::vector<dynet::ParameterStorage*>& storages, pid_t consumer) {
+    long pushed = counters[0].load();
+    while (pushed - counters[1].load() >= capacity) {
+      int status;
+      if (waitpid(consumer, &status, WNOHANG) == consumer)
+        throw std::runtime_error("the process consuming the parameter snapshots died");
+      sched_yield();
+    }
+    float* slot = &values[(pushed % capacity)*snapshotSize];
+    for (auto storage : storages) {
+      std::copy(storage->values.v, storage->values.v + storage->values.d.size(), slot);
+      slot += storage->values.d.size();
+    }
+    items[pushed % capacity] = item;
+    counters[0].store(pushed + 1); //publishes the slot
+  }
+
+  //Waits for the next snapshot, copies it into storages, and checks that it is the snapshot of the expected item
+  void pop(int item, const std::vector<dynet::ParameterStorage*>& storages) {
+    long popped = counters[1].load();
+    while (counters[0].load() == popped)
+      sched_yield();
+    if (items[popped % capacity] != item)
+      throw std::runtime_error("parameter snapshots out of order");
+    const float* slot = &values[(popped % capacity)*snapshotSize];
+    for (auto storage : storages) {
+      std::copy(slot, slot + storage->values.d.size(), storage->values.v);
+      slot += storage->values.d.size();
+    }
+    counters[1].store(popped + 1); //frees the slot
+  }
+};
+
+#endif
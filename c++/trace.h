@@ -0,0 +1,141 @@
+/**
+* file trace.h
+* optional timeline of the ES-RNN programs, in Chrome trace-event JSON format, viewable in Perfetto (ui.perfetto.dev) or chrome://tracing
+  - nowSecs() - the steady clock used here and in metrics.h
+  - traceStart(path) switches the tracing on, traceFinish() writes the file. Without traceStart() recording costs one predictable branch.
+  - traceSpan(name, startSecs, endSecs, series, seriesLen, net) records a complete span, times are nowSecs() values
+  - TraceSpan - records the lifetime of a scope
+* Every thread appends to its own buffer, without locks; a lock is taken only once per thread, to register the buffer.
+* traceFinish() has to be called when no thread is recording anymore.
+*/
+
+#ifndef ESRNN_TRACE_H_
+#define ESRNN_TRACE_H_
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <fstream>
+#include <iostream>
+
+//seconds since an arbitrary, fixed point. Steady, so differences are wall-clock durations, also when many threads are running.
+inline double nowSecs() {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct TraceEvent {
+  const char* name; //has to be a literal, or otherwise outlive the tracer
+  double startSecs;
+  double durSecs;
+  std::string series;
+  int seriesLen;
+  int net;
+};
+
+struct TraceBuffer {
+  int tid;
+  std::vector<TraceEvent> events;
+};
+
+struct Tracer {
+  bool enabled = false;
+  std::string path;
+  double originSecs = 0;
+  std::mutex registryMutex;
+  std::vector<std::unique_ptr<TraceBuffer>> buffers;
+
+  static Tracer& instance() {
+    static Tracer tracer;
+    return tracer;
+  }
+
+  TraceBuffer* threadBuffer() {
+    static thread_local TraceBuffer* buffer = nullptr;
+    if (buffer == nullptr) {
+      std::lock_guard<std::mutex> lock(registryMutex);
+      buffers.emplace_back(new TraceBuffer());
+      buffer = buffers.back().get();
+      buffer->tid = (int)buffers.size();
+      buffer->events.reserve(1 << 16);
+    }
+    return buffer;
+  }
+};
+
+inline bool traceEnabled() {
+  return Tracer::instance().enabled;
+}
+
+inline void traceStart(const std::string& path) {
+  Tracer& tracer = Tracer::instance();
+  tracer.path = path;
+  tracer.originSecs = nowSecs();
+  tracer.enabled = true;
+  std::cout << "tracing into " << path << std::endl;
+}
+
+//series="", seriesLen<0, net<0 mean: not applicable
+inline void traceSpan(const char* name, double startSecs, double endSecs, const std::string& series = std::string(), int seriesLen = -1, int net = -1) {
+  Tracer& tracer = Tracer::instance();
+  if (!tracer.enabled)
+    return;
+  TraceEvent event = { name, startSecs, endSecs - startSecs, series, seriesLen, net };
+  tracer.threadBuffer()->events.push_back(event);
+}
+
+struct TraceSpan {
+  const char* name;
+  int net;
+  double startSecs;
+
+  TraceSpan(const char* name_, int net_ = -1) : name(name_), net(net_), startSecs(0) {
+    if (traceEnabled())
+      startSecs = nowSecs();
+  }
+  ~TraceSpan() {
+    if (traceEnabled())
+      traceSpan(name, startSecs, nowSecs(), std::string(), -1, net);
+  }
+};
+
+//writes all buffers as complete ("X") events, timestamps in microseconds since traceStart()
+inline void traceFinish() {
+  Tracer& tracer = Tracer::instance();
+  if (!tracer.enabled)
+    return;
+  tracer.enabled = false;
+  std::ofstream file(tracer.path);
+  file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  bool first = true;
+  for (auto& buffer : tracer.buffers) {
+    if (!first)
+      file << ",";
+    first = false;
+    file << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid
+      << ",\"args\":{\"name\":\"" << "thread " << buffer->tid << "\"}}";
+    for (auto& event : buffer->events) {
+      file << ",\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->tid
+        << ",\"ts\":" << (long long)((event.startSecs - tracer.originSecs) * 1e6)
+        << ",\"dur\":" << (long long)(event.durSecs * 1e6);
+      if (!event.series.empty() || event.net >= 0) {
+        file << ",\"args\":{";
+        const char* sep = "";
+        if (!event.series.empty()) {
+          file << "\"series\":\"" << event.series << "\",\"len\":" << event.seriesLen;
+          sep = ",";
+        }
+        if (event.net >= 0)
+          file << sep << "\"net\":" << event.net;
+        file << "}";
+      }
+      file << "}";
+    }
+    buffer->events.clear();
+  }
+  file << "\n]}" << std::endl;
+  std::cout << "trace written to " << tracer.path << std::endl;
+}
+
+#endif
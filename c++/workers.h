@@ -0,0 +1,157 @@
+/**
+* file workers.h
+* worker processes for the parallel training modes of ES_RNN (HOGWILD and DATA_PARALLEL), Linux/Mac only.
+* Dynet allows one computation graph per process, and its memory pools are global, so the workers are processes, forked at the start of every epoch, not threads.
+* With dynetParams.shared_parameters the parameter memory (values, gradients and the trainer moments) is one shared mapping, so all workers see the same weights.
+* The gradients must not be shared: the workers move them to private memory right before the first fork (PrivateGradients and GradientAllReduce in allreduce.h).
+* Everything else a worker produces (losses, forecasts, metrics) is passed back to the parent through the shared arrays below.
+  - SharedArray - fixed size array in an anonymous shared mapping, created before the fork
+  - ForkedWorkers - forks the workers, hands out work items from a shared counter, and joins the workers' results
+  - SpinBarrier - barrier of the worker processes
+*/
+
+#ifndef ESRNN_WORKERS_H_
+#define ESRNN_WORKERS_H_
+
+#if defined _WINDOWS
+  #error "the worker processes need fork(), it is not available on Windows"
+#endif
+
+#include <atomic>
+#include <new>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sched.h>
+#include <unistd.h>
+#include "metrics.h"
+
+template <class T>
+struct SharedArray {
+  T* data;
+  size_t size;
+
+  explicit SharedArray(size_t size_) : size(size_) {
+    void* mem = mmap(NULL, std::max(size, (size_t)1) * sizeof(T), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0); //mmap takes no empty mapping
+    if (mem == MAP_FAILED)
+      throw std::runtime_error("mmap of shared memory failed");
+    data = (T*)mem; //zeroed by the kernel
+  }
+  ~SharedArray() {
+    munmap(data, std::max(size, (size_t)1) * sizeof(T));
+  }
+  SharedArray(const SharedArray&) = delete;
+  SharedArray& operator=(const SharedArray&) = delete;
+
+  T& operator[](size_t i) { return data[i]; }
+  void fill(const T& val) {
+    for (size_t i = 0; i < size; i++)
+      data[i] = val;
+  }
+};
+
+//Usage, per epoch: start(); for (i=next(); i<n; i=next()) {...}; join(...)
+//After start() the parent process is worker 0, the children are 1..numOfWorkers-1.
+struct ForkedWorkers {
+  int numOfWorkers;
+  int numOfLists;
+  size_t listCapacity;
+  int worker = 0;
+  std::vector<pid_t> children;
+  SharedArray<std::atomic<int>> nextItem;
+  SharedArray<Metrics> workerMetrics;
+  SharedArray<int> listSizes; //[worker][list]
+  SharedArray<float> listValues; //[worker][list][listCapacity]
+
+  ForkedWorkers(int numOfWorkers_, int numOfLists_, size_t listCapacity_) :
+    numOfWorkers(numOfWorkers_), numOfLists(numOfLists_), listCapacity(listCapacity_),
+    nextItem(1), workerMetrics(numOfWorkers_),
+    listSizes(numOfWorkers_*numOfLists_), listValues(numOfWorkers_*numOfLists_*listCapacity_) {
+    if (!nextItem[0].is_lock_free())
+      throw std::runtime_error("the worker processes need lock-free atomic<int>");
+  }
+
+  //returns index of this worker
+  int start() {
+    new (&nextItem[0]) std::atomic<int>(0);
+    std::cout.flush();
+    std::cerr.flush();
+    children.clear();
+    worker = 0;
+    for (int iw = 1; iw < numOfWorkers; iw++) {
+      pid_t pid = fork();
+      if (pid < 0)
+        throw std::runtime_error("fork failed");
+      if (pid == 0) {
+        worker = iw;
+        children.clear();
+        return worker;
+      }
+      children.push_back(pid);
+    }
+    return worker;
+  }
+
+  //claims the next work item
+  int next() {
+    return nextItem[0].fetch_add(1);
+  }
+
+  //A child saves its lists and metrics and exits. The parent waits for the children, and appends their lists and metrics to its own.
+  void join(const std::vector<std::vector<float>*>& lists, Metrics& metrics) {
+    if (lists.size() != (size_t)numOfLists)
+      throw std::invalid_argument("wrong number of lists");
+    if (worker > 0) {
+      for (int il = 0; il < numOfLists; il++) {
+        size_t size = lists[il]->size() < listCapacity ? lists[il]->size() : listCapacity;
+        listSizes[worker*numOfLists + il] = (int)size;
+        std::copy(lists[il]->begin(), lists[il]->begin() + size, &listValues[(worker*numOfLists + il)*listCapacity]);
+      }
+      workerMetrics[worker] = metrics;
+      std::cout.flush();
+      std::cerr.flush();
+      _exit(0);
+    }
+    for (pid_t pid : children) {
+      int status = 0;
+      if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        throw std::runtime_error("a worker process failed");
+    }
+    for (int iw = 1; iw < numOfWorkers; iw++) {
+      for (int il = 0; il < numOfLists; il++) {
+        const float* values = &listValues[(iw*numOfLists + il)*listCapacity];
+        lists[il]->insert(lists[il]->end(), values, values + listSizes[iw*numOfLists + il]);
+      }
+      metrics.add(workerMetrics[iw]);
+    }
+  }
+};
+
+//Spinning, reusable barrier of numOfWorkers processes; create it before the fork.
+//The waits are short (one tree level of a gradient sum), so the workers yield instead of sleeping.
+//If a worker dies, the others wait forever.
+struct SpinBarrier {
+  int numOfWorkers;
+  SharedArray<std::atomic<int>> state; //arrived, generation
+
+  explicit SpinBarrier(int numOfWorkers_) : numOfWorkers(numOfWorkers_), state(2) {
+    new (&state[0]) std::atomic<int>(0);
+    new (&state[1]) std::atomic<int>(0);
+  }
+
+  void wait() {
+    int generation = state[1].load();
+    if (state[0].fetch_add(1) + 1 == numOfWorkers) {
+      state[0].store(0);
+      state[1].fetch_add(1); //releases the others
+    } else
+      while (state[1].load() == generation)
+        sched_yield();
+  }
+};
+
+#endif